@@ -0,0 +1,528 @@
+//------------------------------------------------------------------------------
+//
+// Name:       cache_bench.c
+//
+// Purpose:    Benchmark the cache with workloads that reuse their data in
+//             different ways, against the same workload without the cache.
+//             stream:  a sequential scan over all blocks, pass after pass
+//             zipf:    blocks drawn from a Zipf distribution (hot working set)
+//             bfs:     the blocks of the vertices and neighbors of a BFS
+//             stencil: a 3 point stencil chain, every iteration reads the
+//                      output blocks of the previous one
+//             A block has the size of a cache line. Every workload is swept
+//             over the numbers of lines, line sizes, configurations and
+//             policies and reports throughput, bytes moved and latency.
+//
+// Usage:      cache_bench [-w stream,zipf,bfs,stencil] [-l lines,...]
+//                         [-s lineSize,...] [-c configs] [-p policies]
+//                         [-f footprint MB] [-n steps]
+//             configs and policies are given by name (see configName and
+//             policyName), -p all sweeps all policies.
+//
+//------------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <sys/types.h>
+#ifdef __APPLE__
+#include <OpenCL/opencl.h>
+#include <unistd.h>
+#else
+#include <CL/cl.h>
+#endif
+
+#include "err_code.h"
+#include "cache.h"
+
+//pick up device type from compiler command line or from
+//the default type
+#ifndef DEVICE
+#define DEVICE CL_DEVICE_TYPE_DEFAULT
+#endif
+
+#define MAX_SWEEP 16
+#define NUMBER_OF_WORKLOADS 4
+#define NUMBER_OF_CONFIGS 4
+#define NUMBER_OF_POLICIES 10
+#define ZIPF_EXPONENT 0.99
+#define BFS_DEGREE 8
+#define BFS_NEAR_RANGE 16
+
+extern int output_device_info(cl_device_id );
+extern double wtime();
+
+//------------------------------------------------------------------------------
+
+const char *KernelSource = "\n" \
+"__kernel void accumulate(                                              \n" \
+"   __global const int* a,                                              \n" \
+"   __global int* sum,                                                  \n" \
+"   const unsigned int count)                                           \n" \
+"{                                                                      \n" \
+"   int i = get_global_id(0);                                           \n" \
+"   if(i < count)                                                       \n" \
+"       sum[i] += a[i];                                                 \n" \
+"}                                                                      \n" \
+"__kernel void stencil(                                                 \n" \
+"   __global const int* left,                                           \n" \
+"   __global const int* middle,                                         \n" \
+"   __global const int* right,                                          \n" \
+"   __global int* out,                                                  \n" \
+"   const unsigned int count)                                           \n" \
+"{                                                                      \n" \
+"   int i = get_global_id(0);                                           \n" \
+"   if(i < count)                                                       \n" \
+"       out[i] = (left[count - 1] + 2 * middle[i] + right[0]) / 4 + 1;  \n" \
+"}                                                                      \n" \
+"\n";
+
+enum Workload_t {stream_WL, zipf_WL, bfs_WL, stencil_WL};
+
+const char* workloadName[NUMBER_OF_WORKLOADS] = {"stream", "zipf", "bfs", "stencil"};
+const char* configName[NUMBER_OF_CONFIGS] = {"direct_mapped", "two_way", "four_way", "fully_associative"};
+const char* policyName[NUMBER_OF_POLICIES] = {"random", "fifo", "lru", "mru", "lfu", "mfu", "clock", "slru", "two_queue", "arc"};
+
+typedef struct Bench_t {
+	cl_context context;
+	cl_command_queue commands;
+	cl_kernel accumulate;
+	cl_kernel stencil;
+	int steps;
+	size_t footprint;
+} Bench_t;
+
+typedef struct BenchResult_t {
+	double seconds;
+	double meanLatency;
+	double p99Latency;
+	uint64_t bytesToDevice;
+	uint64_t bytesToHost;
+	uint64_t checksum;
+} BenchResult_t;
+
+//------------------------------------------------------------------------------
+
+int ParseNames(char* list, const char** names, int numberOfNames, int* values)
+{
+	int count = 0;
+	for (char* name = strtok(list, ","); (name != NULL) && (count < MAX_SWEEP); name = strtok(NULL, ",")) {
+		for (int i = 0; i < numberOfNames; i++) {
+			if (strcmp(name, names[i]) == 0)
+				values[count++] = i;
+		}
+	}
+	return count;
+}
+
+int ParseNumbers(char* list, int* values)
+{
+	int count = 0;
+	for (char* number = strtok(list, ","); (number != NULL) && (count < MAX_SWEEP); number = strtok(NULL, ","))
+		values[count++] = atoi(number);
+	return count;
+}
+
+int CompareDoubles(const void* a, const void* b)
+{
+	double difference = *(const double*)a - *(const double*)b;
+	return (difference > 0) - (difference < 0);
+}
+
+//------------------------------------------------------------------------------
+//
+// The block sequences of the workloads, every step fetches one block
+//
+
+int* StreamSequence(int numberOfBlocks, int steps)
+{
+	int* sequence = (int*)malloc(steps * sizeof(int));
+	for (int i = 0; i < steps; i++)
+		sequence[i] = i % numberOfBlocks;
+	return sequence;
+}
+
+int* ZipfSequence(int numberOfBlocks, int steps)
+{
+	int* sequence = (int*)malloc(steps * sizeof(int));
+	double* cdf = (double*)malloc(numberOfBlocks * sizeof(double));
+	double sum = 0;
+
+	for (int i = 0; i < numberOfBlocks; i++) {
+		sum += 1.0 / pow((double)(i + 1), ZIPF_EXPONENT);
+		cdf[i] = sum;
+	}
+	for (int i = 0; i < steps; i++) {
+		double u = sum * (double)rand() / ((double)RAND_MAX + 1.0);
+		int low = 0, high = numberOfBlocks - 1;
+		while (low < high) {
+			int middle = (low + high) / 2;
+			if (cdf[middle] < u)
+				low = middle + 1;
+			else
+				high = middle;
+		}
+		//Scatter the hot blocks, so they do not all fall in the first sets
+		sequence[i] = (int)(((uint64_t)low * 2654435761u) % (uint64_t)numberOfBlocks);
+	}
+	free(cdf);
+	return sequence;
+}
+
+int* BfsSequence(int numberOfBlocks, int steps)
+{
+	int* sequence = (int*)malloc(steps * sizeof(int));
+	int* neighbor = (int*)malloc((size_t)numberOfBlocks * BFS_DEGREE * sizeof(int));
+	int* queue = (int*)malloc(numberOfBlocks * sizeof(int));
+	char* visited = (char*)calloc(numberOfBlocks, 1);
+	int head = 0, tail = 0, step = 0;
+
+	//Half of the neighbors are close to the vertex, the others anywhere in the graph
+	for (int v = 0; v < numberOfBlocks; v++) {
+		for (int e = 0; e < BFS_DEGREE; e++) {
+			int near = v + rand() % (2 * BFS_NEAR_RANGE + 1) - BFS_NEAR_RANGE;
+			neighbor[v * BFS_DEGREE + e] = (e % 2 == 0) ? (near + numberOfBlocks) % numberOfBlocks : rand() % numberOfBlocks;
+		}
+	}
+	//Every visit fetches the vertex and all its neighbors, a new BFS starts when the graph is done
+	while (step < steps) {
+		if (head == tail) {
+			memset(visited, 0, numberOfBlocks);
+			head = tail = 0;
+			queue[tail++] = rand() % numberOfBlocks;
+			visited[queue[0]] = 1;
+		}
+		int v = queue[head++];
+		sequence[step++] = v;
+		for (int e = 0; (e < BFS_DEGREE) && (step < steps); e++) {
+			int w = neighbor[v * BFS_DEGREE + e];
+			sequence[step++] = w;
+			if (!visited[w]) {
+				visited[w] = 1;
+				queue[tail++] = w;
+			}
+		}
+	}
+	free(neighbor);
+	free(queue);
+	free(visited);
+	return sequence;
+}
+
+//------------------------------------------------------------------------------
+//
+// A run of a workload, with the cache when cachePtr is not NULL
+//
+
+void FinishResult(double* latency, int numberOfLatencies, double seconds, BenchResult_t* result)
+{
+	double sum = 0;
+	qsort(latency, numberOfLatencies, sizeof(double), CompareDoubles);
+	for (int i = 0; i < numberOfLatencies; i++)
+		sum += latency[i];
+	result->seconds = seconds;
+	result->meanLatency = (numberOfLatencies > 0) ? sum / numberOfLatencies : 0;
+	result->p99Latency = (numberOfLatencies > 0) ? latency[(int)(0.99 * (numberOfLatencies - 1))] : 0;
+}
+
+void RunFetches(Bench_t* bench, const int* sequence, int* data, size_t lineSize, struct Cache_t* cachePtr, BenchResult_t* result)
+{
+	cl_int err;
+	const unsigned int count = lineSize / sizeof(int);
+	int* sum = (int*)calloc(count, sizeof(int));
+	double* latency = (double*)malloc(bench->steps * sizeof(double));
+	cl_mem d_sum = clCreateBuffer(bench->context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, lineSize, sum, &err);
+	checkError(err, "Creating sum buffer");
+	size_t global = count;
+
+	memset(result, 0, sizeof(BenchResult_t));
+	double startTime = wtime();
+	for (int i = 0; i < bench->steps; i++) {
+		double stepTime = wtime();
+		int* block = data + (size_t)sequence[i] * count;
+		cl_mem input;
+		if (cachePtr != NULL)
+			input = clCreateCacheBuffer(bench->context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, lineSize, block, &err, cachePtr);
+		else
+			input = clCreateBuffer(bench->context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, lineSize, block, &err);
+		checkError(err, "Fetching block");
+		err  = clSetKernelArg(bench->accumulate, 0, sizeof(cl_mem), &input);
+		err |= clSetKernelArg(bench->accumulate, 1, sizeof(cl_mem), &d_sum);
+		err |= clSetKernelArg(bench->accumulate, 2, sizeof(unsigned int), &count);
+		checkError(err, "Setting kernel arguments");
+		err = clEnqueueNDRangeKernel(bench->commands, bench->accumulate, 1, NULL, &global, NULL, 0, NULL, NULL);
+		checkError(err, "Enqueueing accumulate");
+		err = clFinish(bench->commands);
+		checkError(err, "Waiting for accumulate");
+		if (cachePtr == NULL) {
+			clReleaseMemObject(input);
+			result->bytesToDevice += lineSize;
+		}
+		latency[i] = wtime() - stepTime;
+	}
+	err = clEnqueueReadBuffer(bench->commands, d_sum, CL_TRUE, 0, lineSize, sum, 0, NULL, NULL);
+	checkError(err, "Reading back the sum");
+	FinishResult(latency, bench->steps, wtime() - startTime, result);
+
+	for (unsigned int i = 0; i < count; i++)
+		result->checksum = result->checksum * 31 + (uint32_t)sum[i];
+	clReleaseMemObject(d_sum);
+	free(latency);
+	free(sum);
+}
+
+void RunStencil(Bench_t* bench, int* data, int* next, int numberOfBlocks, size_t lineSize, struct Cache_t* cachePtr, BenchResult_t* result)
+{
+	cl_int err;
+	const unsigned int count = lineSize / sizeof(int);
+	int iterations = (bench->steps + numberOfBlocks - 1) / numberOfBlocks;
+	double* latency = (double*)malloc((size_t)iterations * numberOfBlocks * sizeof(double));
+	int numberOfLatencies = 0;
+	size_t global = count;
+
+	memset(result, 0, sizeof(BenchResult_t));
+	double startTime = wtime();
+	for (int t = 0; t < iterations; t++) {
+		//The output of an iteration is the input of the next one
+		int* in = (t % 2 == 0) ? data : next;
+		int* out = (t % 2 == 0) ? next : data;
+		for (int j = 0; j < numberOfBlocks; j++) {
+			double stepTime = wtime();
+			void* hostAddresses[4] = {in + (size_t)((j > 0) ? j - 1 : j) * count, in + (size_t)j * count,
+				in + (size_t)((j + 1 < numberOfBlocks) ? j + 1 : j) * count, out + (size_t)j * count};
+			cl_mem buffers[4];
+			if (cachePtr != NULL) {
+				const cl_mem_flags flags[4] = {CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+					CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, CL_MEM_WRITE_ONLY};
+				const size_t sizes[4] = {lineSize, lineSize, lineSize, lineSize};
+				clCreateCacheBuffers(bench->context, bench->commands, 4, flags, sizes, hostAddresses, buffers, &err, cachePtr);
+			}
+			else {
+				for (int k = 0; k < 3; k++) {
+					buffers[k] = clCreateBuffer(bench->context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, lineSize, hostAddresses[k], &err);
+					checkError(err, "Creating input buffer");
+				}
+				buffers[3] = clCreateBuffer(bench->context, CL_MEM_WRITE_ONLY, lineSize, NULL, &err);
+			}
+			checkError(err, "Fetching blocks");
+			err = 0;
+			for (int k = 0; k < 4; k++)
+				err |= clSetKernelArg(bench->stencil, k, sizeof(cl_mem), &buffers[k]);
+			err |= clSetKernelArg(bench->stencil, 4, sizeof(unsigned int), &count);
+			checkError(err, "Setting kernel arguments");
+			err = clEnqueueNDRangeKernel(bench->commands, bench->stencil, 1, NULL, &global, NULL, 0, NULL, NULL);
+			checkError(err, "Enqueueing stencil");
+			if (cachePtr == NULL) {
+				//Without the cache every output goes back to the host at once
+				err = clEnqueueReadBuffer(bench->commands, buffers[3], CL_TRUE, 0, lineSize, hostAddresses[3], 0, NULL, NULL);
+				checkError(err, "Reading back output");
+				for (int k = 0; k < 4; k++)
+					clReleaseMemObject(buffers[k]);
+				result->bytesToDevice += 3 * lineSize;
+				result->bytesToHost += lineSize;
+			}
+			else {
+				err = clFinish(bench->commands);
+				checkError(err, "Waiting for stencil");
+			}
+			latency[numberOfLatencies++] = wtime() - stepTime;
+		}
+	}
+	//The blocks still dirty in the cache are part of the result
+	if (cachePtr != NULL) {
+		err = clFlushCache(bench->commands, cachePtr);
+		checkError(err, "Flushing the cache");
+	}
+	FinishResult(latency, numberOfLatencies, wtime() - startTime, result);
+
+	int* last = (iterations % 2 == 0) ? data : next;
+	for (size_t i = 0; i < (size_t)numberOfBlocks * count; i++)
+		result->checksum = result->checksum * 31 + (uint32_t)last[i];
+	free(latency);
+}
+
+void RunWorkload(Bench_t* bench, enum Workload_t workload, const int* sequence, const int* initialData, int numberOfBlocks, size_t lineSize, struct Cache_t* cachePtr, BenchResult_t* result)
+{
+	size_t blocksSize = (size_t)numberOfBlocks * lineSize;
+	//Every run starts from the same data, so the checksums of all runs must be the same
+	int* data = (int*)malloc(blocksSize);
+	int* next = (workload == stencil_WL) ? (int*)calloc(1, blocksSize) : NULL;
+	memcpy(data, initialData, blocksSize);
+
+	if (workload == stencil_WL)
+		RunStencil(bench, data, next, numberOfBlocks, lineSize, cachePtr, result);
+	else
+		RunFetches(bench, sequence, data, lineSize, cachePtr, result);
+	if (cachePtr != NULL) {
+		CacheStats_t stats;
+		GetCacheStats(cachePtr, &stats);
+		result->bytesToDevice = stats.bytesToDevice;
+		result->bytesToHost = stats.bytesToHost;
+		FreeCacheStats(&stats);
+	}
+	free(data);
+	free(next);
+}
+
+void PrintResult(const char* workload, const char* config, const char* policy, int lines, size_t lineSize, int steps, BenchResult_t* result, BenchResult_t* baseline)
+{
+	double bytes = (double)steps * (double)lineSize;
+	printf("%-8s %-18s %-10s %6d %8zu %10.1f %10.3f %10.3f %9.1f %9.1f %7.2fx %s\n", workload, config, policy, lines, lineSize,
+		bytes / result->seconds / 1.0e6, (double)result->bytesToDevice / 1.0e6, (double)result->bytesToHost / 1.0e6,
+		result->meanLatency * 1.0e6, result->p99Latency * 1.0e6, baseline->seconds / result->seconds,
+		(result->checksum == baseline->checksum) ? "ok" : "MISMATCH");
+}
+
+//------------------------------------------------------------------------------
+
+void PrintUsage(const char* program)
+{
+	printf("Usage: %s [-w stream,zipf,bfs,stencil] [-l lines,...] [-s lineSize,...] [-c configs] [-p policies] [-f footprint MB] [-n steps]\n", program);
+}
+
+//------------------------------------------------------------------------------
+
+int main(int argc, char** argv)
+{
+	cl_int err;
+	cl_device_id device_id = NULL;
+	cl_program program;
+	Bench_t bench;
+	int workloads[MAX_SWEEP] = {stream_WL, zipf_WL, bfs_WL, stencil_WL};
+	int lineCounts[MAX_SWEEP] = {64, 256};
+	int lineSizes[MAX_SWEEP] = {16384, 262144};
+	int configs[MAX_SWEEP] = {direct_mapped, two_way, four_way, fully_associative};
+	int policies[MAX_SWEEP] = {lru_RP, lfu_RP, slru_RP, arc_RP};
+	int numberOfWorkloads = 4, numberOfLineCounts = 2, numberOfLineSizes = 2, numberOfConfigs = 4, numberOfPolicies = 4;
+	int footprint = 32;
+	int allPolicies[NUMBER_OF_POLICIES] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9};
+
+	bench.steps = 4096;
+	for (int i = 1; i < argc; i += 2) {
+		//Every option takes a value
+		if (i + 1 == argc) {
+			printf("Missing value of %s\n", argv[i]);
+			PrintUsage(argv[0]);
+			return EXIT_FAILURE;
+		}
+		if (strcmp(argv[i], "-w") == 0)
+			numberOfWorkloads = ParseNames(argv[i + 1], workloadName, NUMBER_OF_WORKLOADS, workloads);
+		else if (strcmp(argv[i], "-l") == 0)
+			numberOfLineCounts = ParseNumbers(argv[i + 1], lineCounts);
+		else if (strcmp(argv[i], "-s") == 0)
+			numberOfLineSizes = ParseNumbers(argv[i + 1], lineSizes);
+		else if (strcmp(argv[i], "-c") == 0)
+			numberOfConfigs = ParseNames(argv[i + 1], configName, NUMBER_OF_CONFIGS, configs);
+		else if ((strcmp(argv[i], "-p") == 0) && (strcmp(argv[i + 1], "all") == 0)) {
+			memcpy(policies, allPolicies, sizeof(allPolicies));
+			numberOfPolicies = NUMBER_OF_POLICIES;
+		}
+		else if (strcmp(argv[i], "-p") == 0)
+			numberOfPolicies = ParseNames(argv[i + 1], policyName, NUMBER_OF_POLICIES, policies);
+		else if (strcmp(argv[i], "-f") == 0)
+			footprint = atoi(argv[i + 1]);
+		else if (strcmp(argv[i], "-n") == 0)
+			bench.steps = atoi(argv[i + 1]);
+		else {
+			printf("Unknown argument %s\n", argv[i]);
+			PrintUsage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	bench.footprint = (size_t)footprint << 20;
+
+	// Set up platform and device, the same way as vadd_chain
+	cl_uint numPlatforms;
+	err = clGetPlatformIDs(0, NULL, &numPlatforms);
+	checkError(err, "Finding platforms");
+	if (numPlatforms == 0) {
+		printf("Found 0 platforms!\n");
+		return EXIT_FAILURE;
+	}
+	cl_platform_id Platform[numPlatforms];
+	err = clGetPlatformIDs(numPlatforms, Platform, NULL);
+	checkError(err, "Getting platforms");
+	for (cl_uint i = 0; i < numPlatforms; i++) {
+		err = clGetDeviceIDs(Platform[i], DEVICE, 1, &device_id, NULL);
+		if (err == CL_SUCCESS)
+			break;
+	}
+	if (device_id == NULL)
+		checkError(err, "Getting device");
+	err = output_device_info(device_id);
+	checkError(err, "Outputting device info");
+
+	bench.context = clCreateContext(0, 1, &device_id, NULL, NULL, &err);
+	checkError(err, "Creating context");
+	bench.commands = clCreateCommandQueue(bench.context, device_id, 0, &err);
+	checkError(err, "Creating command queue");
+	program = clCreateProgramWithSource(bench.context, 1, (const char **) & KernelSource, NULL, &err);
+	checkError(err, "Creating program");
+	err = clBuildProgram(program, 0, NULL, NULL, NULL, NULL);
+	if (err != CL_SUCCESS) {
+		size_t len;
+		char buffer[2048];
+		printf("Error: Failed to build program executable!\n%s\n", err_code(err));
+		clGetProgramBuildInfo(program, device_id, CL_PROGRAM_BUILD_LOG, sizeof(buffer), buffer, &len);
+		printf("%s\n", buffer);
+		return EXIT_FAILURE;
+	}
+	bench.accumulate = clCreateKernel(program, "accumulate", &err);
+	checkError(err, "Creating accumulate kernel");
+	bench.stencil = clCreateKernel(program, "stencil", &err);
+	checkError(err, "Creating stencil kernel");
+
+	printf("%-8s %-18s %-10s %6s %8s %10s %10s %10s %9s %9s %8s %s\n", "workload", "config", "policy", "lines", "lineSize",
+		"MB/s", "MB to dev", "MB to host", "mean us", "p99 us", "speedup", "check");
+	for (int s = 0; s < numberOfLineSizes; s++) {
+		size_t lineSize = (size_t)lineSizes[s];
+		int numberOfBlocks = (int)(bench.footprint / lineSize);
+		if (numberOfBlocks < 1)
+			numberOfBlocks = 1;
+		int* initialData = (int*)malloc((size_t)numberOfBlocks * lineSize);
+		for (size_t i = 0; i < (size_t)numberOfBlocks * lineSize / sizeof(int); i++)
+			initialData[i] = rand() % 100;
+
+		for (int w = 0; w < numberOfWorkloads; w++) {
+			enum Workload_t workload = (enum Workload_t)workloads[w];
+			int* sequence = NULL;
+			BenchResult_t baseline, result;
+			if (workload == stream_WL)
+				sequence = StreamSequence(numberOfBlocks, bench.steps);
+			else if (workload == zipf_WL)
+				sequence = ZipfSequence(numberOfBlocks, bench.steps);
+			else if (workload == bfs_WL)
+				sequence = BfsSequence(numberOfBlocks, bench.steps);
+			int steps = (workload == stencil_WL) ? ((bench.steps + numberOfBlocks - 1) / numberOfBlocks) * numberOfBlocks * 4 : bench.steps;
+
+			//The uncached baseline creates a buffer for every fetch
+			RunWorkload(&bench, workload, sequence, initialData, numberOfBlocks, lineSize, NULL, &baseline);
+			PrintResult(workloadName[workload], "uncached", "-", 0, lineSize, steps, &baseline, &baseline);
+			for (int l = 0; l < numberOfLineCounts; l++) {
+				for (int c = 0; c < numberOfConfigs; c++) {
+					for (int p = 0; p < numberOfPolicies; p++) {
+						struct Cache_t* myCache = CreateCache(bench.context, bench.commands, lineCounts[l], (int)lineSize, 32,
+							(enum CacheConfiguration_t)configs[c], (enum ReplacementPolicy_t)policies[p], &err);
+						//Not every policy works with every configuration
+						if (myCache == NULL)
+							continue;
+						SetWritePolicy(myCache, write_back_WP);
+						RunWorkload(&bench, workload, sequence, initialData, numberOfBlocks, lineSize, myCache, &result);
+						PrintResult(workloadName[workload], configName[configs[c]], policyName[policies[p]], lineCounts[l], lineSize, steps, &result, &baseline);
+						FreeCache(myCache);
+					}
+				}
+			}
+			free(sequence);
+		}
+		free(initialData);
+	}
+
+	clReleaseKernel(bench.accumulate);
+	clReleaseKernel(bench.stencil);
+	clReleaseProgram(program);
+	clReleaseCommandQueue(bench.commands);
+	clReleaseContext(bench.context);
+	return 0;
+}
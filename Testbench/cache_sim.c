@@ -0,0 +1,205 @@
+//------------------------------------------------------------------------------
+//
+// Name:       cache_sim.c
+//
+// Purpose:    Replay a trace recorded with SetTraceFile() against every cache
+//             configuration, replacement policy and number of lines, without
+//             an OpenCL device. The caches are the real caches of cache.c on
+//             the host only runtime of src/host_only_cl.c, so the hits and the
+//             bytes they report are the ones the application would get.
+//
+// Usage:      cache_sim trace_file [-l lines,lines,...] [-d dataSize] [-w]
+//             -l the numbers of cache lines to try (default 16,64,256,1024)
+//             -d the data size of the lines (default the largest request)
+//             -w simulate write_back_WP instead of no_write_back_WP
+//
+//------------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __APPLE__
+#include <OpenCL/opencl.h>
+#else
+#include <CL/cl.h>
+#endif
+
+#include "cache.h"
+
+#define MAX_LINE_COUNTS 16
+#define NUMBER_OF_CONFIGS 4
+#define NUMBER_OF_POLICIES 10
+
+extern double wtime();
+
+typedef struct SimResult_t {
+	enum CacheConfiguration_t config;
+	enum ReplacementPolicy_t policy;
+	int numberOfCacheLines;
+	bool valid;
+	CacheStats_t stats;
+} SimResult_t;
+
+const char* configName[NUMBER_OF_CONFIGS] = {"direct_mapped", "two_way", "four_way", "fully_associative"};
+const char* policyName[NUMBER_OF_POLICIES] = {"random", "fifo", "lru", "mru", "lfu", "mfu", "clock", "slru", "two_queue", "arc"};
+
+//------------------------------------------------------------------------------
+
+TraceRecord_t* ReadTrace(const char* fileName, size_t* numberOfRecords)
+{
+	TraceHeader_t header;
+	FILE* file = fopen(fileName, "rb");
+	if (file == NULL)
+		return NULL;
+	if ((fread(&header, sizeof(header), 1, file) != 1) || (header.magic != CACHE_TRACE_MAGIC)
+		|| (header.version != CACHE_TRACE_VERSION) || (header.recordSize != sizeof(TraceRecord_t))) {
+		fclose(file);
+		return NULL;
+	}
+	fseek(file, 0, SEEK_END);
+	*numberOfRecords = ((size_t)ftell(file) - sizeof(header)) / sizeof(TraceRecord_t);
+	fseek(file, sizeof(header), SEEK_SET);
+	TraceRecord_t* records = (TraceRecord_t*)malloc((*numberOfRecords + 1) * sizeof(TraceRecord_t));
+	*numberOfRecords = fread(records, sizeof(TraceRecord_t), *numberOfRecords, file);
+	fclose(file);
+	return records;
+}
+
+//------------------------------------------------------------------------------
+
+void Replay(cl_context context, cl_command_queue queue, const TraceRecord_t* records, size_t numberOfRecords, int dataSize, bool writeBack, SimResult_t* result)
+{
+	cl_int err;
+	struct Cache_t* cachePtr = CreateCache(context, queue, result->numberOfCacheLines, dataSize, 32, result->config, result->policy, &err);
+
+	//Not every policy works with every configuration
+	if (cachePtr == NULL)
+		return;
+	if (writeBack)
+		SetWritePolicy(cachePtr, write_back_WP);
+	for (size_t i = 0; i < numberOfRecords; i++) {
+		const TraceRecord_t* record = &records[i];
+		void* hostAddress = (void*)(uintptr_t)record->hostAddress;
+		switch (record->kind) {
+		case create_TK:
+			clCreateCacheBuffer(context, (cl_mem_flags)record->flags, (size_t)record->size, hostAddress, &err, cachePtr);
+			break;
+		case read_TK:
+			clEnqueueReadCacheBuffer(queue, CL_TRUE, (size_t)record->offset, (size_t)record->size, hostAddress, 0, NULL, NULL, cachePtr);
+			break;
+		case read_range_TK:
+			clEnqueueReadCacheBufferRange(queue, CL_TRUE, (size_t)record->offset, (size_t)record->size, hostAddress, 0, NULL, NULL, cachePtr);
+			break;
+		case write_range_TK:
+			clEnqueueWriteCacheBufferRange(queue, CL_TRUE, (size_t)record->offset, (size_t)record->size, hostAddress, 0, NULL, NULL, cachePtr);
+			break;
+		case flush_TK:
+			clFlushCache(queue, cachePtr);
+			break;
+		}
+	}
+	//The dirty lines at the end are written back as well
+	clFlushCache(queue, cachePtr);
+	GetCacheStats(cachePtr, &result->stats);
+	result->valid = true;
+	FreeCache(cachePtr);
+}
+
+//------------------------------------------------------------------------------
+
+int CompareResults(const void* a, const void* b)
+{
+	const SimResult_t* resultA = (const SimResult_t*)a;
+	const SimResult_t* resultB = (const SimResult_t*)b;
+	uint64_t bytesA = resultA->stats.bytesToDevice + resultA->stats.bytesToHost;
+	uint64_t bytesB = resultB->stats.bytesToDevice + resultB->stats.bytesToHost;
+
+	//The fewest bytes moved first, the smaller cache first when they move the same
+	if (resultA->valid != resultB->valid)
+		return resultA->valid ? -1 : 1;
+	if (bytesA != bytesB)
+		return (bytesA < bytesB) ? -1 : 1;
+	return resultA->numberOfCacheLines - resultB->numberOfCacheLines;
+}
+
+//------------------------------------------------------------------------------
+
+int main(int argc, char** argv)
+{
+	int lineCounts[MAX_LINE_COUNTS] = {16, 64, 256, 1024};
+	int numberOfLineCounts = 4;
+	int dataSize = 0;
+	bool writeBack = false;
+	size_t numberOfRecords = 0;
+	cl_int err;
+
+	if (argc < 2) {
+		printf("Usage: %s trace_file [-l lines,lines,...] [-d dataSize] [-w]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	for (int i = 2; i < argc; i++) {
+		if ((strcmp(argv[i], "-l") == 0) && (i + 1 < argc)) {
+			numberOfLineCounts = 0;
+			for (char* count = strtok(argv[++i], ","); (count != NULL) && (numberOfLineCounts < MAX_LINE_COUNTS); count = strtok(NULL, ","))
+				lineCounts[numberOfLineCounts++] = atoi(count);
+		}
+		else if ((strcmp(argv[i], "-d") == 0) && (i + 1 < argc))
+			dataSize = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-w") == 0)
+			writeBack = true;
+		else {
+			printf("Unknown argument %s\n", argv[i]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	TraceRecord_t* records = ReadTrace(argv[1], &numberOfRecords);
+	if (records == NULL) {
+		printf("Error: %s is not a cache trace\n", argv[1]);
+		return EXIT_FAILURE;
+	}
+	//By default every request fits in a line
+	if (dataSize == 0) {
+		for (size_t i = 0; i < numberOfRecords; i++) {
+			if ((records[i].kind == create_TK) && (records[i].size > (uint64_t)dataSize))
+				dataSize = (int)records[i].size;
+		}
+	}
+	printf("%zu requests, lines of %d bytes, %s\n", numberOfRecords, dataSize, writeBack ? "write_back_WP" : "no_write_back_WP");
+
+	cl_context context = clCreateContext(NULL, 0, NULL, NULL, NULL, &err);
+	cl_command_queue queue = clCreateCommandQueue(context, NULL, 0, &err);
+	int numberOfResults = NUMBER_OF_CONFIGS * NUMBER_OF_POLICIES * numberOfLineCounts;
+	SimResult_t* results = (SimResult_t*)calloc(numberOfResults, sizeof(SimResult_t));
+	for (int i = 0; i < numberOfResults; i++) {
+		results[i].config = (enum CacheConfiguration_t)(i % NUMBER_OF_CONFIGS);
+		results[i].policy = (enum ReplacementPolicy_t)((i / NUMBER_OF_CONFIGS) % NUMBER_OF_POLICIES);
+		results[i].numberOfCacheLines = lineCounts[i / (NUMBER_OF_CONFIGS * NUMBER_OF_POLICIES)];
+	}
+
+	//Every combination is its own cache, so they are replayed in parallel
+	double startTime = wtime();
+	#pragma omp parallel for schedule(dynamic)
+	for (int i = 0; i < numberOfResults; i++)
+		Replay(context, queue, records, numberOfRecords, dataSize, writeBack, &results[i]);
+	double runTime = wtime() - startTime;
+
+	qsort(results, numberOfResults, sizeof(SimResult_t), CompareResults);
+	printf("%-18s %-10s %6s %9s %12s %12s %10s\n", "config", "policy", "lines", "hit rate", "to device", "to host", "evictions");
+	for (int i = 0; i < numberOfResults; i++) {
+		CacheStats_t* stats = &results[i].stats;
+		if (!results[i].valid)
+			continue;
+		double hitRate = (stats->hits + stats->misses > 0) ? (double)stats->hits / (double)(stats->hits + stats->misses) : 0.0;
+		printf("%-18s %-10s %6d %9.4f %12llu %12llu %10llu\n", configName[results[i].config], policyName[results[i].policy], results[i].numberOfCacheLines,
+			hitRate, (unsigned long long)stats->bytesToDevice, (unsigned long long)stats->bytesToHost, (unsigned long long)stats->evictions);
+		FreeCacheStats(stats);
+	}
+	printf("%d caches simulated in %.3f seconds\n", numberOfResults, runTime);
+
+	free(results);
+	free(records);
+	clReleaseCommandQueue(queue);
+	clReleaseContext(context);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,1558 @@
+//------------------------------------------------------------------------------
+//
+// Name:       cache_test.c
+//
+// Purpose:    Regression tests of the cache on the host only runtime of
+//             src/host_only_cl.c, built with HOST_ONLY_DATA. The tests check
+//             the hits, misses and transfers the cache reports and which
+//             entries it keeps, and the data of a round trip through the
+//             device buffers of that runtime.
+//
+// Usage:      cache_test
+//             Returns EXIT_FAILURE when a check fails.
+//
+//------------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#ifdef __APPLE__
+#include <OpenCL/opencl.h>
+#else
+#include <CL/cl.h>
+#endif
+
+#include "cache.h"
+
+#define ENTRY_SIZE 64
+#define NUMBER_OF_ENTRIES 64
+#define NUMBER_OF_THREADS 4
+#define REQUESTS_PER_THREAD 20000
+
+#define CHECK(condition) Check((condition), #condition, __func__, __LINE__)
+
+cl_context context;
+cl_command_queue queue;
+//Aligned to the lines, so with modulo_IF the entries i and i + 2 share a set of a cache with two sets
+char entries[NUMBER_OF_ENTRIES][ENTRY_SIZE] __attribute__((aligned(4096)));
+int numberOfFailures = 0;
+
+//------------------------------------------------------------------------------
+
+void Check(bool condition, const char* text, const char* test, int line)
+{
+	if (!condition) {
+		printf("FAILED %s:%d %s\n", test, line, text);
+		numberOfFailures++;
+	}
+}
+
+//------------------------------------------------------------------------------
+
+uint64_t GetHits(struct Cache_t* cachePtr)
+{
+	CacheStats_t stats;
+
+	GetCacheStats(cachePtr, &stats);
+	FreeCacheStats(&stats);
+	return stats.hits;
+}
+
+//------------------------------------------------------------------------------
+
+uint64_t GetBytesToDevice(struct Cache_t* cachePtr)
+{
+	CacheStats_t stats;
+
+	GetCacheStats(cachePtr, &stats);
+	FreeCacheStats(&stats);
+	return stats.bytesToDevice;
+}
+
+//------------------------------------------------------------------------------
+
+uint64_t GetBytesToHost(struct Cache_t* cachePtr)
+{
+	CacheStats_t stats;
+
+	GetCacheStats(cachePtr, &stats);
+	FreeCacheStats(&stats);
+	return stats.bytesToHost;
+}
+
+//------------------------------------------------------------------------------
+
+//Request entry i on command_queue, an input when flags has CL_MEM_COPY_HOST_PTR
+void RequestOn(cl_command_queue command_queue, cl_mem_flags flags, int i, struct Cache_t* cachePtr)
+{
+	cl_int err;
+
+	cl_mem buffer = clEnqueueCacheBuffer(command_queue, flags, ENTRY_SIZE, entries[i], 0, NULL, NULL, &err, cachePtr);
+	CHECK((buffer != NULL) && (err == CL_SUCCESS));
+}
+
+//------------------------------------------------------------------------------
+
+//Request entry i as input and return whether it was a hit
+bool Request(int i, struct Cache_t* cachePtr)
+{
+	cl_int err;
+
+	uint64_t hits = GetHits(cachePtr);
+	cl_mem buffer = clCreateCacheBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, ENTRY_SIZE, entries[i], &err, cachePtr);
+	CHECK((buffer != NULL) && (err == CL_SUCCESS));
+	return GetHits(cachePtr) > hits;
+}
+
+//------------------------------------------------------------------------------
+
+//Return whether the data of hostAddress is in a line, a read changes no replacement state
+bool IsCached(void* hostAddress, struct Cache_t* cachePtr)
+{
+	return clEnqueueReadCacheBuffer(queue, CL_TRUE, 0, ENTRY_SIZE, hostAddress, 0, NULL, NULL, cachePtr) == 0;
+}
+
+//------------------------------------------------------------------------------
+
+//Fill size bytes of data with a pattern of the seed
+void FillPattern(char* data, size_t size, int seed)
+{
+	for (size_t i = 0; i < size; i++)
+		data[i] = (char)(i * 31 + seed);
+}
+
+//------------------------------------------------------------------------------
+
+//A fully associative LFU cache where every line has its own frequency, the hit needs a new frequency bucket
+void TestFrequencyBucketsFull(enum ReplacementPolicy_t policy)
+{
+	cl_int err;
+	struct Cache_t* cachePtr = CreateCache(context, queue, 4, ENTRY_SIZE, 32, fully_associative, policy, &err);
+
+	CHECK(cachePtr != NULL);
+	for (int i = 0; i < 4; i++) {
+		for (int access = 0; access <= i; access++)
+			CHECK(Request(i, cachePtr) == (access > 0));
+	}
+	CHECK(Request(3, cachePtr));
+	CHECK(Request(3, cachePtr));
+
+	//LFU evicts entry 0 with a single access, MFU entry 3 with six
+	CHECK(!Request(4, cachePtr));
+	CHECK(Request((policy == lfu_RP) ? 3 : 0, cachePtr));
+	CHECK(!Request((policy == lfu_RP) ? 0 : 3, cachePtr));
+	FreeCache(cachePtr);
+}
+
+//------------------------------------------------------------------------------
+
+//Every line has its device buffer from the start, a miss refills the buffer of its line with the new data
+void TestLineBuffers(void)
+{
+	cl_int err;
+	cl_mem buffers[2];
+	char data[ENTRY_SIZE];
+	struct Cache_t* cachePtr = CreateCache(context, queue, 2, ENTRY_SIZE, 32, direct_mapped, lru_RP, &err);
+
+	CHECK((cachePtr != NULL) && (cachePtr->deviceData[0] != NULL) && (cachePtr->deviceData[1] != NULL));
+	for (int i = 0; i < 2; i++) {
+		buffers[i] = clCreateCacheBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, ENTRY_SIZE, entries[i], &err, cachePtr);
+		CHECK((buffers[i] != NULL) && (buffers[i] == cachePtr->deviceData[i]));
+	}
+	CHECK(buffers[0] != buffers[1]);
+	for (int i = 2; i < 6; i++) {
+		cl_mem buffer = clCreateCacheBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, ENTRY_SIZE, entries[i], &err, cachePtr);
+		CHECK((buffer == buffers[i % 2]) && (clEnqueueReadBuffer(queue, buffer, CL_TRUE, 0, ENTRY_SIZE, data, 0, NULL, NULL) == CL_SUCCESS));
+		CHECK(memcmp(data, entries[i], ENTRY_SIZE) == 0);
+	}
+	FreeCache(cachePtr);
+}
+
+//------------------------------------------------------------------------------
+
+//The misses are split into cold, conflict and capacity misses, the sets report their lines and misses
+void TestStats(void)
+{
+	cl_int err;
+	CacheStats_t stats;
+	int first[9] = {0, 4, 8, 12, 16, 1, 5, 1, 16};
+	//Four sets of four ways, entry i is in set i % 4
+	struct Cache_t* cachePtr = CreateCache(context, queue, 16, ENTRY_SIZE, 32, four_way, lru_RP, &err);
+
+	CHECK(cachePtr != NULL);
+	for (int i = 0; i < 9; i++)
+		Request(first[i], cachePtr);
+	GetCacheStats(cachePtr, &stats);
+	CHECK((stats.hits == 2) && (stats.misses == 7) && (stats.coldMisses == 6) && (stats.conflictMisses == 1) && (stats.capacityMisses == 0));
+	CHECK((stats.evictions == 1) && (stats.bytesToDevice == 7 * ENTRY_SIZE) && (stats.bytesToHost == 0));
+	CHECK((stats.numberOfSets == 4) && (stats.maxLinesPerSet == 4));
+	CHECK((stats.setOccupancy[0] == 4) && (stats.setOccupancy[1] == 2) && (stats.setOccupancy[2] == 0) && (stats.setOccupancy[3] == 0));
+	CHECK((stats.setMisses[0] == 5) && (stats.setMisses[1] == 2) && (stats.setMisses[2] == 0) && (stats.setMisses[3] == 0));
+	CHECK((stats.occupancyHistogram[0] == 2) && (stats.occupancyHistogram[2] == 1) && (stats.occupancyHistogram[4] == 1));
+	FreeCacheStats(&stats);
+	CHECK(stats.setOccupancy == NULL);
+
+	//In a full cache every eviction is a capacity miss
+	for (int i = 2; i < 16; i++) {
+		if (i % 4 >= 1)
+			Request(i, cachePtr);
+	}
+	CHECK(!Request(17, cachePtr));
+	GetCacheStats(cachePtr, &stats);
+	CHECK((stats.capacityMisses == 1) && (stats.occupancyHistogram[4] == 4));
+	FreeCacheStats(&stats);
+
+	//A reset keeps the data
+	ResetCacheStats(cachePtr);
+	GetCacheStats(cachePtr, &stats);
+	CHECK((stats.hits == 0) && (stats.misses == 0) && (stats.evictions == 0) && (stats.bytesToDevice == 0) && (stats.setMisses[0] == 0));
+	CHECK(stats.occupancyHistogram[4] == 4);
+	FreeCacheStats(&stats);
+	CHECK(Request(17, cachePtr));
+	FreeCache(cachePtr);
+}
+
+//------------------------------------------------------------------------------
+
+//With the decay the count of an entry that was hot long ago is halved until newer entries are used more often
+void TestDecay(int decayPeriod)
+{
+	cl_int err;
+	struct Cache_t* cachePtr = CreateCache(context, queue, 4, ENTRY_SIZE, 32, fully_associative, lfu_RP, &err);
+
+	CHECK(cachePtr != NULL);
+	SetDecayPeriod(cachePtr, decayPeriod);
+	CHECK(!Request(0, cachePtr));
+	for (int i = 0; i < 20; i++)
+		CHECK(Request(0, cachePtr));
+	for (int round = 0; round < 10; round++) {
+		for (int i = 1; i < 4; i++)
+			CHECK(Request(i, cachePtr) == (round > 0));
+	}
+	CHECK(!Request(4, cachePtr));
+	CHECK(IsCached(entries[0], cachePtr) == (decayPeriod == 0));
+	FreeCache(cachePtr);
+}
+
+//------------------------------------------------------------------------------
+
+//Reading a line is no access, so the least recently or least often used line is still the victim
+void TestProbesKeepState(enum CacheConfiguration_t config, enum ReplacementPolicy_t policy)
+{
+	cl_int err;
+	//A four way cache with two sets holds the even entries in one set
+	int step = (config == fully_associative) ? 1 : 2;
+	struct Cache_t* cachePtr = CreateCache(context, queue, (config == fully_associative) ? 4 : 8, ENTRY_SIZE, 32, config, policy, &err);
+
+	CHECK(cachePtr != NULL);
+	for (int i = 0; i < 4; i++)
+		CHECK(!Request(i * step, cachePtr));
+	for (int i = 1; i < 4; i++)
+		CHECK(Request(i * step, cachePtr));
+	for (int i = 0; i < 8; i++) {
+		CHECK(clEnqueueReadCacheBuffer(queue, CL_TRUE, 0, ENTRY_SIZE, entries[0], 0, NULL, NULL, cachePtr) == 0);
+		CHECK(clEnqueueReadCacheBufferRange(queue, CL_TRUE, 0, ENTRY_SIZE / 2, entries[0], 0, NULL, NULL, cachePtr) == 0);
+	}
+	CHECK(!Request(4 * step, cachePtr));
+	CHECK(!IsCached(entries[0], cachePtr));
+	for (int i = 1; i < 5; i++)
+		CHECK(IsCached(entries[i * step], cachePtr));
+	FreeCache(cachePtr);
+}
+
+//------------------------------------------------------------------------------
+
+//A full fully associative cache evicts the line its policy selects, random_RP any one of them
+void TestHashedIndexAtCapacity(enum ReplacementPolicy_t policy)
+{
+	cl_int err;
+	struct Cache_t* cachePtr = CreateCache(context, queue, 4, ENTRY_SIZE, 32, fully_associative, policy, &err);
+	int order[6] = {0, 0, 0, 1, 2, 2};
+
+	CHECK(cachePtr != NULL);
+	for (int i = 0; i < 4; i++)
+		CHECK(!Request(i, cachePtr));
+	//Entry 3 is the least recently and least often used, entry 2 the most recently and entry 0 the most often
+	for (int i = 0; i < 6; i++)
+		CHECK(Request(order[i], cachePtr));
+	//Probing the lines in reverse saves no victim
+	for (int i = 3; i >= 0; i--)
+		CHECK(IsCached(entries[i], cachePtr) && IsCached(entries[i], cachePtr));
+	CHECK(!Request(4, cachePtr));
+	CHECK(IsCached(entries[4], cachePtr));
+
+	int victim = -1;
+	if ((policy == lru_RP) || (policy == lfu_RP))
+		victim = 3;
+	else if (policy == mru_RP)
+		victim = 2;
+	else if ((policy == fifo_RP) || (policy == mfu_RP))
+		victim = 0;
+	int numberOfCached = 0;
+	for (int i = 0; i < 4; i++) {
+		numberOfCached += IsCached(entries[i], cachePtr);
+		if (victim != -1)
+			CHECK(IsCached(entries[i], cachePtr) == (i != victim));
+	}
+	CHECK(numberOfCached == 3);
+	FreeCache(cachePtr);
+}
+
+//------------------------------------------------------------------------------
+
+//A cyclic pass over twice the lines of a large LRU cache misses every time and leaves the second half cached
+void TestHashedIndexLarge(void)
+{
+	cl_int err;
+	const int numberOfLines = 1024;
+	char* data = (char*)calloc(2 * numberOfLines, ENTRY_SIZE);
+	struct Cache_t* cachePtr = CreateCache(context, queue, numberOfLines, ENTRY_SIZE, 32, fully_associative, lru_RP, &err);
+
+	CHECK(cachePtr != NULL);
+	for (int pass = 0; pass < 2; pass++) {
+		for (int i = 0; i < 2 * numberOfLines; i++)
+			clCreateCacheBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, ENTRY_SIZE, data + i * ENTRY_SIZE, &err, cachePtr);
+	}
+	CHECK(GetHits(cachePtr) == 0);
+	int numberOfCached = 0;
+	for (int i = 0; i < 2 * numberOfLines; i++) {
+		if (IsCached(data + i * ENTRY_SIZE, cachePtr)) {
+			numberOfCached++;
+			CHECK(i >= numberOfLines);
+		}
+	}
+	CHECK(numberOfCached == numberOfLines);
+	//The slots of the evicted lines are reused, every remaining line is still found
+	for (int i = 2 * numberOfLines - 1; i >= numberOfLines; i--)
+		clCreateCacheBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, ENTRY_SIZE, data + i * ENTRY_SIZE, &err, cachePtr);
+	CHECK(GetHits(cachePtr) == (uint64_t)numberOfLines);
+	FreeCache(cachePtr);
+	free(data);
+}
+
+//------------------------------------------------------------------------------
+
+//Request the data of hostAddress as input on its own or as a batch of one
+void RequestInput(char* hostAddress, bool batched, struct Cache_t* cachePtr)
+{
+	cl_int err;
+	cl_mem_flags flags = CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR;
+	size_t size = ENTRY_SIZE;
+	void* hostAddresses[1] = {hostAddress};
+	cl_mem deviceData[1];
+
+	if (batched)
+		CHECK(clCreateCacheBuffers(context, queue, 1, &flags, &size, hostAddresses, deviceData, &err, cachePtr) == 0);
+	else
+		CHECK(clCreateCacheBuffer(context, flags, size, hostAddress, &err, cachePtr) != NULL);
+}
+
+//------------------------------------------------------------------------------
+
+//Return the hits of rounds of a hot set used twice and a one pass scan, together more than the lines of the cache, requested on their own or in batches of one
+uint64_t RunScans(enum CacheConfiguration_t config, enum ReplacementPolicy_t policy, char* data, bool batched)
+{
+	cl_int err;
+	const int numberOfLines = 64;
+	struct Cache_t* cachePtr = CreateCache(context, queue, numberOfLines, ENTRY_SIZE, 32, config, policy, &err);
+	int next = numberOfLines;
+
+	CHECK(cachePtr != NULL);
+	for (int round = 0; round < 20; round++) {
+		for (int i = 0; i < 2 * (numberOfLines * 3 / 8); i++)
+			RequestInput(data + (i % (numberOfLines * 3 / 8)) * ENTRY_SIZE, batched, cachePtr);
+		for (int i = 0; i < numberOfLines * 3 / 4; i++)
+			RequestInput(data + (next++) * ENTRY_SIZE, batched, cachePtr);
+	}
+	uint64_t hits = GetHits(cachePtr);
+	FreeCache(cachePtr);
+	return hits;
+}
+
+//------------------------------------------------------------------------------
+
+//The scans flush the hot set out of an LRU cache, a scan resistant policy keeps more of it
+void TestScanResistance(enum CacheConfiguration_t config, enum ReplacementPolicy_t policy)
+{
+	char* data = (char*)calloc(2048, ENTRY_SIZE);
+
+	CHECK(RunScans(config, policy, data, false) > RunScans(config, lru_RP, data, false));
+	//A batch pins and unpins its lines, a miss in it is no second use of the line
+	CHECK(RunScans(config, policy, data, true) == RunScans(config, policy, data, false));
+	free(data);
+}
+
+//------------------------------------------------------------------------------
+
+//The queue of a request selects its device, a miss copies from a peer and new device data drops the other copies
+void TestMultiDevice(void)
+{
+	cl_int err;
+	cl_command_queue queues[2] = {clCreateCommandQueue(context, NULL, 0, &err), clCreateCommandQueue(context, NULL, 0, &err)};
+	struct Cache_t* cachePtr = CreateMultiDeviceCache(context, 2, queues, 8, ENTRY_SIZE, 32, four_way, lru_RP, &err);
+
+	CHECK(cachePtr != NULL);
+	RequestOn(queues[0], CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, 0, cachePtr);
+	CHECK(IsCached(entries[0], cachePtr->device[0]) && !IsCached(entries[0], cachePtr->device[1]));
+	CHECK(GetBytesToDevice(cachePtr) == ENTRY_SIZE);
+	RequestOn(queues[1], CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, 0, cachePtr);
+	CHECK(IsCached(entries[0], cachePtr->device[0]) && IsCached(entries[0], cachePtr->device[1]));
+	CHECK((cachePtr->PeerTransfers == 1) && (GetBytesToDevice(cachePtr) == ENTRY_SIZE));
+
+	//A queue of no device uses a device that already holds the data
+	uint64_t hits = GetHits(cachePtr);
+	RequestOn(queue, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, 0, cachePtr);
+	CHECK((GetHits(cachePtr) == hits + 1) && (GetBytesToDevice(cachePtr) == ENTRY_SIZE));
+
+	//Data produced or written on one device is dropped from the other
+	RequestOn(queues[1], CL_MEM_READ_WRITE, 0, cachePtr);
+	CHECK(!IsCached(entries[0], cachePtr->device[0]) && IsCached(entries[0], cachePtr->device[1]));
+	RequestOn(queues[0], CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, 0, cachePtr);
+	CHECK((cachePtr->PeerTransfers == 2) && IsCached(entries[0], cachePtr->device[0]));
+	CHECK(clEnqueueWriteCacheBufferRange(queues[0], CL_TRUE, 0, ENTRY_SIZE, entries[0], 0, NULL, NULL, cachePtr) == 0);
+	CHECK(IsCached(entries[0], cachePtr->device[0]) && !IsCached(entries[0], cachePtr->device[1]));
+	FreeCache(cachePtr);
+	clReleaseCommandQueue(queues[0]);
+	clReleaseCommandQueue(queues[1]);
+}
+
+//------------------------------------------------------------------------------
+
+//Only changed host data is uploaded again, with dedup_CC identical data at an other address is not uploaded at all
+void TestContentCheck(enum ContentCheck_t contentCheck)
+{
+	cl_int err;
+	char copy[ENTRY_SIZE];
+	int numberOfCacheLines[2] = {4, 4};
+	int dataSizes[2] = {ENTRY_SIZE, 4 * ENTRY_SIZE};
+	struct Cache_t* caches[2] = {CreateCache(context, queue, 16, ENTRY_SIZE, 32, four_way, lru_RP, &err),
+		CreateSizeClassCache(context, queue, 2, numberOfCacheLines, dataSizes, 32, four_way, lru_RP, &err)};
+
+	for (int i = 0; i < 2; i++) {
+		struct Cache_t* cachePtr = caches[i];
+		CHECK(cachePtr != NULL);
+		SetContentCheck(cachePtr, contentCheck);
+		CHECK(!Request(5, cachePtr));
+		CHECK(Request(5, cachePtr));
+		CHECK(GetBytesToDevice(cachePtr) == ENTRY_SIZE);
+		entries[5][0]++;
+		Request(5, cachePtr);
+		CHECK(GetBytesToDevice(cachePtr) == 2 * ENTRY_SIZE);
+		entries[5][0]--;
+
+		//A range write leaves only part of the line uploaded, the next request uploads all of it
+		CHECK(clEnqueueWriteCacheBufferRange(queue, CL_TRUE, 0, ENTRY_SIZE / 2, entries[5], 0, NULL, NULL, cachePtr) == 0);
+		uint64_t bytesToDevice = GetBytesToDevice(cachePtr);
+		Request(5, cachePtr);
+		CHECK(GetBytesToDevice(cachePtr) == bytesToDevice + ENTRY_SIZE);
+
+		memcpy(copy, entries[5], ENTRY_SIZE);
+		bytesToDevice = GetBytesToDevice(cachePtr);
+		clCreateCacheBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, ENTRY_SIZE, copy, &err, cachePtr);
+		CHECK(GetBytesToDevice(cachePtr) == bytesToDevice + ((contentCheck == dedup_CC) ? 0 : ENTRY_SIZE));
+		FreeCache(cachePtr);
+	}
+}
+
+//------------------------------------------------------------------------------
+
+//Only a write only output skips the upload, the output of a kernel is then an input without any transfer
+void TestOutputBuffers(enum WritePolicy_t writePolicy)
+{
+	cl_int err;
+	struct Cache_t* cachePtr = CreateCache(context, queue, 16, ENTRY_SIZE, 32, four_way, lru_RP, &err);
+
+	CHECK(cachePtr != NULL);
+	SetWritePolicy(cachePtr, writePolicy);
+	RequestOn(queue, CL_MEM_WRITE_ONLY, 0, cachePtr);
+	CHECK(GetBytesToDevice(cachePtr) == 0);
+	//A kernel may write only part of a read write output, the other bytes are the ones of the host
+	RequestOn(queue, CL_MEM_READ_WRITE, 1, cachePtr);
+	CHECK(GetBytesToDevice(cachePtr) == ENTRY_SIZE);
+	CHECK(Request(0, cachePtr) && Request(1, cachePtr));
+	RequestOn(queue, CL_MEM_READ_WRITE, 1, cachePtr);
+	CHECK(GetBytesToDevice(cachePtr) == ENTRY_SIZE);
+
+	//Only write_back_WP writes the outputs back
+	CHECK(clFlushCache(queue, cachePtr) == 0);
+	CHECK(GetBytesToHost(cachePtr) == ((writePolicy == write_back_WP) ? 2 * ENTRY_SIZE : 0));
+	FreeCache(cachePtr);
+}
+
+//------------------------------------------------------------------------------
+
+//A line holds the bytes of its request, a larger request of the same address fills the line again
+void TestVariableSize(void)
+{
+	cl_int err;
+	char host[4 * ENTRY_SIZE];
+	char data[4 * ENTRY_SIZE];
+	struct Cache_t* cachePtr = CreateCache(context, queue, 4, 4 * ENTRY_SIZE, 32, fully_associative, lru_RP, &err);
+
+	CHECK(cachePtr != NULL);
+	FillPattern(host, sizeof(host), 1);
+	CHECK(clCreateCacheBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, ENTRY_SIZE, host, &err, cachePtr) != NULL);
+	CHECK(clCreateCacheBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, ENTRY_SIZE / 2, host, &err, cachePtr) != NULL);
+	CHECK((GetHits(cachePtr) == 1) && (GetBytesToDevice(cachePtr) == ENTRY_SIZE));
+
+	//Only the bytes held by the line can be read
+	CHECK(clEnqueueReadCacheBuffer(queue, CL_TRUE, 0, ENTRY_SIZE, host, 0, NULL, NULL, cachePtr) == 0);
+	CHECK(clEnqueueReadCacheBuffer(queue, CL_TRUE, 0, ENTRY_SIZE + 1, host, 0, NULL, NULL, cachePtr) == 1);
+	cl_mem buffer = clCreateCacheBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, 3 * ENTRY_SIZE, host, &err, cachePtr);
+	CHECK((buffer != NULL) && (GetHits(cachePtr) == 1) && (GetBytesToDevice(cachePtr) == 4 * ENTRY_SIZE));
+	CHECK((clEnqueueReadBuffer(queue, buffer, CL_TRUE, 0, 3 * ENTRY_SIZE, data, 0, NULL, NULL) == CL_SUCCESS) && (memcmp(data, host, 3 * ENTRY_SIZE) == 0));
+	CHECK(clEnqueueReadCacheBuffer(queue, CL_TRUE, 0, 3 * ENTRY_SIZE, host, 0, NULL, NULL, cachePtr) == 0);
+	CHECK((clCreateCacheBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, 4 * ENTRY_SIZE + 1, host, &err, cachePtr) == NULL) && (err == CL_INVALID_BUFFER_SIZE));
+	FreeCache(cachePtr);
+}
+
+//------------------------------------------------------------------------------
+
+uint64_t GetBypasses(struct Cache_t* cachePtr)
+{
+	CacheStats_t stats;
+
+	GetCacheStats(cachePtr, &stats);
+	FreeCacheStats(&stats);
+	return stats.bypasses;
+}
+
+//------------------------------------------------------------------------------
+
+//Request the entries set, set + 16 and set + 32 of a cache with 16 sets in turn and return the hits
+int CycleSet(int set, int rounds, struct Cache_t* cachePtr)
+{
+	int hits = 0;
+
+	for (int round = 0; round < rounds; round++) {
+		for (int i = 0; i < 3; i++)
+			hits += Request(set + 16 * i, cachePtr);
+	}
+	return hits;
+}
+
+//------------------------------------------------------------------------------
+
+//Three entries in turn in a set of two ways always miss with lru_RP, so the follower sets take mru_RP from its leader
+void TestPolicyDuel(void)
+{
+	cl_int err;
+	CacheStats_t stats;
+	//16 sets of 2 ways, set 0 leads for lru_RP and set 8 for mru_RP
+	struct Cache_t* cachePtr = CreateAssociativeCache(context, queue, 32, 2, ENTRY_SIZE, 32, lru_RP, &err);
+	struct Cache_t* smallCache = CreateCache(context, queue, 8, ENTRY_SIZE, 32, two_way, lru_RP, &err);
+
+	CHECK((smallCache != NULL) && (SetPolicyDuel(smallCache, lru_RP, mru_RP) == 1));
+	CHECK((cachePtr != NULL) && (SetPolicyDuel(cachePtr, lru_RP, clock_RP) == 1));
+	CHECK(SetPolicyDuel(cachePtr, lru_RP, mru_RP) == 0);
+	CHECK(CycleSet(4, 4, cachePtr) == 0);
+	for (int round = 0; round < 10; round++) {
+		CHECK(CycleSet(0, 1, cachePtr) == 0);
+		CycleSet(8, 1, cachePtr);
+	}
+	GetCacheStats(cachePtr, &stats);
+	FreeCacheStats(&stats);
+	CHECK((stats.followerPolicy == mru_RP) && (stats.policySwitches > 0) && (stats.duelMisses[0] > stats.duelMisses[1]));
+	CHECK(CycleSet(4, 4, cachePtr) > 0);
+
+	//Two equal policies end the duel
+	CHECK(SetPolicyDuel(cachePtr, lru_RP, lru_RP) == 0);
+	GetCacheStats(cachePtr, &stats);
+	FreeCacheStats(&stats);
+	CHECK(stats.followerPolicy == lru_RP);
+	CHECK(CycleSet(12, 4, cachePtr) == 0);
+	FreeCache(smallCache);
+	FreeCache(cachePtr);
+}
+
+//------------------------------------------------------------------------------
+
+//Read the records of a trace file, the number of records is returned and -1 when the header is not a trace
+int ReadTrace(const char* fileName, TraceRecord_t* records, int capacity)
+{
+	TraceHeader_t header;
+	int numberOfRecords = -1;
+	FILE* file = fopen(fileName, "rb");
+
+	if (file == NULL)
+		return -1;
+	if ((fread(&header, sizeof(header), 1, file) == 1) && (header.magic == CACHE_TRACE_MAGIC)
+		&& (header.version == CACHE_TRACE_VERSION) && (header.recordSize == sizeof(TraceRecord_t)))
+		numberOfRecords = (int)fread(records, sizeof(TraceRecord_t), capacity, file);
+	fclose(file);
+	return numberOfRecords;
+}
+
+//------------------------------------------------------------------------------
+
+//A trace holds every request in order with its kind, host address, range and flags
+void TestTrace(void)
+{
+	cl_int err;
+	TraceRecord_t records[8];
+	const char* fileNames[2] = {"cache_test.trace", "cache_test_free.trace"};
+	cl_mem_flags input = CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR;
+	struct Cache_t* cachePtr = CreateCache(context, queue, 4, ENTRY_SIZE, 32, fully_associative, lru_RP, &err);
+
+	CHECK((cachePtr != NULL) && (SetTraceFile(cachePtr, fileNames[0]) == 0));
+	CHECK(clCreateCacheBuffer(context, input, ENTRY_SIZE, entries[0], &err, cachePtr) != NULL);
+	RequestOn(queue, CL_MEM_WRITE_ONLY, 1, cachePtr);
+	CHECK(clEnqueueReadCacheBuffer(queue, CL_TRUE, 0, ENTRY_SIZE, entries[0], 0, NULL, NULL, cachePtr) == 0);
+	CHECK(clEnqueueReadCacheBufferRange(queue, CL_TRUE, 8, 16, entries[0], 0, NULL, NULL, cachePtr) == 0);
+	CHECK(clEnqueueWriteCacheBufferRange(queue, CL_TRUE, 4, 8, entries[0], 0, NULL, NULL, cachePtr) == 0);
+	CHECK(clFlushCache(queue, cachePtr) == 0);
+	CHECK(SetTraceFile(cachePtr, NULL) == 0);
+	CHECK(!Request(2, cachePtr));
+
+	TraceRecord_t expected[6] = {
+		{0, (uint64_t)(uintptr_t)entries[0], ENTRY_SIZE, 0, input, create_TK, 0},
+		{0, (uint64_t)(uintptr_t)entries[1], ENTRY_SIZE, 0, CL_MEM_WRITE_ONLY, create_TK, 0},
+		{0, (uint64_t)(uintptr_t)entries[0], ENTRY_SIZE, 0, 0, read_TK, 0},
+		{0, (uint64_t)(uintptr_t)entries[0], 16, 8, 0, read_range_TK, 0},
+		{0, (uint64_t)(uintptr_t)entries[0], 8, 4, 0, write_range_TK, 0},
+		{0, 0, 0, 0, 0, flush_TK, 0}};
+	CHECK(ReadTrace(fileNames[0], records, 8) == 6);
+	for (int i = 0; i < 6; i++) {
+		CHECK((records[i].kind == expected[i].kind) && (records[i].hostAddress == expected[i].hostAddress) && (records[i].flags == expected[i].flags));
+		CHECK((records[i].kind == flush_TK) || ((records[i].size == expected[i].size) && (records[i].offset == expected[i].offset)));
+		CHECK((i == 0) || (records[i].time >= records[i - 1].time));
+	}
+
+	//FreeCache() ends the trace as well
+	CHECK(SetTraceFile(cachePtr, fileNames[1]) == 0);
+	CHECK(Request(2, cachePtr));
+	FreeCache(cachePtr);
+	CHECK((ReadTrace(fileNames[1], records, 8) == 1) && (records[0].hostAddress == (uint64_t)(uintptr_t)entries[2]));
+	remove(fileNames[0]);
+	remove(fileNames[1]);
+}
+
+//------------------------------------------------------------------------------
+
+//Every transfer is timed on a profiling queue, the host only queue takes one nanosecond per byte or work item
+void TestProfiling(void)
+{
+	cl_int err;
+	char host[ENTRY_SIZE];
+	char* trace = NULL;
+	size_t traceSize = 0;
+	const char* fileName = "cache_test.json";
+	const size_t kernelSize = 18 * ENTRY_SIZE;
+	cl_event kernelEvent = NULL;
+	cl_command_queue profilingQueue = clCreateCommandQueue(context, NULL, CL_QUEUE_PROFILING_ENABLE, &err);
+	struct Cache_t* plainCache = CreateCache(context, queue, 4, ENTRY_SIZE, 32, fully_associative, lru_RP, &err);
+	struct Cache_t* cachePtr = CreateCache(context, profilingQueue, 4, 4 * ENTRY_SIZE, 32, fully_associative, lru_RP, &err);
+
+	CHECK((plainCache != NULL) && (SetProfiling(plainCache, true) == 1) && (plainCache->profile == NULL));
+	CHECK((cachePtr != NULL) && (SetProfiling(cachePtr, true) == 0));
+	SetWritePolicy(cachePtr, write_back_WP);
+	CHECK(clCreateCacheBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, ENTRY_SIZE, entries[0], &err, cachePtr) != NULL);
+	CHECK(clCreateCacheBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, 4 * ENTRY_SIZE, entries[4], &err, cachePtr) != NULL);
+	CHECK(clCreateCacheBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, ENTRY_SIZE, entries[0], &err, cachePtr) != NULL);
+	CHECK((cachePtr->profile->numberOfRecords == 2) && (cachePtr->profile->busyTime[to_device_PK] == 5 * ENTRY_SIZE));
+
+	//The latency is the middle of its bucket, a quarter of a power of 2 wide
+	uint64_t latency = GetProfileLatency(cachePtr, to_device_PK, ENTRY_SIZE, 0.5);
+	CHECK((latency >= ENTRY_SIZE) && (latency < 5 * ENTRY_SIZE / 4));
+	latency = GetProfileLatency(cachePtr, to_device_PK, 0, 1.0);
+	CHECK((latency >= 4 * ENTRY_SIZE) && (latency < 5 * ENTRY_SIZE));
+	CHECK(GetProfileLatency(cachePtr, to_host_PK, 0, 0.5) == 0);
+
+	cl_mem output = clCreateCacheBuffer(context, CL_MEM_WRITE_ONLY, ENTRY_SIZE, host, &err, cachePtr);
+	CHECK((output != NULL) && (clFlushCache(profilingQueue, cachePtr) == 0));
+	CHECK(cachePtr->profile->busyTime[to_host_PK] == ENTRY_SIZE);
+	cl_program program = clCreateProgramWithSource(context, 0, NULL, NULL, &err);
+	cl_kernel kernel = clCreateKernel(program, "Kernel", &err);
+	CHECK(clEnqueueNDRangeKernel(profilingQueue, kernel, 1, NULL, &kernelSize, NULL, 0, NULL, &kernelEvent) == CL_SUCCESS);
+	ProfileKernel(cachePtr, kernelEvent);
+	CHECK(GetMissTimeFraction(cachePtr) == 0.25);
+
+	//The trace has one complete event per profiled command
+	CHECK(WriteChromeTrace(cachePtr, fileName) == 0);
+	FILE* file = fopen(fileName, "r");
+	CHECK((file != NULL) && (getdelim(&trace, &traceSize, '\0', file) > 0));
+	int numberOfEvents = 0;
+	for (char* event = (trace != NULL) ? strstr(trace, "\"ph\":\"X\"") : NULL; event != NULL; event = strstr(event + 1, "\"ph\":\"X\""))
+		numberOfEvents++;
+	CHECK(numberOfEvents == 4);
+	if (file != NULL)
+		fclose(file);
+	free(trace);
+	remove(fileName);
+
+	//Turning profiling off drops the profile
+	CHECK((SetProfiling(cachePtr, false) == 0) && (GetProfileLatency(cachePtr, to_device_PK, 0, 1.0) == 0) && (WriteChromeTrace(cachePtr, fileName) == 1));
+	clReleaseEvent(kernelEvent);
+	clReleaseKernel(kernel);
+	clReleaseProgram(program);
+	FreeCache(cachePtr);
+	FreeCache(plainCache);
+	clReleaseCommandQueue(profilingQueue);
+}
+
+//------------------------------------------------------------------------------
+
+//A zero copy line is the host memory of its data, nothing is moved and a kernel and the host see each other's writes
+void TestZeroCopy(enum MemoryBackend_t backend)
+{
+	cl_int err;
+	char host[2][ENTRY_SIZE];
+	char data[ENTRY_SIZE];
+	struct Cache_t* cachePtr = CreateZeroCopyCache(context, queue, 4, ENTRY_SIZE, 32, fully_associative, lru_RP, backend, &err);
+
+	//The host only device reports neither system SVM nor memory shared with the host
+	CHECK((cachePtr != NULL) && (cachePtr->memoryBackend == ((backend == auto_MB) ? copy_MB : host_ptr_MB)));
+	SetWritePolicy(cachePtr, write_back_WP);
+	FillPattern(host[0], ENTRY_SIZE, 1);
+	FillPattern(host[1], ENTRY_SIZE, 2);
+	cl_mem input = clCreateCacheBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, ENTRY_SIZE, host[0], &err, cachePtr);
+	CHECK((input != NULL) && (clEnqueueReadBuffer(queue, input, CL_TRUE, 0, ENTRY_SIZE, data, 0, NULL, NULL) == CL_SUCCESS));
+	CHECK(memcmp(data, host[0], ENTRY_SIZE) == 0);
+	CHECK(clCreateCacheBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, ENTRY_SIZE, host[0], &err, cachePtr) == input);
+	FillPattern(host[0], ENTRY_SIZE, 4);
+	CHECK(clEnqueueReadBuffer(queue, input, CL_TRUE, 0, ENTRY_SIZE, data, 0, NULL, NULL) == CL_SUCCESS);
+	CHECK((memcmp(data, host[0], ENTRY_SIZE) == 0) == (backend != auto_MB));
+
+	//The kernel writes its output into the host memory
+	cl_mem output = clCreateCacheBuffer(context, CL_MEM_READ_WRITE, ENTRY_SIZE, host[1], &err, cachePtr);
+	FillPattern(data, ENTRY_SIZE, 3);
+	CHECK((output != NULL) && (clEnqueueWriteBuffer(queue, output, CL_TRUE, 0, ENTRY_SIZE, data, 0, NULL, NULL) == CL_SUCCESS));
+	CHECK(clFlushCache(queue, cachePtr) == 0);
+	CHECK(memcmp(host[1], data, ENTRY_SIZE) == 0);
+	if (backend == auto_MB)
+		CHECK((GetBytesToDevice(cachePtr) == 2 * ENTRY_SIZE) && (GetBytesToHost(cachePtr) == ENTRY_SIZE));
+	else
+		CHECK((GetBytesToDevice(cachePtr) == 0) && (GetBytesToHost(cachePtr) == 0) && (GetHits(cachePtr) == 1));
+	FreeCache(cachePtr);
+}
+
+//------------------------------------------------------------------------------
+
+//A pinned line is not evicted until its last pin is released, a miss in a set of pinned lines is bypassed
+void TestPins(void)
+{
+	cl_int err;
+	cl_mem buffers[2];
+	void* hostAddresses[2] = {entries[0], entries[1]};
+	cl_event event = NULL;
+	struct Cache_t* cachePtr = CreateCache(context, queue, 2, ENTRY_SIZE, 32, fully_associative, lru_RP, &err);
+
+	CHECK(cachePtr != NULL);
+	for (int i = 0; i < 2; i++) {
+		buffers[i] = clCreateCacheBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, ENTRY_SIZE, entries[i], &err, cachePtr);
+		CHECK(buffers[i] != NULL);
+	}
+	CHECK((clPinCacheBuffer(entries[0], buffers[0], cachePtr) == 0) && (clPinCacheBuffer(entries[0], buffers[0], cachePtr) == 0));
+	CHECK((clPinCacheBuffer(entries[0], buffers[1], cachePtr) == 1) && (clPinCacheBuffer(entries[2], buffers[0], cachePtr) == 1));
+	CHECK(!Request(2, cachePtr) && IsCached(entries[0], cachePtr) && !IsCached(entries[1], cachePtr));
+
+	//With both lines pinned the next miss gets a temporary buffer
+	buffers[1] = clCreateCacheBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, ENTRY_SIZE, entries[1], &err, cachePtr);
+	CHECK((buffers[1] != NULL) && (clPinCacheBuffer(entries[1], buffers[1], cachePtr) == 0));
+	CHECK((GetBypasses(cachePtr) == 0) && !Request(3, cachePtr) && (GetBypasses(cachePtr) == 1));
+	CHECK(IsCached(entries[0], cachePtr) && IsCached(entries[1], cachePtr));
+	CHECK(clUnpinCacheBuffer(entries[0], buffers[0], cachePtr) == 0);
+	CHECK(!Request(3, cachePtr) && (GetBypasses(cachePtr) == 2));
+	CHECK(clUnpinCacheBuffer(entries[0], buffers[0], cachePtr) == 0);
+	CHECK(!Request(3, cachePtr) && !IsCached(entries[0], cachePtr) && IsCached(entries[1], cachePtr));
+	CHECK(clUnpinCacheBuffer(entries[1], buffers[1], cachePtr) == 0);
+
+	//The pins of an event are released by the first call after its completion
+	buffers[0] = clCreateCacheBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, ENTRY_SIZE, entries[0], &err, cachePtr);
+	buffers[1] = clCreateCacheBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, ENTRY_SIZE, entries[1], &err, cachePtr);
+	CHECK(clEnqueueMarkerWithWaitList(queue, 0, NULL, &event) == CL_SUCCESS);
+	CHECK(clPinCacheBuffersUntil(event, 2, hostAddresses, buffers, cachePtr) == 0);
+	CHECK(!Request(2, cachePtr) && (GetBypasses(cachePtr) == 2) && !IsCached(entries[0], cachePtr));
+	clReleaseEvent(event);
+	FreeCache(cachePtr);
+}
+
+//------------------------------------------------------------------------------
+
+//A prefetch fills the line once without a hit or a miss, the first request of the line is a useful prefetch
+void TestPrefetch(void)
+{
+	cl_int err;
+	CacheStats_t stats;
+	char data[ENTRY_SIZE];
+	void* hostAddresses[3] = {entries[0], entries[1], entries[2]};
+	struct Cache_t* cachePtr = CreateCache(context, queue, 8, ENTRY_SIZE, 32, fully_associative, lru_RP, &err);
+
+	CHECK(cachePtr != NULL);
+	CHECK(clCachePrefetch(queue, hostAddresses, NULL, 3, cachePtr) == 0);
+	CHECK(clCachePrefetch(queue, hostAddresses, NULL, 1, cachePtr) == 0);
+	CHECK((cachePtr->Prefetches == 3) && (GetBytesToDevice(cachePtr) == 3 * ENTRY_SIZE));
+	cl_mem buffer = clCreateCacheBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, ENTRY_SIZE, entries[1], &err, cachePtr);
+	CHECK((buffer != NULL) && (clEnqueueReadBuffer(queue, buffer, CL_TRUE, 0, ENTRY_SIZE, data, 0, NULL, NULL) == CL_SUCCESS));
+	CHECK(memcmp(data, entries[1], ENTRY_SIZE) == 0);
+	CHECK(Request(1, cachePtr) && Request(2, cachePtr));
+	GetCacheStats(cachePtr, &stats);
+	FreeCacheStats(&stats);
+	CHECK((cachePtr->UsefulPrefetches == 2) && (stats.hits == 3) && (stats.misses == 0));
+	FreeCache(cachePtr);
+}
+
+//------------------------------------------------------------------------------
+
+//stride_PF prefetches the next entries at the distance of the last requests, but not past the end of its range
+void TestStridePrefetch(void)
+{
+	cl_int err;
+	struct Cache_t* cachePtr = CreateCache(context, queue, 16, ENTRY_SIZE, 32, fully_associative, lru_RP, &err);
+
+	CHECK(cachePtr != NULL);
+	SetPrefetcher(cachePtr, stride_PF, 2, entries[0], entries[NUMBER_OF_ENTRIES]);
+	for (int i = 0; i < 3; i++)
+		CHECK(!Request(2 * i, cachePtr));
+	CHECK(IsCached(entries[6], cachePtr) && IsCached(entries[8], cachePtr) && !IsCached(entries[10], cachePtr));
+	CHECK(Request(6, cachePtr) && Request(8, cachePtr) && Request(10, cachePtr));
+	CHECK((cachePtr->UsefulPrefetches == 3) && (cachePtr->Prefetches == 5));
+
+	//The last entries of the range have no entries after them
+	for (int i = NUMBER_OF_ENTRIES - 5; i < NUMBER_OF_ENTRIES; i += 2)
+		CHECK(!Request(i, cachePtr));
+	CHECK(cachePtr->Prefetches == 5);
+	FreeCache(cachePtr);
+}
+
+//------------------------------------------------------------------------------
+
+//sequence_PF prefetches the entries that followed an entry the last time it was requested
+void TestSequencePrefetch(void)
+{
+	cl_int err;
+	int chain[3] = {0, 5, 9};
+	struct Cache_t* cachePtr = CreateCache(context, queue, 8, ENTRY_SIZE, 32, fully_associative, lru_RP, &err);
+
+	CHECK(cachePtr != NULL);
+	SetPrefetcher(cachePtr, sequence_PF, 2, NULL, NULL);
+	for (int i = 0; i < 3; i++)
+		CHECK(!Request(chain[i], cachePtr));
+	for (int i = 10; i < 18; i++)
+		CHECK(!Request(i, cachePtr));
+	CHECK(!IsCached(entries[5], cachePtr) && !IsCached(entries[9], cachePtr));
+	CHECK(!Request(chain[0], cachePtr));
+	CHECK(Request(chain[1], cachePtr) && Request(chain[2], cachePtr));
+	CHECK(cachePtr->UsefulPrefetches == 2);
+	FreeCache(cachePtr);
+}
+
+//------------------------------------------------------------------------------
+
+//A bypassed request gets a buffer with its data without evicting a line, output data is still written back
+void TestBypass(void)
+{
+	cl_int err;
+	char data[ENTRY_SIZE];
+	char host[ENTRY_SIZE];
+	char produced[ENTRY_SIZE];
+	struct Cache_t* cachePtr = CreateCache(context, queue, 4, ENTRY_SIZE, 32, fully_associative, lru_RP, &err);
+
+	CHECK(cachePtr != NULL);
+	SetWritePolicy(cachePtr, write_back_WP);
+	for (int i = 0; i < 4; i++)
+		CHECK(!Request(i, cachePtr));
+	for (int pass = 0; pass < 2; pass++) {
+		cl_mem buffer = clCreateCacheBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR | CL_MEM_CACHE_BYPASS, ENTRY_SIZE, entries[4], &err, cachePtr);
+		CHECK((buffer != NULL) && (clEnqueueReadBuffer(queue, buffer, CL_TRUE, 0, ENTRY_SIZE, data, 0, NULL, NULL) == CL_SUCCESS));
+		CHECK(memcmp(data, entries[4], ENTRY_SIZE) == 0);
+	}
+	CHECK((GetBypasses(cachePtr) == 2) && (GetHits(cachePtr) == 0));
+	for (int i = 0; i < 4; i++)
+		CHECK(IsCached(entries[i], cachePtr));
+
+	//Data that is already cached is served by its line
+	cl_mem line = clCreateCacheBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, ENTRY_SIZE, entries[0], &err, cachePtr);
+	CHECK(clCreateCacheBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR | CL_MEM_CACHE_BYPASS, ENTRY_SIZE, entries[0], &err, cachePtr) == line);
+	CHECK((GetBypasses(cachePtr) == 2) && (GetHits(cachePtr) == 2));
+
+	FillPattern(host, ENTRY_SIZE, 1);
+	FillPattern(produced, ENTRY_SIZE, 2);
+	cl_mem output = clCreateCacheBuffer(context, CL_MEM_READ_WRITE | CL_MEM_CACHE_BYPASS, ENTRY_SIZE, host, &err, cachePtr);
+	CHECK((output != NULL) && (clEnqueueWriteBuffer(queue, output, CL_TRUE, 0, ENTRY_SIZE, produced, 0, NULL, NULL) == CL_SUCCESS));
+	CHECK((clFlushCache(queue, cachePtr) == 0) && (memcmp(host, produced, ENTRY_SIZE) == 0));
+	for (int i = 0; i < 4; i++)
+		CHECK(IsCached(entries[i], cachePtr));
+	FreeCache(cachePtr);
+}
+
+//------------------------------------------------------------------------------
+
+//With seen_twice_AP the first miss in a full cache is bypassed, the second miss of the same address takes a line
+void TestSeenTwice(void)
+{
+	cl_int err;
+	struct Cache_t* cachePtr = CreateCache(context, queue, 4, ENTRY_SIZE, 32, fully_associative, lru_RP, &err);
+
+	CHECK(cachePtr != NULL);
+	SetAdmissionPolicy(cachePtr, seen_twice_AP);
+	for (int i = 0; i < 4; i++)
+		CHECK(!Request(i, cachePtr));
+	CHECK(GetBypasses(cachePtr) == 0);
+	CHECK(!Request(4, cachePtr) && (GetBypasses(cachePtr) == 1));
+	for (int i = 0; i < 4; i++)
+		CHECK(IsCached(entries[i], cachePtr));
+	CHECK(!Request(4, cachePtr) && (GetBypasses(cachePtr) == 1));
+	CHECK(Request(4, cachePtr) && !IsCached(entries[0], cachePtr));
+	FreeCache(cachePtr);
+}
+
+//------------------------------------------------------------------------------
+
+//Any power of 2 number of ways that gives a power of 2 number of sets makes a cache, the other numbers fail
+void TestAssociativity(void)
+{
+	cl_int err;
+	int valid[4][3] = {{64, 8, n_way}, {64, 32, n_way}, {64, 64, fully_associative}, {48, 48, fully_associative}};
+	int invalid[4][2] = {{64, 3}, {48, 16}, {64, 128}, {0, 1}};
+
+	for (int i = 0; i < 4; i++) {
+		struct Cache_t* cachePtr = CreateAssociativeCache(context, queue, valid[i][0], valid[i][1], ENTRY_SIZE, 32, lru_RP, &err);
+		CHECK((cachePtr != NULL) && (err == CL_SUCCESS) && (cachePtr->config == (enum CacheConfiguration_t)valid[i][2]));
+		CHECK((cachePtr != NULL) && (cachePtr->numberOfSets == valid[i][0] / valid[i][1]) && (cachePtr->numberOfLinesPerSet == valid[i][1]));
+		if (cachePtr != NULL)
+			FreeCache(cachePtr);
+	}
+	for (int i = 0; i < 4; i++) {
+		err = CL_SUCCESS;
+		CHECK((CreateAssociativeCache(context, queue, invalid[i][0], invalid[i][1], ENTRY_SIZE, 32, lru_RP, &err) == NULL) && (err == CL_INVALID_VALUE));
+	}
+}
+
+//------------------------------------------------------------------------------
+
+//The tag comparison finds the data in every way of a set, also in the ways past the width of the vector instructions
+void TestWideSets(int numberOfWays)
+{
+	cl_int err;
+	char other[ENTRY_SIZE] __attribute__((aligned(ENTRY_SIZE)));
+	int numberOfSets = NUMBER_OF_ENTRIES / numberOfWays;
+	struct Cache_t* cachePtr = CreateAssociativeCache(context, queue, NUMBER_OF_ENTRIES, numberOfWays, ENTRY_SIZE, 32, lru_RP, &err);
+
+	CHECK(cachePtr != NULL);
+	for (int i = 0; i < NUMBER_OF_ENTRIES; i++)
+		CHECK(!Request(i, cachePtr));
+	for (int i = 0; i < NUMBER_OF_ENTRIES; i++)
+		CHECK(IsCached(entries[i], cachePtr));
+	CHECK(!IsCached(other, cachePtr));
+
+	//The new data replaces the least recently used entry of its set, the one in the first way
+	int victim = (int)(((uintptr_t)other / ENTRY_SIZE) % numberOfSets);
+	CHECK(clCreateCacheBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, ENTRY_SIZE, other, &err, cachePtr) != NULL);
+	CHECK(IsCached(other, cachePtr));
+	for (int i = 0; i < NUMBER_OF_ENTRIES; i++)
+		CHECK(IsCached(entries[i], cachePtr) == (i != victim));
+	FreeCache(cachePtr);
+}
+
+//------------------------------------------------------------------------------
+
+//Entries 1024 bytes apart all share a set with modulo_IF, the hashed index functions spread them over the sets
+void TestIndexFunction(enum IndexFunction_t indexFunction)
+{
+	cl_int err;
+	CacheStats_t stats;
+	char* data = (char*)aligned_alloc(4096, 16 * 1024);
+	struct Cache_t* cachePtr = CreateCache(context, queue, 64, ENTRY_SIZE, 32, four_way, lru_RP, &err);
+
+	CHECK((data != NULL) && (cachePtr != NULL));
+	SetIndexFunction(cachePtr, indexFunction);
+	for (int pass = 0; pass < 2; pass++) {
+		for (int i = 0; i < 16; i++)
+			CHECK(clCreateCacheBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, ENTRY_SIZE, data + i * 1024, &err, cachePtr) != NULL);
+	}
+	GetCacheStats(cachePtr, &stats);
+	FreeCacheStats(&stats);
+
+	//The second pass hits every entry that was not evicted, 28 misses evict a line of the one set of modulo_IF
+	if (indexFunction == modulo_IF)
+		CHECK((stats.hits == 0) && (stats.conflictMisses == 28));
+	else
+		CHECK((stats.hits == 16) && (stats.conflictMisses == 0));
+	FreeCache(cachePtr);
+	free(data);
+}
+
+//------------------------------------------------------------------------------
+
+//A range write or read of a line moves only the bytes of the range to the same offset, other ranges are rejected
+void TestRanges(void)
+{
+	cl_int err;
+	char host[4 * ENTRY_SIZE];
+	char produced[4 * ENTRY_SIZE];
+	char data[4 * ENTRY_SIZE];
+	struct Cache_t* cachePtr = CreateCache(context, queue, 4, 4 * ENTRY_SIZE, 32, fully_associative, lru_RP, &err);
+
+	CHECK(cachePtr != NULL);
+	FillPattern(host, sizeof(host), 1);
+	cl_mem buffer = clCreateCacheBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, 4 * ENTRY_SIZE, host, &err, cachePtr);
+	CHECK(buffer != NULL);
+	FillPattern(host + ENTRY_SIZE, ENTRY_SIZE, 2);
+	CHECK(clEnqueueWriteCacheBufferRange(queue, CL_TRUE, ENTRY_SIZE, ENTRY_SIZE, host, 0, NULL, NULL, cachePtr) == 0);
+	CHECK(GetBytesToDevice(cachePtr) == 5 * ENTRY_SIZE);
+	CHECK((clEnqueueReadBuffer(queue, buffer, CL_TRUE, 0, 4 * ENTRY_SIZE, data, 0, NULL, NULL) == CL_SUCCESS) && (memcmp(data, host, 4 * ENTRY_SIZE) == 0));
+
+	//The read of a range leaves the rest of the host memory alone
+	FillPattern(produced, sizeof(produced), 3);
+	CHECK(clEnqueueWriteBuffer(queue, buffer, CL_TRUE, 0, 4 * ENTRY_SIZE, produced, 0, NULL, NULL) == CL_SUCCESS);
+	memcpy(data, host, sizeof(host));
+	CHECK(clEnqueueReadCacheBufferRange(queue, CL_TRUE, 2 * ENTRY_SIZE, ENTRY_SIZE / 2, host, 0, NULL, NULL, cachePtr) == 0);
+	CHECK(GetBytesToHost(cachePtr) == ENTRY_SIZE / 2);
+	CHECK(memcmp(host + 2 * ENTRY_SIZE, produced + 2 * ENTRY_SIZE, ENTRY_SIZE / 2) == 0);
+	CHECK((memcmp(host, data, 2 * ENTRY_SIZE) == 0) && (memcmp(host + 5 * ENTRY_SIZE / 2, data + 5 * ENTRY_SIZE / 2, 3 * ENTRY_SIZE / 2) == 0));
+
+	//Ranges past the bytes of the line and addresses without a line
+	CHECK(clEnqueueReadCacheBufferRange(queue, CL_TRUE, 3 * ENTRY_SIZE, ENTRY_SIZE + 1, host, 0, NULL, NULL, cachePtr) == 1);
+	CHECK(clEnqueueWriteCacheBufferRange(queue, CL_TRUE, 3 * ENTRY_SIZE, ENTRY_SIZE + 1, host, 0, NULL, NULL, cachePtr) == 1);
+	CHECK(clEnqueueWriteCacheBufferRange(queue, CL_TRUE, 0, ENTRY_SIZE, produced, 0, NULL, NULL, cachePtr) == 1);
+	CHECK(clEnqueueReadCacheBufferRange(queue, CL_TRUE, 0, ENTRY_SIZE, produced, 0, NULL, NULL, cachePtr) == 1);
+	CHECK((GetBytesToDevice(cachePtr) == 5 * ENTRY_SIZE) && (GetBytesToHost(cachePtr) == ENTRY_SIZE / 2));
+	FreeCache(cachePtr);
+}
+
+//------------------------------------------------------------------------------
+
+//An entry takes a line of the smallest size class that fits, so large entries do not evict small ones
+void TestSizeClasses(void)
+{
+	cl_int err;
+	int numberOfCacheLines[2] = {2, 1};
+	int dataSizes[2] = {ENTRY_SIZE, 4 * ENTRY_SIZE};
+	struct Cache_t* cachePtr = CreateSizeClassCache(context, queue, 2, numberOfCacheLines, dataSizes, 32, fully_associative, lru_RP, &err);
+
+	CHECK(cachePtr != NULL);
+	CHECK(!Request(0, cachePtr) && !Request(1, cachePtr));
+	CHECK(clCreateCacheBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, 4 * ENTRY_SIZE, entries[4], &err, cachePtr) != NULL);
+	CHECK(clCreateCacheBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, 4 * ENTRY_SIZE, entries[8], &err, cachePtr) != NULL);
+	CHECK(!IsCached(entries[4], cachePtr) && IsCached(entries[8], cachePtr));
+	CHECK(Request(0, cachePtr) && Request(1, cachePtr));
+
+	//A larger request moves the entry to the size class that fits
+	cl_mem buffer = clCreateCacheBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, 2 * ENTRY_SIZE, entries[0], &err, cachePtr);
+	CHECK((buffer != NULL) && !IsCached(entries[8], cachePtr));
+	CHECK(clEnqueueReadCacheBuffer(queue, CL_TRUE, 0, 2 * ENTRY_SIZE, entries[0], 0, NULL, NULL, cachePtr) == 0);
+	CHECK((clCreateCacheBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, 4 * ENTRY_SIZE + 1, entries[0], &err, cachePtr) == NULL) && (err == CL_INVALID_BUFFER_SIZE));
+	FreeCache(cachePtr);
+}
+
+//------------------------------------------------------------------------------
+
+//A miss, a hit and a fill after the write back of an output all return an event after which the line holds the data
+void TestEnqueueEvents(void)
+{
+	cl_int err;
+	cl_event events[3] = {NULL, NULL, NULL};
+	cl_event waitEvent = NULL;
+	char host[2][ENTRY_SIZE];
+	char data[ENTRY_SIZE];
+	struct Cache_t* cachePtr = CreateCache(context, queue, 1, ENTRY_SIZE, 32, direct_mapped, lru_RP, &err);
+
+	CHECK(cachePtr != NULL);
+	SetWritePolicy(cachePtr, write_back_WP);
+	FillPattern(host[0], ENTRY_SIZE, 1);
+	FillPattern(host[1], ENTRY_SIZE, 2);
+	CHECK(clEnqueueMarkerWithWaitList(queue, 0, NULL, &waitEvent) == CL_SUCCESS);
+	cl_mem buffer = clEnqueueCacheBuffer(queue, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, ENTRY_SIZE, host[0], 1, &waitEvent, &events[0], &err, cachePtr);
+	CHECK((buffer != NULL) && (events[0] != NULL) && (clWaitForEvents(1, &events[0]) == CL_SUCCESS));
+	CHECK((clEnqueueReadBuffer(queue, buffer, CL_TRUE, 0, ENTRY_SIZE, data, 0, NULL, NULL) == CL_SUCCESS) && (memcmp(data, host[0], ENTRY_SIZE) == 0));
+	CHECK((clEnqueueCacheBuffer(queue, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, ENTRY_SIZE, host[0], 0, NULL, &events[1], &err, cachePtr) == buffer) && (events[1] != NULL));
+	CHECK(GetHits(cachePtr) == 1);
+
+	//The fill of the other data waits for the write back of the output
+	CHECK(clEnqueueCacheBuffer(queue, CL_MEM_READ_WRITE, ENTRY_SIZE, host[0], 0, NULL, NULL, &err, cachePtr) == buffer);
+	FillPattern(data, ENTRY_SIZE, 3);
+	CHECK(clEnqueueWriteBuffer(queue, buffer, CL_TRUE, 0, ENTRY_SIZE, data, 0, NULL, NULL) == CL_SUCCESS);
+	buffer = clEnqueueCacheBuffer(queue, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, ENTRY_SIZE, host[1], 0, NULL, &events[2], &err, cachePtr);
+	CHECK((buffer != NULL) && (events[2] != NULL) && (clWaitForEvents(1, &events[2]) == CL_SUCCESS));
+	CHECK((clEnqueueReadBuffer(queue, buffer, CL_TRUE, 0, ENTRY_SIZE, data, 0, NULL, NULL) == CL_SUCCESS) && (memcmp(data, host[1], ENTRY_SIZE) == 0));
+	CHECK(cachePtr->DirtyWriteBacks == 1);
+	FillPattern(data, ENTRY_SIZE, 3);
+	CHECK(memcmp(host[0], data, ENTRY_SIZE) == 0);
+	for (int i = 0; i < 3; i++) {
+		if (events[i] != NULL)
+			clReleaseEvent(events[i]);
+	}
+	clReleaseEvent(waitEvent);
+	FreeCache(cachePtr);
+}
+
+//------------------------------------------------------------------------------
+
+//Data a kernel wrote reaches the host on eviction and on a flush only with write_back_WP, a clean line is not written again
+void TestWriteBack(enum WritePolicy_t writePolicy)
+{
+	cl_int err;
+	char host[5][ENTRY_SIZE];
+	char original[ENTRY_SIZE];
+	char produced[2][ENTRY_SIZE];
+	bool writeBack = (writePolicy == write_back_WP);
+	struct Cache_t* cachePtr = CreateCache(context, queue, 4, ENTRY_SIZE, 32, fully_associative, lru_RP, &err);
+
+	CHECK(cachePtr != NULL);
+	SetWritePolicy(cachePtr, writePolicy);
+	for (int i = 0; i < 5; i++)
+		FillPattern(host[i], ENTRY_SIZE, i);
+	memcpy(original, host[0], ENTRY_SIZE);
+	FillPattern(produced[0], ENTRY_SIZE, 10);
+	FillPattern(produced[1], ENTRY_SIZE, 11);
+
+	//The write of the kernel into its output
+	cl_mem output = clCreateCacheBuffer(context, CL_MEM_READ_WRITE, ENTRY_SIZE, host[0], &err, cachePtr);
+	CHECK((output != NULL) && (clEnqueueWriteBuffer(queue, output, CL_TRUE, 0, ENTRY_SIZE, produced[0], 0, NULL, NULL) == CL_SUCCESS));
+	for (int i = 1; i < 5; i++)
+		CHECK(clCreateCacheBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, ENTRY_SIZE, host[i], &err, cachePtr) != NULL);
+	CHECK(memcmp(host[0], writeBack ? produced[0] : original, ENTRY_SIZE) == 0);
+	CHECK(cachePtr->DirtyWriteBacks == (writeBack ? 1 : 0));
+
+	output = clCreateCacheBuffer(context, CL_MEM_READ_WRITE, ENTRY_SIZE, host[1], &err, cachePtr);
+	CHECK((output != NULL) && (clEnqueueWriteBuffer(queue, output, CL_TRUE, 0, ENTRY_SIZE, produced[1], 0, NULL, NULL) == CL_SUCCESS));
+	CHECK(clFlushCache(queue, cachePtr) == 0);
+	CHECK((memcmp(host[1], produced[1], ENTRY_SIZE) == 0) == writeBack);
+	uint64_t bytesToHost = GetBytesToHost(cachePtr);
+	CHECK(clFlushCache(queue, cachePtr) == 0);
+	CHECK(GetBytesToHost(cachePtr) == bytesToHost);
+	FreeCache(cachePtr);
+}
+
+//------------------------------------------------------------------------------
+
+//Dense data is uploaded raw and its reads skip the marks of the zero blocks, sparse data is packed again
+void TestCompressionEstimate(void)
+{
+	cl_int err;
+	const int size = 65536;
+	char* data = (char*)calloc(2, size);
+	struct Cache_t* cachePtr = CreateCache(context, queue, 2, size, 32, fully_associative, lru_RP, &err);
+
+	CHECK((cachePtr != NULL) && (SetCompression(cachePtr, true) == 0));
+	memset(data, 1, size);
+	CHECK(clCreateCacheBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, size, data, &err, cachePtr) != NULL);
+	CHECK((cachePtr->zeroBlockShare == 0) && (cachePtr->CompressedTransfers == 0));
+	for (int i = 1; i < 16; i++)
+		CHECK(clEnqueueReadCacheBuffer(queue, CL_TRUE, 0, size, data, 0, NULL, NULL, cachePtr) == 0);
+	CHECK((cachePtr->compressionSkips == 15) && (cachePtr->CompressedTransfers == 0) && (GetBytesToHost(cachePtr) == 15 * (uint64_t)size));
+
+	CHECK(clCreateCacheBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, size, data + size, &err, cachePtr) != NULL);
+	CHECK((cachePtr->zeroBlockShare == 100) && (cachePtr->CompressedTransfers == 1));
+	FreeCache(cachePtr);
+	free(data);
+}
+
+//------------------------------------------------------------------------------
+
+//Upload size bytes at data, read them back and change and read a range at odd offsets, data ends as it started
+void CheckRoundTrip(char* data, size_t size, struct Cache_t* cachePtr)
+{
+	cl_int err;
+	char* expected = (char*)malloc(size);
+
+	memcpy(expected, data, size);
+	CHECK(clCreateCacheBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, size, data, &err, cachePtr) != NULL);
+	memset(data, 0, size);
+	CHECK(clEnqueueReadCacheBuffer(queue, CL_TRUE, 0, size, data, 0, NULL, NULL, cachePtr) == 0);
+	CHECK(memcmp(data, expected, size) == 0);
+
+	FillPattern(data + size / 4 + 1, size / 2, 7);
+	memcpy(expected + size / 4 + 1, data + size / 4 + 1, size / 2);
+	CHECK(clEnqueueWriteCacheBufferRange(queue, CL_TRUE, size / 4 + 1, size / 2, data, 0, NULL, NULL, cachePtr) == 0);
+	memset(data, 0, size);
+	CHECK(clEnqueueReadCacheBufferRange(queue, CL_TRUE, 3, size - 3, data, 0, NULL, NULL, cachePtr) == 0);
+	CHECK((data[0] == 0) && (memcmp(data + 3, expected + 3, size - 3) == 0));
+	memcpy(data, expected, size);
+	free(expected);
+}
+
+//------------------------------------------------------------------------------
+
+//The staging ring moves the data in chunks, the line is no multiple of the staging buffers
+void TestStagedRoundTrip(void)
+{
+	cl_int err;
+	const size_t size = 5 * 4096 + 100;
+	char* data = (char*)malloc(size);
+	struct Cache_t* cachePtr = CreateCache(context, queue, 4, (int)size, 32, four_way, lru_RP, &err);
+
+	CHECK((cachePtr != NULL) && (SetStagingBuffers(cachePtr, 2, 4096 + 36) == 0));
+	FillPattern(data, size, 1);
+	CheckRoundTrip(data, size, cachePtr);
+	FreeCache(cachePtr);
+	free(data);
+}
+
+//------------------------------------------------------------------------------
+
+//Large transfers are split in chunks over the transfer queues, also through the staging ring
+void TestSplitRoundTrip(bool staged)
+{
+	cl_int err;
+	const size_t size = 5 * 4096 + 100;
+	char* data = (char*)malloc(size);
+	cl_command_queue transferQueues[2] = {clCreateCommandQueue(context, NULL, 0, &err), clCreateCommandQueue(context, NULL, 0, &err)};
+	struct Cache_t* cachePtr = CreateCache(context, queue, 4, (int)size, 32, four_way, lru_RP, &err);
+
+	CHECK(cachePtr != NULL);
+	if (staged)
+		CHECK(SetStagingBuffers(cachePtr, 2, 4096 + 36) == 0);
+	//The line is no multiple of the chunks, the last chunk is shorter
+	SetTransferQueues(cachePtr, 2, transferQueues, 3000);
+	FillPattern(data, size, 2);
+	CheckRoundTrip(data, size, cachePtr);
+	FreeCache(cachePtr);
+	clReleaseCommandQueue(transferQueues[0]);
+	clReleaseCommandQueue(transferQueues[1]);
+	free(data);
+}
+
+//------------------------------------------------------------------------------
+
+//Sparse data makes a compressed round trip that ends in a partial block, dense data falls back to raw transfers
+void TestCompressionRoundTrip(void)
+{
+	cl_int err;
+	const size_t size = 65536 + 100 * 4;
+	char* data = (char*)calloc(2, size);
+	struct Cache_t* cachePtr = CreateCache(context, queue, 4, (int)size, 32, four_way, lru_RP, &err);
+
+	CHECK((cachePtr != NULL) && (SetCompression(cachePtr, true) == 0));
+	FillPattern(data + 1000, 300, 3);
+	FillPattern(data + size - 8, 8, 4);
+	CheckRoundTrip(data, size, cachePtr);
+	//The fill and the read of the whole line were compressed
+	CHECK((cachePtr->CompressedTransfers == 2) && (cachePtr->SavedBytes > 0));
+
+	FillPattern(data + size, size, 5);
+	CheckRoundTrip(data + size, size, cachePtr);
+	CHECK(cachePtr->CompressedTransfers == 2);
+	FreeCache(cachePtr);
+	free(data);
+}
+
+//------------------------------------------------------------------------------
+
+//A new cache warmed from a snapshot holds the data of the nodes at their new addresses, a node without an address is skipped
+void TestSnapshotRoundTrip(void)
+{
+	cl_int err;
+	const int numberOfNodes = 6;
+	const char* fileName = "cache_test.snapshot";
+	char firstRun[6][100];
+	char secondRun[6][100];
+	char expected[6][100];
+	void* nodeAddresses[6];
+	struct Cache_t* cachePtr = CreateCache(context, queue, 16, 100, 32, four_way, lru_RP, &err);
+
+	CHECK(cachePtr != NULL);
+	for (int i = 0; i < numberOfNodes; i++) {
+		//The nodes have sizes that are no multiple of the sub-buffer alignment
+		FillPattern(firstRun[i], 40 + i, i);
+		CHECK(clCreateCacheBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, 40 + i, firstRun[i], &err, cachePtr) != NULL);
+		CHECK(SetNodeId(cachePtr, firstRun[i], i) == 0);
+	}
+	CHECK(SaveCacheSnapshot(cachePtr, fileName) == 0);
+	FreeCache(cachePtr);
+
+	//The next run has the same data at other addresses
+	memcpy(secondRun, firstRun, sizeof(secondRun));
+	memcpy(expected, firstRun, sizeof(expected));
+	for (int i = 0; i < numberOfNodes; i++)
+		nodeAddresses[i] = secondRun[i];
+	nodeAddresses[3] = NULL;
+	cachePtr = CreateCache(context, queue, 16, 100, 32, four_way, lru_RP, &err);
+	CHECK((cachePtr != NULL) && (WarmCache(queue, fileName, nodeAddresses, numberOfNodes, cachePtr) == 0));
+	CHECK(cachePtr->Prefetches == numberOfNodes - 1);
+	memset(secondRun, 0, sizeof(secondRun));
+	for (int i = 0; i < numberOfNodes; i++) {
+		bool isCached = (clEnqueueReadCacheBuffer(queue, CL_TRUE, 0, 40 + i, secondRun[i], 0, NULL, NULL, cachePtr) == 0);
+		CHECK(isCached == (i != 3));
+		if (isCached)
+			CHECK(memcmp(secondRun[i], expected[i], 40 + i) == 0);
+	}
+	FreeCache(cachePtr);
+	remove(fileName);
+}
+
+//------------------------------------------------------------------------------
+
+//A device copies data produced by an other device, a checked request must not replace the copy with the host data
+void TestContentCheckPeerCopy(enum ContentCheck_t contentCheck)
+{
+	cl_int err;
+	cl_command_queue queues[2] = {queue, clCreateCommandQueue(context, NULL, 0, &err)};
+	struct Cache_t* cachePtr = CreateMultiDeviceCache(context, 2, queues, 8, ENTRY_SIZE, 32, four_way, lru_RP, &err);
+
+	CHECK(cachePtr != NULL);
+	SetWritePolicy(cachePtr, write_back_WP);
+	SetContentCheck(cachePtr, contentCheck);
+	RequestOn(queues[0], CL_MEM_READ_WRITE, 0, cachePtr);
+	RequestOn(queues[1], CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, 0, cachePtr);
+	uint64_t bytesToDevice = GetBytesToDevice(cachePtr);
+	uint64_t hits = GetHits(cachePtr);
+	RequestOn(queues[1], CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, 0, cachePtr);
+	CHECK(GetHits(cachePtr) == hits + 1);
+	CHECK(GetBytesToDevice(cachePtr) == bytesToDevice);
+
+	//A copy of host data keeps the fingerprint of the peer, so unchanged data is not uploaded again
+	RequestOn(queues[0], CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, 1, cachePtr);
+	RequestOn(queues[1], CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, 1, cachePtr);
+	bytesToDevice = GetBytesToDevice(cachePtr);
+	RequestOn(queues[1], CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, 1, cachePtr);
+	CHECK(GetBytesToDevice(cachePtr) == bytesToDevice);
+
+	//Changed host data is still uploaded
+	entries[1][0]++;
+	RequestOn(queues[1], CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, 1, cachePtr);
+	CHECK(GetBytesToDevice(cachePtr) == bytesToDevice + ENTRY_SIZE);
+	entries[1][0]--;
+	clFlushCache(queue, cachePtr);
+	FreeCache(cachePtr);
+	clReleaseCommandQueue(queues[1]);
+}
+
+//------------------------------------------------------------------------------
+
+void* RequestRandomEntries(void* cachePtr)
+{
+	uint32_t state = (uint32_t)(uintptr_t)&state | 1;
+	cl_int err;
+
+	//Most requests go to the first 16 entries, so there are lockless hits, misses and evictions at the same time
+	for (int i = 0; i < REQUESTS_PER_THREAD; i++) {
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+		int entry = ((state & 3) != 0) ? (int)((state >> 2) % 16) : (int)((state >> 2) % NUMBER_OF_ENTRIES);
+		if (clCreateCacheBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, ENTRY_SIZE, entries[entry], &err, (struct Cache_t*)cachePtr) == NULL)
+			return cachePtr;
+	}
+	return NULL;
+}
+
+//------------------------------------------------------------------------------
+
+//Threads share a thread safe cache, every request is counted once as a hit or a miss
+void TestThreadSafe(enum CacheConfiguration_t config, enum ReplacementPolicy_t policy)
+{
+	pthread_t threads[NUMBER_OF_THREADS];
+	CacheStats_t stats;
+	cl_int err;
+	struct Cache_t* cachePtr = CreateCache(context, queue, 32, ENTRY_SIZE, 32, config, policy, &err);
+
+	CHECK(cachePtr != NULL);
+	SetThreadSafe(cachePtr, 4);
+	for (int i = 0; i < NUMBER_OF_THREADS; i++)
+		pthread_create(&threads[i], NULL, RequestRandomEntries, cachePtr);
+	for (int i = 0; i < NUMBER_OF_THREADS; i++) {
+		void* failed;
+		pthread_join(threads[i], &failed);
+		CHECK(failed == NULL);
+	}
+	GetCacheStats(cachePtr, &stats);
+	CHECK(stats.hits + stats.misses == NUMBER_OF_THREADS * REQUESTS_PER_THREAD);
+	CHECK(stats.hits > 0);
+	FreeCacheStats(&stats);
+	FreeCache(cachePtr);
+}
+
+//------------------------------------------------------------------------------
+
+//The misses of a batch are uploaded together, the batch is seen by the prefetcher
+void TestCreateCacheBuffers(void)
+{
+	cl_mem_flags flags[3] = {CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, CL_MEM_WRITE_ONLY};
+	size_t sizes[3] = {ENTRY_SIZE, ENTRY_SIZE, ENTRY_SIZE};
+	void* hostAddresses[3] = {entries[0], entries[1], entries[2]};
+	cl_mem deviceData[3];
+	cl_int err;
+	struct Cache_t* cachePtr = CreateCache(context, queue, 16, ENTRY_SIZE, 32, four_way, lru_RP, &err);
+
+	CHECK(cachePtr != NULL);
+	SetPrefetcher(cachePtr, stride_PF, 1, entries[0], entries[NUMBER_OF_ENTRIES]);
+	CHECK(clCreateCacheBuffers(context, queue, 3, flags, sizes, hostAddresses, deviceData, &err, cachePtr) == 0);
+	CHECK((deviceData[0] != NULL) && (deviceData[1] != NULL) && (deviceData[2] != NULL));
+	//The two inputs are packed back to back in one upload of no more bytes than their own uploads, the prefetch adds a line
+	CHECK((GetBytesToDevice(cachePtr) == 3 * ENTRY_SIZE) && (cachePtr->WriteTransfers == 2));
+	CHECK(Request(0, cachePtr));
+	CHECK(Request(1, cachePtr));
+	//The stride of the three buffers prefetched the next one
+	CHECK(Request(3, cachePtr));
+
+	//The next batch reuses the packed data of the cache
+	int writeTransfers = cachePtr->WriteTransfers;
+	hostAddresses[0] = entries[8];
+	hostAddresses[1] = entries[9];
+	CHECK(clCreateCacheBuffers(context, queue, 2, flags, sizes, hostAddresses, deviceData, &err, cachePtr) == 0);
+	CHECK((cachePtr->WriteTransfers == writeTransfers + 1) && IsCached(entries[8], cachePtr) && IsCached(entries[9], cachePtr));
+	FreeCache(cachePtr);
+}
+
+//------------------------------------------------------------------------------
+
+//A failed batch releases the bypass buffers of the buffers it already resolved
+void TestCreateCacheBuffersFailure(void)
+{
+	cl_mem_flags flags[2] = {CL_MEM_READ_WRITE | CL_MEM_CACHE_BYPASS, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR};
+	size_t sizes[2] = {ENTRY_SIZE, 2 * ENTRY_SIZE};
+	void* hostAddresses[2] = {entries[0], entries[1]};
+	cl_mem deviceData[2];
+	cl_int err;
+	struct Cache_t* cachePtr = CreateCache(context, queue, 16, ENTRY_SIZE, 32, four_way, lru_RP, &err);
+
+	CHECK(cachePtr != NULL);
+	CHECK(clCreateCacheBuffers(context, queue, 2, flags, sizes, hostAddresses, deviceData, &err, cachePtr) == 1);
+	CHECK(err == CL_INVALID_BUFFER_SIZE);
+	CHECK((deviceData[0] == NULL) && (deviceData[1] == NULL));
+	CHECK(clEnqueueReadCacheBuffer(queue, CL_TRUE, 0, ENTRY_SIZE, entries[0], 0, NULL, NULL, cachePtr) != 0);
+	FreeCache(cachePtr);
+}
+
+//------------------------------------------------------------------------------
+
+//A keyed line hits on its key in any host memory and writes back to the host memory of the last request
+void TestKeyed(void)
+{
+	cl_int err;
+	char host[4][ENTRY_SIZE];
+	char produced[ENTRY_SIZE];
+	cl_mem_flags input = CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR;
+	struct Cache_t* plainCache = CreateCache(context, queue, 4, ENTRY_SIZE, 32, fully_associative, lru_RP, &err);
+	struct Cache_t* cachePtr = CreateCache(context, queue, 4, ENTRY_SIZE, 32, fully_associative, lru_RP, &err);
+
+	CHECK((plainCache != NULL) && (cachePtr != NULL));
+	CHECK((clCreateCacheBufferKeyed(context, input, 7, entries[0], ENTRY_SIZE, &err, plainCache) == NULL) && (err == CL_INVALID_OPERATION));
+	SetKeyHash(cachePtr, NULL);
+	SetWritePolicy(cachePtr, write_back_WP);
+	for (int i = 0; i < 4; i++)
+		FillPattern(host[i], ENTRY_SIZE, i);
+	FillPattern(produced, ENTRY_SIZE, 4);
+	cl_mem buffer = clCreateCacheBufferKeyed(context, input, 7, host[0], ENTRY_SIZE, &err, cachePtr);
+	CHECK((buffer != NULL) && (clCreateCacheBufferKeyed(context, input, 7, host[1], ENTRY_SIZE, &err, cachePtr) == buffer));
+	CHECK((clCreateCacheBufferKeyed(context, input, 8, host[0], ENTRY_SIZE, &err, cachePtr) != buffer) && (GetHits(cachePtr) == 1));
+	CHECK((clCreateCacheBufferKeyed(context, input, UINTPTR_MAX, host[0], ENTRY_SIZE, &err, cachePtr) == NULL) && (err == CL_INVALID_VALUE));
+	CHECK((clEnqueueReadCacheBufferKeyed(queue, CL_TRUE, 0, ENTRY_SIZE, 7, 0, NULL, NULL, cachePtr) == 0) && (memcmp(host[1], host[0], ENTRY_SIZE) == 0));
+	CHECK(clEnqueueReadCacheBufferKeyed(queue, CL_TRUE, 0, ENTRY_SIZE, 10, 0, NULL, NULL, cachePtr) == 1);
+
+	//The output of key 9 is written back to the host memory it was last requested with
+	FillPattern(host[1], ENTRY_SIZE, 1);
+	cl_mem output = clCreateCacheBufferKeyed(context, CL_MEM_WRITE_ONLY, 9, host[2], ENTRY_SIZE, &err, cachePtr);
+	CHECK((output != NULL) && (clEnqueueWriteBuffer(queue, output, CL_TRUE, 0, ENTRY_SIZE, produced, 0, NULL, NULL) == CL_SUCCESS));
+	CHECK(clCreateCacheBufferKeyed(context, CL_MEM_READ_WRITE, 9, host[3], ENTRY_SIZE, &err, cachePtr) == output);
+	CHECK(clFlushCache(queue, cachePtr) == 0);
+	CHECK((memcmp(host[3], produced, ENTRY_SIZE) == 0) && (memcmp(host[2], produced, ENTRY_SIZE) != 0));
+	FreeCache(cachePtr);
+	FreeCache(plainCache);
+}
+
+//------------------------------------------------------------------------------
+
+//A multi device cache has no queue of its own, a keyed request on it needs the queue of a device
+void TestKeyedMultiDevice(void)
+{
+	cl_int err;
+	cl_command_queue queues[2] = {queue, clCreateCommandQueue(context, NULL, 0, &err)};
+	struct Cache_t* cachePtr = CreateMultiDeviceCache(context, 2, queues, 8, ENTRY_SIZE, 32, four_way, lru_RP, &err);
+
+	CHECK(cachePtr != NULL);
+	SetKeyHash(cachePtr, NULL);
+	cl_mem buffer = clCreateCacheBufferKeyed(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, 1, entries[1], ENTRY_SIZE, &err, cachePtr);
+	CHECK((buffer == NULL) && (err == CL_INVALID_COMMAND_QUEUE));
+	buffer = clEnqueueCacheBufferKeyed(queues[1], CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, 1, entries[1], ENTRY_SIZE, 0, NULL, NULL, &err, cachePtr);
+	CHECK((buffer != NULL) && (err == CL_SUCCESS));
+	FreeCache(cachePtr);
+	clReleaseCommandQueue(queues[1]);
+}
+
+//------------------------------------------------------------------------------
+
+int main(void)
+{
+	cl_int err;
+
+	context = clCreateContext(NULL, 0, NULL, NULL, NULL, &err);
+	queue = clCreateCommandQueue(context, NULL, 0, &err);
+	for (int i = 0; i < NUMBER_OF_ENTRIES; i++)
+		memset(entries[i], i, ENTRY_SIZE);
+
+	TestFrequencyBucketsFull(lfu_RP);
+	TestLineBuffers();
+	TestStats();
+	TestDecay(0);
+	TestDecay(8);
+	TestFrequencyBucketsFull(mfu_RP);
+	TestProbesKeepState(four_way, lru_RP);
+	TestProbesKeepState(four_way, lfu_RP);
+	TestProbesKeepState(fully_associative, lru_RP);
+	TestProbesKeepState(fully_associative, lfu_RP);
+	TestHashedIndexAtCapacity(random_RP);
+	TestHashedIndexAtCapacity(fifo_RP);
+	TestHashedIndexAtCapacity(lru_RP);
+	TestHashedIndexAtCapacity(mru_RP);
+	TestHashedIndexAtCapacity(lfu_RP);
+	TestHashedIndexAtCapacity(mfu_RP);
+	TestHashedIndexLarge();
+	TestScanResistance(four_way, clock_RP);
+	TestScanResistance(four_way, slru_RP);
+	TestScanResistance(four_way, two_queue_RP);
+	TestScanResistance(four_way, arc_RP);
+	TestScanResistance(fully_associative, clock_RP);
+	TestScanResistance(fully_associative, slru_RP);
+	TestScanResistance(fully_associative, two_queue_RP);
+	TestScanResistance(fully_associative, arc_RP);
+	TestVariableSize();
+	TestSizeClasses();
+	TestRanges();
+	TestPolicyDuel();
+	TestTrace();
+	TestProfiling();
+	TestZeroCopy(host_ptr_MB);
+	TestZeroCopy(svm_MB);
+	TestZeroCopy(auto_MB);
+	TestPins();
+	TestPrefetch();
+	TestStridePrefetch();
+	TestSequencePrefetch();
+	TestBypass();
+	TestSeenTwice();
+	TestAssociativity();
+	TestWideSets(8);
+	TestWideSets(16);
+	TestWideSets(32);
+	TestWideSets(NUMBER_OF_ENTRIES);
+	TestIndexFunction(modulo_IF);
+	TestIndexFunction(xor_fold_IF);
+	TestIndexFunction(fibonacci_IF);
+	TestEnqueueEvents();
+	TestWriteBack(no_write_back_WP);
+	TestWriteBack(write_back_WP);
+	TestOutputBuffers(no_write_back_WP);
+	TestOutputBuffers(write_back_WP);
+	TestCompressionEstimate();
+	TestStagedRoundTrip();
+	TestSplitRoundTrip(false);
+	TestSplitRoundTrip(true);
+	TestCompressionRoundTrip();
+	TestSnapshotRoundTrip();
+	TestMultiDevice();
+	TestContentCheck(unchanged_CC);
+	TestContentCheck(dedup_CC);
+	TestContentCheckPeerCopy(unchanged_CC);
+	TestContentCheckPeerCopy(dedup_CC);
+	TestCreateCacheBuffers();
+	TestCreateCacheBuffersFailure();
+	TestKeyed();
+	TestKeyedMultiDevice();
+	TestThreadSafe(four_way, lru_RP);
+	TestThreadSafe(four_way, clock_RP);
+	TestThreadSafe(direct_mapped, fifo_RP);
+	TestThreadSafe(fully_associative, clock_RP);
+
+	clReleaseCommandQueue(queue);
+	clReleaseContext(context);
+	if (numberOfFailures > 0) {
+		printf("%d checks failed\n", numberOfFailures);
+		return EXIT_FAILURE;
+	}
+	printf("All tests passed\n");
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,322 @@
+//------------------------------------------------------------------------------
+//
+// Name:       host_only_cl.c
+//
+// Purpose:    A host only OpenCL runtime for the cache simulator. It implements
+//             the OpenCL functions used by cache.c without a device: buffers
+//             hold no data, transfers and kernels do nothing and every event
+//             is complete when it is returned. Linked instead of -lOpenCL.
+//             Built with HOST_ONLY_DATA the buffers hold their data in host
+//             memory, transfers and copies move it and the kernels of the
+//             zero block codec of cache.c run on the host, so the tests can
+//             check the data of a round trip. The simulator replays traces of
+//             host addresses of an other process and leaves it off.
+//             A queue created with CL_QUEUE_PROFILING_ENABLE times its commands
+//             on a clock of its own that counts one nanosecond per byte or
+//             work item, so the profile of a cache is the same on every run.
+//
+//------------------------------------------------------------------------------
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#ifdef __APPLE__
+#include <OpenCL/opencl.h>
+#else
+#include <CL/cl.h>
+#endif
+
+//The objects only count their references, the atomics let the simulator run caches in parallel
+struct _cl_context { int references; };
+//A profiling queue starts every command when the one before it ended
+struct _cl_command_queue { int references; cl_context context; cl_command_queue_properties properties; cl_ulong clock; };
+//The data of a sub-buffer lies in its parent, a buffer made with CL_MEM_USE_HOST_PTR uses the host memory
+struct _cl_mem { int references; void* hostPtr; void* mapped; char* data; bool ownsData; cl_mem parent; };
+struct _cl_event { int references; bool profiled; cl_ulong queued; cl_ulong end; };
+struct _cl_program { int references; int blockWords; };
+//A kernel keeps the arguments of the codec kernels, buffers and 32 bit words
+union KernelArg { cl_mem buffer; cl_uint word; };
+struct _cl_kernel { int references; char* name; int blockWords; union KernelArg args[5]; };
+
+static struct _cl_context* NewObject(size_t size) {
+	struct _cl_context* object = (struct _cl_context*)calloc(1, size);
+	object->references = 1;
+	return object;
+}
+
+static void Retain(int* references) {
+	__atomic_add_fetch(references, 1, __ATOMIC_RELAXED);
+}
+
+static int Release(int* references) {
+	return __atomic_sub_fetch(references, 1, __ATOMIC_ACQ_REL) == 0;
+}
+
+static cl_int CompleteEvent(cl_command_queue command_queue, size_t duration, cl_event* event) {
+	bool profiled = (command_queue != NULL) && ((command_queue->properties & CL_QUEUE_PROFILING_ENABLE) == CL_QUEUE_PROFILING_ENABLE);
+	cl_ulong queued = profiled ? __atomic_fetch_add(&command_queue->clock, (cl_ulong)duration, __ATOMIC_RELAXED) : 0;
+
+	if (event != NULL) {
+		*event = (cl_event)NewObject(sizeof(struct _cl_event));
+		(*event)->profiled = profiled;
+		(*event)->queued = queued;
+		(*event)->end = queued + (cl_ulong)duration;
+	}
+	return CL_SUCCESS;
+}
+
+cl_context clCreateContext(const cl_context_properties* properties, cl_uint num_devices, const cl_device_id* devices, void (CL_CALLBACK* pfn_notify)(const char*, const void*, size_t, void*), void* user_data, cl_int* errcode_ret) {
+	if (errcode_ret != NULL)
+		*errcode_ret = CL_SUCCESS;
+	return (cl_context)NewObject(sizeof(struct _cl_context));
+}
+
+cl_int clRetainContext(cl_context context) {
+	Retain(&context->references);
+	return CL_SUCCESS;
+}
+
+cl_int clReleaseContext(cl_context context) {
+	if (Release(&context->references))
+		free(context);
+	return CL_SUCCESS;
+}
+
+cl_command_queue clCreateCommandQueue(cl_context context, cl_device_id device, cl_command_queue_properties properties, cl_int* errcode_ret) {
+	cl_command_queue queue = (cl_command_queue)NewObject(sizeof(struct _cl_command_queue));
+	queue->context = context;
+	queue->properties = properties;
+	if (errcode_ret != NULL)
+		*errcode_ret = CL_SUCCESS;
+	return queue;
+}
+
+cl_int clRetainCommandQueue(cl_command_queue command_queue) {
+	Retain(&command_queue->references);
+	return CL_SUCCESS;
+}
+
+cl_int clReleaseCommandQueue(cl_command_queue command_queue) {
+	if (Release(&command_queue->references))
+		free(command_queue);
+	return CL_SUCCESS;
+}
+
+cl_int clGetCommandQueueInfo(cl_command_queue command_queue, cl_command_queue_info param_name, size_t param_value_size, void* param_value, size_t* param_value_size_ret) {
+	//The queue has no device, so the caches use the copy backend
+	memset(param_value, 0, param_value_size);
+	if (param_name == CL_QUEUE_CONTEXT)
+		*(cl_context*)param_value = command_queue->context;
+	else if (param_name == CL_QUEUE_PROPERTIES)
+		*(cl_command_queue_properties*)param_value = command_queue->properties;
+	return CL_SUCCESS;
+}
+
+cl_int clGetDeviceInfo(cl_device_id device, cl_device_info param_name, size_t param_value_size, void* param_value, size_t* param_value_size_ret) {
+	memset(param_value, 0, param_value_size);
+	return CL_SUCCESS;
+}
+
+cl_int clFinish(cl_command_queue command_queue) {
+	return CL_SUCCESS;
+}
+
+cl_mem clCreateBuffer(cl_context context, cl_mem_flags flags, size_t size, void* host_ptr, cl_int* errcode_ret) {
+	cl_mem buffer = (cl_mem)NewObject(sizeof(struct _cl_mem));
+	buffer->hostPtr = host_ptr;
+#ifdef HOST_ONLY_DATA
+	if ((flags & CL_MEM_USE_HOST_PTR) == CL_MEM_USE_HOST_PTR)
+		buffer->data = (char*)host_ptr;
+	else {
+		buffer->data = (char*)calloc(1, (size > 0) ? size : 1);
+		buffer->ownsData = true;
+		if ((flags & CL_MEM_COPY_HOST_PTR) == CL_MEM_COPY_HOST_PTR)
+			memcpy(buffer->data, host_ptr, size);
+	}
+#endif
+	if (errcode_ret != NULL)
+		*errcode_ret = CL_SUCCESS;
+	return buffer;
+}
+
+cl_mem clCreateSubBuffer(cl_mem buffer, cl_mem_flags flags, cl_buffer_create_type buffer_create_type, const void* buffer_create_info, cl_int* errcode_ret) {
+	cl_mem subBuffer = (cl_mem)NewObject(sizeof(struct _cl_mem));
+#ifdef HOST_ONLY_DATA
+	subBuffer->data = buffer->data + ((const cl_buffer_region*)buffer_create_info)->origin;
+	subBuffer->parent = buffer;
+	Retain(&buffer->references);
+#endif
+	if (errcode_ret != NULL)
+		*errcode_ret = CL_SUCCESS;
+	return subBuffer;
+}
+
+cl_int clReleaseMemObject(cl_mem memobj) {
+	if (Release(&memobj->references)) {
+		if (memobj->parent != NULL)
+			clReleaseMemObject(memobj->parent);
+		if (memobj->ownsData)
+			free(memobj->data);
+		free(memobj->mapped);
+		free(memobj);
+	}
+	return CL_SUCCESS;
+}
+
+cl_int clEnqueueWriteBuffer(cl_command_queue command_queue, cl_mem buffer, cl_bool blocking_write, size_t offset, size_t size, const void* ptr, cl_uint num_events_in_wait_list, const cl_event* event_wait_list, cl_event* event) {
+#ifdef HOST_ONLY_DATA
+	//A zero copy buffer of cache.c uses the host memory itself
+	memmove(buffer->data + offset, ptr, size);
+#endif
+	return CompleteEvent(command_queue, size, event);
+}
+
+cl_int clEnqueueReadBuffer(cl_command_queue command_queue, cl_mem buffer, cl_bool blocking_read, size_t offset, size_t size, void* ptr, cl_uint num_events_in_wait_list, const cl_event* event_wait_list, cl_event* event) {
+#ifdef HOST_ONLY_DATA
+	memmove(ptr, buffer->data + offset, size);
+#endif
+	return CompleteEvent(command_queue, size, event);
+}
+
+cl_int clEnqueueCopyBuffer(cl_command_queue command_queue, cl_mem src_buffer, cl_mem dst_buffer, size_t src_offset, size_t dst_offset, size_t size, cl_uint num_events_in_wait_list, const cl_event* event_wait_list, cl_event* event) {
+#ifdef HOST_ONLY_DATA
+	memmove(dst_buffer->data + dst_offset, src_buffer->data + src_offset, size);
+#endif
+	return CompleteEvent(command_queue, size, event);
+}
+
+void* clEnqueueMapBuffer(cl_command_queue command_queue, cl_mem buffer, cl_bool blocking_map, cl_map_flags map_flags, size_t offset, size_t size, cl_uint num_events_in_wait_list, const cl_event* event_wait_list, cl_event* event, cl_int* errcode_ret) {
+	//A mapped staging buffer needs real memory, it lives until the buffer is released
+	if ((buffer->data == NULL) && (buffer->mapped == NULL))
+		buffer->mapped = calloc(1, offset + size);
+	if (errcode_ret != NULL)
+		*errcode_ret = CompleteEvent(command_queue, 0, event);
+	else
+		CompleteEvent(command_queue, 0, event);
+	return ((buffer->data != NULL) ? buffer->data : (char*)buffer->mapped) + offset;
+}
+
+cl_int clEnqueueUnmapMemObject(cl_command_queue command_queue, cl_mem memobj, void* mapped_ptr, cl_uint num_events_in_wait_list, const cl_event* event_wait_list, cl_event* event) {
+	return CompleteEvent(command_queue, 0, event);
+}
+
+cl_int clEnqueueSVMMigrateMem(cl_command_queue command_queue, cl_uint num_svm_pointers, const void** svm_pointers, const size_t* sizes, cl_mem_migration_flags flags, cl_uint num_events_in_wait_list, const cl_event* event_wait_list, cl_event* event) {
+	return CompleteEvent(command_queue, 0, event);
+}
+
+cl_int clEnqueueMarkerWithWaitList(cl_command_queue command_queue, cl_uint num_events_in_wait_list, const cl_event* event_wait_list, cl_event* event) {
+	return CompleteEvent(command_queue, 0, event);
+}
+
+cl_int clEnqueueBarrierWithWaitList(cl_command_queue command_queue, cl_uint num_events_in_wait_list, const cl_event* event_wait_list, cl_event* event) {
+	return CompleteEvent(command_queue, 0, event);
+}
+
+cl_int clWaitForEvents(cl_uint num_events, const cl_event* event_list) {
+	return CL_SUCCESS;
+}
+
+cl_int clRetainEvent(cl_event event) {
+	Retain(&event->references);
+	return CL_SUCCESS;
+}
+
+cl_int clReleaseEvent(cl_event event) {
+	if (Release(&event->references))
+		free(event);
+	return CL_SUCCESS;
+}
+
+cl_int clSetEventCallback(cl_event event, cl_int command_exec_callback_type, void (CL_CALLBACK* pfn_notify)(cl_event, cl_int, void*), void* user_data) {
+	//Every event is complete, the callback runs at once
+	pfn_notify(event, CL_COMPLETE, user_data);
+	return CL_SUCCESS;
+}
+
+cl_int clGetEventProfilingInfo(cl_event event, cl_profiling_info param_name, size_t param_value_size, void* param_value, size_t* param_value_size_ret) {
+	if (!event->profiled)
+		return CL_PROFILING_INFO_NOT_AVAILABLE;
+	//A command starts as soon as it is queued
+	*(cl_ulong*)param_value = (param_name == CL_PROFILING_COMMAND_END) ? event->end : event->queued;
+	if (param_value_size_ret != NULL)
+		*param_value_size_ret = sizeof(cl_ulong);
+	return CL_SUCCESS;
+}
+
+cl_program clCreateProgramWithSource(cl_context context, cl_uint count, const char** strings, const size_t* lengths, cl_int* errcode_ret) {
+	if (errcode_ret != NULL)
+		*errcode_ret = CL_SUCCESS;
+	return (cl_program)NewObject(sizeof(struct _cl_program));
+}
+
+cl_int clBuildProgram(cl_program program, cl_uint num_devices, const cl_device_id* device_list, const char* options, void (CL_CALLBACK* pfn_notify)(cl_program, void*), void* user_data) {
+	//The block size of the zero block codec is a define of the build
+	const char* define = (options != NULL) ? strstr(options, "ZERO_BLOCK_WORDS=") : NULL;
+	if (define != NULL)
+		sscanf(define, "ZERO_BLOCK_WORDS=%d", &program->blockWords);
+	return CL_SUCCESS;
+}
+
+cl_int clReleaseProgram(cl_program program) {
+	if (Release(&program->references))
+		free(program);
+	return CL_SUCCESS;
+}
+
+cl_kernel clCreateKernel(cl_program program, const char* kernel_name, cl_int* errcode_ret) {
+	cl_kernel kernel = (cl_kernel)NewObject(sizeof(struct _cl_kernel));
+	kernel->name = strdup(kernel_name);
+	kernel->blockWords = program->blockWords;
+	if (errcode_ret != NULL)
+		*errcode_ret = CL_SUCCESS;
+	return kernel;
+}
+
+cl_int clReleaseKernel(cl_kernel kernel) {
+	if (Release(&kernel->references)) {
+		free(kernel->name);
+		free(kernel);
+	}
+	return CL_SUCCESS;
+}
+
+cl_int clSetKernelArg(cl_kernel kernel, cl_uint arg_index, size_t arg_size, const void* arg_value) {
+	if ((arg_index < 5) && (arg_size <= sizeof(union KernelArg)))
+		memcpy(&kernel->args[arg_index], arg_value, arg_size);
+	return CL_SUCCESS;
+}
+
+#ifdef HOST_ONLY_DATA
+//The codec kernels of cache.c on the host, every other kernel does nothing
+static void RunKernel(cl_kernel kernel, size_t globalSize) {
+	size_t blockWords = (size_t)kernel->blockWords;
+	if ((kernel->name != NULL) && (strcmp(kernel->name, "UnpackZeroBlocks") == 0)) {
+		const cl_int* packed = (const cl_int*)kernel->args[0].buffer->data;
+		const cl_uint* payload = (const cl_uint*)(packed + kernel->args[1].word);
+		cl_uint* data = (cl_uint*)kernel->args[2].buffer->data + kernel->args[3].word;
+		cl_uint numberOfWords = kernel->args[4].word;
+		for (size_t word = 0; (word < globalSize) && (word < numberOfWords); word++) {
+			cl_int block = packed[word / blockWords];
+			data[word] = (block < 0) ? 0 : payload[(size_t)block * blockWords + word % blockWords];
+		}
+	} else if ((kernel->name != NULL) && (strcmp(kernel->name, "MarkZeroBlocks") == 0)) {
+		const cl_uint* data = (const cl_uint*)kernel->args[0].buffer->data + kernel->args[1].word;
+		cl_uint numberOfWords = kernel->args[2].word;
+		unsigned char* nonZero = (unsigned char*)kernel->args[3].buffer->data;
+		for (size_t block = 0; block < globalSize; block++) {
+			cl_uint bits = 0;
+			for (size_t i = block * blockWords; (i < (block + 1) * blockWords) && (i < numberOfWords); i++)
+				bits |= data[i];
+			nonZero[block] = (bits != 0);
+		}
+	}
+}
+#endif
+
+cl_int clEnqueueNDRangeKernel(cl_command_queue command_queue, cl_kernel kernel, cl_uint work_dim, const size_t* global_work_offset, const size_t* global_work_size, const size_t* local_work_size, cl_uint num_events_in_wait_list, const cl_event* event_wait_list, cl_event* event) {
+#ifdef HOST_ONLY_DATA
+	RunKernel(kernel, global_work_size[0]);
+#endif
+	return CompleteEvent(command_queue, global_work_size[0], event);
+}
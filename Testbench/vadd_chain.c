@@ -90,15 +90,9 @@ int main(int argc, char** argv)
     cl_program       program;       // compute program
     cl_kernel        ko_vadd;       // compute kernel
 
-    //-----------------------------------------------------
-    //------------------ Create Cache ---------------------
-
-    struct Cache_t* myCache = CreateCache(8, dataSize, 32, direct_mapped, random_RP);
-
     cl_mem input1;
     cl_mem input2;
     cl_mem output;
-    //-----------------------------------------------------
 
     // Fill vectors a and b with random float values
     int i = 0;
@@ -151,6 +145,15 @@ int main(int argc, char** argv)
     commands = clCreateCommandQueue(context, device_id, 0, &err);
     checkError(err, "Creating command queue");
 
+    //-----------------------------------------------------
+    //------------------ Create Cache ---------------------
+
+    struct Cache_t* myCache = CreateCache(context, commands, 8, dataSize, 32, direct_mapped, random_RP, &err);
+    checkError(err, "Creating cache");
+    //Keep the intermediate results on the device, they are written back on eviction or flush
+    SetWritePolicy(myCache, write_back_WP);
+    //-----------------------------------------------------
+
     // Create the compute program from the source buffer
     program = clCreateProgramWithSource(context, 1, (const char **) & KernelSource, NULL, &err);
     checkError(err, "Creating program");
@@ -179,7 +182,7 @@ int main(int argc, char** argv)
 
     input1 = clCreateCacheBuffer(context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, dataSize, h_a, &err, myCache);
     input2 = clCreateCacheBuffer(context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, dataSize, h_b, &err, myCache);
-    output = clCreateCacheBuffer(context, CL_MEM_READ_WRITE, dataSize, h_c, &err, myCache);
+    output = clCreateCacheBuffer(context, CL_MEM_WRITE_ONLY, dataSize, h_c, &err, myCache);
     //-----------------------------------------------------
 
     // Enqueue kernel - first time
@@ -196,13 +199,9 @@ int main(int argc, char** argv)
     err = clEnqueueNDRangeKernel(commands, ko_vadd, 1, NULL, &global, NULL, 0, NULL, NULL);
     checkError(err, "Enqueueing kernel 1st time");
 
-   //Read back the result
-    err = clEnqueueReadBuffer(commands, output, CL_TRUE, 0, sizeof(int) * count, h_c, 0, NULL, NULL );  
-    checkError(err, "Reading back h_c");
-
     input1 = clCreateCacheBuffer(context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, dataSize, h_c, &err, myCache);
     input2 = clCreateCacheBuffer(context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, dataSize, h_d, &err, myCache);
-    output = clCreateCacheBuffer(context, CL_MEM_READ_WRITE, dataSize, h_e, &err, myCache);
+    output = clCreateCacheBuffer(context, CL_MEM_WRITE_ONLY, dataSize, h_e, &err, myCache);
     // Enqueue kernel - second time
     // Set different arguments to the compute kernel
     err  = clSetKernelArg(ko_vadd, 0, sizeof(cl_mem), &input1);
@@ -214,13 +213,9 @@ int main(int argc, char** argv)
     err = clEnqueueNDRangeKernel(commands, ko_vadd, 1, NULL, &global, NULL, 0, NULL, NULL);
     checkError(err, "Enqueueing kernel 2nd time");
 
-   //Read back the result
-    err = clEnqueueReadBuffer(commands, output, CL_TRUE, 0, sizeof(int) * count, h_e, 0, NULL, NULL );  
-    checkError(err, "Reading back h_e");
-
     input1 = clCreateCacheBuffer(context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, dataSize, h_e, &err, myCache);
     input2 = clCreateCacheBuffer(context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, dataSize, h_f, &err, myCache);
-    output = clCreateCacheBuffer(context, CL_MEM_READ_WRITE, dataSize, h_g, &err, myCache);
+    output = clCreateCacheBuffer(context, CL_MEM_WRITE_ONLY, dataSize, h_g, &err, myCache);
     // Enqueue kernel - third time
     // Set different (again) arguments to the compute kernel
     err  = clSetKernelArg(ko_vadd, 0, sizeof(cl_mem), &input1);
@@ -236,6 +231,10 @@ int main(int argc, char** argv)
     err = clEnqueueReadCacheBuffer(commands, CL_TRUE, 0, sizeof(int) * count, h_g, 0, NULL, NULL, myCache); 
     checkError(err, "Reading back h_g with Get()");
 
+    // Write the intermediate results that are still dirty in cache back to the host
+    err = clFlushCache(commands, myCache);
+    checkError(err, "Flushing the cache");
+
     // Test the results
     //-----------------------------------------------------
     correct = 0;
@@ -1,41 +1,1172 @@
 #include "math.h"
 #include <stdlib.h> 
 #include <stdio.h>
+#include <string.h>
 #include "cache.h"
 #include <stdint.h>
+#include <time.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define CACHE_X86_SIMD
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define CACHE_NEON_SIMD
+#endif
+
+//Marks a line that is in no list of the FullyAssociativeIndex_t
+#define UNLINKED_LINE (-2)
+
+//By default the counts of lfu_RP and mfu_RP are halved after this many accesses per way of a set
+#define DEFAULT_DECAY_FACTOR 16
+
+//The recency stamps of a set are halved when its counter reaches this value
+#define STAMP_LIMIT (1 << 30)
+
+//The segments of the scan resistant policies in lineState and ghostState
+#define RECENT_SEGMENT 1
+#define FREQUENT_SEGMENT 2
+
+//Counters are shared by all threads of a thread safe cache
+#define ADD_COUNTER(counter, value) __atomic_add_fetch(&(counter), (value), __ATOMIC_RELAXED)
+
+//The fields that the optimistic hits of ReadHit() access without the lock, the writers use relaxed atomics for them as well
+#define LOAD_RELAXED(field) __atomic_load_n(&(field), __ATOMIC_RELAXED)
+#define STORE_RELAXED(field, value) __atomic_store_n(&(field), (value), __ATOMIC_RELAXED)
+
+//Marks the fills of a prefetch, like CL_MEM_CACHE_BYPASS it is never passed to the OpenCL runtime
+#define CL_MEM_CACHE_PREFETCH ((cl_mem_flags)1 << 41)
+
+//Pins the line of a request until PinBuffer() releases it, like CL_MEM_CACHE_BYPASS it is never passed to the OpenCL runtime
+#define CL_MEM_CACHE_PIN ((cl_mem_flags)1 << 42)
+
+//Marks the fills from a packed upload of WarmCache() or clCreateCacheBuffers(), they are no copies from an other device
+#define CL_MEM_CACHE_PACKED ((cl_mem_flags)1 << 43)
+
+//Smaller transfers are not worth the extra copy through a staging buffer, at most this many staging buffers
+#define MIN_STAGED_TRANSFER 4096
+#define MAX_STAGING_BUFFERS 16
+
+//Smaller transfers are not worth a kernel launch, the zero block codec skips blocks of this many 32 bit words
+#define MIN_COMPRESSED_TRANSFER 65536
+#define ZERO_BLOCK_WORDS 64
+
+//Reads after a dense transfer skip the marks of the zero block codec, every this many reads still mark their blocks
+#define COMPRESSION_PROBE_PERIOD 16
+
+//The latencies are recorded in PROFILE_SUB_BUCKETS buckets per power of 2 nanoseconds, for transfers of up to 
+//2^PROFILE_SIZE_BUCKETS bytes, the last PROFILE_RECORDS profiled commands are kept for WriteChromeTrace()
+#define PROFILE_KINDS 3
+#define PROFILE_SIZE_BUCKETS 32
+#define PROFILE_SUB_BUCKETS 4
+#define PROFILE_LATENCY_BUCKETS (40 * PROFILE_SUB_BUCKETS)
+#define PROFILE_RECORDS 65536
+
+//The number of trace records that are collected before they are written to the trace file
+#define TRACE_BUFFER_RECORDS 4096
+
+//A policy duel has at most DUEL_LEADER_SETS leader sets per policy and at least DUEL_MIN_PERIOD sets per leader
+//The saturating counter of the duel runs from 0 to DUEL_COUNTER_MAX, the upper half selects the second policy
+#define DUEL_LEADER_SETS 32
+#define DUEL_MIN_PERIOD 16
+#define DUEL_COUNTER_MAX 63
+
+//WarmCache() and clCreateCacheBuffers() pack the data of several lines into uploads of about this many bytes, WarmCache() aligns 
+//its sub-buffers to the base address alignment of the device or DEFAULT_SUB_BUFFER_ALIGNMENT bytes when the device does not tell
+#define PACKED_BATCH_SIZE (16 << 20)
+#define DEFAULT_SUB_BUFFER_ALIGNMENT 4096
+
+//The number of requests remembered by sequence_PF and the largest prefetchDepth
+#define PREFETCH_HISTORY 256
+#define MAX_PREFETCH_DEPTH 16
 
 //Global variables
 bool printMemUsage = false;
 bool printMemPercentage = false;
 
-struct Cache_t* CreateCache(int numberOfCacheLines, int dataSize, int tagSize, enum CacheConfiguration_t config, enum ReplacementPolicy_t policy) {
-	int numberOfSets, indexSize, numberOfLinesPerSet, addressBitShift;
-	time_t t;
-	srand((unsigned)time(&t));
+//The device side of the zero block codec, built by SetCompression() with ZERO_BLOCK_WORDS as a define
+//A packed transfer starts with one int per block, the index of the block in the payload or -1 for a zero block
+static const char* zeroBlockSource =
+	"__kernel void UnpackZeroBlocks(__global const int* packed, uint numberOfBlocks, __global uint* data, uint offset, uint numberOfWords) {\n"
+	"	uint word = get_global_id(0);\n"
+	"	if (word >= numberOfWords)\n"
+	"		return;\n"
+	"	int block = packed[word / ZERO_BLOCK_WORDS];\n"
+	"	__global const uint* payload = (__global const uint*)(packed + numberOfBlocks);\n"
+	"	data[offset + word] = (block < 0) ? 0 : payload[block * ZERO_BLOCK_WORDS + word % ZERO_BLOCK_WORDS];\n"
+	"}\n"
+	"__kernel void MarkZeroBlocks(__global const uint* data, uint offset, uint numberOfWords, __global uchar* nonZero) {\n"
+	"	uint first = get_global_id(0) * ZERO_BLOCK_WORDS;\n"
+	"	uint last = min(first + ZERO_BLOCK_WORDS, numberOfWords);\n"
+	"	uint bits = 0;\n"
+	"	for (uint i = first; i < last; i++)\n"
+	"		bits |= data[offset + i];\n"
+	"	nonZero[get_global_id(0)] = (bits != 0);\n"
+	"}\n";
+
+//Tag comparison of GetWay(), selected by SelectMatchTags() for the instruction set of the host
+static int MatchTagsScalar(void* const* tags, const bool* valid, int count, void* hostAddress);
+static int (*matchTags)(void* const* tags, const bool* valid, int count, void* hostAddress) = MatchTagsScalar;
+//Caches are created by several threads while others use matchTags, so it is selected only once
+static pthread_once_t matchTagsOnce = PTHREAD_ONCE_INIT;
+
+//-------------------------------------------
+//-------Defining internal functions---------
+//-------------------------------------------
+
+/*
+* Functions to create a cache. GetNumberOfWays() returns the ways of a configuration or -1 for n_way, 
+* GetMemoryBackend() resolves auto_MB and svm_MB for the device of the commandQueue and CreateBackendCache() 
+* creates the cache with the resolved backend.
+*/
+static int GetNumberOfWays(
+	enum CacheConfiguration_t config, 
+	int numberOfCacheLines);
+
+static enum MemoryBackend_t GetMemoryBackend(
+	cl_command_queue commandQueue, 
+	enum MemoryBackend_t backend);
+
+static struct Cache_t* CreateBackendCache(
+	cl_context context, 
+	cl_command_queue commandQueue, 
+	int numberOfCacheLines, 
+	int numberOfWays, 
+	int dataSize, 
+	int tagSize, 
+	enum ReplacementPolicy_t policy, 
+	enum MemoryBackend_t backend, 
+	cl_int *errorcode_ret);
+
+/*
+* A function to map the hostAddress to a set with the index function of the cache.
+* The indexbitmask created in the CreateCache() function limits the result to the number of sets.
+*/
+static int GetIndex(
+	void* hostAddress, 
+	struct Cache_t* cachePtr);
+
+/*
+* A function to find the way where the data is cached. 
+* It compares the tags of all ways in a set until it finds a line with valid data and the correct tag. 
+* The tags of a set are contiguous, so they are compared with AVX-512 (8 tags), AVX2 (4 tags) or NEON 
+* instructions when the host supports them, otherwise one tag at a time.
+* The lookup changes no replacement state, so it can probe a cache that does not serve the request.
+*/
+static int GetWay(
+	void* hostAddress, 
+	int setIndex, 
+	struct Cache_t* cachePtr);
+
+/*
+* A function to update the replacement state of a set for a request that it serves. 
+* way is the way that holds the data or -1 for a miss, which only counts for the decay of lfu_RP and mfu_RP.
+*/
+static void AccessWay(
+	int setIndex, 
+	int way, 
+	struct Cache_t* cachePtr);
+
+/*
+* A function to select the tag comparison of GetWay() for the instruction set of the host.
+* On x86 the support is checked at runtime, so the library does not need to be built with -mavx2.
+* It runs once through pthread_once(), before the first cache is created.
+*/
+static void SelectMatchTags(void);
+
+/*
+* Functions for the FullyAssociativeIndex_t of a fully associative cache.
+* GetWayHashed() and SetWayHashed() replace GetWay() and SetWay(), SetHashedTag() moves a line 
+* to its new tag in the hash table. The other functions maintain the hash table, lists and frequency buckets.
+*/
+static struct FullyAssociativeIndex_t* CreateHashedIndex(
+	int numberOfCacheLines);
+
+static void FreeHashedIndex(
+	struct FullyAssociativeIndex_t* index);
+
+static uint64_t HashAddress(
+	void* hostAddress);
+
+static int FindHashedSlot(
+	void* hostAddress, 
+	struct Cache_t* cachePtr);
+
+static void RemoveHashedSlot(
+	int slot, 
+	struct Cache_t* cachePtr);
+
+static void UnlinkHashedLine(
+	int line, 
+	struct FullyAssociativeIndex_t* index);
+
+static void LinkHashedLine(
+	int line, 
+	int bucket, 
+	struct FullyAssociativeIndex_t* index);
+
+static int GetFrequencyBucket(
+	int frequency, 
+	int previous, 
+	struct FullyAssociativeIndex_t* index);
+
+static void TouchHashedLine(
+	int line, 
+	struct Cache_t* cachePtr);
+
+static int GetWayHashed(
+	void* hostAddress, 
+	struct Cache_t* cachePtr);
+
+static int SetWayHashed(
+	void* hostAddress, 
+	struct Cache_t* cachePtr);
+
+static void SetHashedTag(
+	int line, 
+	void* hostAddress, 
+	struct Cache_t* cachePtr);
+
+/*
+* A function to invalidate a line, for example when its transfer failed.
+* The line is removed from the hashedIndex and counts as an empty line again.
+*/
+static void InvalidateLine(
+	int line, 
+	struct Cache_t* cachePtr);
+
+/*
+* A function that returns the next recency stamp of a set, it halves the old stamps before the counter overflows.
+*/
+static int NextStamp(
+	int setIndex, 
+	struct Cache_t* cachePtr);
+
+/*
+* Functions that age the counts of lfu_RP and mfu_RP, for a set and for the frequency buckets of a hashedIndex.
+*/
+static void CountFrequencyAccess(
+	int setIndex, 
+	struct Cache_t* cachePtr);
+
+static void DecayHashedFrequencies(
+	struct FullyAssociativeIndex_t* index);
+
+/*
+* Functions for the scan resistant replacement policies (clock_RP, slru_RP, two_queue_RP and arc_RP).
+* TouchWay() updates the replacement state of a way after a hit.
+* EvictWay() selects the victim in a full set and remembers its tag when the policy needs it,
+* InsertWay() sets the state of the way that receives hostAddress.
+* The ghost functions find, add and count the remembered tags of a set.
+*/
+static void TouchWay(
+	int setIndex, 
+	int way, 
+	struct Cache_t* cachePtr);
+
+static bool IsScanResistant(
+	enum ReplacementPolicy_t policy);
+
+static int EvictWay(
+	void* hostAddress, 
+	int setIndex, 
+	struct Cache_t* cachePtr);
+
+static void InsertWay(
+	void* hostAddress, 
+	int setIndex, 
+	int way, 
+	struct Cache_t* cachePtr);
+
+static int OldestWay(
+	int setIndex, 
+	int state, 
+	struct Cache_t* cachePtr);
+
+static int CountWays(
+	int setIndex, 
+	int state, 
+	struct Cache_t* cachePtr);
+
+static int FindGhost(
+	void* hostAddress, 
+	int setIndex, 
+	struct Cache_t* cachePtr);
+
+static void AddGhost(
+	void* hostAddress, 
+	int setIndex, 
+	int state, 
+	struct Cache_t* cachePtr);
+
+static int CountGhosts(
+	int setIndex, 
+	int state, 
+	struct Cache_t* cachePtr);
+
+static void DropOldestGhost(
+	int setIndex, 
+	int state, 
+	struct Cache_t* cachePtr);
+
+/*
+* A function to determine in which way the data must be stored.
+* It first checks if an empty way is available within the provided set.
+* If all ways are full it overwrites a way based on the replacement policy.
+*/
+static int SetWay(
+	void* hostAddress, 
+	int setIndex, 
+	struct Cache_t* cachePtr);
+
+/*
+* A function to return the index of the line that holds the data of hostAddress, or -1 when it is not cached.
+*/
+static int FindLine(
+	void* hostAddress, 
+	struct Cache_t* cachePtr);
+
+/*
+* A function to find the smallest size class of a CreateSizeClassCache() cache that fits size bytes.
+* It returns NULL when size is larger than every size class.
+*/
+static struct Cache_t* GetSizeClass(
+	size_t size, 
+	struct Cache_t* cachePtr);
+
+/*
+* Functions for pinned lines. IsPinned() tells if a line may not be evicted, FirstUnpinnedWay() returns the 
+* first way of a set that may be evicted or -1, HasEvictableWay() tells if a miss in the set can get a line.
+* PinLine() and UnpinLine() change the pinCount of a line while the caller holds the lock of its set.
+* PinBuffer() finds the line of hostAddress that has deviceData as buffer in a cache, its size classes
+* or its devices and pins or unpins it, it returns false when no such line is cached. UnpinResolvedLine() unpins
+* the line a request of clCreateCacheBuffers() pinned without a lookup, it returns false when the request pinned none.
+* PinEventCallback() marks a PinnedBuffer_t as completed, ReleaseCompletedPins() unpins the completed
+* pendingPins, with wait it first waits for all of them.
+*/
+static bool IsPinned(
+	int line, 
+	struct Cache_t* cachePtr);
+
+static int FirstUnpinnedWay(
+	int setIndex, 
+	struct Cache_t* cachePtr);
+
+static bool HasEvictableWay(
+	int setIndex, 
+	struct Cache_t* cachePtr);
+
+static void PinLine(
+	int line, 
+	struct Cache_t* cachePtr);
+
+static void UnpinLine(
+	int line, 
+	struct Cache_t* cachePtr);
+
+static bool PinBuffer(
+	void* hostAddress, 
+	cl_mem deviceData, 
+	bool pin, 
+	struct Cache_t* cachePtr);
+
+static bool UnpinResolvedLine(
+	void* hostAddress, 
+	cl_mem deviceData, 
+	const PinnedLine_t* pinnedLine);
+
+static void CL_CALLBACK PinEventCallback(
+	cl_event event, 
+	cl_int status, 
+	void* userData);
+
+static void ReleaseCompletedPins(
+	bool wait, 
+	struct Cache_t* cachePtr);
+
+/*
+* A function to find the line of hostAddress while holding the lock of its set, it returns -1 when not cached.
+*/
+static int FindLineLocked(
+	void* hostAddress, 
+	struct Cache_t* cachePtr);
+
+/*
+* A function to find the size class that currently holds the data of hostAddress.
+*/
+static struct Cache_t* FindSizeClass(
+	void* hostAddress, 
+	struct Cache_t* cachePtr);
+
+/*
+* Functions for bypassed requests. EnqueueBypass() creates and fills a temporary buffer for the request.
+* FindBypass() returns the index of the bypass buffer of hostAddress or -1, FindBypassSizeClass() the size class
+* that holds it. TransferBypass() reads (isRead) or writes part of a bypass buffer at hostOffset of its hostData, 
+* a read of the whole buffer also releases it. ReleaseBypass() releases one buffer, after a blocking write back when writeBack is set.
+* DropBypass() releases the bypass buffer deviceData of hostAddress in a cache, its size classes or its devices 
+* without a write back, it returns false when there is no such buffer.
+* FindBypass() and ReleaseBypass() expect the caller to hold the bypassLock, the others take it themselves.
+* NeedsHostData() tells whether a request with flags is filled from the host, so an older dirty copy is written back first.
+*/
+static bool AdmitLine(
+	void* hostAddress, 
+	struct Cache_t* cachePtr);
+
+static cl_mem EnqueueBypass(
+	cl_command_queue command_queue, 
+	cl_bool blocking_write, 
+	cl_mem_flags flags, 
+	size_t size, 
+	void* hostAddress, 
+	void* hostData, 
+	cl_uint num_events_in_wait_list, 
+	const cl_event *event_wait_list, 
+	cl_event *event, 
+	cl_int *errorcode_ret, 
+	struct Cache_t* cachePtr);
+
+static int FindBypass(
+	void* hostAddress, 
+	struct Cache_t* cachePtr);
+
+static struct Cache_t* FindBypassSizeClass(
+	void* hostAddress, 
+	struct Cache_t* cachePtr);
+
+static int TransferBypass(
+	cl_command_queue command_queue, 
+	cl_bool isRead, 
+	cl_bool blocking, 
+	size_t offset, 
+	size_t size, 
+	void* hostAddress, 
+	size_t hostOffset, 
+	cl_uint num_events_in_wait_list, 
+	const cl_event *event_wait_list, 
+	cl_event *event, 
+	struct Cache_t* cachePtr);
+
+static bool NeedsHostData(
+	cl_mem_flags flags);
+
+static cl_int ReleaseBypass(
+	cl_command_queue command_queue, 
+	int index, 
+	bool writeBack, 
+	struct Cache_t* cachePtr);
+
+static bool DropBypass(
+	void* hostAddress, 
+	cl_mem deviceData, 
+	struct Cache_t* cachePtr);
+
+/*
+* Functions for the packed fills of clCreateCacheBuffers(). PackMisses() uploads the data of the input buffers 
+* that miss back to back in one write of up to PACKED_BATCH_SIZE bytes into the packedData of the cache and sets 
+* packedOffsets[i] to the offset of every packed buffer, the others are SIZE_MAX. It returns true when it packed, 
+* the caller then holds the packLock until the lines are filled. Nothing is packed for fewer than two misses, 
+* for a cache without lines of its own, while an other batch uses the packedData or when the packed upload fails. 
+* EnqueuePackedLine() fills the line of hostAddress from lineData at lineOffset.
+* GetSubBufferAlignment() returns the alignment in bytes of a sub-buffer on the device of command_queue.
+*/
+static bool PackMisses(
+	cl_context context, 
+	cl_command_queue command_queue, 
+	int count, 
+	const cl_mem_flags* flags, 
+	const size_t* sizes, 
+	void** hostAddresses, 
+	size_t* packedOffsets, 
+	struct Cache_t* cachePtr);
+
+static cl_mem EnqueuePackedLine(
+	cl_command_queue command_queue, 
+	cl_mem_flags flags, 
+	size_t size, 
+	void* hostAddress, 
+	cl_mem lineData, 
+	size_t lineOffset, 
+	cl_event *event, 
+	cl_int *errorcode_ret, 
+	PinnedLine_t* pinnedLine, 
+	struct Cache_t* cachePtr);
+
+static size_t GetSubBufferAlignment(
+	cl_command_queue command_queue);
+
+/*
+* Functions for a thread safe cache. LockSet() and UnlockSet() take the lock of the stripe of a set and 
+* update its sequence. LockAddress() and UnlockStripe() lock the stripe of a host address in a cache 
+* with size classes. ReadHit() returns the buffer of a hit without taking a lock, or NULL when the 
+* request has to take the lock. All functions return directly when the cache is not thread safe.
+*/
+static void LockSet(
+	int setIndex, 
+	struct Cache_t* cachePtr);
+
+static void UnlockSet(
+	int setIndex, 
+	struct Cache_t* cachePtr);
+
+static int LockAddress(
+	void* hostAddress, 
+	struct Cache_t* cachePtr);
+
+static void UnlockStripe(
+	int stripe, 
+	struct Cache_t* cachePtr);
+
+static void LockBypass(
+	struct Cache_t* cachePtr);
+
+static void UnlockBypass(
+	struct Cache_t* cachePtr);
+
+static cl_mem ReadHit(
+	void* hostAddress, 
+	int setIndex, 
+	size_t size, 
+	struct Cache_t* cachePtr);
+
+/*
+* Functions for the content check. HashContent() returns the fingerprint of size bytes at data, never 0.
+* LockContentLine() returns an other valid line with the given fingerprint and size, or -1. When its set is in 
+* an other stripe than the set of line, that stripe stays locked until UnlockContentLine().
+* A stripe that is held by an other thread is skipped, because the caller already holds the lock of its own set.
+*/
+static uint64_t RotateLeft(
+	uint64_t x, 
+	int bits);
+
+static uint64_t HashContent(
+	const void* data, 
+	size_t size);
+
+static int LockContentLine(
+	uint64_t contentHash, 
+	size_t size, 
+	int line, 
+	struct Cache_t* cachePtr);
+
+static void UnlockContentLine(
+	int contentLine, 
+	int line, 
+	struct Cache_t* cachePtr);
+
+/*
+* A function that returns the next number of the random generator of a set.
+*/
+static uint32_t NextRandom(
+	int setIndex, 
+	struct Cache_t* cachePtr);
+
+/*
+* A function to add up the counters of all size classes in the front end cache.
+*/
+static void SumSubCacheCounters(
+	struct Cache_t* cachePtr);
+
+/*
+* Functions for the transfers between host and lines. EnqueueHostWrite() and EnqueueHostRead() take the arguments of 
+* clEnqueueWriteBuffer() and clEnqueueReadBuffer() and profile the transfer when the cache has a profile.
+* WriteHostData() and ReadHostData() do the transfer and split large transfers with EnqueueSplitTransfer().
+* StageWrite() and StageRead() go through the staging buffers when the cache has them.
+* TakeStagingBuffer() returns the next buffer of the ring once its last transfer finished, WaitStagingBuffer() 
+* waits for the last transfer of a buffer. The caller holds the stagingLock.
+*/
+static cl_int EnqueueHostWrite(
+	cl_command_queue command_queue, 
+	cl_mem deviceData, 
+	cl_bool blocking_write, 
+	size_t offset, 
+	size_t size, 
+	const void* ptr, 
+	cl_uint num_events_in_wait_list, 
+	const cl_event *event_wait_list, 
+	cl_event *event, 
+	struct Cache_t* cachePtr);
+
+static cl_int EnqueueHostRead(
+	cl_command_queue command_queue, 
+	cl_mem deviceData, 
+	cl_bool blocking_read, 
+	size_t offset, 
+	size_t size, 
+	void* ptr, 
+	cl_uint num_events_in_wait_list, 
+	const cl_event *event_wait_list, 
+	cl_event *event, 
+	struct Cache_t* cachePtr);
+
+static cl_int WriteHostData(
+	cl_command_queue command_queue, 
+	cl_mem deviceData, 
+	cl_bool blocking_write, 
+	size_t offset, 
+	size_t size, 
+	const void* ptr, 
+	cl_uint num_events_in_wait_list, 
+	const cl_event *event_wait_list, 
+	cl_event *event, 
+	struct Cache_t* cachePtr);
+
+static cl_int ReadHostData(
+	cl_command_queue command_queue, 
+	cl_mem deviceData, 
+	cl_bool blocking_read, 
+	size_t offset, 
+	size_t size, 
+	void* ptr, 
+	cl_uint num_events_in_wait_list, 
+	const cl_event *event_wait_list, 
+	cl_event *event, 
+	struct Cache_t* cachePtr);
+
+/*
+* Functions for the policy duel. GetSetPolicy() returns the policy of a set and converts the replacement state 
+* of a follower set when the winner changed, GetLeaderGroup() returns the policy index of a leader set or -1 for 
+* a follower. CountDuelMiss() moves the counter on a miss of a leader set, ConvertSetPolicy() keeps the age 
+* order of the ways of a set from one policy for the next. The caller holds the lock of the set.
+*/
+static enum ReplacementPolicy_t GetSetPolicy(
+	int setIndex, 
+	struct Cache_t* cachePtr);
+
+static int GetLeaderGroup(
+	int setIndex, 
+	struct Cache_t* cachePtr);
+
+static void CountDuelMiss(
+	int setIndex, 
+	struct Cache_t* cachePtr);
+
+static void ConvertSetPolicy(
+	int setIndex, 
+	enum ReplacementPolicy_t from, 
+	enum ReplacementPolicy_t to, 
+	struct Cache_t* cachePtr);
+
+/*
+* Functions for the trace. TraceRequest() adds a request to the trace of the cache when it has one, 
+* WriteTraceRecords() writes the collected records to the trace file. The caller holds the lock of the trace.
+*/
+static void TraceRequest(
+	enum TraceKind_t kind, 
+	cl_mem_flags flags, 
+	size_t offset, 
+	size_t size, 
+	void* hostAddress, 
+	struct Cache_t* cachePtr);
+
+static bool WriteTraceRecords(
+	TraceFile_t* trace);
+
+/*
+* Functions for the profiling. HasProfilingQueues() checks all command queues for CL_QUEUE_PROFILING_ENABLE, 
+* SetProfile() gives the cache and its size classes or devices a reference to the profile and ReleaseProfile() 
+* drops a reference. HandOverProfileEvent() sets the callback that records the profileEvent when it completes 
+* and hands the event to the caller when it asked for one with event. RecordProfile() adds a completed command.
+* GetSizeBucket(), GetLatencyBucket() and GetBucketLatency() map sizes and latencies to the histogram buckets.
+*/
+static bool HasProfilingQueues(
+	struct Cache_t* cachePtr);
+
+static void SetProfile(
+	TransferProfile_t* profile, 
+	struct Cache_t* cachePtr);
+
+static void ReleaseProfile(
+	TransferProfile_t* profile);
+
+static void HandOverProfileEvent(
+	cl_event profileEvent, 
+	enum ProfileKind_t kind, 
+	size_t size, 
+	cl_event* event, 
+	TransferProfile_t* profile);
+
+static void CL_CALLBACK ProfileEventCallback(
+	cl_event event, 
+	cl_int status, 
+	void* userData);
+
+static void RecordProfile(
+	enum ProfileKind_t kind, 
+	size_t size, 
+	cl_ulong queued, 
+	cl_ulong start, 
+	cl_ulong end, 
+	TransferProfile_t* profile);
+
+static int GetSizeBucket(
+	size_t size);
+
+static int GetLatencyBucket(
+	uint64_t latency);
+
+static uint64_t GetBucketLatency(
+	int bucket);
+
+/*
+* Functions for GetCacheStats(). CountStatsSets() counts the sets and the largest number of ways of all line caches,
+* AddCacheStats() adds the counters and sets of a cache, from index set on in the arrays of stats.
+*/
+static void CountStatsSets(
+	struct Cache_t* cachePtr, 
+	int* numberOfSets, 
+	int* maxLinesPerSet);
+
+static void AddCacheStats(
+	struct Cache_t* cachePtr, 
+	CacheStats_t* stats, 
+	int* set);
+
+/*
+* Functions for the zero copy backends. SyncHostMemory() replaces a transfer between a line and its own host memory, 
+* CreateLineBuffer() creates the buffer of a line or bypassed request for the memory backend of the cache.
+*/
+static cl_int SyncHostMemory(
+	cl_bool isRead, 
+	cl_command_queue command_queue, 
+	cl_mem deviceData, 
+	cl_bool blocking, 
+	size_t offset, 
+	size_t size, 
+	void* ptr, 
+	cl_uint num_events_in_wait_list, 
+	const cl_event *event_wait_list, 
+	cl_event *event, 
+	struct Cache_t* cachePtr);
+
+static cl_mem CreateLineBuffer(
+	size_t size, 
+	void* hostAddress, 
+	cl_int *errorcode_ret, 
+	struct Cache_t* cachePtr);
+
+/*
+* Functions for the zero block codec of SetCompression(). PackZeroBlocks() returns the block index followed by 
+* the non zero blocks, or NULL when less than a quarter of the transfer would be saved, and sets zeroBlockShare 
+* to the percentage of zero blocks it sampled. GetCodecBuffer() returns the kept buffer of at least size bytes 
+* in buffer, which has bufferSize bytes, and grows it when needed, the caller holds the compressionLock.
+* WriteZeroBlocks() and ReadZeroBlocks() return false when the transfer is not compressed, otherwise 
+* errorcode_ret holds the result of the compressed transfer.
+*/
+static bool IsZeroBlock(
+	const cl_uint* word, 
+	size_t numberOfWords, 
+	size_t block);
+
+static void* PackZeroBlocks(
+	const void* data, 
+	size_t size, 
+	size_t* packedSize, 
+	int* zeroBlockShare);
+
+static cl_mem GetCodecBuffer(
+	cl_mem* buffer, 
+	size_t* bufferSize, 
+	cl_mem_flags flags, 
+	size_t size, 
+	struct Cache_t* cachePtr);
+
+static bool IsCompressible(
+	size_t offset, 
+	size_t size, 
+	cl_kernel kernel);
+
+static bool WriteZeroBlocks(
+	cl_command_queue command_queue, 
+	cl_mem deviceData, 
+	cl_bool blocking_write, 
+	size_t offset, 
+	size_t size, 
+	const void* ptr, 
+	cl_uint num_events_in_wait_list, 
+	const cl_event *event_wait_list, 
+	cl_event *event, 
+	cl_int *errorcode_ret, 
+	struct Cache_t* cachePtr);
+
+static bool ReadZeroBlocks(
+	cl_command_queue command_queue, 
+	cl_mem deviceData, 
+	cl_bool blocking_read, 
+	size_t offset, 
+	size_t size, 
+	void* ptr, 
+	cl_uint num_events_in_wait_list, 
+	const cl_event *event_wait_list, 
+	cl_event *event, 
+	cl_int *errorcode_ret, 
+	struct Cache_t* cachePtr);
+
+static cl_int SetCompressionKernels(
+	cl_program program, 
+	struct Cache_t* cachePtr);
+
+static cl_int EnqueueSplitTransfer(
+	cl_bool isRead, 
+	cl_command_queue command_queue, 
+	cl_mem deviceData, 
+	cl_bool blocking, 
+	size_t offset, 
+	size_t size, 
+	void* ptr, 
+	cl_uint num_events_in_wait_list, 
+	const cl_event *event_wait_list, 
+	cl_event *event, 
+	struct Cache_t* cachePtr);
+
+static cl_int StageWrite(
+	cl_command_queue command_queue, 
+	cl_mem deviceData, 
+	cl_bool blocking_write, 
+	size_t offset, 
+	size_t size, 
+	const void* ptr, 
+	cl_uint num_events_in_wait_list, 
+	const cl_event *event_wait_list, 
+	cl_event *event, 
+	struct Cache_t* cachePtr);
+
+static cl_int StageRead(
+	cl_command_queue command_queue, 
+	cl_mem deviceData, 
+	cl_bool blocking_read, 
+	size_t offset, 
+	size_t size, 
+	void* ptr, 
+	cl_uint num_events_in_wait_list, 
+	const cl_event *event_wait_list, 
+	cl_event *event, 
+	struct Cache_t* cachePtr);
+
+static int TakeStagingBuffer(
+	struct Cache_t* cachePtr);
+
+static cl_int WaitStagingBuffer(
+	int buffer, 
+	struct Cache_t* cachePtr);
+
+/*
+* A function to write a dirty cache line back to the host address in its tag.
+* The line is no longer dirty afterwards, with a non-blocking read the host data is only 
+* up to date after the returned event has completed.
+*/
+static cl_int WriteBackLine(
+	cl_command_queue command_queue, 
+	cl_bool blocking_read, 
+	int line, 
+	cl_uint num_events_in_wait_list,
+	const cl_event *event_wait_list, 
+	cl_event *event,
+	struct Cache_t* cachePtr);
+
+/*
+* A function that looks up the hostAddress and fills the line on a miss.
+* It is shared by clCreateCacheBuffer() and clEnqueueCacheBuffer() and their Keyed variants.
+* hostAddress is the tag of the request and hostData the host memory of its data, the same pointer unless the 
+* cache is keyed.
+* Evicted dirty data is read back first, the fill waits for that read and for the given events.
+*/
+static cl_mem EnqueueLine(
+	cl_command_queue command_queue, 
+	cl_bool blocking_write, 
+	cl_mem_flags flags, 
+	size_t size, 
+	void* hostAddress, 
+	void* hostData, 
+	cl_uint num_events_in_wait_list,
+	const cl_event *event_wait_list, 
+	cl_event *event,
+	cl_int *errorcode_ret, 
+	PinnedLine_t* pinnedLine, 
+	struct Cache_t* cachePtr);
+
+/*
+* Functions of the built-in prefetcher. ObserveRequest() records a request of the application and prefetches
+* the lines predicted after it. PredictStride() and PredictSequence() store up to prefetchDepth predictions in 
+* hostAddresses and sizes and return their number, the caller holds the prefetchLock.
+*/
+static void ObserveRequest(
+	cl_command_queue command_queue, 
+	cl_mem_flags flags, 
+	size_t size, 
+	void* hostAddress, 
+	struct Cache_t* cachePtr);
+
+static int PredictStride(
+	size_t size, 
+	void* hostAddress, 
+	void** hostAddresses, 
+	size_t* sizes, 
+	struct Cache_t* cachePtr);
+
+static int PredictSequence(
+	void* hostAddress, 
+	void** hostAddresses, 
+	size_t* sizes, 
+	struct Cache_t* cachePtr);
+
+/*
+* The parts of EnqueueLine(). EnqueueSizeClassLine() routes a request to a size class,
+* EnqueueSetLine() looks up and fills the line in a set while the caller holds the lock of that set.
+*/
+static cl_mem EnqueueSizeClassLine(
+	cl_command_queue command_queue, 
+	cl_bool blocking_write, 
+	cl_mem_flags flags, 
+	size_t size, 
+	void* hostAddress, 
+	void* hostData, 
+	cl_uint num_events_in_wait_list,
+	const cl_event *event_wait_list, 
+	cl_event *event,
+	cl_int *errorcode_ret, 
+	PinnedLine_t* pinnedLine, 
+	struct Cache_t* cachePtr);
+
+static cl_mem EnqueueSetLine(
+	cl_command_queue command_queue, 
+	cl_bool blocking_write, 
+	cl_mem_flags flags, 
+	size_t size, 
+	void* hostAddress, 
+	void* hostData, 
+	int set, 
+	cl_mem peerData, 
+	size_t peerOffset, 
+	cl_uint num_events_in_wait_list,
+	const cl_event *event_wait_list, 
+	cl_event *event,
+	cl_int *errorcode_ret, 
+	PinnedLine_t* pinnedLine, 
+	struct Cache_t* cachePtr);
+
+/*
+* Functions of CreateMultiDeviceCache() caches. GetDevice() selects the device for a request, FindDevice() the 
+* device to read the data of hostAddress from, NULL when no device holds it. InvalidateDevices() drops the line 
+* of hostAddress from every device but keep. EnqueueDeviceLine() routes a request to a device, EnqueuePeerLine()
+* fills the line on device with a copy from peer and returns false when peer does not hold the data.
+*/
+static int GetDevice(
+	cl_command_queue command_queue, 
+	void* hostAddress, 
+	struct Cache_t* cachePtr);
+
+static struct Cache_t* FindDevice(
+	cl_command_queue command_queue, 
+	void* hostAddress, 
+	struct Cache_t* cachePtr);
+
+static void InvalidateDevices(
+	void* hostAddress, 
+	struct Cache_t* keep, 
+	struct Cache_t* cachePtr);
+
+static cl_mem EnqueueDeviceLine(
+	cl_command_queue command_queue, 
+	cl_bool blocking_write, 
+	cl_mem_flags flags, 
+	size_t size, 
+	void* hostAddress, 
+	void* hostData, 
+	cl_uint num_events_in_wait_list,
+	const cl_event *event_wait_list, 
+	cl_event *event,
+	cl_int *errorcode_ret, 
+	PinnedLine_t* pinnedLine, 
+	struct Cache_t* cachePtr);
+
+static bool EnqueuePeerLine(
+	cl_bool blocking_write, 
+	cl_mem_flags flags, 
+	size_t size, 
+	void* hostAddress, 
+	void* hostData, 
+	cl_uint num_events_in_wait_list,
+	const cl_event *event_wait_list, 
+	cl_event *event,
+	cl_int *errorcode_ret, 
+	struct Cache_t* peer, 
+	struct Cache_t* device, 
+	cl_mem* deviceData, 
+	PinnedLine_t* pinnedLine);
+
+/*
+* Functions of the snapshots. GetWayAge() returns the age of a way under a policy, lower is older.
+* CollectSnapshot() appends the ranked lines with a nodeId of the cache to entries and returns their new number,
+* CompareSnapshotEntries() sorts them hottest first. GetWarmLeaf() returns the cache that takes the data of 
+* hostAddress, NULL when the data is already cached, and sets the queue of its device. WarmLeaf() fills the lines 
+* of the count entries of a cache, hottest first, that fit in its empty ways. The batches are filled from the coldest
+* entry, so the hottest lines become the most recent lines of their sets. WarmLine() fills one line from lineData, 
+* a sub-buffer of a batch or NULL for a zero copy line, and sets its nodeId.
+*/
+static int GetWayAge(
+	int setIndex, 
+	int way, 
+	enum ReplacementPolicy_t policy, 
+	struct Cache_t* cachePtr);
+
+static int CollectSnapshot(
+	SnapshotEntry_t** entries, 
+	int numberOfEntries, 
+	int* capacity, 
+	struct Cache_t* cachePtr);
+
+static int CompareSnapshotEntries(
+	const void* a, 
+	const void* b);
+
+static struct Cache_t* GetWarmLeaf(
+	cl_command_queue* command_queue, 
+	void* hostAddress, 
+	size_t size, 
+	struct Cache_t* cachePtr);
+
+static cl_int WarmLeaf(
+	cl_command_queue command_queue, 
+	const SnapshotEntry_t** entries, 
+	void** hostAddresses, 
+	int count, 
+	struct Cache_t* cachePtr);
+
+static cl_int WarmLine(
+	cl_command_queue command_queue, 
+	const SnapshotEntry_t* entry, 
+	void* hostAddress, 
+	cl_mem lineData, 
+	struct Cache_t* cachePtr);
+
+/*
+* Functions for the keys of a keyed cache. CheckKey() returns CL_SUCCESS when key can be used on the cache,
+* GetKeyTag() returns the tag of a key and GetTagKey() the key of a tag.
+*/
+static cl_int CheckKey(
+	uint64_t key, 
+	struct Cache_t* cachePtr);
+
+static void* GetKeyTag(
+	uint64_t key);
+
+static uint64_t GetTagKey(
+	void* tag);
+
+/*
+* A function that reads (isRead) or writes size bytes at offset of the line of hostAddress from or to the 
+* hostData of the line, hostOffset bytes from its start.
+* It is shared by clEnqueueReadCacheBuffer() and the range functions, bypassed data is transferred with TransferBypass().
+* It returns 0 on success and 1 when the data is not cached or the range does not fit.
+*/
+static int TransferLine(
+	cl_command_queue command_queue, 
+	cl_bool isRead, 
+	cl_bool blocking, 
+	size_t offset, 
+	size_t size, 
+	void* hostAddress, 
+	size_t hostOffset, 
+	cl_uint num_events_in_wait_list, 
+	const cl_event *event_wait_list, 
+	cl_event *event, 
+	struct Cache_t* cachePtr);
+
+struct Cache_t* CreateCache(cl_context context, cl_command_queue commandQueue, int numberOfCacheLines, int dataSize, int tagSize, enum CacheConfiguration_t config, enum ReplacementPolicy_t policy, cl_int *errorcode_ret) {
+	int numberOfWays = GetNumberOfWays(config, numberOfCacheLines);
+	if (numberOfWays == -1) {
+		if (errorcode_ret != NULL)
+			*errorcode_ret = CL_INVALID_VALUE;
+		return NULL;
+	}
+	return CreateAssociativeCache(context, commandQueue, numberOfCacheLines, numberOfWays, dataSize, tagSize, policy, errorcode_ret);
+}
+
+struct Cache_t* CreateZeroCopyCache(cl_context context, cl_command_queue commandQueue, int numberOfCacheLines, int dataSize, int tagSize, enum CacheConfiguration_t config, enum ReplacementPolicy_t policy, enum MemoryBackend_t backend, cl_int *errorcode_ret) {
+	int numberOfWays = GetNumberOfWays(config, numberOfCacheLines);
+	if (numberOfWays == -1) {
+		if (errorcode_ret != NULL)
+			*errorcode_ret = CL_INVALID_VALUE;
+		return NULL;
+	}
+	return CreateBackendCache(context, commandQueue, numberOfCacheLines, numberOfWays, dataSize, tagSize, policy, GetMemoryBackend(commandQueue, backend), errorcode_ret);
+}
+
+struct Cache_t* CreateAssociativeCache(cl_context context, cl_command_queue commandQueue, int numberOfCacheLines, int numberOfWays, int dataSize, int tagSize, enum ReplacementPolicy_t policy, cl_int *errorcode_ret) {
+	return CreateBackendCache(context, commandQueue, numberOfCacheLines, numberOfWays, dataSize, tagSize, policy, copy_MB, errorcode_ret);
+}
+
+static int GetNumberOfWays(enum CacheConfiguration_t config, int numberOfCacheLines) {
 	switch (config){
 	case direct_mapped:
-		numberOfSets = numberOfCacheLines;
-		numberOfLinesPerSet = 1;
-		indexSize = ceil(log10(numberOfCacheLines) / log10(2));
-		break;
+		return 1;
 	case two_way:
-		numberOfSets = (int)floor(numberOfCacheLines / 2);
-		numberOfLinesPerSet = 2;
-		indexSize = ceil(log10(numberOfCacheLines) / log10(2)) - 1;
-		break;
+		return 2;
 	case four_way:
-		numberOfSets = (int)floor(numberOfCacheLines / 4);
-		numberOfLinesPerSet = 4;
-		indexSize = ceil(log10(numberOfCacheLines) / log10(2)) - 2;
-		break;
+		return 4;
 	case fully_associative:
-		numberOfSets = 1;
-		numberOfLinesPerSet = numberOfCacheLines;
-		indexSize = 1;	
-		break;
+		return numberOfCacheLines;
 	default:
-		break;
+		//Any other associativity is created with CreateAssociativeCache()
+		return -1;
+	}
+}
+
+static enum MemoryBackend_t GetMemoryBackend(cl_command_queue commandQueue, enum MemoryBackend_t backend) {
+	cl_device_id device;
+	cl_device_svm_capabilities svmCapabilities = 0;
+	cl_bool hostUnifiedMemory = CL_FALSE;
+
+	if ((backend == copy_MB) || (backend == host_ptr_MB))
+		return backend;
+	if (clGetCommandQueueInfo(commandQueue, CL_QUEUE_DEVICE, sizeof(cl_device_id), &device, NULL) != CL_SUCCESS)
+		return (backend == svm_MB) ? host_ptr_MB : copy_MB;
+	//Devices before OpenCL 2.0 do not know the SVM query
+	if (clGetDeviceInfo(device, CL_DEVICE_SVM_CAPABILITIES, sizeof(svmCapabilities), &svmCapabilities, NULL) != CL_SUCCESS)
+		svmCapabilities = 0;
+	if (clGetDeviceInfo(device, CL_DEVICE_HOST_UNIFIED_MEMORY, sizeof(hostUnifiedMemory), &hostUnifiedMemory, NULL) != CL_SUCCESS)
+		hostUnifiedMemory = CL_FALSE;
+	//Only fine grained system SVM shares every host allocation with the device
+	if ((svmCapabilities & CL_DEVICE_SVM_FINE_GRAIN_SYSTEM) != 0)
+		return svm_MB;
+	if ((backend == svm_MB) || (hostUnifiedMemory == CL_TRUE))
+		return host_ptr_MB;
+	return copy_MB;
+}
+
+static struct Cache_t* CreateBackendCache(cl_context context, cl_command_queue commandQueue, int numberOfCacheLines, int numberOfWays, int dataSize, int tagSize, enum ReplacementPolicy_t policy, enum MemoryBackend_t backend, cl_int *errorcode_ret) {
+	int numberOfSets, indexSize, numberOfLinesPerSet, addressBitShift;
+	enum CacheConfiguration_t config;
+	cl_int err = CL_SUCCESS;
+	time_t t;
+	uint32_t seed = (uint32_t)time(&t);
+	pthread_once(&matchTagsOnce, SelectMatchTags);
+
+	//The number of ways has to be a power of 2 that divides the lines into a power of 2 number of sets
+	if ((numberOfCacheLines <= 0) || (numberOfWays <= 0) || (numberOfCacheLines % numberOfWays != 0)
+		|| ((numberOfWays & (numberOfWays - 1)) != 0 && numberOfWays != numberOfCacheLines)
+		|| (((numberOfCacheLines / numberOfWays) & (numberOfCacheLines / numberOfWays - 1)) != 0)) {
+		if (errorcode_ret != NULL)
+			*errorcode_ret = CL_INVALID_VALUE;
+		return NULL;
 	}
+	numberOfLinesPerSet = numberOfWays;
+	numberOfSets = numberOfCacheLines / numberOfWays;
+	for (indexSize = 0; (1 << indexSize) < numberOfSets; indexSize++);
+	if (numberOfWays == 1)
+		config = direct_mapped;
+	else if (numberOfWays == numberOfCacheLines)
+		config = fully_associative;
+	else if (numberOfWays == 2)
+		config = two_way;
+	else if (numberOfWays == 4)
+		config = four_way;
+	else
+		config = n_way;
 
 	//Size of usable cache memory in bytes
 	int cacheSize = numberOfCacheLines * dataSize;
@@ -46,26 +1177,64 @@ struct Cache_t* CreateCache(int numberOfCacheLines, int dataSize, int tagSize, e
 	Cache_t* myCache=(Cache_t*)malloc(sizeof(Cache_t));
 	memoryAllocated += sizeof(Cache_t);
 
-	//Allocate memory for each set in the cache
-	myCache->cacheLine =(CacheLine_t**)malloc((sizeof(CacheLine_t*) * numberOfSets));
+	//Allocate the state of each set in the cache
 	myCache->replacementLine = calloc(numberOfSets,sizeof(int));
-	memoryAllocated += (sizeof(CacheLine_t*)+sizeof(int)) * numberOfSets;
+	myCache->conflictMisses = calloc(numberOfSets, sizeof(uint64_t));
+	myCache->setMisses = calloc(numberOfSets, sizeof(uint64_t));
+	myCache->decayCounter = calloc(numberOfSets, sizeof(int));
+	myCache->randomState = (uint32_t*)malloc(numberOfSets * sizeof(uint32_t));
+	memoryAllocated += (2 * sizeof(int) + sizeof(uint32_t) + 2 * sizeof(uint64_t)) * numberOfSets;
+	//Every set has its own random generator so random_RP needs no shared state, xorshift needs a non-zero seed
+	for (int i = 0; i < numberOfSets; i++)
+		myCache->randomState[i] = ((seed ^ ((uint32_t)i * 2654435761u)) != 0) ? (seed ^ ((uint32_t)i * 2654435761u)) : 1;
 
-	//Allocate memory for the cachelines in	each set
-	for (int i = 0; i < numberOfSets; i++) {
-		myCache->cacheLine[i] = (CacheLine_t*)malloc(sizeof(CacheLine_t) * numberOfLinesPerSet);
-		memoryAllocated += sizeof(CacheLine_t) * numberOfLinesPerSet;
-		//Allocate memory for the meta data on each cacheline
-		for (int j = 0; j < numberOfLinesPerSet; j++) {
-			//Allocate memory
-			myCache->cacheLine[i][j].metaData = malloc(sizeof(MetaData_t));
-			memoryAllocated += (sizeof(char) * dataSize) + sizeof(MetaData_t);
-			//Initialize fields of CacheLine_t and MetaData_t
-			myCache->cacheLine[i][j].valid = false;
-			myCache->cacheLine[i][j].tag = NULL;
-			myCache->cacheLine[i][j].metaData->nodeId = -1;
-			myCache->cacheLine[i][j].metaData->accessedOrder = 0;
-		}
+	//Allocate one contiguous array per field of the cachelines, the ways of a set are next to each other
+	myCache->tag = (void**)calloc(numberOfCacheLines, sizeof(void*));
+	myCache->hostData = (void**)calloc(numberOfCacheLines, sizeof(void*));
+	myCache->valid = (bool*)calloc(numberOfCacheLines, sizeof(bool));
+	myCache->dirty = (bool*)calloc(numberOfCacheLines, sizeof(bool));
+	myCache->deviceAuthoritative = (bool*)calloc(numberOfCacheLines, sizeof(bool));
+	myCache->size = (size_t*)calloc(numberOfCacheLines, sizeof(size_t));
+	myCache->accessedOrder = (int*)calloc(numberOfCacheLines, sizeof(int));
+	myCache->deviceData = (cl_mem*)calloc(numberOfCacheLines, sizeof(cl_mem));
+	myCache->metaData = (MetaData_t*)malloc(numberOfCacheLines * sizeof(MetaData_t));
+	myCache->lineState = (unsigned char*)calloc(numberOfCacheLines, sizeof(unsigned char));
+	myCache->prefetched = (bool*)calloc(numberOfCacheLines, sizeof(bool));
+	myCache->contentHash = (uint64_t*)calloc(numberOfCacheLines, sizeof(uint64_t));
+	myCache->pinCount = (int*)calloc(numberOfCacheLines, sizeof(int));
+	memoryAllocated += (2 * sizeof(void*) + 4 * sizeof(bool) + sizeof(size_t) + 2 * sizeof(int) + sizeof(cl_mem) + sizeof(MetaData_t) + sizeof(unsigned char) + (sizeof(char) * dataSize)) * numberOfCacheLines;
+
+	//Only 2Q and ARC remember evicted tags, one entry per way
+	myCache->ghostTag = NULL;
+	myCache->ghostState = NULL;
+	myCache->ghostOrder = NULL;
+	myCache->arcTarget = NULL;
+	if ((policy == two_queue_RP) || (policy == arc_RP)) {
+		myCache->ghostTag = (void**)calloc(numberOfCacheLines, sizeof(void*));
+		myCache->ghostState = (unsigned char*)calloc(numberOfCacheLines, sizeof(unsigned char));
+		myCache->ghostOrder = (int*)calloc(numberOfCacheLines, sizeof(int));
+		myCache->arcTarget = (int*)calloc(numberOfSets, sizeof(int));
+		memoryAllocated += (sizeof(void*) + sizeof(unsigned char) + sizeof(int)) * numberOfCacheLines + sizeof(int) * numberOfSets;
+	}
+
+	//The context and queue are needed for every refill, keep them alive as long as the cache
+	myCache->context = context;
+	myCache->commandQueue = commandQueue;
+	clRetainContext(context);
+	clRetainCommandQueue(commandQueue);
+
+	myCache->memoryBackend = backend;
+	myCache->profile = NULL;
+	myCache->setPolicy = NULL;
+	myCache->trace = NULL;
+	for (int i = 0; i < numberOfCacheLines; i++) {
+		//Initialize the fields of MetaData_t
+		myCache->metaData[i].nodeId = -1;
+		//Allocate the device buffer of the line once, misses only refill it
+		//A zero copy line gets its buffer from the host memory of the data it holds
+		myCache->deviceData[i] = NULL;
+		if ((err == CL_SUCCESS) && (backend == copy_MB))
+			myCache->deviceData[i] = clCreateBuffer(context, CL_MEM_READ_WRITE, dataSize, NULL, &err);
 	}
 
 	//Get the bitshift from the data Size
@@ -85,20 +1254,103 @@ struct Cache_t* CreateCache(int numberOfCacheLines, int dataSize, int tagSize, e
 	myCache->numberOfSets = numberOfSets;
 	myCache->config = config;
 	myCache->policy = policy;
-	if (config == fully_associative)
-		myCache->indexBitMask = 0;
-	else
-		myCache->indexBitMask = pow(2, indexSize) - 1;
+	myCache->writePolicy = no_write_back_WP;
+	myCache->numberOfSizeClasses = 0;
+	myCache->sizeClass = NULL;
+	myCache->indexFunction = modulo_IF;
+	myCache->keyed = false;
+	myCache->keyHash = NULL;
+	myCache->numberOfValidLines = 0;
+	myCache->decayPeriod = DEFAULT_DECAY_FACTOR * numberOfLinesPerSet;
+	myCache->admissionPolicy = admit_all_AP;
+	myCache->admissionFilter = NULL;
+	myCache->Bypasses = 0;
+	myCache->Hits = 0;
+	myCache->ColdMisses = 0;
+	myCache->CapacityMisses = 0;
+	myCache->Evictions = 0;
+	myCache->DirtyWriteBacks = 0;
+	myCache->BytesToDevice = 0;
+	myCache->BytesToHost = 0;
+	myCache->DuelMisses[0] = 0;
+	myCache->DuelMisses[1] = 0;
+	myCache->PolicySwitches = 0;
+	myCache->duelPeriod = 0;
+	myCache->duelCounter = 0;
+	myCache->duelWinner = 0;
+	myCache->PeerTransfers = 0;
+	myCache->contentCheck = address_CC;
+	myCache->unpackKernel = NULL;
+	myCache->markKernel = NULL;
+	myCache->CompressedTransfers = 0;
+	myCache->SavedBytes = 0;
+	myCache->compressedData = NULL;
+	myCache->compressedDataSize = 0;
+	myCache->compressionEvent = NULL;
+	myCache->markData = NULL;
+	myCache->markDataSize = 0;
+	//Nothing is known about the data yet, the first reads mark their blocks
+	myCache->zeroBlockShare = 100;
+	myCache->compressionSkips = 0;
+	myCache->UnchangedHits = 0;
+	myCache->ChangedUploads = 0;
+	myCache->DedupCopies = 0;
+	myCache->numberOfPinnedLines = 0;
+	myCache->pendingPins = NULL;
+	myCache->numberOfStagingBuffers = 0;
+	myCache->stagingSize = 0;
+	myCache->stagingBuffer = NULL;
+	myCache->stagingHost = NULL;
+	myCache->stagingEvent = NULL;
+	myCache->nextStagingBuffer = 0;
+	myCache->packedData = NULL;
+	myCache->packedDataSize = 0;
+	myCache->numberOfTransferQueues = 0;
+	myCache->transferQueue = NULL;
+	myCache->transferChunkSize = 0;
+	myCache->Prefetches = 0;
+	myCache->UsefulPrefetches = 0;
+	myCache->prefetcher = no_prefetch_PF;
+	myCache->prefetchDepth = 0;
+	myCache->prefetchHistory = NULL;
+	myCache->numberOfPrefetchEntries = 0;
+	myCache->prefetchHistoryNext = 0;
+	myCache->numberOfDevices = 0;
+	myCache->device = NULL;
+	myCache->bypass = NULL;
+	myCache->numberOfBypassBuffers = 0;
+	myCache->bypassCapacity = 0;
+	myCache->threadSafe = false;
+	myCache->numberOfLocks = 0;
+	myCache->setLocks = NULL;
+	myCache->setSequence = NULL;
+	myCache->indexSize = indexSize;
+	myCache->indexBitMask = pow(2, indexSize) - 1;
+	//A fully associative cache finds lines and victims through a hash table and lists instead of scanning
+	myCache->hashedIndex = NULL;
+	if ((numberOfSets == 1) && (numberOfLinesPerSet > 1)) {
+		myCache->hashedIndex = CreateHashedIndex(numberOfCacheLines);
+		memoryAllocated += myCache->hashedIndex->memoryAllocated;
+	}
+
+	if (errorcode_ret != NULL)
+		*errorcode_ret = err;
+	if (err != CL_SUCCESS) {
+		//Not every line got a device buffer, release what was allocated
+		FreeCache(myCache);
+		return NULL;
+	}
 
 	//Printf information about the memory allocation
 	if (printMemUsage) {
-		const char configString[4][22] = {
+		const char configString[5][22] = {
 			"direct mapped",
 			"two way associative",
 			"four way associative",
-			"fully associative" };
+			"fully associative",
+			"n way associative" };
 		printf("--------Memory allocation--------\n");
-		printf("Cache configuration = %s\n", configString[config]);
+		printf("Cache configuration = %s (%d ways)\n", configString[config], numberOfWays);
 		printf("Usable cache memory = %d bytes\n", cacheSize);
 		printf("Total amount of allocated memory = %ld bytes\n", memoryAllocated);
 		printf("---------------------------------\n");
@@ -110,162 +1362,4170 @@ struct Cache_t* CreateCache(int numberOfCacheLines, int dataSize, int tagSize, e
 	return myCache;
 }
 
-static int GetIndex(int indexBitMask, int addressBitShift, void* hostAddress) {
-	return (int)(((intptr_t)hostAddress >> addressBitShift)& indexBitMask);
-}
-
-static int GetWay( void* hostAddress, int setIndex, struct Cache_t* cachePtr) {
-	int numberOfLinesPerSet = cachePtr->numberOfLinesPerSet;
-	CacheLine_t* Set = cachePtr->cacheLine[setIndex];
+struct Cache_t* CreateSizeClassCache(cl_context context, cl_command_queue commandQueue, int numberOfSizeClasses, const int* numberOfCacheLines, const int* dataSizes, int tagSize, enum CacheConfiguration_t config, enum ReplacementPolicy_t policy, cl_int *errorcode_ret) {
+	cl_int err = CL_SUCCESS;
 
-	if(cachePtr->config==direct_mapped){
-		//For direct mapped cache the way is always 0
-		return 0;
-	}	
+	//The front end holds no lines itself, it only routes to the size classes
+	Cache_t* myCache = (Cache_t*)calloc(1, sizeof(Cache_t));
+	myCache->context = context;
+	myCache->commandQueue = commandQueue;
+	clRetainContext(context);
+	clRetainCommandQueue(commandQueue);
+	myCache->tagSize = tagSize;
+	myCache->config = config;
+	myCache->policy = policy;
+	myCache->writePolicy = no_write_back_WP;
+	myCache->sizeClass = (Cache_t**)calloc(numberOfSizeClasses, sizeof(Cache_t*));
 
-	//Check for each way if the data valid and the tag is correct, if so return 0 else -1.
-	for (int way = 0; way < numberOfLinesPerSet; way++) {
-		if ((Set[way].valid == true) && (Set[way].tag == hostAddress)) {
-			//It is in cache, update replacement policies for accessed way
-			if (cachePtr->policy == lru_RP || cachePtr->policy == mru_RP) {
-				cachePtr->replacementLine[setIndex]++;
-				cachePtr->cacheLine[setIndex][way].metaData->accessedOrder = cachePtr->replacementLine[setIndex];
-			}
-			else if (cachePtr->policy == lfu_RP || cachePtr->policy == mfu_RP) {
-				cachePtr->cacheLine[setIndex][way].metaData->accessedOrder++;
-			}
-			return way;
+	for (int i = 0; i < numberOfSizeClasses; i++) {
+		//The size classes must be sorted from small to large for GetSizeClass()
+		if ((i > 0) && (dataSizes[i] <= dataSizes[i - 1])) {
+			err = CL_INVALID_VALUE;
+			break;
 		}
-	};
-	return -1;
-}
+		myCache->sizeClass[i] = CreateCache(context, commandQueue, numberOfCacheLines[i], dataSizes[i], tagSize, config, policy, &err);
+		if (err != CL_SUCCESS)
+			break;
+		myCache->numberOfSizeClasses++;
+		myCache->dataSize = dataSizes[i];
+	}
 
-static int SetWay(int setIndex, struct Cache_t* cachePtr) {
-	int numberOfLinesPerSet = cachePtr->numberOfLinesPerSet;
-	CacheLine_t* Set = cachePtr->cacheLine[setIndex];
-	int replacementWay = 0;
-	switch (cachePtr->policy)
-	{
-	case random_RP:
-		//Check for empty ways
-		for (int way = 0; way < numberOfLinesPerSet; way++) {
-			if (Set[way].valid != true)
-				return way;
-		};
-		return rand() % numberOfLinesPerSet;
-	case fifo_RP:
-		cachePtr->replacementLine[setIndex] = (cachePtr->replacementLine[setIndex] + 1) % numberOfLinesPerSet;
-		return cachePtr->replacementLine[setIndex];
-	case lru_RP:
-		for (int way = 0; way < numberOfLinesPerSet; way++) {
-			if (Set[way].metaData->accessedOrder < Set[replacementWay].metaData->accessedOrder)
-				replacementWay = way;
-		};
-		cachePtr->replacementLine[setIndex]++;
-		cachePtr->cacheLine[setIndex][replacementWay].metaData->accessedOrder = cachePtr->replacementLine[setIndex];
-		return replacementWay;
-	case mru_RP:
-		for (int way = 0; way < numberOfLinesPerSet; way++) {
-			//Check for empty ways
-			if (Set[way].valid != true) {
-				replacementWay = way;
-				break;
-			}
-			//Find the way with the highest accessed order
-			if (Set[way].metaData->accessedOrder > Set[replacementWay].metaData->accessedOrder)
-				replacementWay = way;
-		};
-		cachePtr->replacementLine[setIndex]++;
-		cachePtr->cacheLine[setIndex][replacementWay].metaData->accessedOrder = cachePtr->replacementLine[setIndex];
-		return replacementWay;
-	case lfu_RP:
-		for (int way = 0; way < numberOfLinesPerSet; way++) {
-			if (Set[way].metaData->accessedOrder < Set[replacementWay].metaData->accessedOrder)
-				replacementWay = way;
-		};
-		cachePtr->cacheLine[setIndex][replacementWay].metaData->accessedOrder = 1;
-		return replacementWay;
-	case mfu_RP:
-		for (int way = 0; way < numberOfLinesPerSet; way++) {
-			//Check for empty ways
-			if (Set[way].valid != true) {
-				replacementWay = way;
-				break;
-			}
-			//Find the way with the highest accessed order
-			if (Set[way].metaData->accessedOrder > Set[replacementWay].metaData->accessedOrder)
-				replacementWay = way;
-		};
-		cachePtr->cacheLine[setIndex][replacementWay].metaData->accessedOrder = 1;
-		return replacementWay;
-	default:
-		break;
+	if (errorcode_ret != NULL)
+		*errorcode_ret = err;
+	if (err != CL_SUCCESS) {
+		FreeCache(myCache);
+		return NULL;
 	}
-	//If all ways are full and no replacement policy active return 0
-	return 0;
+	return myCache;
 }
 
-cl_mem clCreateCacheBuffer(cl_context context, cl_mem_flags flags, size_t size, void* hostAddress, cl_int *errorcode_ret, struct Cache_t* cachePtr){
-	int set = GetIndex(cachePtr->indexBitMask, cachePtr->addressBitShift, hostAddress);
-	int way = GetWay(hostAddress, set, cachePtr);
-
-	if (!(((flags & CL_MEM_COPY_HOST_PTR) == CL_MEM_COPY_HOST_PTR) && (cachePtr->cacheLine[set][way].valid == true) && (cachePtr->cacheLine[set][way].tag == hostAddress))){
-		//Data is not in cache or is forced to update
-
-		//Find way to store data
-		if (way == -1) 
-			way = SetWay(set, cachePtr);
+struct Cache_t* CreateMultiDeviceCache(cl_context context, int numberOfDevices, const cl_command_queue* commandQueues, int numberOfCacheLines, int dataSize, int tagSize, enum CacheConfiguration_t config, enum ReplacementPolicy_t policy, cl_int *errorcode_ret) {
+	cl_int err = CL_SUCCESS;
 
-		if(hostAddress != NULL){
-			cachePtr->cacheLine[set][way].deviceData = clCreateBuffer(context,  flags | CL_MEM_COPY_HOST_PTR, cachePtr->dataSize, hostAddress, errorcode_ret);
-		}else if (hostAddress == NULL){
-			cachePtr->cacheLine[set][way].deviceData = clCreateBuffer(context,  flags, cachePtr->dataSize, hostAddress, errorcode_ret);
-		}
-		cachePtr->memCopies += 1;
-		if((flags & CL_MEM_COPY_HOST_PTR) == CL_MEM_COPY_HOST_PTR)
-			cachePtr->WriteTransfers += 1;
+	//The front end holds no lines itself, it only routes to the devices
+	Cache_t* myCache = (Cache_t*)calloc(1, sizeof(Cache_t));
+	myCache->context = context;
+	clRetainContext(context);
+	myCache->commandQueue = NULL;
+	myCache->dataSize = dataSize;
+	myCache->tagSize = tagSize;
+	myCache->config = config;
+	myCache->policy = policy;
+	myCache->writePolicy = no_write_back_WP;
+	myCache->device = (Cache_t**)calloc((numberOfDevices > 0) ? numberOfDevices : 1, sizeof(Cache_t*));
 
-		//Set the tag
-		cachePtr->cacheLine[set][way].tag = hostAddress;
+	if (numberOfDevices <= 0)
+		err = CL_INVALID_VALUE;
+	for (int i = 0; (i < numberOfDevices) && (err == CL_SUCCESS); i++) {
+		//Every device gets its own lines, the queue selects the device of its buffers
+		myCache->device[i] = CreateCache(context, commandQueues[i], numberOfCacheLines, dataSize, tagSize, config, policy, &err);
+		if (err != CL_SUCCESS)
+			break;
+		myCache->numberOfDevices++;
+	}
+
+	if (errorcode_ret != NULL)
+		*errorcode_ret = err;
+	if (err != CL_SUCCESS) {
+		FreeCache(myCache);
+		return NULL;
+	}
+	return myCache;
+}
+
+static int GetIndex(void* hostAddress, struct Cache_t* cachePtr) {
+	uint64_t address = (uint64_t)(uintptr_t)hostAddress >> cachePtr->addressBitShift;
+	uint64_t index = 0;
+
+	if (cachePtr->indexSize == 0)
+		return 0;
+	//A key has no offset bits within a line, the index function takes the key or its hash
+	if (cachePtr->keyed) {
+		uint64_t key = GetTagKey(hostAddress);
+		address = (cachePtr->keyHash != NULL) ? cachePtr->keyHash(key) : key;
+	}
+	switch (cachePtr->indexFunction)
+	{
+	case xor_fold_IF:
+		//Fold all address bits above the shift onto the index bits
+		while (address != 0) {
+			index ^= address & cachePtr->indexBitMask;
+			address >>= cachePtr->indexSize;
+		}
+		return (int)index;
+	case fibonacci_IF:
+		//Multiply with 2^64 divided by the golden ratio and take the top bits
+		return (int)((address * 11400714819323198485ull) >> (64 - cachePtr->indexSize));
+	case modulo_IF:
+	default:
+		return (int)(address & cachePtr->indexBitMask);
+	}
+}
+
+static int MatchTagsScalar(void* const* tags, const bool* valid, int count, void* hostAddress) {
+	for (int way = 0; way < count; way++) {
+		if ((valid[way] == true) && (tags[way] == hostAddress))
+			return way;
+	}
+	return -1;
+}
+
+#ifdef CACHE_X86_SIMD
+__attribute__((target("avx2")))
+static int MatchTagsAVX2(void* const* tags, const bool* valid, int count, void* hostAddress) {
+	__m256i key = _mm256_set1_epi64x((long long)(intptr_t)hostAddress);
+	int way = 0;
+
+	//Compare 4 tags per instruction, an invalid line can still hold an old tag so check the valid bit of each match
+	for (; way + 4 <= count; way += 4) {
+		__m256i tag = _mm256_loadu_si256((const __m256i*)&tags[way]);
+		int mask = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(tag, key)));
+		while (mask != 0) {
+			int lane = __builtin_ctz(mask);
+			if (valid[way + lane] == true)
+				return way + lane;
+			mask &= mask - 1;
+		}
+	}
+	int remainder = MatchTagsScalar(&tags[way], &valid[way], count - way, hostAddress);
+	return (remainder == -1) ? -1 : way + remainder;
+}
+
+__attribute__((target("avx512f")))
+static int MatchTagsAVX512(void* const* tags, const bool* valid, int count, void* hostAddress) {
+	__m512i key = _mm512_set1_epi64((long long)(intptr_t)hostAddress);
+	int way = 0;
+
+	//Compare 8 tags per instruction
+	for (; way + 8 <= count; way += 8) {
+		__m512i tag = _mm512_loadu_si512((const void*)&tags[way]);
+		unsigned int mask = _mm512_cmpeq_epi64_mask(tag, key);
+		while (mask != 0) {
+			int lane = __builtin_ctz(mask);
+			if (valid[way + lane] == true)
+				return way + lane;
+			mask &= mask - 1;
+		}
+	}
+	int remainder = MatchTagsAVX2(&tags[way], &valid[way], count - way, hostAddress);
+	return (remainder == -1) ? -1 : way + remainder;
+}
+#endif
+
+#ifdef CACHE_NEON_SIMD
+static int MatchTagsNEON(void* const* tags, const bool* valid, int count, void* hostAddress) {
+	uint64x2_t key = vdupq_n_u64((uint64_t)(uintptr_t)hostAddress);
+	int way = 0;
+
+	//Compare 4 tags per iteration in two 128 bit registers
+	for (; way + 4 <= count; way += 4) {
+		uint64x2_t low = vceqq_u64(vld1q_u64((const uint64_t*)&tags[way]), key);
+		uint64x2_t high = vceqq_u64(vld1q_u64((const uint64_t*)&tags[way + 2]), key);
+		if ((vmaxvq_u32(vreinterpretq_u32_u64(vorrq_u64(low, high)))) == 0)
+			continue;
+		int remainder = MatchTagsScalar(&tags[way], &valid[way], 4, hostAddress);
+		if (remainder != -1)
+			return way + remainder;
+	}
+	int remainder = MatchTagsScalar(&tags[way], &valid[way], count - way, hostAddress);
+	return (remainder == -1) ? -1 : way + remainder;
+}
+#endif
+
+static void SelectMatchTags(void) {
+#ifdef CACHE_X86_SIMD
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f"))
+		matchTags = MatchTagsAVX512;
+	else if (__builtin_cpu_supports("avx2"))
+		matchTags = MatchTagsAVX2;
+#elif defined(CACHE_NEON_SIMD)
+	matchTags = MatchTagsNEON;
+#endif
+}
+
+static struct FullyAssociativeIndex_t* CreateHashedIndex(int numberOfCacheLines) {
+	struct FullyAssociativeIndex_t* index = (struct FullyAssociativeIndex_t*)malloc(sizeof(struct FullyAssociativeIndex_t));
+	int numberOfSlots = 1;
+
+	//Keep the table at most half full so the probe sequences stay short
+	while (numberOfSlots < 2 * numberOfCacheLines)
+		numberOfSlots <<= 1;
+	index->slotMask = numberOfSlots - 1;
+	index->slot = (int*)malloc(numberOfSlots * sizeof(int));
+	for (int i = 0; i < numberOfSlots; i++)
+		index->slot[i] = -1;
+
+	index->next = (int*)malloc(numberOfCacheLines * sizeof(int));
+	index->prev = (int*)malloc(numberOfCacheLines * sizeof(int));
+	index->bucket = (int*)malloc(numberOfCacheLines * sizeof(int));
+	index->freeLines = (int*)malloc(numberOfCacheLines * sizeof(int));
+	index->bucketFrequency = (int*)malloc(numberOfCacheLines * sizeof(int));
+	index->bucketHead = (int*)malloc(numberOfCacheLines * sizeof(int));
+	index->bucketTail = (int*)malloc(numberOfCacheLines * sizeof(int));
+	index->bucketNext = (int*)malloc(numberOfCacheLines * sizeof(int));
+	index->bucketPrev = (int*)malloc(numberOfCacheLines * sizeof(int));
+	index->head = -1;
+	index->tail = -1;
+	index->firstBucket = -1;
+	index->lastBucket = -1;
+
+	//All lines start on the free stack, line 0 is used first
+	index->numberOfFreeLines = numberOfCacheLines;
+	for (int i = 0; i < numberOfCacheLines; i++) {
+		index->freeLines[i] = numberOfCacheLines - 1 - i;
+		index->prev[i] = UNLINKED_LINE;
+		index->next[i] = -1;
+		index->bucket[i] = -1;
+	}
+	//There can never be more frequency buckets than lines, chain them all on the free list
+	index->freeBucket = 0;
+	for (int i = 0; i < numberOfCacheLines; i++)
+		index->bucketNext[i] = (i + 1 < numberOfCacheLines) ? i + 1 : -1;
+
+	index->memoryAllocated = sizeof(struct FullyAssociativeIndex_t) + numberOfSlots * sizeof(int) + 9 * numberOfCacheLines * sizeof(int);
+	return index;
+}
+
+static void FreeHashedIndex(struct FullyAssociativeIndex_t* index) {
+	if (index == NULL)
+		return;
+	free(index->slot);
+	free(index->next);
+	free(index->prev);
+	free(index->bucket);
+	free(index->freeLines);
+	free(index->bucketFrequency);
+	free(index->bucketHead);
+	free(index->bucketTail);
+	free(index->bucketNext);
+	free(index->bucketPrev);
+	free(index);
+}
+
+static uint64_t HashAddress(void* hostAddress) {
+	//The finalizer of splitmix64, every input bit affects every output bit
+	uint64_t hash = (uint64_t)(uintptr_t)hostAddress;
+	hash = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9ull;
+	hash = (hash ^ (hash >> 27)) * 0x94d049bb133111ebull;
+	return hash ^ (hash >> 31);
+}
+
+static int FindHashedSlot(void* hostAddress, struct Cache_t* cachePtr) {
+	struct FullyAssociativeIndex_t* index = cachePtr->hashedIndex;
+	int slot = (int)(HashAddress(hostAddress) & index->slotMask);
+
+	//Linear probing, the table is never full so an empty slot ends the search
+	//The optimistic hits of ReadHit() probe without the lock
+	int line;
+	while ((line = LOAD_RELAXED(index->slot[slot])) != -1) {
+		if (LOAD_RELAXED(cachePtr->tag[line]) == hostAddress)
+			return slot;
+		slot = (slot + 1) & index->slotMask;
+	}
+	return -1;
+}
+
+static void RemoveHashedSlot(int slot, struct Cache_t* cachePtr) {
+	struct FullyAssociativeIndex_t* index = cachePtr->hashedIndex;
+	int next = slot;
+
+	//Shift the following entries back instead of leaving a tombstone
+	STORE_RELAXED(index->slot[slot], -1);
+	while (true) {
+		next = (next + 1) & index->slotMask;
+		if (index->slot[next] == -1)
+			return;
+		int home = (int)(HashAddress(cachePtr->tag[index->slot[next]]) & index->slotMask);
+		//Move the entry when its home slot is not between the empty slot and its current slot
+		if (((next > slot) && ((home <= slot) || (home > next))) || ((next < slot) && ((home <= slot) && (home > next)))) {
+			STORE_RELAXED(index->slot[slot], index->slot[next]);
+			STORE_RELAXED(index->slot[next], -1);
+			slot = next;
+		}
+	}
+}
+
+static void UnlinkHashedLine(int line, struct FullyAssociativeIndex_t* index) {
+	int bucket = index->bucket[line];
+	int* head = (bucket == -1) ? &index->head : &index->bucketHead[bucket];
+	int* tail = (bucket == -1) ? &index->tail : &index->bucketTail[bucket];
+
+	if (index->prev[line] == UNLINKED_LINE)
+		return;
+	if (index->prev[line] != -1)
+		index->next[index->prev[line]] = index->next[line];
+	else
+		*head = index->next[line];
+	if (index->next[line] != -1)
+		index->prev[index->next[line]] = index->prev[line];
+	else
+		*tail = index->prev[line];
+	index->prev[line] = UNLINKED_LINE;
+	index->next[line] = -1;
+	index->bucket[line] = -1;
+
+	//An empty frequency bucket goes back to the free list
+	if ((bucket != -1) && (index->bucketHead[bucket] == -1)) {
+		if (index->bucketPrev[bucket] != -1)
+			index->bucketNext[index->bucketPrev[bucket]] = index->bucketNext[bucket];
+		else
+			index->firstBucket = index->bucketNext[bucket];
+		if (index->bucketNext[bucket] != -1)
+			index->bucketPrev[index->bucketNext[bucket]] = index->bucketPrev[bucket];
+		else
+			index->lastBucket = index->bucketPrev[bucket];
+		index->bucketNext[bucket] = index->freeBucket;
+		index->freeBucket = bucket;
+	}
+}
+
+static void LinkHashedLine(int line, int bucket, struct FullyAssociativeIndex_t* index) {
+	if (bucket == -1) {
+		//The recency list has the most recent line at the head
+		index->prev[line] = -1;
+		index->next[line] = index->head;
+		if (index->head != -1)
+			index->prev[index->head] = line;
+		else
+			index->tail = line;
+		index->head = line;
+	} else {
+		//Within a frequency bucket new lines go to the tail, so the head is the oldest line
+		index->prev[line] = index->bucketTail[bucket];
+		index->next[line] = -1;
+		if (index->bucketTail[bucket] != -1)
+			index->next[index->bucketTail[bucket]] = line;
+		else
+			index->bucketHead[bucket] = line;
+		index->bucketTail[bucket] = line;
+	}
+	index->bucket[line] = bucket;
+}
+
+static int GetFrequencyBucket(int frequency, int previous, struct FullyAssociativeIndex_t* index) {
+	//The buckets are sorted on frequency, the bucket for frequency comes directly after previous
+	int next = (previous == -1) ? index->firstBucket : index->bucketNext[previous];
+	if ((next != -1) && (index->bucketFrequency[next] == frequency))
+		return next;
+
+	int bucket = index->freeBucket;
+	index->freeBucket = index->bucketNext[bucket];
+	index->bucketFrequency[bucket] = frequency;
+	index->bucketHead[bucket] = -1;
+	index->bucketTail[bucket] = -1;
+	index->bucketPrev[bucket] = previous;
+	index->bucketNext[bucket] = next;
+	if (previous != -1)
+		index->bucketNext[previous] = bucket;
+	else
+		index->firstBucket = bucket;
+	if (next != -1)
+		index->bucketPrev[next] = bucket;
+	else
+		index->lastBucket = bucket;
+	return bucket;
+}
+
+static void TouchHashedLine(int line, struct Cache_t* cachePtr) {
+	struct FullyAssociativeIndex_t* index = cachePtr->hashedIndex;
+
+	switch (cachePtr->policy)
+	{
+	case lru_RP:
+	case mru_RP:
+		UnlinkHashedLine(line, index);
+		LinkHashedLine(line, -1, index);
+		break;
+	case lfu_RP:
+	case mfu_RP: {
+		//Move the line to the bucket of the next frequency, the old bucket can become empty
+		int bucket = index->bucket[line];
+		int frequency = index->bucketFrequency[bucket] + 1;
+		int following = index->bucketNext[bucket];
+		if ((index->bucketHead[bucket] == line) && (index->bucketTail[bucket] == line) && ((following == -1) || (index->bucketFrequency[following] != frequency))) {
+			//The line is alone in its bucket, raising the frequency in place keeps the order and needs no free bucket
+			index->bucketFrequency[bucket] = frequency;
+			break;
+		}
+		//The old bucket keeps other lines or merges into the next one, so a free bucket is left when one is needed
+		int next = GetFrequencyBucket(frequency, bucket, index);
+		UnlinkHashedLine(line, index);
+		LinkHashedLine(line, next, index);
+		break;
+	}
+	case clock_RP:
+	case slru_RP:
+	case two_queue_RP:
+	case arc_RP:
+		//The scan resistant policies keep their state per way, the single set is set 0
+		TouchWay(0, line, cachePtr);
+		break;
+	default:
+		//FIFO and random do not change on a hit
+		break;
+	}
+}
+
+static void DecayHashedFrequencies(struct FullyAssociativeIndex_t* index) {
+	int previous = -1;
+	int bucket = index->firstBucket;
+
+	//Halve the frequency of every bucket, rounded up so no bucket drops below the frequency of a new line
+	while (bucket != -1) {
+		int next = index->bucketNext[bucket];
+		index->bucketFrequency[bucket] = (index->bucketFrequency[bucket] + 1) / 2;
+		if ((previous != -1) && (index->bucketFrequency[previous] == index->bucketFrequency[bucket])) {
+			//Two buckets ended up with the same frequency, append the lines of this bucket to the previous one
+			for (int line = index->bucketHead[bucket]; line != -1; line = index->next[line])
+				index->bucket[line] = previous;
+			index->prev[index->bucketHead[bucket]] = index->bucketTail[previous];
+			index->next[index->bucketTail[previous]] = index->bucketHead[bucket];
+			index->bucketTail[previous] = index->bucketTail[bucket];
+			index->bucketNext[previous] = next;
+			if (next != -1)
+				index->bucketPrev[next] = previous;
+			else
+				index->lastBucket = previous;
+			index->bucketNext[bucket] = index->freeBucket;
+			index->freeBucket = bucket;
+		} else {
+			previous = bucket;
+		}
+		bucket = next;
+	}
+}
+
+static int GetWayHashed(void* hostAddress, struct Cache_t* cachePtr) {
+	int slot = FindHashedSlot(hostAddress, cachePtr);
+
+	//With a single set the way is the line
+	return (slot != -1) ? cachePtr->hashedIndex->slot[slot] : -1;
+}
+
+static int SetWayHashed(void* hostAddress, struct Cache_t* cachePtr) {
+	struct FullyAssociativeIndex_t* index = cachePtr->hashedIndex;
+	int line = -1;
+
+	//Empty lines are used first, otherwise the victim is at the end of a list, pinned lines are passed over
+	if (index->numberOfFreeLines > 0) {
+		line = index->freeLines[--index->numberOfFreeLines];
+		if (IsScanResistant(cachePtr->policy))
+			InsertWay(hostAddress, 0, line, cachePtr);
+	} else if (IsScanResistant(cachePtr->policy)) {
+		//The scan resistant policies select their victim from the state of the ways
+		line = EvictWay(hostAddress, 0, cachePtr);
+		InsertWay(hostAddress, 0, line, cachePtr);
+		UnlinkHashedLine(line, index);
+	} else {
+		switch (cachePtr->policy)
+		{
+		case random_RP:
+			line = NextRandom(0, cachePtr) % cachePtr->numberOfLinesPerSet;
+			while (IsPinned(line, cachePtr))
+				line = (line + 1) % cachePtr->numberOfLinesPerSet;
+			break;
+		case mru_RP:
+			line = index->head;
+			while (IsPinned(line, cachePtr))
+				line = index->next[line];
+			break;
+		case lfu_RP:
+		case mfu_RP:
+			//The oldest unpinned line of the first bucket that has one
+			for (int bucket = (cachePtr->policy == lfu_RP) ? index->firstBucket : index->lastBucket; bucket != -1; 
+				bucket = (cachePtr->policy == lfu_RP) ? index->bucketNext[bucket] : index->bucketPrev[bucket]) {
+				line = index->bucketHead[bucket];
+				while ((line != -1) && IsPinned(line, cachePtr))
+					line = index->next[line];
+				if (line != -1)
+					break;
+			}
+			break;
+		case fifo_RP:
+		case lru_RP:
+		default:
+			line = index->tail;
+			while (IsPinned(line, cachePtr))
+				line = index->prev[line];
+			break;
+		}
+		UnlinkHashedLine(line, index);
+	}
+
+	//The line is linked as a new entry, its tag is updated by SetHashedTag()
+	if ((cachePtr->policy == lfu_RP) || (cachePtr->policy == mfu_RP))
+		LinkHashedLine(line, GetFrequencyBucket(1, -1, index), index);
+	else
+		LinkHashedLine(line, -1, index);
+	return line;
+}
+
+static void SetHashedTag(int line, void* hostAddress, struct Cache_t* cachePtr) {
+	struct FullyAssociativeIndex_t* index = cachePtr->hashedIndex;
+
+	if ((cachePtr->valid[line] == true) && (cachePtr->tag[line] == hostAddress))
+		return;
+	//Remove the evicted tag before the new one is inserted
+	if (cachePtr->valid[line] == true)
+		RemoveHashedSlot(FindHashedSlot(cachePtr->tag[line], cachePtr), cachePtr);
+	int slot = (int)(HashAddress(hostAddress) & index->slotMask);
+	while (index->slot[slot] != -1)
+		slot = (slot + 1) & index->slotMask;
+	STORE_RELAXED(index->slot[slot], line);
+}
+
+static void InvalidateLine(int line, struct Cache_t* cachePtr) {
+	struct FullyAssociativeIndex_t* index = cachePtr->hashedIndex;
+
+	if (index != NULL) {
+		if (cachePtr->valid[line] == true)
+			RemoveHashedSlot(FindHashedSlot(cachePtr->tag[line], cachePtr), cachePtr);
+		//A line that SetWayHashed() gave out but never got valid is linked as well
+		if (index->prev[line] != UNLINKED_LINE) {
+			UnlinkHashedLine(line, index);
+			index->freeLines[index->numberOfFreeLines++] = line;
+		}
+	}
+	if (cachePtr->valid[line] == true)
+		ADD_COUNTER(cachePtr->numberOfValidLines, -1);
+	STORE_RELAXED(cachePtr->valid[line], false);
+	cachePtr->dirty[line] = false;
+	cachePtr->deviceAuthoritative[line] = false;
+	STORE_RELAXED(cachePtr->tag[line], NULL);
+	cachePtr->hostData[line] = NULL;
+	cachePtr->metaData[line].nodeId = -1;
+	__atomic_store_n(&cachePtr->contentHash[line], 0, __ATOMIC_RELAXED);
+	//An empty line holds nothing to protect
+	if (cachePtr->pinCount[line] > 0)
+		ADD_COUNTER(cachePtr->numberOfPinnedLines, -1);
+	cachePtr->pinCount[line] = 0;
+}
+
+static bool IsPinned(int line, struct Cache_t* cachePtr) {
+	return (cachePtr->numberOfPinnedLines > 0) && (cachePtr->pinCount[line] > 0);
+}
+
+static int FirstUnpinnedWay(int setIndex, struct Cache_t* cachePtr) {
+	int first = setIndex * cachePtr->numberOfLinesPerSet;
+
+	for (int way = 0; way < cachePtr->numberOfLinesPerSet; way++) {
+		if (!IsPinned(first + way, cachePtr))
+			return way;
+	}
+	return -1;
+}
+
+static bool HasEvictableWay(int setIndex, struct Cache_t* cachePtr) {
+	//A fully associative cache has a free or unpinned line as long as not all lines are pinned
+	if (cachePtr->hashedIndex != NULL)
+		return __atomic_load_n(&cachePtr->numberOfPinnedLines, __ATOMIC_RELAXED) < cachePtr->numberOfLinesPerSet;
+	return FirstUnpinnedWay(setIndex, cachePtr) != -1;
+}
+
+static void PinLine(int line, struct Cache_t* cachePtr) {
+	if (cachePtr->pinCount[line]++ == 0)
+		ADD_COUNTER(cachePtr->numberOfPinnedLines, 1);
+}
+
+static void UnpinLine(int line, struct Cache_t* cachePtr) {
+	if ((cachePtr->pinCount[line] > 0) && (--cachePtr->pinCount[line] == 0))
+		ADD_COUNTER(cachePtr->numberOfPinnedLines, -1);
+}
+
+static bool PinBuffer(void* hostAddress, cl_mem deviceData, bool pin, struct Cache_t* cachePtr) {
+	//The line is in one of the size classes or devices, the buffer tells the copies on several devices apart
+	for (int i = 0; i < cachePtr->numberOfSizeClasses; i++) {
+		if (PinBuffer(hostAddress, deviceData, pin, cachePtr->sizeClass[i]))
+			return true;
+	}
+	for (int i = 0; i < cachePtr->numberOfDevices; i++) {
+		if (PinBuffer(hostAddress, deviceData, pin, cachePtr->device[i]))
+			return true;
+	}
+	if (cachePtr->numberOfSets == 0)
+		return false;
+
+	int set = GetIndex(hostAddress, cachePtr);
+	bool found = false;
+	LockSet(set, cachePtr);
+	int line = FindLine(hostAddress, cachePtr);
+	if ((line != -1) && (cachePtr->deviceData[line] == deviceData)) {
+		if (pin)
+			PinLine(line, cachePtr);
+		else
+			UnpinLine(line, cachePtr);
+		found = true;
+	}
+	UnlockSet(set, cachePtr);
+	return found;
+}
+
+static bool UnpinResolvedLine(void* hostAddress, cl_mem deviceData, const PinnedLine_t* pinnedLine) {
+	struct Cache_t* cachePtr = pinnedLine->owner;
+	if (cachePtr == NULL)
+		return false;
+
+	int line = pinnedLine->line;
+	int set = line / cachePtr->numberOfLinesPerSet;
+	LockSet(set, cachePtr);
+	//An invalidated line lost its pin, its index may already hold other data
+	if ((cachePtr->valid[line] == true) && (cachePtr->tag[line] == hostAddress) && (cachePtr->deviceData[line] == deviceData))
+		UnpinLine(line, cachePtr);
+	UnlockSet(set, cachePtr);
+	return true;
+}
+
+static void CL_CALLBACK PinEventCallback(cl_event event, cl_int status, void* userData) {
+	//The callback runs on a thread of the OpenCL runtime, the pin is released by the next call on the cache
+	PinnedBuffer_t* pinnedBuffer = (PinnedBuffer_t*)userData;
+	(void)event;
+	pinnedBuffer->status = status;
+	__atomic_store_n(&pinnedBuffer->completed, true, __ATOMIC_RELEASE);
+}
+
+static void ReleaseCompletedPins(bool wait, struct Cache_t* cachePtr) {
+	PinnedBuffer_t* completed = NULL;
+
+	if (__atomic_load_n(&cachePtr->pendingPins, __ATOMIC_ACQUIRE) == NULL)
+		return;
+	if (cachePtr->threadSafe)
+		pthread_mutex_lock(&cachePtr->pinLock);
+	PinnedBuffer_t** link = &cachePtr->pendingPins;
+	while (*link != NULL) {
+		PinnedBuffer_t* pinnedBuffer = *link;
+		if (wait) {
+			//The callback may still run after the event completed, the node is freed after it finished
+			clWaitForEvents(1, &pinnedBuffer->event);
+			while (!__atomic_load_n(&pinnedBuffer->completed, __ATOMIC_ACQUIRE))
+				sched_yield();
+		}
+		if (__atomic_load_n(&pinnedBuffer->completed, __ATOMIC_ACQUIRE)) {
+			*link = pinnedBuffer->next;
+			pinnedBuffer->next = completed;
+			completed = pinnedBuffer;
+		} else {
+			link = &pinnedBuffer->next;
+		}
+	}
+	if (cachePtr->threadSafe)
+		pthread_mutex_unlock(&cachePtr->pinLock);
+
+	//The lines are unpinned without the pinLock, PinBuffer() takes the locks of the sets
+	while (completed != NULL) {
+		PinnedBuffer_t* next = completed->next;
+		//A command that terminated with an error may not have released the buffer, its line stays pinned
+		if (completed->status >= 0)
+			PinBuffer(completed->hostAddress, completed->deviceData, false, cachePtr);
+		clReleaseEvent(completed->event);
+		free(completed);
+		completed = next;
+	}
+}
+
+static int GetWay( void* hostAddress, int setIndex, struct Cache_t* cachePtr) {
+	if (cachePtr->hashedIndex != NULL)
+		return GetWayHashed(hostAddress, cachePtr);
+
+	int numberOfLinesPerSet = cachePtr->numberOfLinesPerSet;
+	int first = setIndex * numberOfLinesPerSet;
+
+	if(cachePtr->config==direct_mapped){
+		//For direct mapped cache the way is always 0
+		return 0;
+	}	
+
+	//Find the way with valid data and the correct tag, -1 when there is none.
+	return matchTags(&cachePtr->tag[first], &cachePtr->valid[first], numberOfLinesPerSet, hostAddress);
+}
+
+static void AccessWay(int setIndex, int way, struct Cache_t* cachePtr) {
+	if (cachePtr->hashedIndex != NULL) {
+		if (way != -1)
+			TouchHashedLine(way, cachePtr);
+		if (cachePtr->policy == lfu_RP || cachePtr->policy == mfu_RP)
+			CountFrequencyAccess(0, cachePtr);
+		return;
+	}
+	//A direct mapped set has a single way, it has no replacement state
+	if (cachePtr->config == direct_mapped)
+		return;
+
+	int first = setIndex * cachePtr->numberOfLinesPerSet;
+	enum ReplacementPolicy_t policy = GetSetPolicy(setIndex, cachePtr);
+	if (way != -1) {
+		//It is in cache, update replacement policies for accessed way
+		if (policy == lru_RP || policy == mru_RP) {
+			STORE_RELAXED(cachePtr->accessedOrder[first + way], NextStamp(setIndex, cachePtr));
+		}
+		else if (policy == lfu_RP || policy == mfu_RP) {
+			STORE_RELAXED(cachePtr->accessedOrder[first + way], LOAD_RELAXED(cachePtr->accessedOrder[first + way]) + 1);
+		}
+		else
+			TouchWay(setIndex, way, cachePtr);
+	}
+	if (policy == lfu_RP || policy == mfu_RP)
+		CountFrequencyAccess(setIndex, cachePtr);
+}
+
+static enum ReplacementPolicy_t GetSetPolicy(int setIndex, struct Cache_t* cachePtr) {
+	if (cachePtr->setPolicy == NULL)
+		return cachePtr->policy;
+	int leader = GetLeaderGroup(setIndex, cachePtr);
+	enum ReplacementPolicy_t policy = (leader != -1) ? cachePtr->duelPolicy[leader] 
+		: cachePtr->duelPolicy[__atomic_load_n(&cachePtr->duelWinner, __ATOMIC_RELAXED)];
+	//A follower set converts its state when the winner changed since its last access
+	if (cachePtr->setPolicy[setIndex] != (unsigned char)policy) {
+		ConvertSetPolicy(setIndex, (enum ReplacementPolicy_t)cachePtr->setPolicy[setIndex], policy, cachePtr);
+		cachePtr->setPolicy[setIndex] = (unsigned char)policy;
+	}
+	return policy;
+}
+
+static int GetLeaderGroup(int setIndex, struct Cache_t* cachePtr) {
+	//The leader sets are spread over the cache, one set of each group per period
+	int offset = setIndex % cachePtr->duelPeriod;
+	if (offset == 0)
+		return 0;
+	if (offset == cachePtr->duelPeriod / 2)
+		return 1;
+	return -1;
+}
+
+static void CountDuelMiss(int setIndex, struct Cache_t* cachePtr) {
+	int leader = GetLeaderGroup(setIndex, cachePtr);
+	int counter, next;
+
+	if (leader == -1)
+		return;
+	ADD_COUNTER(cachePtr->DuelMisses[leader], 1);
+	//A miss of the first group moves the counter up towards the second policy, saturating at both ends
+	counter = __atomic_load_n(&cachePtr->duelCounter, __ATOMIC_RELAXED);
+	do {
+		next = (leader == 0) ? counter + 1 : counter - 1;
+		if ((next < 0) || (next > DUEL_COUNTER_MAX))
+			return;
+	} while (!__atomic_compare_exchange_n(&cachePtr->duelCounter, &counter, next, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+	int winner = (next > DUEL_COUNTER_MAX / 2) ? 1 : 0;
+	if (__atomic_exchange_n(&cachePtr->duelWinner, winner, __ATOMIC_RELAXED) != winner)
+		ADD_COUNTER(cachePtr->PolicySwitches, 1);
+}
+
+static int GetWayAge(int setIndex, int way, enum ReplacementPolicy_t policy, struct Cache_t* cachePtr) {
+	int numberOfLinesPerSet = cachePtr->numberOfLinesPerSet;
+
+	//The next victim of a FIFO is the oldest way, random_RP and clock_RP keep no order
+	if (policy == fifo_RP)
+		return (way - LOAD_RELAXED(cachePtr->replacementLine[setIndex]) - 1 + 2 * numberOfLinesPerSet) % numberOfLinesPerSet;
+	if ((policy == random_RP) || (policy == clock_RP))
+		return way;
+	//A recency stamp or a frequency
+	return LOAD_RELAXED(cachePtr->accessedOrder[setIndex * numberOfLinesPerSet + way]);
+}
+
+static void ConvertSetPolicy(int setIndex, enum ReplacementPolicy_t from, enum ReplacementPolicy_t to, struct Cache_t* cachePtr) {
+	int numberOfLinesPerSet = cachePtr->numberOfLinesPerSet;
+	int first = setIndex * numberOfLinesPerSet;
+	int age[numberOfLinesPerSet];
+	int oldestWay = 0;
+
+	//The age of every way under the old policy, so the new policy evicts the same ways first
+	for (int way = 0; way < numberOfLinesPerSet; way++) {
+		age[way] = GetWayAge(setIndex, way, from, cachePtr);
+		if (age[way] < age[oldestWay])
+			oldestWay = way;
+	}
+	switch (to)
+	{
+	case lru_RP:
+	case mru_RP:
+		//The stamps become the ranks of the ages, the stamp counter continues after them
+		for (int way = 0; way < numberOfLinesPerSet; way++) {
+			int rank = 1;
+			for (int other = 0; other < numberOfLinesPerSet; other++) {
+				if ((age[other] < age[way]) || ((age[other] == age[way]) && (other < way)))
+					rank++;
+			}
+			STORE_RELAXED(cachePtr->accessedOrder[first + way], rank);
+		}
+		STORE_RELAXED(cachePtr->replacementLine[setIndex], numberOfLinesPerSet);
+		break;
+	case lfu_RP:
+	case mfu_RP:
+		//Stamps are no frequencies, every line starts again as seen once
+		if ((from != lfu_RP) && (from != mfu_RP)) {
+			for (int way = 0; way < numberOfLinesPerSet; way++)
+				STORE_RELAXED(cachePtr->accessedOrder[first + way], 1);
+		}
+		break;
+	case fifo_RP:
+		//The next victim of the FIFO is the oldest way
+		STORE_RELAXED(cachePtr->replacementLine[setIndex], (oldestWay + numberOfLinesPerSet - 1) % numberOfLinesPerSet);
+		break;
+	default:
+		break;
+	}
+}
+
+static int NextStamp(int setIndex, struct Cache_t* cachePtr) {
+	int numberOfLinesPerSet = cachePtr->numberOfLinesPerSet;
+	int first = setIndex * numberOfLinesPerSet;
+
+	//Halve all stamps of the set long before the counter can overflow, the order of the stamps stays the same
+	int counter = LOAD_RELAXED(cachePtr->replacementLine[setIndex]);
+	if (counter >= STAMP_LIMIT) {
+		for (int i = first; i < first + numberOfLinesPerSet; i++) {
+			STORE_RELAXED(cachePtr->accessedOrder[i], LOAD_RELAXED(cachePtr->accessedOrder[i]) >> 1);
+			if (cachePtr->ghostOrder != NULL)
+				cachePtr->ghostOrder[i] >>= 1;
+		}
+		//An optimistic hit may take a stamp meanwhile, the exchange keeps its increment
+		while (!__atomic_compare_exchange_n(&cachePtr->replacementLine[setIndex], &counter, counter >> 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+	}
+	//Optimistic hits of a thread safe cache take stamps without the lock
+	return __atomic_add_fetch(&cachePtr->replacementLine[setIndex], 1, __ATOMIC_RELAXED);
+}
+
+static void CountFrequencyAccess(int setIndex, struct Cache_t* cachePtr) {
+	int first = setIndex * cachePtr->numberOfLinesPerSet;
+
+	//After decayPeriod accesses to the set all its counts are halved, so old popularity fades out
+	if ((cachePtr->decayPeriod <= 0) || (++cachePtr->decayCounter[setIndex] < cachePtr->decayPeriod))
+		return;
+	cachePtr->decayCounter[setIndex] = 0;
+	if (cachePtr->hashedIndex != NULL) {
+		DecayHashedFrequencies(cachePtr->hashedIndex);
+		return;
+	}
+	for (int i = first; i < first + cachePtr->numberOfLinesPerSet; i++)
+		STORE_RELAXED(cachePtr->accessedOrder[i], (LOAD_RELAXED(cachePtr->accessedOrder[i]) + 1) / 2);
+}
+
+static bool IsScanResistant(enum ReplacementPolicy_t policy) {
+	return (policy == clock_RP) || (policy == slru_RP) || (policy == two_queue_RP) || (policy == arc_RP);
+}
+
+static void TouchWay(int setIndex, int way, struct Cache_t* cachePtr) {
+	int numberOfLinesPerSet = cachePtr->numberOfLinesPerSet;
+	int line = setIndex * numberOfLinesPerSet + way;
+
+	switch (cachePtr->policy)
+	{
+	case clock_RP:
+		STORE_RELAXED(cachePtr->lineState[line], 1);
+		break;
+	case slru_RP: {
+		//A hit in probation promotes the line, the protected segment holds at most 3/4 of the ways
+		int protectedWays = (3 * numberOfLinesPerSet) / 4;
+		if (protectedWays < 1)
+			protectedWays = 1;
+		STORE_RELAXED(cachePtr->lineState[line], FREQUENT_SEGMENT);
+		STORE_RELAXED(cachePtr->accessedOrder[line], NextStamp(setIndex, cachePtr));
+		//The least recently used protected line gets an other chance in probation, pinned lines stay protected
+		int demotedWay = (CountWays(setIndex, FREQUENT_SEGMENT, cachePtr) > protectedWays) ? OldestWay(setIndex, FREQUENT_SEGMENT, cachePtr) : -1;
+		if (demotedWay != -1) {
+			int demoted = setIndex * numberOfLinesPerSet + demotedWay;
+			STORE_RELAXED(cachePtr->lineState[demoted], RECENT_SEGMENT);
+			STORE_RELAXED(cachePtr->accessedOrder[demoted], NextStamp(setIndex, cachePtr));
+		}
+		break;
+	}
+	case two_queue_RP:
+		//The FIFO segment ignores hits, the main segment is LRU
+		if (LOAD_RELAXED(cachePtr->lineState[line]) == FREQUENT_SEGMENT)
+			STORE_RELAXED(cachePtr->accessedOrder[line], NextStamp(setIndex, cachePtr));
+		break;
+	case arc_RP:
+		//A second access moves the line to the frequency segment
+		STORE_RELAXED(cachePtr->lineState[line], FREQUENT_SEGMENT);
+		STORE_RELAXED(cachePtr->accessedOrder[line], NextStamp(setIndex, cachePtr));
+		break;
+	default:
+		break;
+	}
+}
+
+static int OldestWay(int setIndex, int state, struct Cache_t* cachePtr) {
+	int first = setIndex * cachePtr->numberOfLinesPerSet;
+	int oldestWay = -1;
+
+	//The unpinned valid way of the segment with the lowest accessed order, -1 when there is none
+	for (int way = 0; way < cachePtr->numberOfLinesPerSet; way++) {
+		if ((cachePtr->valid[first + way] == true) && (LOAD_RELAXED(cachePtr->lineState[first + way]) == state) && !IsPinned(first + way, cachePtr)) {
+			if ((oldestWay == -1) || (LOAD_RELAXED(cachePtr->accessedOrder[first + way]) < LOAD_RELAXED(cachePtr->accessedOrder[first + oldestWay])))
+				oldestWay = way;
+		}
+	}
+	return oldestWay;
+}
+
+static int CountWays(int setIndex, int state, struct Cache_t* cachePtr) {
+	int first = setIndex * cachePtr->numberOfLinesPerSet;
+	int count = 0;
+
+	for (int way = 0; way < cachePtr->numberOfLinesPerSet; way++) {
+		if ((cachePtr->valid[first + way] == true) && (LOAD_RELAXED(cachePtr->lineState[first + way]) == state))
+			count++;
+	}
+	return count;
+}
+
+static int FindGhost(void* hostAddress, int setIndex, struct Cache_t* cachePtr) {
+	int first = setIndex * cachePtr->numberOfLinesPerSet;
+
+	for (int i = 0; i < cachePtr->numberOfLinesPerSet; i++) {
+		if ((cachePtr->ghostState[first + i] != 0) && (cachePtr->ghostTag[first + i] == hostAddress))
+			return first + i;
+	}
+	return -1;
+}
+
+static int CountGhosts(int setIndex, int state, struct Cache_t* cachePtr) {
+	int first = setIndex * cachePtr->numberOfLinesPerSet;
+	int count = 0;
+
+	for (int i = 0; i < cachePtr->numberOfLinesPerSet; i++) {
+		if (cachePtr->ghostState[first + i] == state)
+			count++;
+	}
+	return count;
+}
+
+static void DropOldestGhost(int setIndex, int state, struct Cache_t* cachePtr) {
+	int first = setIndex * cachePtr->numberOfLinesPerSet;
+	int oldest = -1;
+
+	//State 0 drops the oldest ghost of any segment
+	for (int i = first; i < first + cachePtr->numberOfLinesPerSet; i++) {
+		if ((cachePtr->ghostState[i] != 0) && ((state == 0) || (cachePtr->ghostState[i] == state))) {
+			if ((oldest == -1) || (cachePtr->ghostOrder[i] < cachePtr->ghostOrder[oldest]))
+				oldest = i;
+		}
+	}
+	if (oldest != -1)
+		cachePtr->ghostState[oldest] = 0;
+}
+
+static void AddGhost(void* hostAddress, int setIndex, int state, struct Cache_t* cachePtr) {
+	int first = setIndex * cachePtr->numberOfLinesPerSet;
+
+	//There is one ghost per way, when all are in use the oldest one is forgotten
+	if (CountGhosts(setIndex, 0, cachePtr) == 0)
+		DropOldestGhost(setIndex, 0, cachePtr);
+	for (int i = first; i < first + cachePtr->numberOfLinesPerSet; i++) {
+		if (cachePtr->ghostState[i] == 0) {
+			cachePtr->ghostTag[i] = hostAddress;
+			cachePtr->ghostState[i] = state;
+			cachePtr->ghostOrder[i] = NextStamp(setIndex, cachePtr);
+			return;
+		}
+	}
+}
+
+static int EvictWay(void* hostAddress, int setIndex, struct Cache_t* cachePtr) {
+	int numberOfLinesPerSet = cachePtr->numberOfLinesPerSet;
+	int first = setIndex * numberOfLinesPerSet;
+	int way = -1;
+
+	switch (cachePtr->policy)
+	{
+	case clock_RP:
+		//Advance the hand over the referenced ways and clear their bit, stop at the first unreferenced way
+		//Pinned ways are passed over without clearing their bit
+		way = LOAD_RELAXED(cachePtr->replacementLine[setIndex]);
+		while ((LOAD_RELAXED(cachePtr->lineState[first + way]) != 0) || IsPinned(first + way, cachePtr)) {
+			if (!IsPinned(first + way, cachePtr))
+				STORE_RELAXED(cachePtr->lineState[first + way], 0);
+			way = (way + 1) % numberOfLinesPerSet;
+		}
+		STORE_RELAXED(cachePtr->replacementLine[setIndex], (way + 1) % numberOfLinesPerSet);
+		return way;
+	case slru_RP:
+		//Probation lines go first, only a set with all lines protected evicts a protected line
+		way = OldestWay(setIndex, RECENT_SEGMENT, cachePtr);
+		if (way == -1)
+			way = OldestWay(setIndex, FREQUENT_SEGMENT, cachePtr);
+		return way;
+	case two_queue_RP: {
+		//The FIFO segment may hold 1/4 of the ways, the tags it evicts are remembered for 1/2 of the ways
+		int fifoWays = (numberOfLinesPerSet / 4 > 0) ? numberOfLinesPerSet / 4 : 1;
+		int ghostWays = (numberOfLinesPerSet / 2 > 0) ? numberOfLinesPerSet / 2 : 1;
+		if ((CountWays(setIndex, RECENT_SEGMENT, cachePtr) > fifoWays) || (CountWays(setIndex, FREQUENT_SEGMENT, cachePtr) == 0)) {
+			way = OldestWay(setIndex, RECENT_SEGMENT, cachePtr);
+			if (way != -1) {
+				if (CountGhosts(setIndex, RECENT_SEGMENT, cachePtr) >= ghostWays)
+					DropOldestGhost(setIndex, RECENT_SEGMENT, cachePtr);
+				AddGhost(cachePtr->tag[first + way], setIndex, RECENT_SEGMENT, cachePtr);
+			}
+		}
+		//A segment with only pinned ways leaves the victim to the other segment
+		if (way == -1)
+			way = OldestWay(setIndex, FREQUENT_SEGMENT, cachePtr);
+		if (way == -1)
+			way = OldestWay(setIndex, RECENT_SEGMENT, cachePtr);
+		return way;
+	}
+	case arc_RP: {
+		int ghost = FindGhost(hostAddress, setIndex, cachePtr);
+		int recentWays = CountWays(setIndex, RECENT_SEGMENT, cachePtr);
+		int recentGhosts = CountGhosts(setIndex, RECENT_SEGMENT, cachePtr);
+		int frequentGhosts = CountGhosts(setIndex, FREQUENT_SEGMENT, cachePtr);
+		int* target = &cachePtr->arcTarget[setIndex];
+		bool frequentGhostHit = false;
+
+		if ((ghost != -1) && (cachePtr->ghostState[ghost] == RECENT_SEGMENT)) {
+			//The recency segment was too small, grow its target
+			*target += (frequentGhosts > recentGhosts) ? frequentGhosts / recentGhosts : 1;
+			if (*target > numberOfLinesPerSet)
+				*target = numberOfLinesPerSet;
+		} else if (ghost != -1) {
+			//The frequency segment was too small, shrink the recency target
+			*target -= (recentGhosts > frequentGhosts) ? recentGhosts / frequentGhosts : 1;
+			if (*target < 0)
+				*target = 0;
+			frequentGhostHit = true;
+		} else if (recentWays + recentGhosts >= numberOfLinesPerSet) {
+			//The recency segment and its ghosts are full
+			if (recentGhosts == 0) {
+				//Without ghosts to drop the oldest recent line is evicted without a ghost
+				way = OldestWay(setIndex, RECENT_SEGMENT, cachePtr);
+				return (way != -1) ? way : OldestWay(setIndex, FREQUENT_SEGMENT, cachePtr);
+			}
+			DropOldestGhost(setIndex, RECENT_SEGMENT, cachePtr);
+		} else if (recentGhosts + frequentGhosts >= numberOfLinesPerSet) {
+			DropOldestGhost(setIndex, FREQUENT_SEGMENT, cachePtr);
+		}
+
+		//Evict from the recency segment when it is larger than its target
+		if ((recentWays >= 1) && (((frequentGhostHit) && (recentWays == *target)) || (recentWays > *target))) {
+			way = OldestWay(setIndex, RECENT_SEGMENT, cachePtr);
+			if (way != -1)
+				AddGhost(cachePtr->tag[first + way], setIndex, RECENT_SEGMENT, cachePtr);
+		}
+		if (way == -1) {
+			way = OldestWay(setIndex, FREQUENT_SEGMENT, cachePtr);
+			if (way == -1)
+				way = OldestWay(setIndex, RECENT_SEGMENT, cachePtr);
+			AddGhost(cachePtr->tag[first + way], setIndex, LOAD_RELAXED(cachePtr->lineState[first + way]), cachePtr);
+		}
+		return way;
+	}
+	default:
+		break;
+	}
+	return 0;
+}
+
+static void InsertWay(void* hostAddress, int setIndex, int way, struct Cache_t* cachePtr) {
+	int line = setIndex * cachePtr->numberOfLinesPerSet + way;
+
+	//The replacementLine of a clock_RP set is its hand, the other policies count accesses in it
+	if (cachePtr->policy != clock_RP)
+		STORE_RELAXED(cachePtr->accessedOrder[line], NextStamp(setIndex, cachePtr));
+	switch (cachePtr->policy)
+	{
+	case clock_RP:
+		//A new line is unreferenced, a one-pass scan is evicted on the first turn of the hand
+		STORE_RELAXED(cachePtr->lineState[line], 0);
+		break;
+	case slru_RP:
+		STORE_RELAXED(cachePtr->lineState[line], RECENT_SEGMENT);
+		break;
+	case two_queue_RP:
+	case arc_RP: {
+		//A tag that was evicted not long ago is reused, it goes directly to the frequency segment
+		int ghost = FindGhost(hostAddress, setIndex, cachePtr);
+		STORE_RELAXED(cachePtr->lineState[line], RECENT_SEGMENT);
+		if (ghost != -1) {
+			cachePtr->ghostState[ghost] = 0;
+			STORE_RELAXED(cachePtr->lineState[line], FREQUENT_SEGMENT);
+		}
+		break;
+	}
+	default:
+		break;
+	}
+}
+
+static int SetWay(void* hostAddress, int setIndex, struct Cache_t* cachePtr) {
+	if (cachePtr->hashedIndex != NULL)
+		return SetWayHashed(hostAddress, cachePtr);
+
+	int numberOfLinesPerSet = cachePtr->numberOfLinesPerSet;
+	int first = setIndex * numberOfLinesPerSet;
+	//Pinned ways are never replaced, EnqueueSetLine() made sure the set has an other way
+	int replacementWay = FirstUnpinnedWay(setIndex, cachePtr);
+	switch (GetSetPolicy(setIndex, cachePtr))
+	{
+	case clock_RP:
+	case slru_RP:
+	case two_queue_RP:
+	case arc_RP:
+		//Check for empty ways
+		replacementWay = -1;
+		for (int way = 0; way < numberOfLinesPerSet; way++) {
+			if (cachePtr->valid[first + way] != true) {
+				replacementWay = way;
+				break;
+			}
+		}
+		if (replacementWay == -1)
+			replacementWay = EvictWay(hostAddress, setIndex, cachePtr);
+		InsertWay(hostAddress, setIndex, replacementWay, cachePtr);
+		return replacementWay;
+	case random_RP:
+		//Check for empty ways
+		for (int way = 0; way < numberOfLinesPerSet; way++) {
+			if (cachePtr->valid[first + way] != true)
+				return way;
+		};
+		replacementWay = NextRandom(setIndex, cachePtr) % numberOfLinesPerSet;
+		while (IsPinned(first + replacementWay, cachePtr))
+			replacementWay = (replacementWay + 1) % numberOfLinesPerSet;
+		return replacementWay;
+	case fifo_RP:
+		do {
+			STORE_RELAXED(cachePtr->replacementLine[setIndex], (LOAD_RELAXED(cachePtr->replacementLine[setIndex]) + 1) % numberOfLinesPerSet);
+		} while (IsPinned(first + LOAD_RELAXED(cachePtr->replacementLine[setIndex]), cachePtr));
+		return LOAD_RELAXED(cachePtr->replacementLine[setIndex]);
+	case lru_RP:
+		for (int way = 0; way < numberOfLinesPerSet; way++) {
+			if (IsPinned(first + way, cachePtr))
+				continue;
+			if (LOAD_RELAXED(cachePtr->accessedOrder[first + way]) < LOAD_RELAXED(cachePtr->accessedOrder[first + replacementWay]))
+				replacementWay = way;
+		};
+		STORE_RELAXED(cachePtr->accessedOrder[first + replacementWay], NextStamp(setIndex, cachePtr));
+		return replacementWay;
+	case mru_RP:
+		for (int way = 0; way < numberOfLinesPerSet; way++) {
+			//Check for empty ways
+			if (cachePtr->valid[first + way] != true) {
+				replacementWay = way;
+				break;
+			}
+			//Find the unpinned way with the highest accessed order
+			if (IsPinned(first + way, cachePtr))
+				continue;
+			if (LOAD_RELAXED(cachePtr->accessedOrder[first + way]) > LOAD_RELAXED(cachePtr->accessedOrder[first + replacementWay]))
+				replacementWay = way;
+		};
+		STORE_RELAXED(cachePtr->accessedOrder[first + replacementWay], NextStamp(setIndex, cachePtr));
+		return replacementWay;
+	case lfu_RP:
+		for (int way = 0; way < numberOfLinesPerSet; way++) {
+			if (IsPinned(first + way, cachePtr))
+				continue;
+			if (LOAD_RELAXED(cachePtr->accessedOrder[first + way]) < LOAD_RELAXED(cachePtr->accessedOrder[first + replacementWay]))
+				replacementWay = way;
+		};
+		STORE_RELAXED(cachePtr->accessedOrder[first + replacementWay], 1);
+		return replacementWay;
+	case mfu_RP:
+		for (int way = 0; way < numberOfLinesPerSet; way++) {
+			//Check for empty ways
+			if (cachePtr->valid[first + way] != true) {
+				replacementWay = way;
+				break;
+			}
+			//Find the unpinned way with the highest accessed order
+			if (IsPinned(first + way, cachePtr))
+				continue;
+			if (LOAD_RELAXED(cachePtr->accessedOrder[first + way]) > LOAD_RELAXED(cachePtr->accessedOrder[first + replacementWay]))
+				replacementWay = way;
+		};
+		STORE_RELAXED(cachePtr->accessedOrder[first + replacementWay], 1);
+		return replacementWay;
+	default:
+		break;
+	}
+	//If all ways are full and no replacement policy active return 0
+	return 0;
+}
+
+static cl_int WaitStagingBuffer(int buffer, struct Cache_t* cachePtr) {
+	cl_int err = CL_SUCCESS;
+
+	if (cachePtr->stagingEvent[buffer] != NULL) {
+		err = clWaitForEvents(1, &cachePtr->stagingEvent[buffer]);
+		clReleaseEvent(cachePtr->stagingEvent[buffer]);
+		cachePtr->stagingEvent[buffer] = NULL;
+	}
+	return err;
+}
+
+static int TakeStagingBuffer(struct Cache_t* cachePtr) {
+	int buffer = cachePtr->nextStagingBuffer;
+
+	//The buffers are used round robin, a buffer is free again when its last transfer finished
+	cachePtr->nextStagingBuffer = (buffer + 1) % cachePtr->numberOfStagingBuffers;
+	WaitStagingBuffer(buffer, cachePtr);
+	return buffer;
+}
+
+static cl_int EnqueueHostWrite(cl_command_queue command_queue, cl_mem deviceData, cl_bool blocking_write, size_t offset, size_t size, const void* ptr, cl_uint num_events_in_wait_list, const cl_event *event_wait_list, cl_event *event, struct Cache_t* cachePtr) {
+	if (cachePtr->profile == NULL)
+		return WriteHostData(command_queue, deviceData, blocking_write, offset, size, ptr, num_events_in_wait_list, event_wait_list, event, cachePtr);
+	//A profiled transfer always gets an event, the caller only keeps it when it asked for one
+	cl_event profileEvent = NULL;
+	cl_int err = WriteHostData(command_queue, deviceData, blocking_write, offset, size, ptr, num_events_in_wait_list, event_wait_list, &profileEvent, cachePtr);
+	HandOverProfileEvent(profileEvent, to_device_PK, size, event, cachePtr->profile);
+	return err;
+}
+
+static cl_int EnqueueHostRead(cl_command_queue command_queue, cl_mem deviceData, cl_bool blocking_read, size_t offset, size_t size, void* ptr, cl_uint num_events_in_wait_list, const cl_event *event_wait_list, cl_event *event, struct Cache_t* cachePtr) {
+	if (cachePtr->profile == NULL)
+		return ReadHostData(command_queue, deviceData, blocking_read, offset, size, ptr, num_events_in_wait_list, event_wait_list, event, cachePtr);
+	cl_event profileEvent = NULL;
+	cl_int err = ReadHostData(command_queue, deviceData, blocking_read, offset, size, ptr, num_events_in_wait_list, event_wait_list, &profileEvent, cachePtr);
+	HandOverProfileEvent(profileEvent, to_host_PK, size, event, cachePtr->profile);
+	return err;
+}
+
+static cl_int WriteHostData(cl_command_queue command_queue, cl_mem deviceData, cl_bool blocking_write, size_t offset, size_t size, const void* ptr, cl_uint num_events_in_wait_list, const cl_event *event_wait_list, cl_event *event, struct Cache_t* cachePtr) {
+	cl_int err = CL_SUCCESS;
+	if (cachePtr->memoryBackend != copy_MB)
+		return SyncHostMemory(false, command_queue, deviceData, blocking_write, offset, size, (void*)ptr, num_events_in_wait_list, event_wait_list, event, cachePtr);
+	if (WriteZeroBlocks(command_queue, deviceData, blocking_write, offset, size, ptr, num_events_in_wait_list, event_wait_list, event, &err, cachePtr))
+		return err;
+	if ((cachePtr->numberOfTransferQueues > 0) && (size >= 2 * cachePtr->transferChunkSize))
+		err = EnqueueSplitTransfer(false, command_queue, deviceData, blocking_write, offset, size, (void*)ptr, num_events_in_wait_list, event_wait_list, event, cachePtr);
+	else
+		err = StageWrite(command_queue, deviceData, blocking_write, offset, size, ptr, num_events_in_wait_list, event_wait_list, event, cachePtr);
+	if (err == CL_SUCCESS)
+		ADD_COUNTER(cachePtr->BytesToDevice, (uint64_t)size);
+	return err;
+}
+
+static cl_int ReadHostData(cl_command_queue command_queue, cl_mem deviceData, cl_bool blocking_read, size_t offset, size_t size, void* ptr, cl_uint num_events_in_wait_list, const cl_event *event_wait_list, cl_event *event, struct Cache_t* cachePtr) {
+	cl_int err = CL_SUCCESS;
+	if (cachePtr->memoryBackend != copy_MB)
+		return SyncHostMemory(true, command_queue, deviceData, blocking_read, offset, size, ptr, num_events_in_wait_list, event_wait_list, event, cachePtr);
+	if (ReadZeroBlocks(command_queue, deviceData, blocking_read, offset, size, ptr, num_events_in_wait_list, event_wait_list, event, &err, cachePtr))
+		return err;
+	if ((cachePtr->numberOfTransferQueues > 0) && (size >= 2 * cachePtr->transferChunkSize))
+		err = EnqueueSplitTransfer(true, command_queue, deviceData, blocking_read, offset, size, ptr, num_events_in_wait_list, event_wait_list, event, cachePtr);
+	else
+		err = StageRead(command_queue, deviceData, blocking_read, offset, size, ptr, num_events_in_wait_list, event_wait_list, event, cachePtr);
+	if (err == CL_SUCCESS)
+		ADD_COUNTER(cachePtr->BytesToHost, (uint64_t)size);
+	return err;
+}
+
+static cl_int SyncHostMemory(cl_bool isRead, cl_command_queue command_queue, cl_mem deviceData, cl_bool blocking, size_t offset, size_t size, void* ptr, cl_uint num_events_in_wait_list, const cl_event *event_wait_list, cl_event *event, struct Cache_t* cachePtr) {
+	cl_int err;
+	//The host memory is the memory of the device, migrating it is only a hint where it is used next
+	if (cachePtr->memoryBackend == svm_MB) {
+		cl_event migrateEvent = NULL;
+		err = clEnqueueSVMMigrateMem(command_queue, 1, (const void**)&ptr, &size, isRead ? CL_MIGRATE_MEM_OBJECT_HOST : 0, num_events_in_wait_list, event_wait_list, &migrateEvent);
+		if ((err == CL_SUCCESS) && blocking)
+			err = clWaitForEvents(1, &migrateEvent);
+		if ((err == CL_SUCCESS) && (event != NULL)) {
+			*event = migrateEvent;
+			migrateEvent = NULL;
+		}
+		if (migrateEvent != NULL)
+			clReleaseEvent(migrateEvent);
+		return err;
+	}
+	//A transfer between a CL_MEM_USE_HOST_PTR buffer and its own host memory only synchronizes it
+	if (isRead)
+		return clEnqueueReadBuffer(command_queue, deviceData, blocking, offset, size, ptr, num_events_in_wait_list, event_wait_list, event);
+	return clEnqueueWriteBuffer(command_queue, deviceData, blocking, offset, size, ptr, num_events_in_wait_list, event_wait_list, event);
+}
+
+static cl_mem CreateLineBuffer(size_t size, void* hostAddress, cl_int *errorcode_ret, struct Cache_t* cachePtr) {
+	if ((cachePtr->memoryBackend == copy_MB) || (hostAddress == NULL))
+		return clCreateBuffer(cachePtr->context, CL_MEM_READ_WRITE, size, NULL, errorcode_ret);
+	return clCreateBuffer(cachePtr->context, CL_MEM_READ_WRITE | CL_MEM_USE_HOST_PTR, size, hostAddress, errorcode_ret);
+}
+
+static bool IsZeroBlock(const cl_uint* word, size_t numberOfWords, size_t block) {
+	size_t last = (block + 1) * ZERO_BLOCK_WORDS;
+	cl_uint bits = 0;
+	if (last > numberOfWords)
+		last = numberOfWords;
+	for (size_t i = block * ZERO_BLOCK_WORDS; i < last; i++)
+		bits |= word[i];
+	return bits == 0;
+}
+
+static void* PackZeroBlocks(const void* data, size_t size, size_t* packedSize, int* zeroBlockShare) {
+	const cl_uint* word = (const cl_uint*)data;
+	size_t numberOfWords = size / sizeof(cl_uint);
+	size_t numberOfBlocks = (numberOfWords + ZERO_BLOCK_WORDS - 1) / ZERO_BLOCK_WORDS;
+	size_t sampledBlocks = 0, sampledZeroBlocks = 0, zeroBlocks = 0;
+
+	//Every 8th block estimates the share of zero blocks, dense data is not read completely
+	for (size_t block = 0; block < numberOfBlocks; block += 8) {
+		sampledBlocks++;
+		if (IsZeroBlock(word, numberOfWords, block))
+			sampledZeroBlocks++;
+	}
+	*zeroBlockShare = (int)(100 * sampledZeroBlocks / sampledBlocks);
+	if (4 * sampledZeroBlocks < sampledBlocks)
+		return NULL;
+	for (size_t block = 0; block < numberOfBlocks; block++) {
+		if (IsZeroBlock(word, numberOfWords, block))
+			zeroBlocks++;
+	}
+	//The packed data has to save at least a quarter of the transfer
+	*packedSize = numberOfBlocks * sizeof(cl_int) + (numberOfBlocks - zeroBlocks) * ZERO_BLOCK_WORDS * sizeof(cl_uint);
+	if (4 * *packedSize > 3 * size)
+		return NULL;
+
+	cl_int* blockIndex = (cl_int*)malloc(*packedSize);
+	cl_uint* payload = (cl_uint*)(blockIndex + numberOfBlocks);
+	cl_int numberOfPayloadBlocks = 0;
+	for (size_t block = 0; block < numberOfBlocks; block++) {
+		if (IsZeroBlock(word, numberOfWords, block)) {
+			blockIndex[block] = -1;
+			continue;
+		}
+		//The last block may be partial, the rest of its payload is never unpacked
+		size_t first = block * ZERO_BLOCK_WORDS;
+		size_t count = (numberOfWords - first < ZERO_BLOCK_WORDS) ? numberOfWords - first : ZERO_BLOCK_WORDS;
+		cl_uint* target = payload + (size_t)numberOfPayloadBlocks * ZERO_BLOCK_WORDS;
+		memcpy(target, word + first, count * sizeof(cl_uint));
+		memset(target + count, 0, (ZERO_BLOCK_WORDS - count) * sizeof(cl_uint));
+		blockIndex[block] = numberOfPayloadBlocks++;
+	}
+	return blockIndex;
+}
+
+static bool IsCompressible(size_t offset, size_t size, cl_kernel kernel) {
+	//The kernels work on 32 bit words and a short transfer costs less than the kernel launch
+	return (kernel != NULL) && (size >= MIN_COMPRESSED_TRANSFER) && (size % sizeof(cl_uint) == 0) && (offset % sizeof(cl_uint) == 0);
+}
+
+static cl_mem GetCodecBuffer(cl_mem* buffer, size_t* bufferSize, cl_mem_flags flags, size_t size, struct Cache_t* cachePtr) {
+	cl_int err = CL_SUCCESS;
+	//The buffer only grows, a kernel that still uses the old one keeps it alive
+	if (*bufferSize < size) {
+		if (*buffer != NULL)
+			clReleaseMemObject(*buffer);
+		*buffer = clCreateBuffer(cachePtr->context, flags, size, NULL, &err);
+		if (err != CL_SUCCESS)
+			*buffer = NULL;
+		*bufferSize = (*buffer != NULL) ? size : 0;
+	}
+	return *buffer;
+}
+
+static bool WriteZeroBlocks(cl_command_queue command_queue, cl_mem deviceData, cl_bool blocking_write, size_t offset, size_t size, const void* ptr, cl_uint num_events_in_wait_list, const cl_event *event_wait_list, cl_event *event, cl_int *errorcode_ret, struct Cache_t* cachePtr) {
+	size_t packedSize = 0;
+	if (!IsCompressible(offset, size, cachePtr->unpackKernel))
+		return false;
+	int zeroBlockShare = 0;
+	void* packed = PackZeroBlocks(ptr, size, &packedSize, &zeroBlockShare);
+	STORE_RELAXED(cachePtr->zeroBlockShare, zeroBlockShare);
+	if (packed == NULL)
+		return false;
+
+	cl_uint numberOfWords = (cl_uint)(size / sizeof(cl_uint));
+	cl_uint numberOfBlocks = (numberOfWords + ZERO_BLOCK_WORDS - 1) / ZERO_BLOCK_WORDS;
+	cl_uint wordOffset = (cl_uint)(offset / sizeof(cl_uint));
+	size_t globalSize = numberOfWords;
+	cl_event unpackEvent = NULL;
+	cl_int err = CL_SUCCESS;
+	//The arguments of the kernel and the kept packed data are shared by all threads
+	if (cachePtr->threadSafe)
+		pthread_mutex_lock(&cachePtr->compressionLock);
+	cl_mem packedData = GetCodecBuffer(&cachePtr->compressedData, &cachePtr->compressedDataSize, CL_MEM_READ_ONLY, packedSize, cachePtr);
+	//The packed data is overwritten after the last unpack out of it, the write copies it before freeing
+	if (packedData != NULL)
+		err = clEnqueueWriteBuffer(command_queue, packedData, CL_TRUE, 0, packedSize, packed, (cachePtr->compressionEvent != NULL) ? 1 : 0, (cachePtr->compressionEvent != NULL) ? &cachePtr->compressionEvent : NULL, NULL);
+	free(packed);
+	//Without memory for the packed data the raw data is transferred
+	if ((packedData == NULL) || (err != CL_SUCCESS)) {
+		if (cachePtr->threadSafe)
+			pthread_mutex_unlock(&cachePtr->compressionLock);
+		return false;
+	}
+	err = clSetKernelArg(cachePtr->unpackKernel, 0, sizeof(cl_mem), &packedData);
+	err |= clSetKernelArg(cachePtr->unpackKernel, 1, sizeof(cl_uint), &numberOfBlocks);
+	err |= clSetKernelArg(cachePtr->unpackKernel, 2, sizeof(cl_mem), &deviceData);
+	err |= clSetKernelArg(cachePtr->unpackKernel, 3, sizeof(cl_uint), &wordOffset);
+	err |= clSetKernelArg(cachePtr->unpackKernel, 4, sizeof(cl_uint), &numberOfWords);
+	if (err == CL_SUCCESS)
+		err = clEnqueueNDRangeKernel(command_queue, cachePtr->unpackKernel, 1, NULL, &globalSize, NULL, num_events_in_wait_list, event_wait_list, &unpackEvent);
+	if (err == CL_SUCCESS) {
+		if (cachePtr->compressionEvent != NULL)
+			clReleaseEvent(cachePtr->compressionEvent);
+		clRetainEvent(unpackEvent);
+		cachePtr->compressionEvent = unpackEvent;
+	}
+	if (cachePtr->threadSafe)
+		pthread_mutex_unlock(&cachePtr->compressionLock);
+
+	if ((err == CL_SUCCESS) && blocking_write)
+		err = clWaitForEvents(1, &unpackEvent);
+	if ((err == CL_SUCCESS) && (event != NULL)) {
+		*event = unpackEvent;
+		unpackEvent = NULL;
+	}
+	if (unpackEvent != NULL)
+		clReleaseEvent(unpackEvent);
+	if (err == CL_SUCCESS) {
+		ADD_COUNTER(cachePtr->CompressedTransfers, 1);
+		ADD_COUNTER(cachePtr->SavedBytes, (uint64_t)(size - packedSize));
+		ADD_COUNTER(cachePtr->BytesToDevice, (uint64_t)packedSize);
+	}
+	*errorcode_ret = err;
+	return true;
+}
+
+static bool ReadZeroBlocks(cl_command_queue command_queue, cl_mem deviceData, cl_bool blocking_read, size_t offset, size_t size, void* ptr, cl_uint num_events_in_wait_list, const cl_event *event_wait_list, cl_event *event, cl_int *errorcode_ret, struct Cache_t* cachePtr) {
+	//The zero blocks are only known after a read of the marks, so only a blocking read can skip them
+	if (!blocking_read || !IsCompressible(offset, size, cachePtr->markKernel))
+		return false;
+	//After dense data the marks are only made now and then, a kernel launch and a read of the marks cost more than they save
+	if ((4 * LOAD_RELAXED(cachePtr->zeroBlockShare) < 100) && (ADD_COUNTER(cachePtr->compressionSkips, 1) % COMPRESSION_PROBE_PERIOD != 0))
+		return false;
+	cl_uint numberOfWords = (cl_uint)(size / sizeof(cl_uint));
+	cl_uint numberOfBlocks = (numberOfWords + ZERO_BLOCK_WORDS - 1) / ZERO_BLOCK_WORDS;
+	cl_uint wordOffset = (cl_uint)(offset / sizeof(cl_uint));
+	size_t globalSize = numberOfBlocks;
+	size_t blockSize = ZERO_BLOCK_WORDS * sizeof(cl_uint);
+	cl_int err = CL_SUCCESS;
+	//The marks stay in the kept buffer until they are read, so the lock is held until then
+	if (cachePtr->threadSafe)
+		pthread_mutex_lock(&cachePtr->compressionLock);
+	cl_mem nonZeroData = GetCodecBuffer(&cachePtr->markData, &cachePtr->markDataSize, CL_MEM_WRITE_ONLY, numberOfBlocks, cachePtr);
+	if (nonZeroData == NULL) {
+		if (cachePtr->threadSafe)
+			pthread_mutex_unlock(&cachePtr->compressionLock);
+		return false;
+	}
+
+	unsigned char* nonZero = (unsigned char*)malloc(numberOfBlocks);
+	cl_event markEvent = NULL;
+	err = clSetKernelArg(cachePtr->markKernel, 0, sizeof(cl_mem), &deviceData);
+	err |= clSetKernelArg(cachePtr->markKernel, 1, sizeof(cl_uint), &wordOffset);
+	err |= clSetKernelArg(cachePtr->markKernel, 2, sizeof(cl_uint), &numberOfWords);
+	err |= clSetKernelArg(cachePtr->markKernel, 3, sizeof(cl_mem), &nonZeroData);
+	if (err == CL_SUCCESS)
+		err = clEnqueueNDRangeKernel(command_queue, cachePtr->markKernel, 1, NULL, &globalSize, NULL, num_events_in_wait_list, event_wait_list, &markEvent);
+	if (err == CL_SUCCESS)
+		err = clEnqueueReadBuffer(command_queue, nonZeroData, CL_TRUE, 0, numberOfBlocks, nonZero, 1, &markEvent, NULL);
+	if (cachePtr->threadSafe)
+		pthread_mutex_unlock(&cachePtr->compressionLock);
+	if (markEvent != NULL)
+		clReleaseEvent(markEvent);
+
+	cl_uint numberOfNonZeroBlocks = 0;
+	for (cl_uint block = 0; (block < numberOfBlocks) && (err == CL_SUCCESS); block++)
+		numberOfNonZeroBlocks += nonZero[block];
+	if (err == CL_SUCCESS)
+		STORE_RELAXED(cachePtr->zeroBlockShare, (int)(100 * (uint64_t)(numberOfBlocks - numberOfNonZeroBlocks) / numberOfBlocks));
+	//Mostly dense data is read as before, the events of the event_wait_list already completed
+	if ((err == CL_SUCCESS) && (4 * numberOfNonZeroBlocks > 3 * numberOfBlocks)) {
+		free(nonZero);
+		return false;
+	}
+
+	//Every run of non zero blocks is one read, the zero blocks are cleared on the host
+	cl_event* readEvents = (cl_event*)malloc((numberOfBlocks / 2 + 1) * sizeof(cl_event));
+	cl_uint numberOfReads = 0;
+	for (cl_uint block = 0; (block < numberOfBlocks) && (err == CL_SUCCESS);) {
+		cl_uint last = block;
+		while ((last < numberOfBlocks) && (nonZero[last] == nonZero[block]))
+			last++;
+		size_t first = block * blockSize;
+		size_t bytes = ((size_t)last * blockSize < size) ? (size_t)(last - block) * blockSize : size - first;
+		if (nonZero[block] == 0)
+			memset((char*)ptr + first, 0, bytes);
+		else if ((err = clEnqueueReadBuffer(command_queue, deviceData, CL_FALSE, offset + first, bytes, (char*)ptr + first, 0, NULL, &readEvents[numberOfReads])) == CL_SUCCESS)
+			numberOfReads++;
+		block = last;
+	}
+	if ((err == CL_SUCCESS) && (numberOfReads > 0))
+		err = clWaitForEvents(numberOfReads, readEvents);
+	if ((err == CL_SUCCESS) && (event != NULL))
+		err = clEnqueueMarkerWithWaitList(command_queue, numberOfReads, readEvents, event);
+	for (cl_uint i = 0; i < numberOfReads; i++)
+		clReleaseEvent(readEvents[i]);
+	if (err == CL_SUCCESS) {
+		ADD_COUNTER(cachePtr->CompressedTransfers, 1);
+		ADD_COUNTER(cachePtr->SavedBytes, (uint64_t)(numberOfBlocks - numberOfNonZeroBlocks) * blockSize);
+		ADD_COUNTER(cachePtr->BytesToHost, (uint64_t)numberOfBlocks + (uint64_t)size - (uint64_t)(numberOfBlocks - numberOfNonZeroBlocks) * blockSize);
+	}
+	free(readEvents);
+	free(nonZero);
+	*errorcode_ret = err;
+	return true;
+}
+
+static cl_int EnqueueSplitTransfer(cl_bool isRead, cl_command_queue command_queue, cl_mem deviceData, cl_bool blocking, size_t offset, size_t size, void* ptr, cl_uint num_events_in_wait_list, const cl_event *event_wait_list, cl_event *event, struct Cache_t* cachePtr) {
+	size_t chunkSize = cachePtr->transferChunkSize;
+	int numberOfChunks = (int)((size + chunkSize - 1) / chunkSize);
+	cl_event* chunkEvents = (cl_event*)calloc(numberOfChunks, sizeof(cl_event));
+	cl_event startEvent = NULL;
+	cl_event doneEvent = NULL;
+	int numberOfChunkEvents = 0;
+
+	//The chunks start after the commands already on the queue, which may still use the line
+	cl_int err = clEnqueueMarkerWithWaitList(command_queue, num_events_in_wait_list, event_wait_list, &startEvent);
+	for (int i = 0; (i < numberOfChunks) && (err == CL_SUCCESS); i++) {
+		cl_command_queue transferQueue = cachePtr->transferQueue[i % cachePtr->numberOfTransferQueues];
+		size_t chunkOffset = (size_t)i * chunkSize;
+		size_t chunk = (size - chunkOffset < chunkSize) ? size - chunkOffset : chunkSize;
+		//A staged read would block on every chunk, split reads go directly to the host memory
+		if (isRead)
+			err = clEnqueueReadBuffer(transferQueue, deviceData, CL_FALSE, offset + chunkOffset, chunk, (char*)ptr + chunkOffset, 1, &startEvent, &chunkEvents[i]);
+		else
+			err = StageWrite(transferQueue, deviceData, CL_FALSE, offset + chunkOffset, chunk, (char*)ptr + chunkOffset, 1, &startEvent, &chunkEvents[i], cachePtr);
+		if (err == CL_SUCCESS)
+			numberOfChunkEvents++;
+	}
+	//Commands enqueued later on the queue wait for all chunks, like they would for a single transfer
+	if (numberOfChunkEvents > 0) {
+		cl_int barrierErr = clEnqueueBarrierWithWaitList(command_queue, numberOfChunkEvents, chunkEvents, &doneEvent);
+		if (err == CL_SUCCESS)
+			err = barrierErr;
+	}
+	if ((err == CL_SUCCESS) && blocking)
+		err = clWaitForEvents(1, &doneEvent);
+	if ((err == CL_SUCCESS) && (event != NULL)) {
+		*event = doneEvent;
+		doneEvent = NULL;
+	}
+	if (doneEvent != NULL)
+		clReleaseEvent(doneEvent);
+	for (int i = 0; i < numberOfChunkEvents; i++)
+		clReleaseEvent(chunkEvents[i]);
+	if (startEvent != NULL)
+		clReleaseEvent(startEvent);
+	free(chunkEvents);
+	return err;
+}
+
+static cl_int StageWrite(cl_command_queue command_queue, cl_mem deviceData, cl_bool blocking_write, size_t offset, size_t size, const void* ptr, cl_uint num_events_in_wait_list, const cl_event *event_wait_list, cl_event *event, struct Cache_t* cachePtr) {
+	if ((cachePtr->numberOfStagingBuffers == 0) || (size < MIN_STAGED_TRANSFER))
+		return clEnqueueWriteBuffer(command_queue, deviceData, blocking_write, offset, size, ptr, num_events_in_wait_list, event_wait_list, event);
+
+	const char* source = (const char*)ptr;
+	size_t stagingSize = cachePtr->stagingSize;
+	cl_event chunkEvents[MAX_STAGING_BUFFERS];
+	int numberOfChunkEvents = 0;
+	cl_int err = CL_SUCCESS;
+
+	if (cachePtr->threadSafe)
+		pthread_mutex_lock(&cachePtr->stagingLock);
+	//The copy of a chunk into pinned memory overlaps the transfer of the previous chunk
+	for (size_t done = 0; (done < size) && (err == CL_SUCCESS); done += stagingSize) {
+		size_t chunkSize = (size - done < stagingSize) ? size - done : stagingSize;
+		int buffer = TakeStagingBuffer(cachePtr);
+		memcpy(cachePtr->stagingHost[buffer], source + done, chunkSize);
+		err = clEnqueueWriteBuffer(command_queue, deviceData, CL_FALSE, offset + done, chunkSize, cachePtr->stagingHost[buffer], num_events_in_wait_list, event_wait_list, &cachePtr->stagingEvent[buffer]);
+		if (err != CL_SUCCESS)
+			cachePtr->stagingEvent[buffer] = NULL;
+	}
+	//The chunks that are not known to be finished are still in the staging buffers
+	for (int i = 0; i < cachePtr->numberOfStagingBuffers; i++) {
+		if (cachePtr->stagingEvent[i] != NULL)
+			chunkEvents[numberOfChunkEvents++] = cachePtr->stagingEvent[i];
+	}
+	if ((err == CL_SUCCESS) && blocking_write && (numberOfChunkEvents > 0))
+		err = clWaitForEvents(numberOfChunkEvents, chunkEvents);
+	if ((err == CL_SUCCESS) && (event != NULL))
+		err = clEnqueueMarkerWithWaitList(command_queue, numberOfChunkEvents, chunkEvents, event);
+	if (cachePtr->threadSafe)
+		pthread_mutex_unlock(&cachePtr->stagingLock);
+	return err;
+}
+
+static cl_int StageRead(cl_command_queue command_queue, cl_mem deviceData, cl_bool blocking_read, size_t offset, size_t size, void* ptr, cl_uint num_events_in_wait_list, const cl_event *event_wait_list, cl_event *event, struct Cache_t* cachePtr) {
+	//A non-blocking read can only copy out of pinned memory after it finished, so it goes directly to ptr
+	if ((cachePtr->numberOfStagingBuffers == 0) || (size < MIN_STAGED_TRANSFER) || !blocking_read)
+		return clEnqueueReadBuffer(command_queue, deviceData, blocking_read, offset, size, ptr, num_events_in_wait_list, event_wait_list, event);
+
+	char* destination = (char*)ptr;
+	size_t stagingSize = cachePtr->stagingSize;
+	int previous = -1;
+	size_t previousDone = 0;
+	cl_int err = CL_SUCCESS;
+
+	if (cachePtr->threadSafe)
+		pthread_mutex_lock(&cachePtr->stagingLock);
+	//The copy of a chunk out of pinned memory overlaps the transfer of the next chunk
+	for (size_t done = 0; (done < size) && (err == CL_SUCCESS); done += stagingSize) {
+		size_t chunkSize = (size - done < stagingSize) ? size - done : stagingSize;
+		int buffer = TakeStagingBuffer(cachePtr);
+		err = clEnqueueReadBuffer(command_queue, deviceData, CL_FALSE, offset + done, chunkSize, cachePtr->stagingHost[buffer], num_events_in_wait_list, event_wait_list, &cachePtr->stagingEvent[buffer]);
+		if (err != CL_SUCCESS) {
+			cachePtr->stagingEvent[buffer] = NULL;
+			break;
+		}
+		if (previous != -1) {
+			err = WaitStagingBuffer(previous, cachePtr);
+			memcpy(destination + previousDone, cachePtr->stagingHost[previous], stagingSize);
+		}
+		previous = buffer;
+		previousDone = done;
+	}
+	if ((err == CL_SUCCESS) && (previous != -1)) {
+		err = WaitStagingBuffer(previous, cachePtr);
+		memcpy(destination + previousDone, cachePtr->stagingHost[previous], size - previousDone);
+	}
+	//The data is on the host already, the event only tells that to the caller
+	if ((err == CL_SUCCESS) && (event != NULL))
+		err = clEnqueueMarkerWithWaitList(command_queue, 0, NULL, event);
+	if (cachePtr->threadSafe)
+		pthread_mutex_unlock(&cachePtr->stagingLock);
+	return err;
+}
+
+static cl_int WriteBackLine(cl_command_queue command_queue, cl_bool blocking_read, int line, cl_uint num_events_in_wait_list, const cl_event *event_wait_list, cl_event *event, struct Cache_t* cachePtr) {
+	cl_int err = EnqueueHostRead(command_queue, cachePtr->deviceData[line], blocking_read, 0, cachePtr->size[line], cachePtr->hostData[line], num_events_in_wait_list, event_wait_list, event, cachePtr);
+	if (err == CL_SUCCESS) {
+		cachePtr->dirty[line] = false;
+		cachePtr->deviceAuthoritative[line] = false;
+		ADD_COUNTER(cachePtr->memCopies, 1);
+		ADD_COUNTER(cachePtr->ReadTransfers, 1);
+		ADD_COUNTER(cachePtr->DirtyWriteBacks, 1);
+	}
+	return err;
+}
+
+static struct Cache_t* GetSizeClass(size_t size, struct Cache_t* cachePtr) {
+	//The size classes are sorted on dataSize, take the smallest one that fits
+	for (int i = 0; i < cachePtr->numberOfSizeClasses; i++) {
+		if (size <= (size_t)cachePtr->sizeClass[i]->dataSize)
+			return cachePtr->sizeClass[i];
+	}
+	return NULL;
+}
+
+static int FindLine(void* hostAddress, struct Cache_t* cachePtr) {
+	int set = GetIndex(hostAddress, cachePtr);
+	int way = GetWay(hostAddress, set, cachePtr);
+	int line = set * cachePtr->numberOfLinesPerSet + way;
+
+	if ((way != -1) && (cachePtr->valid[line] == true) && (cachePtr->tag[line] == hostAddress))
+		return line;
+	return -1;
+}
+
+static int FindLineLocked(void* hostAddress, struct Cache_t* cachePtr) {
+	int set = GetIndex(hostAddress, cachePtr);
+
+	LockSet(set, cachePtr);
+	int line = FindLine(hostAddress, cachePtr);
+	UnlockSet(set, cachePtr);
+	return line;
+}
+
+static struct Cache_t* FindSizeClass(void* hostAddress, struct Cache_t* cachePtr) {
+	for (int i = 0; i < cachePtr->numberOfSizeClasses; i++) {
+		if (FindLineLocked(hostAddress, cachePtr->sizeClass[i]) != -1)
+			return cachePtr->sizeClass[i];
+	}
+	return NULL;
+}
+
+static void SumSubCacheCounters(struct Cache_t* cachePtr) {
+	int memCopies = 0, readTransfers = 0, writeTransfers = 0, bypasses = 0, peerTransfers = 0, prefetches = 0, usefulPrefetches = 0;
+	int unchangedHits = 0, changedUploads = 0, dedupCopies = 0, compressedTransfers = 0;
+	uint64_t savedBytes = 0;
+	int numberOfSubCaches = (cachePtr->numberOfDevices > 0) ? cachePtr->numberOfDevices : cachePtr->numberOfSizeClasses;
+	struct Cache_t** subCache = (cachePtr->numberOfDevices > 0) ? cachePtr->device : cachePtr->sizeClass;
+
+	//The counters of the size classes or devices can change in other threads, read and store them atomically
+	for (int i = 0; i < numberOfSubCaches; i++) {
+		bypasses += __atomic_load_n(&subCache[i]->Bypasses, __ATOMIC_RELAXED);
+		memCopies += __atomic_load_n(&subCache[i]->memCopies, __ATOMIC_RELAXED);
+		readTransfers += __atomic_load_n(&subCache[i]->ReadTransfers, __ATOMIC_RELAXED);
+		writeTransfers += __atomic_load_n(&subCache[i]->WriteTransfers, __ATOMIC_RELAXED);
+		peerTransfers += __atomic_load_n(&subCache[i]->PeerTransfers, __ATOMIC_RELAXED);
+		prefetches += __atomic_load_n(&subCache[i]->Prefetches, __ATOMIC_RELAXED);
+		usefulPrefetches += __atomic_load_n(&subCache[i]->UsefulPrefetches, __ATOMIC_RELAXED);
+		unchangedHits += __atomic_load_n(&subCache[i]->UnchangedHits, __ATOMIC_RELAXED);
+		changedUploads += __atomic_load_n(&subCache[i]->ChangedUploads, __ATOMIC_RELAXED);
+		dedupCopies += __atomic_load_n(&subCache[i]->DedupCopies, __ATOMIC_RELAXED);
+		compressedTransfers += __atomic_load_n(&subCache[i]->CompressedTransfers, __ATOMIC_RELAXED);
+		savedBytes += __atomic_load_n(&subCache[i]->SavedBytes, __ATOMIC_RELAXED);
+	}
+	__atomic_store_n(&cachePtr->CompressedTransfers, compressedTransfers, __ATOMIC_RELAXED);
+	__atomic_store_n(&cachePtr->SavedBytes, savedBytes, __ATOMIC_RELAXED);
+	__atomic_store_n(&cachePtr->UnchangedHits, unchangedHits, __ATOMIC_RELAXED);
+	__atomic_store_n(&cachePtr->ChangedUploads, changedUploads, __ATOMIC_RELAXED);
+	__atomic_store_n(&cachePtr->DedupCopies, dedupCopies, __ATOMIC_RELAXED);
+	__atomic_store_n(&cachePtr->Prefetches, prefetches, __ATOMIC_RELAXED);
+	__atomic_store_n(&cachePtr->UsefulPrefetches, usefulPrefetches, __ATOMIC_RELAXED);
+	__atomic_store_n(&cachePtr->PeerTransfers, peerTransfers, __ATOMIC_RELAXED);
+	__atomic_store_n(&cachePtr->Bypasses, bypasses, __ATOMIC_RELAXED);
+	__atomic_store_n(&cachePtr->memCopies, memCopies, __ATOMIC_RELAXED);
+	__atomic_store_n(&cachePtr->ReadTransfers, readTransfers, __ATOMIC_RELAXED);
+	__atomic_store_n(&cachePtr->WriteTransfers, writeTransfers, __ATOMIC_RELAXED);
+}
+
+static bool AdmitLine(void* hostAddress, struct Cache_t* cachePtr) {
+	int numberOfCacheLines = cachePtr->numberOfSets * cachePtr->numberOfLinesPerSet;
+
+	//While there are empty lines a miss does not evict anything
+	if ((cachePtr->admissionPolicy == admit_all_AP) || (__atomic_load_n(&cachePtr->numberOfValidLines, __ATOMIC_RELAXED) < numberOfCacheLines))
+		return true;
+	//The filter is shared by all sets, its slots are read and written atomically
+	int slot = (int)(HashAddress(hostAddress) % (uint64_t)numberOfCacheLines);
+	if (__atomic_load_n(&cachePtr->admissionFilter[slot], __ATOMIC_RELAXED) == hostAddress) {
+		__atomic_store_n(&cachePtr->admissionFilter[slot], NULL, __ATOMIC_RELAXED);
+		return true;
+	}
+	//Remember the first miss, the next miss on the same address is admitted
+	__atomic_store_n(&cachePtr->admissionFilter[slot], hostAddress, __ATOMIC_RELAXED);
+	return false;
+}
+
+static cl_mem EnqueueBypass(cl_command_queue command_queue, cl_bool blocking_write, cl_mem_flags flags, size_t size, void* hostAddress, void* hostData, cl_uint num_events_in_wait_list, const cl_event *event_wait_list, cl_event *event, cl_int *errorcode_ret, struct Cache_t* cachePtr) {
+	bool copyHostPtr = ((flags & CL_MEM_COPY_HOST_PTR) == CL_MEM_COPY_HOST_PTR);
+	cl_int err = CL_SUCCESS;
+	cl_mem deviceData = NULL;
+	int index;
+
+	if (size == 0) {
+		if (errorcode_ret != NULL)
+			*errorcode_ret = CL_INVALID_BUFFER_SIZE;
+		return NULL;
+	}
+	//A new request for the same host address replaces the old buffer
+	LockBypass(cachePtr);
+	index = FindBypass(hostAddress, cachePtr);
+	if (index != -1)
+		err = ReleaseBypass(command_queue, index, NeedsHostData(flags), cachePtr);
+	UnlockBypass(cachePtr);
+	//The buffer is created and filled without holding the lock
+	if (err == CL_SUCCESS)
+		deviceData = CreateLineBuffer(size, hostData, &err, cachePtr);
+	if (err == CL_SUCCESS) {
+		if ((hostData != NULL) && NeedsHostData(flags)) {
+			err = EnqueueHostWrite(command_queue, deviceData, blocking_write, 0, size, hostData, num_events_in_wait_list, event_wait_list, event, cachePtr);
+			ADD_COUNTER(cachePtr->memCopies, 1);
+			ADD_COUNTER(cachePtr->WriteTransfers, 1);
+		} else if (event != NULL) {
+			err = clEnqueueMarkerWithWaitList(command_queue, num_events_in_wait_list, event_wait_list, event);
+		}
+	}
+	if (err != CL_SUCCESS) {
+		if (deviceData != NULL)
+			clReleaseMemObject(deviceData);
+		if (errorcode_ret != NULL)
+			*errorcode_ret = err;
+		return NULL;
+	}
+
+	//Keep the buffer so it can be read back and released later
+	LockBypass(cachePtr);
+	if (cachePtr->numberOfBypassBuffers == cachePtr->bypassCapacity) {
+		cachePtr->bypassCapacity = (cachePtr->bypassCapacity > 0) ? 2 * cachePtr->bypassCapacity : 16;
+		cachePtr->bypass = (BypassBuffer_t*)realloc(cachePtr->bypass, cachePtr->bypassCapacity * sizeof(BypassBuffer_t));
+	}
+	index = cachePtr->numberOfBypassBuffers++;
+	cachePtr->bypass[index].tag = hostAddress;
+	cachePtr->bypass[index].hostData = hostData;
+	cachePtr->bypass[index].deviceData = deviceData;
+	cachePtr->bypass[index].size = size;
+	cachePtr->bypass[index].dirty = (hostData != NULL) && !copyHostPtr && (cachePtr->writePolicy == write_back_WP);
+	UnlockBypass(cachePtr);
+	ADD_COUNTER(cachePtr->Bypasses, 1);
+	if (errorcode_ret != NULL)
+		*errorcode_ret = CL_SUCCESS;
+	return deviceData;
+}
+
+static int FindBypass(void* hostAddress, struct Cache_t* cachePtr) {
+	//Scratch buffers without a host address are never looked up
+	if (hostAddress == NULL)
+		return -1;
+	for (int i = 0; i < cachePtr->numberOfBypassBuffers; i++) {
+		if (cachePtr->bypass[i].tag == hostAddress)
+			return i;
+	}
+	return -1;
+}
+
+static struct Cache_t* FindBypassSizeClass(void* hostAddress, struct Cache_t* cachePtr) {
+	for (int i = 0; i < cachePtr->numberOfSizeClasses; i++) {
+		LockBypass(cachePtr->sizeClass[i]);
+		int index = FindBypass(hostAddress, cachePtr->sizeClass[i]);
+		UnlockBypass(cachePtr->sizeClass[i]);
+		if (index != -1)
+			return cachePtr->sizeClass[i];
+	}
+	return NULL;
+}
+
+static int TransferBypass(cl_command_queue command_queue, cl_bool isRead, cl_bool blocking, size_t offset, size_t size, void* hostAddress, size_t hostOffset, cl_uint num_events_in_wait_list, const cl_event *event_wait_list, cl_event *event, struct Cache_t* cachePtr) {
+	LockBypass(cachePtr);
+	int index = FindBypass(hostAddress, cachePtr);
+	cl_int err = CL_SUCCESS;
+
+	if ((index == -1) || (size == 0) || (offset + size > cachePtr->bypass[index].size)) {
+		UnlockBypass(cachePtr);
+		return 1;
+	}
+	char* ptr = (char*)cachePtr->bypass[index].hostData + hostOffset;
+	if (isRead)
+		err = EnqueueHostRead(command_queue, cachePtr->bypass[index].deviceData, blocking, offset, size, ptr, num_events_in_wait_list, event_wait_list, event, cachePtr);
+	else
+		err = EnqueueHostWrite(command_queue, cachePtr->bypass[index].deviceData, blocking, offset, size, ptr, num_events_in_wait_list, event_wait_list, event, cachePtr);
+	if (err != CL_SUCCESS) {
+		UnlockBypass(cachePtr);
+		return 1;
+	}
+	ADD_COUNTER(cachePtr->memCopies, 1);
+	if (isRead)
+		ADD_COUNTER(cachePtr->ReadTransfers, 1);
+	else
+		ADD_COUNTER(cachePtr->WriteTransfers, 1);
+	//The buffer was used once, after reading all of it back it is not needed anymore
+	//OpenCL keeps the buffer alive until the enqueued read has finished
+	if (isRead && (offset == 0) && (size == cachePtr->bypass[index].size))
+		ReleaseBypass(command_queue, index, false, cachePtr);
+	UnlockBypass(cachePtr);
+	return 0;
+}
+
+static bool NeedsHostData(cl_mem_flags flags) {
+	//Only a buffer that the device writes completely, CL_MEM_WRITE_ONLY without CL_MEM_COPY_HOST_PTR, needs none of the host data
+	return ((flags & CL_MEM_COPY_HOST_PTR) == CL_MEM_COPY_HOST_PTR) || ((flags & CL_MEM_WRITE_ONLY) != CL_MEM_WRITE_ONLY);
+}
+
+static cl_int ReleaseBypass(cl_command_queue command_queue, int index, bool writeBack, struct Cache_t* cachePtr) {
+	BypassBuffer_t* buffer = &cachePtr->bypass[index];
+	cl_int err = CL_SUCCESS;
+
+	if (writeBack && buffer->dirty) {
+		err = EnqueueHostRead(command_queue, buffer->deviceData, CL_TRUE, 0, buffer->size, buffer->hostData, 0, NULL, NULL, cachePtr);
+		if (err != CL_SUCCESS)
+			return err;
+		ADD_COUNTER(cachePtr->memCopies, 1);
+		ADD_COUNTER(cachePtr->ReadTransfers, 1);
+		ADD_COUNTER(cachePtr->DirtyWriteBacks, 1);
+	}
+	clReleaseMemObject(buffer->deviceData);
+	//The order of the bypass buffers does not matter, move the last one into the gap
+	cachePtr->bypass[index] = cachePtr->bypass[--cachePtr->numberOfBypassBuffers];
+	return CL_SUCCESS;
+}
+
+static bool DropBypass(void* hostAddress, cl_mem deviceData, struct Cache_t* cachePtr) {
+	//The buffer is in one of the size classes or devices
+	for (int i = 0; i < cachePtr->numberOfSizeClasses; i++) {
+		if (DropBypass(hostAddress, deviceData, cachePtr->sizeClass[i]))
+			return true;
+	}
+	for (int i = 0; i < cachePtr->numberOfDevices; i++) {
+		if (DropBypass(hostAddress, deviceData, cachePtr->device[i]))
+			return true;
+	}
+	LockBypass(cachePtr);
+	int index = FindBypass(hostAddress, cachePtr);
+	bool found = (index != -1) && (cachePtr->bypass[index].deviceData == deviceData);
+	if (found)
+		ReleaseBypass(NULL, index, false, cachePtr);
+	UnlockBypass(cachePtr);
+	return found;
+}
+
+static int TransferLine(cl_command_queue command_queue, cl_bool isRead, cl_bool blocking, size_t offset, size_t size, void* hostAddress, size_t hostOffset, cl_uint num_events_in_wait_list, const cl_event *event_wait_list, cl_event *event, struct Cache_t* cachePtr) {
+	int set = GetIndex(hostAddress, cachePtr);
+	cl_int err = CL_SUCCESS;
+
+	LockSet(set, cachePtr);
+	//Get location in Cache
+	int line = FindLine(hostAddress, cachePtr);
+
+	//Data that was bypassed is transferred from its temporary buffer
+	if (line == -1) {
+		UnlockSet(set, cachePtr);
+		return TransferBypass(command_queue, isRead, blocking, offset, size, hostAddress, hostOffset, num_events_in_wait_list, event_wait_list, event, cachePtr);
+	}
+	//Only the bytes held by the line can be transferred
+	if ((size == 0) || (offset + size > cachePtr->size[line])) {
+		UnlockSet(set, cachePtr);
+		return 1;
+	}
+	//The host memory of the data is the one of the line, in a keyed cache hostAddress is the key
+	char* ptr = (char*)cachePtr->hostData[line] + hostOffset;
+	if (isRead)
+		err = EnqueueHostRead(command_queue, cachePtr->deviceData[line], blocking, offset, size, ptr, num_events_in_wait_list, event_wait_list, event, cachePtr);
+	else
+		err = EnqueueHostWrite(command_queue, cachePtr->deviceData[line], blocking, offset, size, ptr, num_events_in_wait_list, event_wait_list, event, cachePtr);
+	if (err == CL_SUCCESS) {
+		//The host is only up to date when the whole line was read
+		if (isRead && (offset == 0) && (size == cachePtr->size[line])) {
+			cachePtr->dirty[line] = false;
+			cachePtr->deviceAuthoritative[line] = false;
+		}
+		//The fingerprint no longer describes the whole line, the next checked request uploads it again
+		if (!isRead)
+			__atomic_store_n(&cachePtr->contentHash[line], 0, __ATOMIC_RELAXED);
+		ADD_COUNTER(cachePtr->memCopies, 1);
+		if (isRead)
+			ADD_COUNTER(cachePtr->ReadTransfers, 1);
+		else
+			ADD_COUNTER(cachePtr->WriteTransfers, 1);
+	}
+	UnlockSet(set, cachePtr);
+	return (err == CL_SUCCESS) ? 0 : 1;
+}
+
+static void LockSet(int setIndex, struct Cache_t* cachePtr) {
+	if (!cachePtr->threadSafe)
+		return;
+	int stripe = setIndex & (cachePtr->numberOfLocks - 1);
+	pthread_mutex_lock(&cachePtr->setLocks[stripe]);
+	//An odd sequence tells optimistic readers that the sets of the stripe are being changed
+	__atomic_store_n(&cachePtr->setSequence[stripe], cachePtr->setSequence[stripe] + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void UnlockSet(int setIndex, struct Cache_t* cachePtr) {
+	if (!cachePtr->threadSafe)
+		return;
+	int stripe = setIndex & (cachePtr->numberOfLocks - 1);
+	__atomic_store_n(&cachePtr->setSequence[stripe], cachePtr->setSequence[stripe] + 1, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&cachePtr->setLocks[stripe]);
+}
+
+static int LockAddress(void* hostAddress, struct Cache_t* cachePtr) {
+	if (!cachePtr->threadSafe)
+		return 0;
+	//A cache with size classes has no sets, its stripes are picked by the hash of the host address
+	int stripe = (int)(HashAddress(hostAddress) & (uint64_t)(cachePtr->numberOfLocks - 1));
+	pthread_mutex_lock(&cachePtr->setLocks[stripe]);
+	return stripe;
+}
+
+static void UnlockStripe(int stripe, struct Cache_t* cachePtr) {
+	if (cachePtr->threadSafe)
+		pthread_mutex_unlock(&cachePtr->setLocks[stripe]);
+}
+
+static void LockBypass(struct Cache_t* cachePtr) {
+	if (cachePtr->threadSafe)
+		pthread_mutex_lock(&cachePtr->bypassLock);
+}
+
+static void UnlockBypass(struct Cache_t* cachePtr) {
+	if (cachePtr->threadSafe)
+		pthread_mutex_unlock(&cachePtr->bypassLock);
+}
+
+static uint64_t RotateLeft(uint64_t x, int bits) {
+	return (x << bits) | (x >> (64 - bits));
+}
+
+static uint64_t HashContent(const void* data, size_t size) {
+	//xxHash64, the four independent lanes keep the multipliers of the host busy
+	const uint64_t prime1 = 11400714785074694791ULL, prime2 = 14029467366897019727ULL, prime3 = 1609587929392839161ULL;
+	const uint64_t prime4 = 9650029242287828579ULL, prime5 = 2870177450012600261ULL;
+	const unsigned char* p = (const unsigned char*)data;
+	const unsigned char* end = p + size;
+	uint64_t hash;
+
+	if (size >= 32) {
+		uint64_t lane[4] = {prime1 + prime2, prime2, 0, 0 - prime1};
+		do {
+			uint64_t word[4];
+			memcpy(word, p, sizeof(word));
+			for (int i = 0; i < 4; i++)
+				lane[i] = RotateLeft(lane[i] + word[i] * prime2, 31) * prime1;
+			p += 32;
+		} while (p + 32 <= end);
+		hash = RotateLeft(lane[0], 1) + RotateLeft(lane[1], 7) + RotateLeft(lane[2], 12) + RotateLeft(lane[3], 18);
+		for (int i = 0; i < 4; i++) {
+			hash ^= RotateLeft(lane[i] * prime2, 31) * prime1;
+			hash = hash * prime1 + prime4;
+		}
+	} else {
+		hash = prime5;
+	}
+	hash += size;
+	for (; p + 8 <= end; p += 8) {
+		uint64_t word;
+		memcpy(&word, p, sizeof(word));
+		hash ^= RotateLeft(word * prime2, 31) * prime1;
+		hash = RotateLeft(hash, 27) * prime1 + prime4;
+	}
+	if (p + 4 <= end) {
+		uint32_t word;
+		memcpy(&word, p, sizeof(word));
+		hash ^= (uint64_t)word * prime1;
+		hash = RotateLeft(hash, 23) * prime2 + prime3;
+		p += 4;
+	}
+	for (; p < end; p++) {
+		hash ^= *p * prime5;
+		hash = RotateLeft(hash, 11) * prime1;
+	}
+	hash ^= hash >> 33;
+	hash *= prime2;
+	hash ^= hash >> 29;
+	hash *= prime3;
+	hash ^= hash >> 32;
+	//0 marks a line without a fingerprint
+	return (hash != 0) ? hash : 1;
+}
+
+static int LockContentLine(uint64_t contentHash, size_t size, int line, struct Cache_t* cachePtr) {
+	int numberOfLinesPerSet = cachePtr->numberOfLinesPerSet;
+	int numberOfCacheLines = cachePtr->numberOfSets * numberOfLinesPerSet;
+	int ownStripe = cachePtr->threadSafe ? (line / numberOfLinesPerSet) & (cachePtr->numberOfLocks - 1) : 0;
+
+	//A miss pays for an upload, a scan of the fingerprints costs far less
+	for (int i = 0; i < numberOfCacheLines; i++) {
+		if ((i == line) || (__atomic_load_n(&cachePtr->contentHash[i], __ATOMIC_RELAXED) != contentHash))
+			continue;
+		int stripe = cachePtr->threadSafe ? (i / numberOfLinesPerSet) & (cachePtr->numberOfLocks - 1) : 0;
+		//The lock of the own set is held, waiting for an other lock could deadlock
+		if ((stripe != ownStripe) && (pthread_mutex_trylock(&cachePtr->setLocks[stripe]) != 0))
+			continue;
+		if ((cachePtr->valid[i] == true) && (cachePtr->deviceAuthoritative[i] == false) && (cachePtr->contentHash[i] == contentHash) && (cachePtr->size[i] == size))
+			return i;
+		if (stripe != ownStripe)
+			pthread_mutex_unlock(&cachePtr->setLocks[stripe]);
+	}
+	return -1;
+}
+
+static void UnlockContentLine(int contentLine, int line, struct Cache_t* cachePtr) {
+	if (!cachePtr->threadSafe)
+		return;
+	int stripe = (contentLine / cachePtr->numberOfLinesPerSet) & (cachePtr->numberOfLocks - 1);
+	if (stripe != ((line / cachePtr->numberOfLinesPerSet) & (cachePtr->numberOfLocks - 1)))
+		pthread_mutex_unlock(&cachePtr->setLocks[stripe]);
+}
+
+static cl_mem ReadHit(void* hostAddress, int setIndex, size_t size, struct Cache_t* cachePtr) {
+	int numberOfLinesPerSet = cachePtr->numberOfLinesPerSet;
+	int first = setIndex * numberOfLinesPerSet;
+	enum ReplacementPolicy_t policy = cachePtr->policy;
+	int way = -1;
+
+	//A content check hashes the host data, which is done under the lock
+	//With a policy duel a follower set may change its policy, which is done under the lock as well
+	//A hit of a keyed request sets the hostData of the line, also under the lock
+	if (!cachePtr->threadSafe || (cachePtr->contentCheck != address_CC) || (cachePtr->setPolicy != NULL) || cachePtr->keyed)
+		return NULL;
+	//Only hits that at most set a stamp or a reference bit can do without the lock
+	//The list and bucket updates of a hashedIndex always need it
+	if ((policy != random_RP) && (policy != fifo_RP) && (policy != clock_RP)
+		&& (((policy != lru_RP) && (policy != mru_RP)) || (cachePtr->hashedIndex != NULL)))
+		return NULL;
+
+	int stripe = setIndex & (cachePtr->numberOfLocks - 1);
+	unsigned int sequence = __atomic_load_n(&cachePtr->setSequence[stripe], __ATOMIC_ACQUIRE);
+	if ((sequence & 1) != 0)
+		return NULL;
+	//Writers change the lines while they are read, so every field is loaded atomically and matchTags() is not used
+	if (cachePtr->hashedIndex != NULL) {
+		int slot = FindHashedSlot(hostAddress, cachePtr);
+		if (slot != -1)
+			way = LOAD_RELAXED(cachePtr->hashedIndex->slot[slot]);
+	} else {
+		for (int i = 0; i < numberOfLinesPerSet; i++) {
+			if (LOAD_RELAXED(cachePtr->tag[first + i]) == hostAddress) {
+				way = i;
+				break;
+			}
+		}
+	}
+	if (way == -1)
+		return NULL;
+	int line = first + way;
+	if ((LOAD_RELAXED(cachePtr->valid[line]) != true) || (LOAD_RELAXED(cachePtr->tag[line]) != hostAddress) || (LOAD_RELAXED(cachePtr->size[line]) < size))
+		return NULL;
+	cl_mem deviceData = LOAD_RELAXED(cachePtr->deviceData[line]);
+	//The hit only counts when no writer changed the stripe while it was read
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	if (__atomic_load_n(&cachePtr->setSequence[stripe], __ATOMIC_RELAXED) != sequence)
+		return NULL;
+
+	//A concurrent eviction may move the stamp or bit to the next data of the line, that only changes a victim choice
+	if (policy == clock_RP) {
+		STORE_RELAXED(cachePtr->lineState[line], 1);
+	} else if ((policy == lru_RP) || (policy == mru_RP)) {
+		//Halving the stamps needs the lock, so does a hit close to the stamp limit
+		//A stamp taken just before a halving keeps the line the most recent one until the counter catches up
+		int stamp = __atomic_add_fetch(&cachePtr->replacementLine[setIndex], 1, __ATOMIC_RELAXED);
+		if (stamp >= STAMP_LIMIT)
+			return NULL;
+		STORE_RELAXED(cachePtr->accessedOrder[line], stamp);
+	}
+	if (__atomic_exchange_n(&cachePtr->prefetched[line], false, __ATOMIC_RELAXED))
+		ADD_COUNTER(cachePtr->UsefulPrefetches, 1);
+	return deviceData;
+}
+
+static uint32_t NextRandom(int setIndex, struct Cache_t* cachePtr) {
+	//xorshift32, the state of the set is protected by the lock of the set
+	uint32_t x = cachePtr->randomState[setIndex];
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	cachePtr->randomState[setIndex] = x;
+	return x;
+}
+
+static int GetDevice(cl_command_queue command_queue, void* hostAddress, struct Cache_t* cachePtr) {
+	//The queue of a device selects that device
+	for (int i = 0; i < cachePtr->numberOfDevices; i++) {
+		if ((command_queue != NULL) && (cachePtr->device[i]->commandQueue == command_queue))
+			return i;
+	}
+	//Otherwise the data is used where it already is
+	for (int i = 0; i < cachePtr->numberOfDevices; i++) {
+		if (FindLineLocked(hostAddress, cachePtr->device[i]) != -1)
+			return i;
+	}
+	//New data is spread over the devices by the hash of its host address
+	return (int)(HashAddress(hostAddress) % (uint64_t)cachePtr->numberOfDevices);
+}
+
+static struct Cache_t* FindDevice(cl_command_queue command_queue, void* hostAddress, struct Cache_t* cachePtr) {
+	struct Cache_t* holder = NULL;
+
+	//Prefer the device of the queue, then a device with dirty data, so reading it back makes the line clean
+	for (int i = 0; i < cachePtr->numberOfDevices; i++) {
+		struct Cache_t* device = cachePtr->device[i];
+		int line = FindLineLocked(hostAddress, device);
+		if (line == -1)
+			continue;
+		if ((command_queue != NULL) && (device->commandQueue == command_queue))
+			return device;
+		if ((holder == NULL) || device->dirty[line])
+			holder = device;
+	}
+	if (holder != NULL)
+		return holder;
+	//Bypassed data is only on the device that got the request
+	for (int i = 0; i < cachePtr->numberOfDevices; i++) {
+		LockBypass(cachePtr->device[i]);
+		int index = FindBypass(hostAddress, cachePtr->device[i]);
+		UnlockBypass(cachePtr->device[i]);
+		if (index != -1)
+			return cachePtr->device[i];
+	}
+	return NULL;
+}
+
+static void InvalidateDevices(void* hostAddress, struct Cache_t* keep, struct Cache_t* cachePtr) {
+	for (int i = 0; i < cachePtr->numberOfDevices; i++) {
+		struct Cache_t* device = cachePtr->device[i];
+		if (device == keep)
+			continue;
+		int set = GetIndex(hostAddress, device);
+		LockSet(set, device);
+		int line = FindLine(hostAddress, device);
+		if (line != -1)
+			InvalidateLine(line, device);
+		UnlockSet(set, device);
+	}
+}
+
+static cl_mem EnqueueDeviceLine(cl_command_queue command_queue, cl_bool blocking_write, cl_mem_flags flags, size_t size, void* hostAddress, void* hostData, cl_uint num_events_in_wait_list, const cl_event *event_wait_list, cl_event *event, cl_int *errorcode_ret, PinnedLine_t* pinnedLine, struct Cache_t* cachePtr) {
+	int index = GetDevice(command_queue, hostAddress, cachePtr);
+	struct Cache_t* device = cachePtr->device[index];
+	bool copyHostPtr = ((flags & CL_MEM_COPY_HOST_PTR) == CL_MEM_COPY_HOST_PTR);
+	cl_mem deviceData = NULL;
+
+	if ((hostData != NULL) && !copyHostPtr) {
+		//The device produces new data, the copies on the other devices are stale from now on
+		InvalidateDevices(hostAddress, device, cachePtr);
+	} else if (copyHostPtr && (hostData != NULL) && (FindLineLocked(hostAddress, device) == -1)) {
+		//Copy the data from an other device that holds it instead of from the host
+		for (int i = 0; i < cachePtr->numberOfDevices; i++) {
+			if (i == index)
+				continue;
+			if (EnqueuePeerLine(blocking_write, flags, size, hostAddress, hostData, num_events_in_wait_list, event_wait_list, event, errorcode_ret, cachePtr->device[i], device, &deviceData, pinnedLine)) {
+				SumSubCacheCounters(cachePtr);
+				return deviceData;
+			}
+		}
+	}
+	deviceData = EnqueueLine(device->commandQueue, blocking_write, flags, size, hostAddress, hostData, num_events_in_wait_list, event_wait_list, event, errorcode_ret, pinnedLine, device);
+	SumSubCacheCounters(cachePtr);
+	return deviceData;
+}
+
+static bool EnqueuePeerLine(cl_bool blocking_write, cl_mem_flags flags, size_t size, void* hostAddress, void* hostData, cl_uint num_events_in_wait_list, const cl_event *event_wait_list, cl_event *event, cl_int *errorcode_ret, struct Cache_t* peer, struct Cache_t* device, cl_mem* deviceData, PinnedLine_t* pinnedLine) {
+	int peerSet = GetIndex(hostAddress, peer);
+	int set = GetIndex(hostAddress, device);
+	cl_event peerEvent = NULL;
+	cl_event copyEvent = NULL;
+	cl_int err = CL_SUCCESS;
+
+	//The devices are always locked in the same order, so two copies in opposite directions cannot deadlock
+	bool peerFirst = (peer < device);
+	if (peerFirst)
+		LockSet(peerSet, peer);
+	LockSet(set, device);
+	if (!peerFirst)
+		LockSet(peerSet, peer);
+	int peerLine = FindLine(hostAddress, peer);
+	if ((peerLine == -1) || (peer->size[peerLine] < size)) {
+		UnlockSet(peerSet, peer);
+		UnlockSet(set, device);
+		return false;
+	}
+
+	//The copy waits for the commands on the queue of the peer, which may still produce the data
+	cl_event* waitEvents = (cl_event*)malloc((num_events_in_wait_list + 1) * sizeof(cl_event));
+	for (cl_uint i = 0; i < num_events_in_wait_list; i++)
+		waitEvents[i] = event_wait_list[i];
+	err = clEnqueueMarkerWithWaitList(peer->commandQueue, 0, NULL, &peerEvent);
+	if (err == CL_SUCCESS) {
+		waitEvents[num_events_in_wait_list] = peerEvent;
+		*deviceData = EnqueueSetLine(device->commandQueue, blocking_write, flags, size, hostAddress, hostData, set, peer->deviceData[peerLine], 0, num_events_in_wait_list + 1, waitEvents, &copyEvent, &err, pinnedLine, device);
+	}
+	//The copy holds the data of the peer line, data produced by the peer must not be replaced by a content check
+	int line = (*deviceData != NULL) ? FindLine(hostAddress, device) : -1;
+	if (line != -1) {
+		device->deviceAuthoritative[line] = peer->deviceAuthoritative[peerLine];
+		//The fingerprint of the peer is only valid for a copy of all its bytes
+		__atomic_store_n(&device->contentHash[line], (peer->size[peerLine] == size) ? peer->contentHash[peerLine] : 0, __ATOMIC_RELAXED);
+	}
+	//Later refills of the peer line wait until the copy has read it
+	if (copyEvent != NULL)
+		err = clEnqueueBarrierWithWaitList(peer->commandQueue, 1, &copyEvent, NULL);
+	UnlockSet(peerSet, peer);
+	UnlockSet(set, device);
+
+	if ((copyEvent != NULL) && blocking_write && (err == CL_SUCCESS))
+		err = clWaitForEvents(1, &copyEvent);
+	if ((event != NULL) && (err == CL_SUCCESS))
+		*event = copyEvent;
+	else if (copyEvent != NULL)
+		clReleaseEvent(copyEvent);
+	if (peerEvent != NULL)
+		clReleaseEvent(peerEvent);
+	free(waitEvents);
+	if (errorcode_ret != NULL)
+		*errorcode_ret = err;
+	if (err != CL_SUCCESS)
+		*deviceData = NULL;
+	return true;
+}
+
+static cl_mem EnqueueLine(cl_command_queue command_queue, cl_bool blocking_write, cl_mem_flags flags, size_t size, void* hostAddress, void* hostData, cl_uint num_events_in_wait_list, const cl_event *event_wait_list, cl_event *event, cl_int *errorcode_ret, PinnedLine_t* pinnedLine, struct Cache_t* cachePtr) {
+	cl_mem deviceData = NULL;
+
+	if (cachePtr->device != NULL) {
+		int stripe = LockAddress(hostAddress, cachePtr);
+		deviceData = EnqueueDeviceLine(command_queue, blocking_write, flags, size, hostAddress, hostData, num_events_in_wait_list, event_wait_list, event, errorcode_ret, pinnedLine, cachePtr);
+		UnlockStripe(stripe, cachePtr);
+		return deviceData;
+	}
+	if (cachePtr->sizeClass != NULL) {
+		//Requests for the same host address are routed one at a time
+		int stripe = LockAddress(hostAddress, cachePtr);
+		deviceData = EnqueueSizeClassLine(command_queue, blocking_write, flags, size, hostAddress, hostData, num_events_in_wait_list, event_wait_list, event, errorcode_ret, pinnedLine, cachePtr);
+		UnlockStripe(stripe, cachePtr);
+		return deviceData;
+	}
+
+	int set = GetIndex(hostAddress, cachePtr);
+	//A hit that needs no transfer is first tried without taking the lock of the set
+	//A prefetch hit is not a use and a pin has to be taken under the lock
+	if (((flags & (CL_MEM_COPY_HOST_PTR | CL_MEM_CACHE_PREFETCH | CL_MEM_CACHE_PIN)) == CL_MEM_COPY_HOST_PTR) && ((deviceData = ReadHit(hostAddress, set, size, cachePtr)) != NULL)) {
+		cl_int err = CL_SUCCESS;
+		ADD_COUNTER(cachePtr->Hits, 1);
+		if (event != NULL)
+			err = clEnqueueMarkerWithWaitList(command_queue, num_events_in_wait_list, event_wait_list, event);
+		if (errorcode_ret != NULL)
+			*errorcode_ret = err;
+		return (err == CL_SUCCESS) ? deviceData : NULL;
+	}
+	LockSet(set, cachePtr);
+	deviceData = EnqueueSetLine(command_queue, blocking_write, flags, size, hostAddress, hostData, set, NULL, 0, num_events_in_wait_list, event_wait_list, event, errorcode_ret, pinnedLine, cachePtr);
+	UnlockSet(set, cachePtr);
+	return deviceData;
+}
+
+static cl_mem EnqueueSizeClassLine(cl_command_queue command_queue, cl_bool blocking_write, cl_mem_flags flags, size_t size, void* hostAddress, void* hostData, cl_uint num_events_in_wait_list, const cl_event *event_wait_list, cl_event *event, cl_int *errorcode_ret, PinnedLine_t* pinnedLine, struct Cache_t* cachePtr) {
+	//Route the request to the size class that fits, the data may still be cached in an other size class
+	struct Cache_t* sizeClass = GetSizeClass(size, cachePtr);
+	struct Cache_t* holder = FindSizeClass(hostAddress, cachePtr);
+	struct Cache_t* bypassHolder = FindBypassSizeClass(hostAddress, cachePtr);
+	cl_mem deviceData = NULL;
+
+	//A bypassed request does not need a line, it may be larger than every size class
+	if ((sizeClass == NULL) && (holder == NULL) && ((flags & CL_MEM_CACHE_BYPASS) == CL_MEM_CACHE_BYPASS) && (cachePtr->numberOfSizeClasses > 0))
+		sizeClass = cachePtr->sizeClass[cachePtr->numberOfSizeClasses - 1];
+	if ((bypassHolder != NULL) && (bypassHolder != sizeClass)) {
+		//Only one size class may hold a bypass buffer of the host address
+		cl_int err = CL_SUCCESS;
+		LockBypass(bypassHolder);
+		int index = FindBypass(hostAddress, bypassHolder);
+		if (index != -1)
+			err = ReleaseBypass(command_queue, index, NeedsHostData(flags), bypassHolder);
+		UnlockBypass(bypassHolder);
+		if (err != CL_SUCCESS) {
+			if (errorcode_ret != NULL)
+				*errorcode_ret = err;
+			SumSubCacheCounters(cachePtr);
+			return NULL;
+		}
+	}
+	if (sizeClass == NULL) {
+		if (errorcode_ret != NULL)
+			*errorcode_ret = CL_INVALID_BUFFER_SIZE;
+		SumSubCacheCounters(cachePtr);
+		return NULL;
+	}
+	if ((holder != NULL) && (holder != sizeClass)) {
+		int set = GetIndex(hostAddress, holder);
+		cl_int err = CL_SUCCESS;
+		LockSet(set, holder);
+		//An other thread may have evicted the line in the meantime
+		int line = FindLine(hostAddress, holder);
+		if ((line != -1) && (holder->dirty[line] == true))
+			err = WriteBackLine(command_queue, CL_TRUE, line, num_events_in_wait_list, event_wait_list, NULL, holder);
+		if ((line != -1) && (err == CL_SUCCESS))
+			InvalidateLine(line, holder);
+		UnlockSet(set, holder);
+		if (err != CL_SUCCESS) {
+			if (errorcode_ret != NULL)
+				*errorcode_ret = err;
+			SumSubCacheCounters(cachePtr);
+			return NULL;
+		}
+	}
+	deviceData = EnqueueLine(command_queue, blocking_write, flags, size, hostAddress, hostData, num_events_in_wait_list, event_wait_list, event, errorcode_ret, pinnedLine, sizeClass);
+	SumSubCacheCounters(cachePtr);
+	return deviceData;
+}
+
+static cl_mem EnqueueSetLine(cl_command_queue command_queue, cl_bool blocking_write, cl_mem_flags flags, size_t size, void* hostAddress, void* hostData, int set, cl_mem peerData, size_t peerOffset, cl_uint num_events_in_wait_list, const cl_event *event_wait_list, cl_event *event, cl_int *errorcode_ret, PinnedLine_t* pinnedLine, struct Cache_t* cachePtr) {
+	int way = GetWay(hostAddress, set, cachePtr);
+	int line = set * cachePtr->numberOfLinesPerSet + way;
+	cl_int err = CL_SUCCESS;
+	bool copyHostPtr = ((flags & CL_MEM_COPY_HOST_PTR) == CL_MEM_COPY_HOST_PTR);
+	bool isPrefetch = ((flags & CL_MEM_CACHE_PREFETCH) == CL_MEM_CACHE_PREFETCH);
+	//Set when nothing is transferred but the caller still expects an event
+	bool needsMarker = (event != NULL);
+
+	//Data that is not cached yet is bypassed on request or when the admission policy refuses it
+	//A direct mapped cache always returns way 0, so the tag decides if the data is cached
+	bool isCached = (way != -1) && (cachePtr->valid[line] == true) && (cachePtr->tag[line] == hostAddress);
+	//A set with only pinned ways can not take new data either
+	bool isFull = !isCached && (cachePtr->numberOfPinnedLines > 0) && !HasEvictableWay(set, cachePtr);
+	//A copy from an other device is always admitted, the host may not have the data
+	if (!isCached && (isFull || ((peerData == NULL) && (((flags & CL_MEM_CACHE_BYPASS) == CL_MEM_CACHE_BYPASS) || !AdmitLine(hostAddress, cachePtr))))) {
+		//A refused prefetch is dropped, a bypass buffer would only be released again
+		//A bypass buffer would be filled from the host instead of the peer, which may hold newer data
+		if (isFull && (peerData != NULL)) {
+			if (errorcode_ret != NULL)
+				*errorcode_ret = CL_OUT_OF_RESOURCES;
+			return NULL;
+		}
+		if (isPrefetch) {
+			if (errorcode_ret != NULL)
+				*errorcode_ret = CL_SUCCESS;
+			return NULL;
+		}
+		return EnqueueBypass(command_queue, blocking_write, flags, size, hostAddress, hostData, num_events_in_wait_list, event_wait_list, event, errorcode_ret, cachePtr);
+	}
+
+	if ((size == 0) || (size > (size_t)cachePtr->dataSize)) {
+		if (errorcode_ret != NULL)
+			*errorcode_ret = CL_INVALID_BUFFER_SIZE;
+		return NULL;
+	}
+	//The set serves the request, a prefetch is no use of the line
+	if (!isPrefetch)
+		AccessWay(set, isCached ? way : -1, cachePtr);
+	//A host address that gets a line has no bypass buffer anymore
+	LockBypass(cachePtr);
+	int bypass = FindBypass(hostAddress, cachePtr);
+	if (bypass != -1)
+		err = ReleaseBypass(command_queue, bypass, NeedsHostData(flags), cachePtr);
+	UnlockBypass(cachePtr);
+	if (bypass != -1) {
+		if (err != CL_SUCCESS) {
+			if (errorcode_ret != NULL)
+				*errorcode_ret = err;
+			return NULL;
+		}
+	}
+
+	//A hit returns the line without any transfer, also when the data was produced on the device
+	//The line has to hold at least size bytes, otherwise it is filled again
+	//A zero copy line wraps the host memory of its data, data of the same key in other host memory needs a new wrap
+	bool isResident = (way != -1) && (cachePtr->valid[line] == true) && (cachePtr->tag[line] == hostAddress) && (cachePtr->size[line] >= size)
+		&& ((cachePtr->memoryBackend == copy_MB) || (hostData == NULL) || (cachePtr->hostData[line] == hostData));
+	//A buffer without CL_MEM_COPY_HOST_PTR may be written by the device, only CL_MEM_WRITE_ONLY needs none of the host data
+	//The line of such a buffer that holds data produced on the device already has the newest bytes
+	bool isDeviceWrite = (hostData != NULL) && !copyHostPtr;
+	bool isWriteOnly = isDeviceWrite && !NeedsHostData(flags);
+	bool isHit = isResident && (copyHostPtr || (isDeviceWrite && (cachePtr->deviceAuthoritative[line] == true)));
+	//Prefetches are not requested by the application, they are neither hits nor misses
+	if (isResident && !isPrefetch)
+		ADD_COUNTER(cachePtr->Hits, 1);
+	//A checked request compares the fingerprint of the host data with the one of the line
+	bool checkContent = (cachePtr->contentCheck != address_CC) && copyHostPtr && (hostData != NULL) && (peerData == NULL);
+	uint64_t contentHash = checkContent ? HashContent(hostData, size) : 0;
+	//Data produced on the device is newer than the host data, a check never replaces it
+	if (isHit && checkContent && (cachePtr->deviceAuthoritative[line] == false)) {
+		if ((cachePtr->contentHash[line] == contentHash) && (cachePtr->size[line] == size)) {
+			ADD_COUNTER(cachePtr->UnchangedHits, 1);
+		} else {
+			ADD_COUNTER(cachePtr->ChangedUploads, 1);
+			isHit = false;
+		}
+	}
+	if (!isHit) {
+		//Data is not in cache or is an output buffer
+		cl_event writeBackEvent = NULL;
+		cl_uint numberOfWaitEvents = num_events_in_wait_list;
+		const cl_event* waitEvents = event_wait_list;
+
+		//Find way to store data
+		if (way == -1) {
+			way = SetWay(hostAddress, set, cachePtr);
+			line = set * cachePtr->numberOfLinesPerSet + way;
+		}
+
+		//Write the evicted data back to the host before the line is reused
+		//The same data is also written back before it is filled again with a larger size
+		bool wasValid = cachePtr->valid[line];
+		bool isEviction = wasValid && (cachePtr->tag[line] != hostAddress);
+		if (isEviction)
+			ADD_COUNTER(cachePtr->Evictions, 1);
+		if (!isResident && !isPrefetch) {
+			ADD_COUNTER(cachePtr->setMisses[set], 1);
+			if (cachePtr->setPolicy != NULL)
+				CountDuelMiss(set, cachePtr);
+			if (!wasValid)
+				ADD_COUNTER(cachePtr->ColdMisses, 1);
+			else if (isEviction && (__atomic_load_n(&cachePtr->numberOfValidLines, __ATOMIC_RELAXED) < cachePtr->numberOfSets * cachePtr->numberOfLinesPerSet))
+				//A valid line is evicted while an other set still has room
+				ADD_COUNTER(cachePtr->conflictMisses[set], 1);
+			else
+				//The cache is full, or the line held the data with a smaller size
+				ADD_COUNTER(cachePtr->CapacityMisses, 1);
+		}
+		if ((cachePtr->valid[line] == true) && (cachePtr->dirty[line] == true) && ((cachePtr->tag[line] != hostAddress) || !isWriteOnly)) {
+			err = WriteBackLine(command_queue, blocking_write, line, num_events_in_wait_list, event_wait_list, blocking_write ? NULL : &writeBackEvent, cachePtr);
+			if (err != CL_SUCCESS) {
+				if (errorcode_ret != NULL)
+					*errorcode_ret = err;
+				return NULL;
+			}
+			//The refill has to wait for the write back, which already waited for the given events
+			if (writeBackEvent != NULL) {
+				numberOfWaitEvents = 1;
+				waitEvents = &writeBackEvent;
+			} else {
+				numberOfWaitEvents = 0;
+				waitEvents = NULL;
+			}
+		}
+
+		//An other line with the same data is copied on the device instead of uploading it again
+		int contentLine = -1;
+		if (checkContent && (cachePtr->contentCheck == dedup_CC))
+			contentLine = LockContentLine(contentHash, size, line, cachePtr);
+
+		//A zero copy line wraps the host memory of its new data, the old buffer is released by the runtime after its last use
+		if ((cachePtr->memoryBackend != copy_MB) && ((cachePtr->deviceData[line] == NULL) || !wasValid || (cachePtr->hostData[line] != hostData) || (cachePtr->size[line] != size))) {
+			cl_mem lineData = CreateLineBuffer(size, hostData, &err, cachePtr);
+			if (err != CL_SUCCESS) {
+				if (contentLine != -1)
+					UnlockContentLine(contentLine, line, cachePtr);
+				InvalidateLine(line, cachePtr);
+				if (writeBackEvent != NULL)
+					clReleaseEvent(writeBackEvent);
+				if (errorcode_ret != NULL)
+					*errorcode_ret = err;
+				return NULL;
+			}
+			if (cachePtr->deviceData[line] != NULL)
+				clReleaseMemObject(cachePtr->deviceData[line]);
+			STORE_RELAXED(cachePtr->deviceData[line], lineData);
+		}
+
+		//Refill the preallocated buffer of the line, write only buffers are produced by the device
+		if ((hostData != NULL) && !isWriteOnly && (peerData != NULL)) {
+			err = clEnqueueCopyBuffer(command_queue, peerData, cachePtr->deviceData[line], peerOffset, 0, size, numberOfWaitEvents, waitEvents, event);
+			needsMarker = false;
+		} else if (contentLine != -1) {
+			//The other line stays locked until the copy is enqueued, a blocking request also waits for it
+			cl_event copyEvent = NULL;
+			err = clEnqueueCopyBuffer(command_queue, cachePtr->deviceData[contentLine], cachePtr->deviceData[line], 0, 0, size, numberOfWaitEvents, waitEvents, &copyEvent);
+			if ((err == CL_SUCCESS) && blocking_write)
+				err = clWaitForEvents(1, &copyEvent);
+			if ((err == CL_SUCCESS) && (event != NULL)) {
+				*event = copyEvent;
+				copyEvent = NULL;
+			}
+			if (copyEvent != NULL)
+				clReleaseEvent(copyEvent);
+			UnlockContentLine(contentLine, line, cachePtr);
+			needsMarker = false;
+		} else if((hostData != NULL) && !isWriteOnly) {
+			err = EnqueueHostWrite(command_queue, cachePtr->deviceData[line], blocking_write, 0, size, hostData, numberOfWaitEvents, waitEvents, event, cachePtr);
+			needsMarker = false;
+		} else if (needsMarker) {
+			err = clEnqueueMarkerWithWaitList(command_queue, numberOfWaitEvents, waitEvents, event);
+			needsMarker = false;
+		}
+		if (writeBackEvent != NULL)
+			clReleaseEvent(writeBackEvent);
+		if (err != CL_SUCCESS) {
+			//The line no longer holds the old data nor the new data
+			InvalidateLine(line, cachePtr);
+			if (errorcode_ret != NULL)
+				*errorcode_ret = err;
+			return NULL;
+		}
+		//The device may write this data, its copy is authoritative until it is read back
+		cachePtr->deviceAuthoritative[line] = isDeviceWrite;
+		cachePtr->dirty[line] = isDeviceWrite && (cachePtr->writePolicy == write_back_WP);
+		if (!isWriteOnly) {
+			ADD_COUNTER(cachePtr->memCopies, 1);
+			if (isPrefetch)
+				ADD_COUNTER(cachePtr->Prefetches, 1);
+			if (peerData != NULL) {
+				//Packed fills come from the host through their packed upload
+				if ((flags & CL_MEM_CACHE_PACKED) != CL_MEM_CACHE_PACKED)
+					ADD_COUNTER(cachePtr->PeerTransfers, 1);
+			} else if (contentLine != -1)
+				ADD_COUNTER(cachePtr->DedupCopies, 1);
+			else if(hostData != NULL)
+				ADD_COUNTER(cachePtr->WriteTransfers, 1);
+		}
+
+		//Set the tag and the number of bytes held by the line, other data has no key yet
+		if (cachePtr->hashedIndex != NULL)
+			SetHashedTag(line, hostAddress, cachePtr);
+		if (!wasValid || (cachePtr->tag[line] != hostAddress))
+			cachePtr->metaData[line].nodeId = -1;
+		STORE_RELAXED(cachePtr->tag[line], hostAddress);
+		cachePtr->hostData[line] = hostData;
+		STORE_RELAXED(cachePtr->size[line], size);
+		//Only data uploaded from the host has a fingerprint, 0 when the content was not checked
+		__atomic_store_n(&cachePtr->contentHash[line], (isDeviceWrite || (peerData != NULL)) ? 0 : contentHash, __ATOMIC_RELAXED);
+		__atomic_store_n(&cachePtr->prefetched[line], isPrefetch && !isDeviceWrite, __ATOMIC_RELAXED);
 
 		//Set cacheline to valid
-		cachePtr->cacheLine[set][way].valid = true;
+		if (!wasValid)
+			ADD_COUNTER(cachePtr->numberOfValidLines, 1);
+		STORE_RELAXED(cachePtr->valid[line], true);
+	} else {
+		//The line writes back to the host memory of the last request of its key
+		if (hostData != NULL)
+			cachePtr->hostData[line] = hostData;
+		//The device may change the data it produced again
+		if (isDeviceWrite && (cachePtr->writePolicy == write_back_WP))
+			cachePtr->dirty[line] = true;
+		//The first request of a prefetched line
+		if (!isPrefetch && __atomic_exchange_n(&cachePtr->prefetched[line], false, __ATOMIC_RELAXED))
+			ADD_COUNTER(cachePtr->UsefulPrefetches, 1);
+	}
+	if (needsMarker)
+		err = clEnqueueMarkerWithWaitList(command_queue, num_events_in_wait_list, event_wait_list, event);
+	if (errorcode_ret != NULL)
+		*errorcode_ret = err;
+	if (err != CL_SUCCESS)
+		return NULL;
+	if ((flags & CL_MEM_CACHE_PIN) == CL_MEM_CACHE_PIN) {
+		PinLine(line, cachePtr);
+		if (pinnedLine != NULL) {
+			pinnedLine->owner = cachePtr;
+			pinnedLine->line = line;
+		}
+	}
+	return cachePtr->deviceData[line];
+}
+
+cl_mem clCreateCacheBuffer(cl_context context, cl_mem_flags flags, size_t size, void* hostAddress, cl_int *errorcode_ret, struct Cache_t* cachePtr){
+	//The buffers are created in the context of the queue of the cache
+	(void)context;
+	TraceRequest(create_TK, flags, 0, size, hostAddress, cachePtr);
+	ReleaseCompletedPins(false, cachePtr);
+	cl_mem deviceData = EnqueueLine(cachePtr->commandQueue, CL_TRUE, flags, size, hostAddress, hostAddress, 0, NULL, NULL, errorcode_ret, NULL, cachePtr);
+	if (cachePtr->prefetcher != no_prefetch_PF)
+		ObserveRequest(cachePtr->commandQueue, flags, size, hostAddress, cachePtr);
+	return deviceData;
+}
+
+cl_mem clEnqueueCacheBuffer(cl_command_queue command_queue, cl_mem_flags flags, size_t size, void* hostAddress, cl_uint num_events_in_wait_list, const cl_event *event_wait_list, cl_event *event, cl_int *errorcode_ret, struct Cache_t* cachePtr){
+	TraceRequest(create_TK, flags, 0, size, hostAddress, cachePtr);
+	ReleaseCompletedPins(false, cachePtr);
+	cl_mem deviceData = EnqueueLine(command_queue, CL_FALSE, flags, size, hostAddress, hostAddress, num_events_in_wait_list, event_wait_list, event, errorcode_ret, NULL, cachePtr);
+	if (cachePtr->prefetcher != no_prefetch_PF)
+		ObserveRequest(command_queue, flags, size, hostAddress, cachePtr);
+	return deviceData;
+}
+
+int clCreateCacheBuffers(cl_context context, cl_command_queue command_queue, int count, const cl_mem_flags* flags, const size_t* sizes, void** hostAddresses, cl_mem* deviceData, cl_int *errorcode_ret, struct Cache_t* cachePtr) {
+	int slots = (count > 0) ? count : 1;
+	cl_event* fillEvents = (cl_event*)malloc(slots * sizeof(cl_event));
+	size_t* packedOffsets = (size_t*)malloc(slots * sizeof(size_t));
+	PinnedLine_t* pinnedLines = (PinnedLine_t*)calloc(slots, sizeof(PinnedLine_t));
+	cl_int err = CL_SUCCESS;
+	int numberOfFillEvents = 0;
+	int resolved = 0;
+
+	ReleaseCompletedPins(false, cachePtr);
+	//The misses of the input buffers are uploaded at once, their lines are filled from the packed data on the device
+	bool isBatchPacked = PackMisses(context, command_queue, count, flags, sizes, hostAddresses, packedOffsets, cachePtr);
+	//Every argument stays pinned until all are resolved, so one argument can not evict an other
+	for (; (resolved < count) && (err == CL_SUCCESS); resolved++) {
+		cl_event fillEvent = NULL;
+		bool isPacked = (packedOffsets[resolved] != SIZE_MAX);
+		TraceRequest(create_TK, flags[resolved], 0, sizes[resolved], hostAddresses[resolved], cachePtr);
+		if (isPacked) {
+			deviceData[resolved] = EnqueuePackedLine(command_queue, flags[resolved] | CL_MEM_CACHE_PIN, sizes[resolved], hostAddresses[resolved], cachePtr->packedData, packedOffsets[resolved], &fillEvent, &err, &pinnedLines[resolved], cachePtr);
+			//A set full of pinned lines can not take the packed data, the buffer gets a bypass buffer filled from the host
+			isPacked = (err != CL_OUT_OF_RESOURCES);
+		}
+		if (!isPacked)
+			deviceData[resolved] = EnqueueLine(command_queue, CL_FALSE, flags[resolved] | CL_MEM_CACHE_PIN, sizes[resolved], hostAddresses[resolved], hostAddresses[resolved], 0, NULL, &fillEvent, &err, &pinnedLines[resolved], cachePtr);
+		if (fillEvent != NULL)
+			fillEvents[numberOfFillEvents++] = fillEvent;
+	}
+	//All fills were enqueued without blocking, the batch waits for them at once
+	//The next batch overwrites the packed data, so the copies out of it are waited for after a failure too
+	if ((numberOfFillEvents > 0) && ((err == CL_SUCCESS) || isBatchPacked)) {
+		cl_int waitErr = clWaitForEvents(numberOfFillEvents, fillEvents);
+		if (err == CL_SUCCESS)
+			err = waitErr;
+	}
+	for (int i = 0; i < numberOfFillEvents; i++)
+		clReleaseEvent(fillEvents[i]);
+	free(fillEvents);
+	free(packedOffsets);
+	if (isBatchPacked && cachePtr->threadSafe)
+		pthread_mutex_unlock(&cachePtr->packLock);
+
+	//The prefetcher sees the buffers like single requests, its fills can not evict the pinned buffers
+	if ((err == CL_SUCCESS) && (cachePtr->prefetcher != no_prefetch_PF)) {
+		for (int i = 0; i < count; i++)
+			ObserveRequest(command_queue, flags[i], sizes[i], hostAddresses[i], cachePtr);
+	}
+	for (int i = 0; i < resolved; i++) {
+		if (deviceData[i] == NULL)
+			continue;
+		//A buffer without a line is a bypass buffer, after a failure the caller has no handle left to release it
+		if (!UnpinResolvedLine(hostAddresses[i], deviceData[i], &pinnedLines[i]) && (err != CL_SUCCESS))
+			DropBypass(hostAddresses[i], deviceData[i], cachePtr);
+		if (err != CL_SUCCESS)
+			deviceData[i] = NULL;
+	}
+	free(pinnedLines);
+	for (int i = resolved; i < count; i++)
+		deviceData[i] = NULL;
+	if (errorcode_ret != NULL)
+		*errorcode_ret = err;
+	return (err == CL_SUCCESS) ? 0 : 1;
+}
+
+static bool PackMisses(cl_context context, cl_command_queue command_queue, int count, const cl_mem_flags* flags, const size_t* sizes, void** hostAddresses, size_t* packedOffsets, struct Cache_t* cachePtr) {
+	size_t batchSize = 0;
+	int numberOfMisses = 0;
+	cl_int err = CL_SUCCESS;
+
+	for (int i = 0; i < count; i++)
+		packedOffsets[i] = SIZE_MAX;
+	//Only a cache of lines that copies the host data can fill them from packed data
+	//A content check hashes the host data of every request and an admission policy may refuse a miss
+	if ((cachePtr->numberOfSets == 0) || (cachePtr->memoryBackend != copy_MB) || (cachePtr->contentCheck != address_CC) || (cachePtr->admissionPolicy != admit_all_AP))
+		return false;
+	for (int i = 0; i < count; i++) {
+		bool isInput = ((flags[i] & (CL_MEM_COPY_HOST_PTR | CL_MEM_CACHE_BYPASS)) == CL_MEM_COPY_HOST_PTR);
+		bool isRepeated = false;
+		if (!isInput || (hostAddresses[i] == NULL) || (sizes[i] == 0) || (sizes[i] > (size_t)cachePtr->dataSize) || (FindLineLocked(hostAddresses[i], cachePtr) != -1))
+			continue;
+		//A buffer given twice is filled once
+		for (int j = 0; j < i; j++)
+			isRepeated = isRepeated || (hostAddresses[j] == hostAddresses[i]);
+		if (isRepeated || (batchSize + sizes[i] > PACKED_BATCH_SIZE))
+			continue;
+		//The copies on the device read at any offset, the upload carries no padding
+		packedOffsets[i] = batchSize;
+		batchSize += sizes[i];
+		numberOfMisses++;
+	}
+	//A single miss is uploaded into its line directly, a batch that finds the packed data in use does the same
+	if ((numberOfMisses < 2) || (cachePtr->threadSafe && (pthread_mutex_trylock(&cachePtr->packLock) != 0))) {
+		for (int i = 0; i < count; i++)
+			packedOffsets[i] = SIZE_MAX;
+		return false;
+	}
+
+	//The packed data is kept for the next batch and only grows
+	if (cachePtr->packedDataSize < batchSize) {
+		if (cachePtr->packedData != NULL)
+			clReleaseMemObject(cachePtr->packedData);
+		cachePtr->packedData = clCreateBuffer(context, CL_MEM_READ_ONLY, batchSize, NULL, &err);
+		cachePtr->packedDataSize = (err == CL_SUCCESS) ? batchSize : 0;
+		if (err != CL_SUCCESS)
+			cachePtr->packedData = NULL;
+	}
+	char* packed = (char*)malloc(batchSize);
+	for (int i = 0; i < count; i++) {
+		if (packedOffsets[i] != SIZE_MAX)
+			memcpy(packed + packedOffsets[i], hostAddresses[i], sizes[i]);
+	}
+	if (err == CL_SUCCESS)
+		err = EnqueueHostWrite(command_queue, cachePtr->packedData, CL_TRUE, 0, batchSize, packed, 0, NULL, NULL, cachePtr);
+	free(packed);
+	//When packing failed every miss is filled on its own
+	if (err != CL_SUCCESS) {
+		for (int i = 0; i < count; i++)
+			packedOffsets[i] = SIZE_MAX;
+		if (cachePtr->threadSafe)
+			pthread_mutex_unlock(&cachePtr->packLock);
+		return false;
+	}
+	ADD_COUNTER(cachePtr->WriteTransfers, 1);
+	return true;
+}
+
+static cl_mem EnqueuePackedLine(cl_command_queue command_queue, cl_mem_flags flags, size_t size, void* hostAddress, cl_mem lineData, size_t lineOffset, cl_event *event, cl_int *errorcode_ret, PinnedLine_t* pinnedLine, struct Cache_t* cachePtr) {
+	int set = GetIndex(hostAddress, cachePtr);
+
+	LockSet(set, cachePtr);
+	cl_mem deviceData = EnqueueSetLine(command_queue, CL_FALSE, flags | CL_MEM_CACHE_PACKED, size, hostAddress, hostAddress, set, lineData, lineOffset, 0, NULL, event, errorcode_ret, pinnedLine, cachePtr);
+	UnlockSet(set, cachePtr);
+	return deviceData;
+}
+
+static size_t GetSubBufferAlignment(cl_command_queue command_queue) {
+	cl_device_id device = NULL;
+	cl_uint alignmentBits = 0;
+
+	//A sub-buffer has to start at a multiple of the base address alignment of the device
+	if ((clGetCommandQueueInfo(command_queue, CL_QUEUE_DEVICE, sizeof(cl_device_id), &device, NULL) != CL_SUCCESS)
+		|| (clGetDeviceInfo(device, CL_DEVICE_MEM_BASE_ADDR_ALIGN, sizeof(cl_uint), &alignmentBits, NULL) != CL_SUCCESS))
+		alignmentBits = 0;
+	return (alignmentBits >= 8) ? alignmentBits / 8 : DEFAULT_SUB_BUFFER_ALIGNMENT;
+}
+
+int clPinCacheBuffer(void* hostAddress, cl_mem deviceData, struct Cache_t* cachePtr) {
+	ReleaseCompletedPins(false, cachePtr);
+	return PinBuffer(hostAddress, deviceData, true, cachePtr) ? 0 : 1;
+}
+
+int clUnpinCacheBuffer(void* hostAddress, cl_mem deviceData, struct Cache_t* cachePtr) {
+	ReleaseCompletedPins(false, cachePtr);
+	return PinBuffer(hostAddress, deviceData, false, cachePtr) ? 0 : 1;
+}
+
+int clPinCacheBuffersUntil(cl_event event, int count, void** hostAddresses, const cl_mem* deviceData, struct Cache_t* cachePtr) {
+	int result = 0;
+
+	ReleaseCompletedPins(false, cachePtr);
+	for (int i = 0; i < count; i++) {
+		if (!PinBuffer(hostAddresses[i], deviceData[i], true, cachePtr)) {
+			//A bypass buffer or a released line has nothing to pin
+			result = 1;
+			continue;
+		}
+		PinnedBuffer_t* pinnedBuffer = (PinnedBuffer_t*)malloc(sizeof(PinnedBuffer_t));
+		pinnedBuffer->hostAddress = hostAddresses[i];
+		pinnedBuffer->deviceData = deviceData[i];
+		pinnedBuffer->event = event;
+		pinnedBuffer->status = CL_COMPLETE;
+		pinnedBuffer->completed = false;
+		clRetainEvent(event);
+
+		if (cachePtr->threadSafe)
+			pthread_mutex_lock(&cachePtr->pinLock);
+		pinnedBuffer->next = cachePtr->pendingPins;
+		__atomic_store_n(&cachePtr->pendingPins, pinnedBuffer, __ATOMIC_RELEASE);
+		if (cachePtr->threadSafe)
+			pthread_mutex_unlock(&cachePtr->pinLock);
+
+		//The callback can run at once when the event already completed, the node is in the list by then
+		if (clSetEventCallback(event, CL_COMPLETE, PinEventCallback, pinnedBuffer) != CL_SUCCESS) {
+			__atomic_store_n(&pinnedBuffer->completed, true, __ATOMIC_RELEASE);
+			result = 1;
+		}
+	}
+	return result;
+}
+
+int clCachePrefetch(cl_command_queue command_queue, void** hostAddresses, const size_t* sizes, int count, struct Cache_t* cachePtr) {
+	int result = 0;
+
+	for (int i = 0; i < count; i++) {
+		size_t size = (sizes != NULL) ? sizes[i] : (size_t)cachePtr->dataSize;
+		cl_int err = CL_SUCCESS;
+		EnqueueLine(command_queue, CL_FALSE, CL_MEM_COPY_HOST_PTR | CL_MEM_CACHE_PREFETCH, size, hostAddresses[i], hostAddresses[i], 0, NULL, NULL, &err, NULL, cachePtr);
+		if (err != CL_SUCCESS)
+			result = 1;
+	}
+	return result;
+}
+
+int SetNodeId(struct Cache_t* cachePtr, void* hostAddress, int nodeId) {
+	int result = 1;
+
+	//The data is in at most one size class, a key is kept on every device that holds the data
+	for (int i = 0; i < cachePtr->numberOfSizeClasses; i++) {
+		if (SetNodeId(cachePtr->sizeClass[i], hostAddress, nodeId) == 0)
+			result = 0;
+	}
+	for (int i = 0; i < cachePtr->numberOfDevices; i++) {
+		if (SetNodeId(cachePtr->device[i], hostAddress, nodeId) == 0)
+			result = 0;
+	}
+	if ((cachePtr->sizeClass != NULL) || (cachePtr->device != NULL))
+		return result;
+
+	int set = GetIndex(hostAddress, cachePtr);
+	LockSet(set, cachePtr);
+	int line = FindLine(hostAddress, cachePtr);
+	if (line != -1)
+		cachePtr->metaData[line].nodeId = nodeId;
+	UnlockSet(set, cachePtr);
+	return (line != -1) ? 0 : 1;
+}
+
+int SaveCacheSnapshot(struct Cache_t* cachePtr, const char* fileName) {
+	int capacity = 1024;
+	SnapshotEntry_t* entries = (SnapshotEntry_t*)malloc(capacity * sizeof(SnapshotEntry_t));
+	int numberOfEntries = CollectSnapshot(&entries, 0, &capacity, cachePtr);
+	size_t fileSize = sizeof(SnapshotHeader_t) + (size_t)numberOfEntries * sizeof(SnapshotEntry_t);
+	size_t nameLength = strlen(fileName);
+	char* temporaryName = (char*)malloc(nameLength + 5);
+	int result = 1;
+
+	//The most recent lines of all sets first, then the second most recent lines and so on
+	qsort(entries, numberOfEntries, sizeof(SnapshotEntry_t), CompareSnapshotEntries);
+	memcpy(temporaryName, fileName, nameLength);
+	strcpy(temporaryName + nameLength, ".tmp");
+	int file = open(temporaryName, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (file != -1) {
+		void* mapped = MAP_FAILED;
+		if (ftruncate(file, (off_t)fileSize) == 0)
+			mapped = mmap(NULL, fileSize, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
+		if (mapped != MAP_FAILED) {
+			SnapshotHeader_t* header = (SnapshotHeader_t*)mapped;
+			header->magic = CACHE_SNAPSHOT_MAGIC;
+			header->version = CACHE_SNAPSHOT_VERSION;
+			header->entrySize = sizeof(SnapshotEntry_t);
+			header->numberOfEntries = (uint32_t)numberOfEntries;
+			memcpy(header + 1, entries, (size_t)numberOfEntries * sizeof(SnapshotEntry_t));
+			if (msync(mapped, fileSize, MS_SYNC) == 0)
+				result = 0;
+			munmap(mapped, fileSize);
+		}
+		close(file);
+		//A reader of fileName sees the old or the new snapshot, never a part of one
+		if ((result == 0) && (rename(temporaryName, fileName) != 0))
+			result = 1;
+		if (result != 0)
+			unlink(temporaryName);
+	}
+	free(temporaryName);
+	free(entries);
+	return result;
+}
+
+int WarmCache(cl_command_queue command_queue, const char* fileName, void** nodeAddresses, int numberOfNodes, struct Cache_t* cachePtr) {
+	struct stat fileInfo;
+	void* mapped = MAP_FAILED;
+	size_t fileSize = 0;
+	int file = -1;
+
+	//The lines of a keyed cache are found by their key, which is no host address of the snapshot
+	if (!cachePtr->keyed)
+		file = open(fileName, O_RDONLY);
+	if (file == -1)
+		return 1;
+	if ((fstat(file, &fileInfo) == 0) && ((size_t)fileInfo.st_size >= sizeof(SnapshotHeader_t))) {
+		fileSize = (size_t)fileInfo.st_size;
+		mapped = mmap(NULL, fileSize, PROT_READ, MAP_PRIVATE, file, 0);
+	}
+	close(file);
+	if (mapped == MAP_FAILED)
+		return 1;
+	const SnapshotHeader_t* header = (const SnapshotHeader_t*)mapped;
+	if ((header->magic != CACHE_SNAPSHOT_MAGIC) || (header->version != CACHE_SNAPSHOT_VERSION) || (header->entrySize != sizeof(SnapshotEntry_t))
+		|| (sizeof(SnapshotHeader_t) + (size_t)header->numberOfEntries * sizeof(SnapshotEntry_t) > fileSize)) {
+		munmap(mapped, fileSize);
+		return 1;
+	}
+
+	const SnapshotEntry_t* entries = (const SnapshotEntry_t*)(header + 1);
+	int count = (int)header->numberOfEntries;
+	int slots = (count > 0) ? count : 1;
+	struct Cache_t** leaves = (struct Cache_t**)malloc(slots * sizeof(struct Cache_t*));
+	cl_command_queue* queues = (cl_command_queue*)malloc(slots * sizeof(cl_command_queue));
+	const SnapshotEntry_t** leafEntries = (const SnapshotEntry_t**)malloc(slots * sizeof(SnapshotEntry_t*));
+	void** hostAddresses = (void**)malloc(slots * sizeof(void*));
+	cl_int err = CL_SUCCESS;
+
+	//Every entry goes to the size class or device that would get a request for its data
+	for (int i = 0; i < count; i++) {
+		int nodeId = entries[i].nodeId;
+		leaves[i] = NULL;
+		queues[i] = command_queue;
+		if ((nodeId < 0) || (nodeId >= numberOfNodes) || (nodeAddresses[nodeId] == NULL) || (entries[i].size == 0))
+			continue;
+		leaves[i] = GetWarmLeaf(&queues[i], nodeAddresses[nodeId], (size_t)entries[i].size, cachePtr);
+	}
+	//The entries of one cache are filled together, the hottest first
+	for (int i = 0; (i < count) && (err == CL_SUCCESS); i++) {
+		struct Cache_t* leaf = leaves[i];
+		int numberOfLeafEntries = 0;
+		if (leaf == NULL)
+			continue;
+		for (int j = i; j < count; j++) {
+			if (leaves[j] != leaf)
+				continue;
+			leaves[j] = NULL;
+			leafEntries[numberOfLeafEntries] = &entries[j];
+			hostAddresses[numberOfLeafEntries] = nodeAddresses[entries[j].nodeId];
+			numberOfLeafEntries++;
+		}
+		err = WarmLeaf(queues[i], leafEntries, hostAddresses, numberOfLeafEntries, leaf);
+	}
+	if ((cachePtr->sizeClass != NULL) || (cachePtr->device != NULL))
+		SumSubCacheCounters(cachePtr);
+
+	free(leaves);
+	free(queues);
+	free(leafEntries);
+	free(hostAddresses);
+	munmap(mapped, fileSize);
+	return (err == CL_SUCCESS) ? 0 : 1;
+}
+
+static int CollectSnapshot(SnapshotEntry_t** entries, int numberOfEntries, int* capacity, struct Cache_t* cachePtr) {
+	struct FullyAssociativeIndex_t* index = cachePtr->hashedIndex;
+	int numberOfLinesPerSet = cachePtr->numberOfLinesPerSet;
+	int* listAge = NULL;
+
+	for (int i = 0; i < cachePtr->numberOfSizeClasses; i++)
+		numberOfEntries = CollectSnapshot(entries, numberOfEntries, capacity, cachePtr->sizeClass[i]);
+	for (int i = 0; i < cachePtr->numberOfDevices; i++)
+		numberOfEntries = CollectSnapshot(entries, numberOfEntries, capacity, cachePtr->device[i]);
+	if ((cachePtr->sizeClass != NULL) || (cachePtr->device != NULL))
+		return numberOfEntries;
+
+	for (int set = 0; set < cachePtr->numberOfSets; set++) {
+		int first = numberOfEntries;
+		LockSet(set, cachePtr);
+		//The recency list of a hashedIndex has the most recent line at the head, a frequency bucket has its own order
+		if ((index != NULL) && (listAge == NULL)) {
+			int age = 0;
+			listAge = (int*)calloc(cachePtr->numberOfSets * numberOfLinesPerSet, sizeof(int));
+			for (int line = index->tail; line != -1; line = index->prev[line])
+				listAge[line] = ++age;
+		}
+		for (int way = 0; way < numberOfLinesPerSet; way++) {
+			int line = set * numberOfLinesPerSet + way;
+			int age = 0;
+			//Data produced on the device or not yet written back differs from the host data of the next run
+			if ((cachePtr->valid[line] != true) || (cachePtr->metaData[line].nodeId == -1) || cachePtr->dirty[line] || cachePtr->deviceAuthoritative[line])
+				continue;
+			if (index == NULL)
+				age = GetWayAge(set, way, GetSetPolicy(set, cachePtr), cachePtr);
+			else if (index->bucket[line] != -1)
+				age = index->bucketFrequency[index->bucket[line]];
+			else
+				age = listAge[line];
+			if (numberOfEntries == *capacity) {
+				*capacity *= 2;
+				*entries = (SnapshotEntry_t*)realloc(*entries, *capacity * sizeof(SnapshotEntry_t));
+			}
+			//Until the lines of the set are ranked the rank holds the reversed age, so the sort puts the newest line first
+			(*entries)[numberOfEntries].nodeId = cachePtr->metaData[line].nodeId;
+			(*entries)[numberOfEntries].rank = UINT32_MAX - (uint32_t)age;
+			(*entries)[numberOfEntries].size = (uint64_t)cachePtr->size[line];
+			numberOfEntries++;
+		}
+		UnlockSet(set, cachePtr);
+		qsort(*entries + first, numberOfEntries - first, sizeof(SnapshotEntry_t), CompareSnapshotEntries);
+		for (int i = first; i < numberOfEntries; i++)
+			(*entries)[i].rank = (uint32_t)(i - first);
+	}
+	free(listAge);
+	return numberOfEntries;
+}
+
+static int CompareSnapshotEntries(const void* a, const void* b) {
+	const SnapshotEntry_t* entryA = (const SnapshotEntry_t*)a;
+	const SnapshotEntry_t* entryB = (const SnapshotEntry_t*)b;
+
+	//The lower rank first, the nodeId keeps the order of equal ranks the same in every run
+	if (entryA->rank != entryB->rank)
+		return (entryA->rank < entryB->rank) ? -1 : 1;
+	return (entryA->nodeId < entryB->nodeId) ? -1 : (entryA->nodeId > entryB->nodeId);
+}
+
+static struct Cache_t* GetWarmLeaf(cl_command_queue* command_queue, void* hostAddress, size_t size, struct Cache_t* cachePtr) {
+	if (cachePtr->device != NULL) {
+		//Data on one device is not warmed on an other one
+		for (int i = 0; i < cachePtr->numberOfDevices; i++) {
+			if (FindLineLocked(hostAddress, cachePtr->device[i]) != -1)
+				return NULL;
+		}
+		struct Cache_t* device = cachePtr->device[GetDevice(*command_queue, hostAddress, cachePtr)];
+		*command_queue = device->commandQueue;
+		return GetWarmLeaf(command_queue, hostAddress, size, device);
+	}
+	if (cachePtr->sizeClass != NULL) {
+		struct Cache_t* sizeClass = GetSizeClass(size, cachePtr);
+		if ((sizeClass == NULL) || (FindSizeClass(hostAddress, cachePtr) != NULL))
+			return NULL;
+		return GetWarmLeaf(command_queue, hostAddress, size, sizeClass);
+	}
+	return (FindLineLocked(hostAddress, cachePtr) == -1) ? cachePtr : NULL;
+}
+
+static cl_int WarmLeaf(cl_command_queue command_queue, const SnapshotEntry_t** entries, void** hostAddresses, int count, struct Cache_t* cachePtr) {
+	int numberOfLinesPerSet = cachePtr->numberOfLinesPerSet;
+	int* freeWays = (int*)calloc(cachePtr->numberOfSets, sizeof(int));
+	int* accepted = (int*)malloc(((count > 0) ? count : 1) * sizeof(int));
+	size_t* offsets = (size_t*)malloc(((count > 0) ? count : 1) * sizeof(size_t));
+	int numberOfAccepted = 0;
+	size_t alignment = GetSubBufferAlignment(command_queue);
+	cl_int err = CL_SUCCESS;
+
+	//The hottest entries take the empty ways first, a warm cache never evicts data
+	for (int line = 0; line < cachePtr->numberOfSets * numberOfLinesPerSet; line++) {
+		if (cachePtr->valid[line] != true)
+			freeWays[line / numberOfLinesPerSet]++;
+	}
+	for (int i = 0; i < count; i++) {
+		int set = GetIndex(hostAddresses[i], cachePtr);
+		if ((entries[i]->size > (uint64_t)cachePtr->dataSize) || (freeWays[set] == 0))
+			continue;
+		freeWays[set]--;
+		accepted[numberOfAccepted++] = i;
+	}
+	free(freeWays);
+
+	//The coldest entries are filled first, so the hottest ones are the most recent lines of their sets
+	for (int last = numberOfAccepted - 1; (last >= 0) && (err == CL_SUCCESS);) {
+		//A zero copy line wraps its host memory, there is nothing to pack
+		if (cachePtr->memoryBackend != copy_MB) {
+			int i = accepted[last--];
+			err = WarmLine(command_queue, entries[i], hostAddresses[i], NULL, cachePtr);
+			continue;
+		}
+		//A batch takes at least one entry and more as long as it stays within PACKED_BATCH_SIZE
+		int end = last;
+		size_t batchSize = 0;
+		for (; last >= 0; last--) {
+			size_t offset = (batchSize + alignment - 1) / alignment * alignment;
+			size_t size = (size_t)entries[accepted[last]]->size;
+			if ((batchSize > 0) && (offset + size > PACKED_BATCH_SIZE))
+				break;
+			offsets[last] = offset;
+			batchSize = offset + size;
+		}
+		//The runtime copies the packed data when the buffer is created, so it is freed right away
+		char* packed = (char*)malloc(batchSize);
+		for (int k = end; k > last; k--)
+			memcpy(packed + offsets[k], hostAddresses[accepted[k]], (size_t)entries[accepted[k]]->size);
+		cl_mem batchData = clCreateBuffer(cachePtr->context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, batchSize, packed, &err);
+		free(packed);
+		if (err != CL_SUCCESS)
+			break;
+		ADD_COUNTER(cachePtr->BytesToDevice, (uint64_t)batchSize);
+		//The lines are copied out of the batch on the device, the runtime keeps the batch alive until the copies finished
+		for (int k = end; (k > last) && (err == CL_SUCCESS); k--) {
+			int i = accepted[k];
+			cl_buffer_region region = {offsets[k], (size_t)entries[i]->size};
+			cl_mem lineData = clCreateSubBuffer(batchData, CL_MEM_READ_ONLY, CL_BUFFER_CREATE_TYPE_REGION, &region, &err);
+			if (err != CL_SUCCESS)
+				break;
+			err = WarmLine(command_queue, entries[i], hostAddresses[i], lineData, cachePtr);
+			clReleaseMemObject(lineData);
+		}
+		clReleaseMemObject(batchData);
+	}
+	free(accepted);
+	free(offsets);
+	return err;
+}
+
+static cl_int WarmLine(cl_command_queue command_queue, const SnapshotEntry_t* entry, void* hostAddress, cl_mem lineData, struct Cache_t* cachePtr) {
+	int set = GetIndex(hostAddress, cachePtr);
+	cl_int err = CL_SUCCESS;
+
+	LockSet(set, cachePtr);
+	EnqueueSetLine(command_queue, CL_FALSE, CL_MEM_COPY_HOST_PTR | CL_MEM_CACHE_PREFETCH | CL_MEM_CACHE_PACKED, (size_t)entry->size, hostAddress, hostAddress, set, lineData, 0, 0, NULL, NULL, &err, NULL, cachePtr);
+	//A zero copy fill may still be refused by the admission policy
+	int line = (err == CL_SUCCESS) ? FindLine(hostAddress, cachePtr) : -1;
+	if (line != -1)
+		cachePtr->metaData[line].nodeId = entry->nodeId;
+	UnlockSet(set, cachePtr);
+	return err;
+}
+
+static void ObserveRequest(cl_command_queue command_queue, cl_mem_flags flags, size_t size, void* hostAddress, struct Cache_t* cachePtr) {
+	void* hostAddresses[MAX_PREFETCH_DEPTH];
+	size_t sizes[MAX_PREFETCH_DEPTH];
+	int count = 0;
+
+	if ((hostAddress == NULL) || ((flags & CL_MEM_CACHE_BYPASS) == CL_MEM_CACHE_BYPASS))
+		return;
+	if (cachePtr->threadSafe)
+		pthread_mutex_lock(&cachePtr->prefetchLock);
+	if (cachePtr->prefetcher == stride_PF) {
+		count = PredictStride(size, hostAddress, hostAddresses, sizes, cachePtr);
+	} else if (cachePtr->prefetcher == sequence_PF) {
+		count = PredictSequence(hostAddress, hostAddresses, sizes, cachePtr);
+		//Remember the request after the prediction, so the search finds its previous occurrence
+		PrefetchEntry_t* entry = &cachePtr->prefetchHistory[cachePtr->prefetchHistoryNext];
+		entry->hostAddress = hostAddress;
+		entry->size = size;
+		entry->isInput = ((flags & CL_MEM_COPY_HOST_PTR) == CL_MEM_COPY_HOST_PTR);
+		cachePtr->prefetchHistoryNext = (cachePtr->prefetchHistoryNext + 1) % cachePtr->numberOfPrefetchEntries;
 	}
-	return cachePtr->cacheLine[set][way].deviceData;
+	if (cachePtr->threadSafe)
+		pthread_mutex_unlock(&cachePtr->prefetchLock);
+
+	//The fills are enqueued without the prefetchLock, they take the locks of the sets themselves
+	clCachePrefetch(command_queue, hostAddresses, sizes, count, cachePtr);
+}
+
+static int PredictStride(size_t size, void* hostAddress, void** hostAddresses, size_t* sizes, struct Cache_t* cachePtr) {
+	char* address = (char*)hostAddress;
+	intptr_t stride = (intptr_t)address - (intptr_t)cachePtr->lastAddress;
+	int count = 0;
+
+	//Two equal distances in a row make a stride
+	if ((stride != 0) && (stride == cachePtr->lastStride))
+		cachePtr->strideConfidence++;
+	else
+		cachePtr->strideConfidence = 0;
+	cachePtr->lastStride = stride;
+	cachePtr->lastAddress = address;
+	if (cachePtr->strideConfidence == 0)
+		return 0;
+
+	//Only predictions that lie completely inside the given host range are prefetched
+	for (int i = 1; i <= cachePtr->prefetchDepth; i++) {
+		uintptr_t next = (uintptr_t)address + (uintptr_t)(i * stride);
+		if ((next < (uintptr_t)cachePtr->prefetchLow) || (next + size > (uintptr_t)cachePtr->prefetchHigh) || (next + size < next))
+			break;
+		hostAddresses[count] = (void*)next;
+		sizes[count] = size;
+		count++;
+	}
+	return count;
+}
+
+static int PredictSequence(void* hostAddress, void** hostAddresses, size_t* sizes, struct Cache_t* cachePtr) {
+	int numberOfEntries = cachePtr->numberOfPrefetchEntries;
+	int newest = cachePtr->prefetchHistoryNext;
+	int previous = -1;
+	int count = 0;
+
+	//Find the last time the host address was requested
+	for (int i = 1; i <= numberOfEntries; i++) {
+		int entry = (newest - i + numberOfEntries) % numberOfEntries;
+		if (cachePtr->prefetchHistory[entry].hostAddress == NULL)
+			break;
+		if (cachePtr->prefetchHistory[entry].hostAddress == hostAddress) {
+			previous = entry;
+			break;
+		}
+	}
+	if (previous == -1)
+		return 0;
+
+	//The inputs requested after it are expected again, outputs are produced on the device
+	for (int entry = (previous + 1) % numberOfEntries; (entry != newest) && (count < cachePtr->prefetchDepth); entry = (entry + 1) % numberOfEntries) {
+		PrefetchEntry_t* request = &cachePtr->prefetchHistory[entry];
+		if (!request->isInput || (request->hostAddress == hostAddress))
+			continue;
+		hostAddresses[count] = request->hostAddress;
+		sizes[count] = request->size;
+		count++;
+	}
+	return count;
 }
 
 
 int clEnqueueReadCacheBuffer(cl_command_queue command_queue, cl_bool blocking_read, size_t offset, size_t size, void* hostAddress, cl_uint num_events_in_wait_list, const cl_event *event_wait_list, cl_event *event, struct Cache_t* cachePtr){
-	//Get location in Cache
-	int set = GetIndex(cachePtr->indexBitMask, cachePtr->addressBitShift, hostAddress);
-	int way = GetWay(hostAddress, set, cachePtr);
-	cl_int err = 0;
+	TraceRequest(read_TK, 0, offset, size, hostAddress, cachePtr);
+	if (cachePtr->device != NULL) {
+		//The transfer is enqueued on the queue of the device that holds the data
+		int stripe = LockAddress(hostAddress, cachePtr);
+		struct Cache_t* holder = FindDevice(command_queue, hostAddress, cachePtr);
+		int result = 1;
+		if (holder != NULL)
+			result = clEnqueueReadCacheBuffer(holder->commandQueue, blocking_read, offset, size, hostAddress, num_events_in_wait_list, event_wait_list, event, holder);
+		UnlockStripe(stripe, cachePtr);
+		SumSubCacheCounters(cachePtr);
+		return result;
+	}
+	if (cachePtr->sizeClass != NULL) {
+		int stripe = LockAddress(hostAddress, cachePtr);
+		struct Cache_t* holder = FindSizeClass(hostAddress, cachePtr);
+		int result = 1;
+		if (holder == NULL)
+			holder = FindBypassSizeClass(hostAddress, cachePtr);
+		if (holder != NULL)
+			result = clEnqueueReadCacheBuffer(command_queue, blocking_read, offset, size, hostAddress, num_events_in_wait_list, event_wait_list, event, holder);
+		UnlockStripe(stripe, cachePtr);
+		SumSubCacheCounters(cachePtr);
+		return result;
+	}
+
+	return TransferLine(command_queue, CL_TRUE, blocking_read, offset, size, hostAddress, 0, num_events_in_wait_list, event_wait_list, event, cachePtr);
+}
+
+int clEnqueueReadCacheBufferRange(cl_command_queue command_queue, cl_bool blocking_read, size_t offset, size_t size, void* hostAddress, cl_uint num_events_in_wait_list, const cl_event *event_wait_list, cl_event *event, struct Cache_t* cachePtr){
+	TraceRequest(read_range_TK, 0, offset, size, hostAddress, cachePtr);
+	if (cachePtr->device != NULL) {
+		//The transfer is enqueued on the queue of the device that holds the data
+		int stripe = LockAddress(hostAddress, cachePtr);
+		struct Cache_t* holder = FindDevice(command_queue, hostAddress, cachePtr);
+		int result = 1;
+		if (holder != NULL)
+			result = clEnqueueReadCacheBufferRange(holder->commandQueue, blocking_read, offset, size, hostAddress, num_events_in_wait_list, event_wait_list, event, holder);
+		UnlockStripe(stripe, cachePtr);
+		SumSubCacheCounters(cachePtr);
+		return result;
+	}
+	if (cachePtr->sizeClass != NULL) {
+		int stripe = LockAddress(hostAddress, cachePtr);
+		struct Cache_t* holder = FindSizeClass(hostAddress, cachePtr);
+		int result = 1;
+		if (holder == NULL)
+			holder = FindBypassSizeClass(hostAddress, cachePtr);
+		if (holder != NULL)
+			result = clEnqueueReadCacheBufferRange(command_queue, blocking_read, offset, size, hostAddress, num_events_in_wait_list, event_wait_list, event, holder);
+		UnlockStripe(stripe, cachePtr);
+		SumSubCacheCounters(cachePtr);
+		return result;
+	}
+
+	//The bytes at offset in the line belong at the same offset from hostAddress
+	return TransferLine(command_queue, CL_TRUE, blocking_read, offset, size, hostAddress, offset, num_events_in_wait_list, event_wait_list, event, cachePtr);
+}
+
+int clEnqueueWriteCacheBufferRange(cl_command_queue command_queue, cl_bool blocking_write, size_t offset, size_t size, void* hostAddress, cl_uint num_events_in_wait_list, const cl_event *event_wait_list, cl_event *event, struct Cache_t* cachePtr){
+	TraceRequest(write_range_TK, 0, offset, size, hostAddress, cachePtr);
+	if (cachePtr->device != NULL) {
+		//The transfer is enqueued on the queue of the device that holds the data
+		int stripe = LockAddress(hostAddress, cachePtr);
+		struct Cache_t* holder = FindDevice(command_queue, hostAddress, cachePtr);
+		int result = 1;
+		if (holder != NULL)
+			result = clEnqueueWriteCacheBufferRange(holder->commandQueue, blocking_write, offset, size, hostAddress, num_events_in_wait_list, event_wait_list, event, holder);
+		//Only the written copy is up to date
+		if (result == 0)
+			InvalidateDevices(hostAddress, holder, cachePtr);
+		UnlockStripe(stripe, cachePtr);
+		SumSubCacheCounters(cachePtr);
+		return result;
+	}
+	if (cachePtr->sizeClass != NULL) {
+		int stripe = LockAddress(hostAddress, cachePtr);
+		struct Cache_t* holder = FindSizeClass(hostAddress, cachePtr);
+		int result = 1;
+		if (holder == NULL)
+			holder = FindBypassSizeClass(hostAddress, cachePtr);
+		if (holder != NULL)
+			result = clEnqueueWriteCacheBufferRange(command_queue, blocking_write, offset, size, hostAddress, num_events_in_wait_list, event_wait_list, event, holder);
+		UnlockStripe(stripe, cachePtr);
+		SumSubCacheCounters(cachePtr);
+		return result;
+	}
+
+	//Only the touched bytes are written, the rest of the line keeps its data and state
+	return TransferLine(command_queue, CL_FALSE, blocking_write, offset, size, hostAddress, offset, num_events_in_wait_list, event_wait_list, event, cachePtr);
+}
+
+cl_mem clCreateCacheBufferKeyed(cl_context context, cl_mem_flags flags, uint64_t key, void* hostAddress, size_t size, cl_int *errorcode_ret, struct Cache_t* cachePtr) {
+	cl_int err = CheckKey(key, cachePtr);
+	//The buffers are created in the context of the queue of the cache, a multi device cache has no queue of its own
+	(void)context;
+	if ((err == CL_SUCCESS) && (cachePtr->device != NULL))
+		err = CL_INVALID_COMMAND_QUEUE;
+	if (err != CL_SUCCESS) {
+		if (errorcode_ret != NULL)
+			*errorcode_ret = err;
+		return NULL;
+	}
+	TraceRequest(create_TK, flags, 0, size, GetKeyTag(key), cachePtr);
+	ReleaseCompletedPins(false, cachePtr);
+	return EnqueueLine(cachePtr->commandQueue, CL_TRUE, flags, size, GetKeyTag(key), hostAddress, 0, NULL, NULL, errorcode_ret, NULL, cachePtr);
+}
+
+cl_mem clEnqueueCacheBufferKeyed(cl_command_queue command_queue, cl_mem_flags flags, uint64_t key, void* hostAddress, size_t size, cl_uint num_events_in_wait_list, const cl_event *event_wait_list, cl_event *event, cl_int *errorcode_ret, struct Cache_t* cachePtr) {
+	cl_int err = CheckKey(key, cachePtr);
+	if (err != CL_SUCCESS) {
+		if (errorcode_ret != NULL)
+			*errorcode_ret = err;
+		return NULL;
+	}
+	TraceRequest(create_TK, flags, 0, size, GetKeyTag(key), cachePtr);
+	ReleaseCompletedPins(false, cachePtr);
+	return EnqueueLine(command_queue, CL_FALSE, flags, size, GetKeyTag(key), hostAddress, num_events_in_wait_list, event_wait_list, event, errorcode_ret, NULL, cachePtr);
+}
+
+int clEnqueueReadCacheBufferKeyed(cl_command_queue command_queue, cl_bool blocking_read, size_t offset, size_t size, uint64_t key, cl_uint num_events_in_wait_list, const cl_event *event_wait_list, cl_event *event, struct Cache_t* cachePtr) {
+	if (CheckKey(key, cachePtr) != CL_SUCCESS)
+		return 1;
+	return clEnqueueReadCacheBuffer(command_queue, blocking_read, offset, size, GetKeyTag(key), num_events_in_wait_list, event_wait_list, event, cachePtr);
+}
+
+int clEnqueueReadCacheBufferRangeKeyed(cl_command_queue command_queue, cl_bool blocking_read, size_t offset, size_t size, uint64_t key, cl_uint num_events_in_wait_list, const cl_event *event_wait_list, cl_event *event, struct Cache_t* cachePtr) {
+	if (CheckKey(key, cachePtr) != CL_SUCCESS)
+		return 1;
+	return clEnqueueReadCacheBufferRange(command_queue, blocking_read, offset, size, GetKeyTag(key), num_events_in_wait_list, event_wait_list, event, cachePtr);
+}
+
+int clEnqueueWriteCacheBufferRangeKeyed(cl_command_queue command_queue, cl_bool blocking_write, size_t offset, size_t size, uint64_t key, cl_uint num_events_in_wait_list, const cl_event *event_wait_list, cl_event *event, struct Cache_t* cachePtr) {
+	if (CheckKey(key, cachePtr) != CL_SUCCESS)
+		return 1;
+	return clEnqueueWriteCacheBufferRange(command_queue, blocking_write, offset, size, GetKeyTag(key), num_events_in_wait_list, event_wait_list, event, cachePtr);
+}
+
+static cl_int CheckKey(uint64_t key, struct Cache_t* cachePtr) {
+	if (!cachePtr->keyed)
+		return CL_INVALID_OPERATION;
+	//The tag of a key is the key plus 1 so no key becomes a NULL tag, the tag has to fit in a host pointer
+	if (key >= (uint64_t)UINTPTR_MAX)
+		return CL_INVALID_VALUE;
+	return CL_SUCCESS;
+}
+
+static void* GetKeyTag(uint64_t key) {
+	return (void*)(uintptr_t)(key + 1);
+}
+
+static uint64_t GetTagKey(void* tag) {
+	return (uint64_t)(uintptr_t)tag - 1;
+}
+
+void SetIndexFunction(struct Cache_t* cachePtr, enum IndexFunction_t indexFunction) {
+	cachePtr->indexFunction = indexFunction;
+	for (int i = 0; i < cachePtr->numberOfSizeClasses; i++)
+		SetIndexFunction(cachePtr->sizeClass[i], indexFunction);
+	for (int i = 0; i < cachePtr->numberOfDevices; i++)
+		SetIndexFunction(cachePtr->device[i], indexFunction);
+}
+
+void SetKeyHash(struct Cache_t* cachePtr, KeyHash_t keyHash) {
+	cachePtr->keyed = true;
+	cachePtr->keyHash = keyHash;
+	for (int i = 0; i < cachePtr->numberOfSizeClasses; i++)
+		SetKeyHash(cachePtr->sizeClass[i], keyHash);
+	for (int i = 0; i < cachePtr->numberOfDevices; i++)
+		SetKeyHash(cachePtr->device[i], keyHash);
+}
+
+void SetWritePolicy(struct Cache_t* cachePtr, enum WritePolicy_t writePolicy) {
+	cachePtr->writePolicy = writePolicy;
+	for (int i = 0; i < cachePtr->numberOfSizeClasses; i++)
+		SetWritePolicy(cachePtr->sizeClass[i], writePolicy);
+	for (int i = 0; i < cachePtr->numberOfDevices; i++)
+		SetWritePolicy(cachePtr->device[i], writePolicy);
+}
+
+void SetDecayPeriod(struct Cache_t* cachePtr, int decayPeriod) {
+	cachePtr->decayPeriod = decayPeriod;
+	for (int i = 0; i < cachePtr->numberOfSizeClasses; i++)
+		SetDecayPeriod(cachePtr->sizeClass[i], decayPeriod);
+	for (int i = 0; i < cachePtr->numberOfDevices; i++)
+		SetDecayPeriod(cachePtr->device[i], decayPeriod);
+}
+
+void SetThreadSafe(struct Cache_t* cachePtr, int numberOfLocks) {
+	//Remove the old locks first, the cache may not be in use by other threads
+	if (cachePtr->setLocks != NULL) {
+		for (int i = 0; i < cachePtr->numberOfLocks; i++)
+			pthread_mutex_destroy(&cachePtr->setLocks[i]);
+		pthread_mutex_destroy(&cachePtr->bypassLock);
+		pthread_mutex_destroy(&cachePtr->prefetchLock);
+		pthread_mutex_destroy(&cachePtr->pinLock);
+		pthread_mutex_destroy(&cachePtr->stagingLock);
+		pthread_mutex_destroy(&cachePtr->packLock);
+		pthread_mutex_destroy(&cachePtr->compressionLock);
+	}
+	free(cachePtr->setLocks);
+	free(cachePtr->setSequence);
+	cachePtr->setLocks = NULL;
+	cachePtr->setSequence = NULL;
+	cachePtr->threadSafe = false;
+	cachePtr->numberOfLocks = 0;
+
+	//Round down to a power of 2, a set associative cache needs no more stripes than sets
+	if ((cachePtr->numberOfSets > 0) && (numberOfLocks > cachePtr->numberOfSets))
+		numberOfLocks = cachePtr->numberOfSets;
+	if (numberOfLocks > 0) {
+		int stripes = 1;
+		while (2 * stripes <= numberOfLocks)
+			stripes *= 2;
+		cachePtr->numberOfLocks = stripes;
+		cachePtr->setLocks = (pthread_mutex_t*)malloc(stripes * sizeof(pthread_mutex_t));
+		cachePtr->setSequence = (unsigned int*)calloc(stripes, sizeof(unsigned int));
+		for (int i = 0; i < stripes; i++)
+			pthread_mutex_init(&cachePtr->setLocks[i], NULL);
+		pthread_mutex_init(&cachePtr->bypassLock, NULL);
+		pthread_mutex_init(&cachePtr->prefetchLock, NULL);
+		pthread_mutex_init(&cachePtr->pinLock, NULL);
+		pthread_mutex_init(&cachePtr->stagingLock, NULL);
+		pthread_mutex_init(&cachePtr->packLock, NULL);
+		pthread_mutex_init(&cachePtr->compressionLock, NULL);
+		cachePtr->threadSafe = true;
+	}
+	for (int i = 0; i < cachePtr->numberOfSizeClasses; i++)
+		SetThreadSafe(cachePtr->sizeClass[i], numberOfLocks);
+	for (int i = 0; i < cachePtr->numberOfDevices; i++)
+		SetThreadSafe(cachePtr->device[i], numberOfLocks);
+}
+
+void SetAdmissionPolicy(struct Cache_t* cachePtr, enum AdmissionPolicy_t admissionPolicy) {
+	int numberOfCacheLines = cachePtr->numberOfSets * cachePtr->numberOfLinesPerSet;
+
+	cachePtr->admissionPolicy = admissionPolicy;
+	if ((admissionPolicy == seen_twice_AP) && (cachePtr->admissionFilter == NULL) && (numberOfCacheLines > 0))
+		cachePtr->admissionFilter = (void**)calloc(numberOfCacheLines, sizeof(void*));
+	for (int i = 0; i < cachePtr->numberOfSizeClasses; i++)
+		SetAdmissionPolicy(cachePtr->sizeClass[i], admissionPolicy);
+	for (int i = 0; i < cachePtr->numberOfDevices; i++)
+		SetAdmissionPolicy(cachePtr->device[i], admissionPolicy);
+}
+
+int SetPolicyDuel(struct Cache_t* cachePtr, enum ReplacementPolicy_t firstPolicy, enum ReplacementPolicy_t secondPolicy) {
+	int result = 0;
+
+	for (int i = 0; i < cachePtr->numberOfSizeClasses; i++)
+		result |= SetPolicyDuel(cachePtr->sizeClass[i], firstPolicy, secondPolicy);
+	for (int i = 0; i < cachePtr->numberOfDevices; i++)
+		result |= SetPolicyDuel(cachePtr->device[i], firstPolicy, secondPolicy);
+	if (cachePtr->numberOfSets == 0)
+		return result;
+
+	//The duel needs sets that can follow an other policy, a single set or a single way has nothing to gain
+	//The scan resistant policies keep segment and ghost state that the other policies can not take over
+	if ((cachePtr->hashedIndex != NULL) || (cachePtr->numberOfSets < DUEL_MIN_PERIOD) || (cachePtr->numberOfLinesPerSet < 2)
+		|| IsScanResistant(cachePtr->policy) || IsScanResistant(firstPolicy) || IsScanResistant(secondPolicy))
+		return 1;
+	if (firstPolicy == secondPolicy) {
+		//The duel ends, every set converts to the one policy and the sets do not need their own policy anymore
+		if (cachePtr->setPolicy != NULL) {
+			cachePtr->duelPolicy[0] = cachePtr->duelPolicy[1] = firstPolicy;
+			for (int set = 0; set < cachePtr->numberOfSets; set++)
+				GetSetPolicy(set, cachePtr);
+			free(cachePtr->setPolicy);
+			cachePtr->setPolicy = NULL;
+		}
+		cachePtr->policy = firstPolicy;
+		return result;
+	}
+	if (cachePtr->setPolicy == NULL) {
+		cachePtr->setPolicy = (unsigned char*)malloc(cachePtr->numberOfSets * sizeof(unsigned char));
+		memset(cachePtr->setPolicy, (unsigned char)cachePtr->policy, cachePtr->numberOfSets);
+	}
+	//DUEL_LEADER_SETS leaders per policy, or fewer so at least half of the sets follow
+	int leaders = (cachePtr->numberOfSets / DUEL_MIN_PERIOD < DUEL_LEADER_SETS) ? cachePtr->numberOfSets / DUEL_MIN_PERIOD : DUEL_LEADER_SETS;
+	cachePtr->duelPeriod = cachePtr->numberOfSets / leaders;
+	cachePtr->duelPolicy[0] = firstPolicy;
+	cachePtr->duelPolicy[1] = secondPolicy;
+	cachePtr->duelCounter = DUEL_COUNTER_MAX / 2;
+	cachePtr->duelWinner = 0;
+	return result;
+}
+
+void SetContentCheck(struct Cache_t* cachePtr, enum ContentCheck_t contentCheck) {
+	cachePtr->contentCheck = contentCheck;
+	for (int i = 0; i < cachePtr->numberOfSizeClasses; i++)
+		SetContentCheck(cachePtr->sizeClass[i], contentCheck);
+	for (int i = 0; i < cachePtr->numberOfDevices; i++)
+		SetContentCheck(cachePtr->device[i], contentCheck);
+}
+
+int SetCompression(struct Cache_t* cachePtr, bool compression) {
+	cl_program program = NULL;
+	cl_int err = CL_SUCCESS;
+
+	//The kernels are built once for all devices of the context, every line cache gets its own kernel objects
+	if (compression) {
+		char options[64];
+		snprintf(options, sizeof(options), "-D ZERO_BLOCK_WORDS=%d", ZERO_BLOCK_WORDS);
+		program = clCreateProgramWithSource(cachePtr->context, 1, &zeroBlockSource, NULL, &err);
+		if (err == CL_SUCCESS)
+			err = clBuildProgram(program, 0, NULL, options, NULL, NULL);
+	}
+	//A failed build leaves the cache without compression
+	if (err == CL_SUCCESS)
+		err = SetCompressionKernels(program, cachePtr);
+	else
+		SetCompressionKernels(NULL, cachePtr);
+	if (program != NULL)
+		clReleaseProgram(program);
+	return (err == CL_SUCCESS) ? 0 : 1;
+}
+
+static cl_int SetCompressionKernels(cl_program program, struct Cache_t* cachePtr) {
+	cl_int err = CL_SUCCESS;
+
+	if (cachePtr->unpackKernel != NULL)
+		clReleaseKernel(cachePtr->unpackKernel);
+	if (cachePtr->markKernel != NULL)
+		clReleaseKernel(cachePtr->markKernel);
+	cachePtr->unpackKernel = NULL;
+	cachePtr->markKernel = NULL;
+	if ((program != NULL) && (cachePtr->numberOfSets > 0)) {
+		cachePtr->unpackKernel = clCreateKernel(program, "UnpackZeroBlocks", &err);
+		if (err == CL_SUCCESS)
+			cachePtr->markKernel = clCreateKernel(program, "MarkZeroBlocks", &err);
+		if (err != CL_SUCCESS) {
+			SetCompressionKernels(NULL, cachePtr);
+			return err;
+		}
+	}
+	for (int i = 0; (i < cachePtr->numberOfSizeClasses) && (err == CL_SUCCESS); i++)
+		err = SetCompressionKernels(program, cachePtr->sizeClass[i]);
+	for (int i = 0; (i < cachePtr->numberOfDevices) && (err == CL_SUCCESS); i++)
+		err = SetCompressionKernels(program, cachePtr->device[i]);
+	return err;
+}
+
+void SetTransferQueues(struct Cache_t* cachePtr, int numberOfTransferQueues, const cl_command_queue* transferQueues, size_t transferChunkSize) {
+	//Release the old queues, the transfers on them already finished when the caller made this call
+	for (int i = 0; i < cachePtr->numberOfTransferQueues; i++)
+		clReleaseCommandQueue(cachePtr->transferQueue[i]);
+	free(cachePtr->transferQueue);
+	cachePtr->transferQueue = NULL;
+	cachePtr->numberOfTransferQueues = 0;
+	cachePtr->transferChunkSize = 0;
+
+	if ((numberOfTransferQueues > 0) && (transferChunkSize > 0)) {
+		cachePtr->transferQueue = (cl_command_queue*)malloc(numberOfTransferQueues * sizeof(cl_command_queue));
+		for (int i = 0; i < numberOfTransferQueues; i++) {
+			cachePtr->transferQueue[i] = transferQueues[i];
+			clRetainCommandQueue(transferQueues[i]);
+		}
+		cachePtr->numberOfTransferQueues = numberOfTransferQueues;
+		cachePtr->transferChunkSize = transferChunkSize;
+	}
+	//The queues belong to one device, so only the size classes share them
+	for (int i = 0; i < cachePtr->numberOfSizeClasses; i++)
+		SetTransferQueues(cachePtr->sizeClass[i], numberOfTransferQueues, transferQueues, transferChunkSize);
+}
+
+int SetStagingBuffers(struct Cache_t* cachePtr, int numberOfStagingBuffers, size_t stagingSize) {
+	int result = 0;
+
+	//Release the old ring first, its transfers have to finish before the pinned memory is unmapped
+	for (int i = 0; i < cachePtr->numberOfStagingBuffers; i++) {
+		WaitStagingBuffer(i, cachePtr);
+		if (cachePtr->stagingHost[i] != NULL)
+			clEnqueueUnmapMemObject(cachePtr->commandQueue, cachePtr->stagingBuffer[i], cachePtr->stagingHost[i], 0, NULL, NULL);
+	}
+	if (cachePtr->numberOfStagingBuffers > 0)
+		clFinish(cachePtr->commandQueue);
+	for (int i = 0; i < cachePtr->numberOfStagingBuffers; i++) {
+		if (cachePtr->stagingBuffer[i] != NULL)
+			clReleaseMemObject(cachePtr->stagingBuffer[i]);
+	}
+	free(cachePtr->stagingBuffer);
+	free(cachePtr->stagingHost);
+	free(cachePtr->stagingEvent);
+	cachePtr->stagingBuffer = NULL;
+	cachePtr->stagingHost = NULL;
+	cachePtr->stagingEvent = NULL;
+	cachePtr->numberOfStagingBuffers = 0;
+	cachePtr->nextStagingBuffer = 0;
+
+	//Only the caches that hold lines transfer data, a front end gives every size class or device its own ring
+	if ((cachePtr->numberOfSets > 0) && (numberOfStagingBuffers > 0) && (stagingSize > 0)) {
+		//Double buffering needs at least two buffers
+		int numberOfBuffers = (numberOfStagingBuffers < 2) ? 2 : ((numberOfStagingBuffers > MAX_STAGING_BUFFERS) ? MAX_STAGING_BUFFERS : numberOfStagingBuffers);
+		cl_int err = CL_SUCCESS;
+		cachePtr->stagingBuffer = (cl_mem*)calloc(numberOfBuffers, sizeof(cl_mem));
+		cachePtr->stagingHost = (void**)calloc(numberOfBuffers, sizeof(void*));
+		cachePtr->stagingEvent = (cl_event*)calloc(numberOfBuffers, sizeof(cl_event));
+		cachePtr->numberOfStagingBuffers = numberOfBuffers;
+		cachePtr->stagingSize = stagingSize;
+		for (int i = 0; (i < numberOfBuffers) && (err == CL_SUCCESS); i++) {
+			//Memory allocated by the runtime is page locked, it stays mapped for the lifetime of the ring
+			cachePtr->stagingBuffer[i] = clCreateBuffer(cachePtr->context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, stagingSize, NULL, &err);
+			if (err == CL_SUCCESS)
+				cachePtr->stagingHost[i] = clEnqueueMapBuffer(cachePtr->commandQueue, cachePtr->stagingBuffer[i], CL_TRUE, CL_MAP_READ | CL_MAP_WRITE, 0, stagingSize, 0, NULL, NULL, &err);
+			if (err != CL_SUCCESS)
+				cachePtr->stagingHost[i] = NULL;
+		}
+		if (err != CL_SUCCESS) {
+			//Without the whole ring the transfers go directly to the host memory
+			SetStagingBuffers(cachePtr, 0, 0);
+			result = 1;
+		}
+	}
+	for (int i = 0; i < cachePtr->numberOfSizeClasses; i++)
+		result |= SetStagingBuffers(cachePtr->sizeClass[i], numberOfStagingBuffers, stagingSize);
+	for (int i = 0; i < cachePtr->numberOfDevices; i++)
+		result |= SetStagingBuffers(cachePtr->device[i], numberOfStagingBuffers, stagingSize);
+	return result;
+}
+
+void SetPrefetcher(struct Cache_t* cachePtr, enum Prefetcher_t prefetcher, int prefetchDepth, void* lowAddress, void* highAddress) {
+	//The prefetcher watches the requests of the application, so only the cache they are made on needs it
+	cachePtr->prefetcher = prefetcher;
+	cachePtr->prefetchDepth = (prefetchDepth < 0) ? 0 : ((prefetchDepth > MAX_PREFETCH_DEPTH) ? MAX_PREFETCH_DEPTH : prefetchDepth);
+	cachePtr->prefetchLow = (char*)lowAddress;
+	cachePtr->prefetchHigh = (char*)highAddress;
+	cachePtr->lastAddress = NULL;
+	cachePtr->lastStride = 0;
+	cachePtr->strideConfidence = 0;
+	if ((prefetcher == sequence_PF) && (cachePtr->prefetchHistory == NULL)) {
+		cachePtr->prefetchHistory = (PrefetchEntry_t*)calloc(PREFETCH_HISTORY, sizeof(PrefetchEntry_t));
+		cachePtr->numberOfPrefetchEntries = PREFETCH_HISTORY;
+		cachePtr->prefetchHistoryNext = 0;
+	}
+}
+
+int SetTraceFile(struct Cache_t* cachePtr, const char* fileName) {
+	TraceFile_t* trace = cachePtr->trace;
+	int result = 0;
+
+	//Close the running trace first, its last records are still in the buffer
+	if (trace != NULL) {
+		__atomic_store_n(&cachePtr->trace, NULL, __ATOMIC_RELEASE);
+		pthread_mutex_lock(&trace->lock);
+		if (!WriteTraceRecords(trace))
+			result = 1;
+		if (fclose(trace->file) != 0)
+			result = 1;
+		pthread_mutex_unlock(&trace->lock);
+		pthread_mutex_destroy(&trace->lock);
+		free(trace->records);
+		free(trace);
+	}
+	if (fileName == NULL)
+		return result;
+
+	FILE* file = fopen(fileName, "wb");
+	if (file == NULL)
+		return 1;
+	TraceHeader_t header = {CACHE_TRACE_MAGIC, CACHE_TRACE_VERSION, sizeof(TraceRecord_t), 0};
+	if (fwrite(&header, sizeof(TraceHeader_t), 1, file) != 1) {
+		fclose(file);
+		return 1;
+	}
+	trace = (TraceFile_t*)malloc(sizeof(TraceFile_t));
+	trace->file = file;
+	pthread_mutex_init(&trace->lock, NULL);
+	trace->records = (TraceRecord_t*)malloc(TRACE_BUFFER_RECORDS * sizeof(TraceRecord_t));
+	trace->numberOfRecords = 0;
+	clock_gettime(CLOCK_MONOTONIC, &trace->start);
+	__atomic_store_n(&cachePtr->trace, trace, __ATOMIC_RELEASE);
+	return result;
+}
+
+static void TraceRequest(enum TraceKind_t kind, cl_mem_flags flags, size_t offset, size_t size, void* hostAddress, struct Cache_t* cachePtr) {
+	TraceFile_t* trace = __atomic_load_n(&cachePtr->trace, __ATOMIC_ACQUIRE);
+	struct timespec now;
+
+	if (trace == NULL)
+		return;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	pthread_mutex_lock(&trace->lock);
+	TraceRecord_t* record = &trace->records[trace->numberOfRecords++];
+	record->time = (uint64_t)(now.tv_sec - trace->start.tv_sec) * 1000000000 + (uint64_t)now.tv_nsec - (uint64_t)trace->start.tv_nsec;
+	record->hostAddress = (uint64_t)(uintptr_t)hostAddress;
+	record->size = (uint64_t)size;
+	record->offset = (uint64_t)offset;
+	record->flags = (uint64_t)flags;
+	record->kind = (uint32_t)kind;
+	record->reserved = 0;
+	if (trace->numberOfRecords == TRACE_BUFFER_RECORDS)
+		WriteTraceRecords(trace);
+	pthread_mutex_unlock(&trace->lock);
+}
+
+static bool WriteTraceRecords(TraceFile_t* trace) {
+	//A failed write drops the records, the trace of the application goes on
+	bool written = (fwrite(trace->records, sizeof(TraceRecord_t), trace->numberOfRecords, trace->file) == (size_t)trace->numberOfRecords);
+	trace->numberOfRecords = 0;
+	return written;
+}
+
+int SetProfiling(struct Cache_t* cachePtr, bool profiling) {
+	TransferProfile_t* profile = NULL;
+
+	//Without profiling on the queues the events have no timestamps
+	if (profiling && !HasProfilingQueues(cachePtr))
+		return 1;
+	if (profiling) {
+		profile = (TransferProfile_t*)calloc(1, sizeof(TransferProfile_t));
+		pthread_mutex_init(&profile->lock, NULL);
+		profile->latencyHistogram = (uint64_t*)calloc(PROFILE_KINDS * PROFILE_SIZE_BUCKETS * PROFILE_LATENCY_BUCKETS, sizeof(uint64_t));
+		profile->records = (ProfileRecord_t*)malloc(PROFILE_RECORDS * sizeof(ProfileRecord_t));
+		profile->references = 1;
+	}
+	SetProfile(profile, cachePtr);
+	ReleaseProfile(profile);
+	return 0;
+}
+
+void ProfileKernel(struct Cache_t* cachePtr, cl_event event) {
+	if (cachePtr->profile == NULL)
+		return;
+	clRetainEvent(event);
+	HandOverProfileEvent(event, kernel_PK, 0, NULL, cachePtr->profile);
+}
+
+uint64_t GetProfileLatency(struct Cache_t* cachePtr, enum ProfileKind_t kind, size_t size, double percentile) {
+	TransferProfile_t* profile = cachePtr->profile;
+	uint64_t histogram[PROFILE_LATENCY_BUCKETS] = {0};
+	uint64_t count = 0, rank, seen = 0;
+	int firstSize = 0, lastSize = PROFILE_SIZE_BUCKETS - 1;
+
+	if (profile == NULL)
+		return 0;
+	//A size of 0 takes the transfers of all sizes together
+	if (size > 0)
+		firstSize = lastSize = GetSizeBucket(size);
+	pthread_mutex_lock(&profile->lock);
+	for (int sizeBucket = firstSize; sizeBucket <= lastSize; sizeBucket++) {
+		uint64_t* bucket = &profile->latencyHistogram[((int)kind * PROFILE_SIZE_BUCKETS + sizeBucket) * PROFILE_LATENCY_BUCKETS];
+		for (int i = 0; i < PROFILE_LATENCY_BUCKETS; i++) {
+			histogram[i] += bucket[i];
+			count += bucket[i];
+		}
+	}
+	pthread_mutex_unlock(&profile->lock);
+	if (count == 0)
+		return 0;
+	rank = (uint64_t)(percentile * (double)count);
+	if (rank >= count)
+		rank = count - 1;
+	for (int i = 0; i < PROFILE_LATENCY_BUCKETS; i++) {
+		seen += histogram[i];
+		if (seen > rank)
+			return GetBucketLatency(i);
+	}
+	return 0;
+}
 
-	if ((cachePtr->cacheLine[set][way].valid == true) && (cachePtr->cacheLine[set][way].tag == hostAddress)) {
-   	err = clEnqueueReadBuffer(command_queue, cachePtr->cacheLine[set][way].deviceData , blocking_read, offset, cachePtr->dataSize, hostAddress, num_events_in_wait_list, event_wait_list, event);  
-		cachePtr->memCopies += 1;
-		cachePtr->ReadTransfers += 1;
+double GetMissTimeFraction(struct Cache_t* cachePtr) {
+	TransferProfile_t* profile = cachePtr->profile;
+	double fraction = 0;
+
+	if (profile == NULL)
 		return 0;
+	pthread_mutex_lock(&profile->lock);
+	uint64_t transferTime = profile->busyTime[to_device_PK] + profile->busyTime[to_host_PK];
+	if (transferTime + profile->busyTime[kernel_PK] > 0)
+		fraction = (double)transferTime / (double)(transferTime + profile->busyTime[kernel_PK]);
+	pthread_mutex_unlock(&profile->lock);
+	return fraction;
+}
+
+int WriteChromeTrace(struct Cache_t* cachePtr, const char* fileName) {
+	const char kindString[PROFILE_KINDS][10] = {"to device", "to host", "kernel"};
+	TransferProfile_t* profile = cachePtr->profile;
+	cl_ulong first = 0;
+
+	if (profile == NULL)
+		return 1;
+	FILE* file = fopen(fileName, "w");
+	if (file == NULL)
+		return 1;
+	pthread_mutex_lock(&profile->lock);
+	//The oldest kept record is overwritten next, the timestamps start at the earliest queued command
+	int numberOfRecords = (profile->numberOfRecords < PROFILE_RECORDS) ? profile->numberOfRecords : PROFILE_RECORDS;
+	int oldest = (profile->numberOfRecords < PROFILE_RECORDS) ? 0 : profile->nextRecord;
+	for (int i = 0; i < numberOfRecords; i++) {
+		if ((i == 0) || (profile->records[i].queued < first))
+			first = profile->records[i].queued;
+	}
+	fprintf(file, "{\"traceEvents\":[\n");
+	for (int kind = 0; kind < PROFILE_KINDS; kind++)
+		fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%d,\"args\":{\"name\":\"%s\"}},\n", kind, kindString[kind]);
+	for (int i = 0; i < numberOfRecords; i++) {
+		ProfileRecord_t* record = &profile->records[(oldest + i) % PROFILE_RECORDS];
+		fprintf(file, "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":0,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"bytes\":%zu,\"queued_us\":%.3f}}%s\n",
+			kindString[record->kind], record->kind, (double)(record->start - first) / 1000.0, (double)(record->end - record->start) / 1000.0,
+			record->size, (double)(record->start - record->queued) / 1000.0, (i + 1 < numberOfRecords) ? "," : "");
+	}
+	fprintf(file, "]}\n");
+	pthread_mutex_unlock(&profile->lock);
+	return (fclose(file) == 0) ? 0 : 1;
+}
+
+static bool HasProfilingQueues(struct Cache_t* cachePtr) {
+	cl_command_queue_properties properties = 0;
+
+	if ((cachePtr->commandQueue != NULL) && ((clGetCommandQueueInfo(cachePtr->commandQueue, CL_QUEUE_PROPERTIES, sizeof(properties), &properties, NULL) != CL_SUCCESS)
+		|| ((properties & CL_QUEUE_PROFILING_ENABLE) == 0)))
+		return false;
+	for (int i = 0; i < cachePtr->numberOfSizeClasses; i++) {
+		if (!HasProfilingQueues(cachePtr->sizeClass[i]))
+			return false;
+	}
+	for (int i = 0; i < cachePtr->numberOfDevices; i++) {
+		if (!HasProfilingQueues(cachePtr->device[i]))
+			return false;
+	}
+	return true;
+}
+
+static void SetProfile(TransferProfile_t* profile, struct Cache_t* cachePtr) {
+	//Every cache holds a reference, so the size classes and devices record into the same profile
+	ReleaseProfile(cachePtr->profile);
+	if (profile != NULL)
+		__atomic_add_fetch(&profile->references, 1, __ATOMIC_RELAXED);
+	cachePtr->profile = profile;
+	for (int i = 0; i < cachePtr->numberOfSizeClasses; i++)
+		SetProfile(profile, cachePtr->sizeClass[i]);
+	for (int i = 0; i < cachePtr->numberOfDevices; i++)
+		SetProfile(profile, cachePtr->device[i]);
+}
+
+static void ReleaseProfile(TransferProfile_t* profile) {
+	if ((profile == NULL) || (__atomic_sub_fetch(&profile->references, 1, __ATOMIC_ACQ_REL) > 0))
+		return;
+	pthread_mutex_destroy(&profile->lock);
+	free(profile->latencyHistogram);
+	free(profile->records);
+	free(profile);
+}
+
+static void HandOverProfileEvent(cl_event profileEvent, enum ProfileKind_t kind, size_t size, cl_event* event, TransferProfile_t* profile) {
+	if (profileEvent == NULL)
+		return;
+	//The callback holds its own reference to the event and the profile until the command completed
+	ProfiledEvent_t* profiled = (ProfiledEvent_t*)malloc(sizeof(ProfiledEvent_t));
+	profiled->profile = profile;
+	profiled->kind = kind;
+	profiled->size = size;
+	__atomic_add_fetch(&profile->references, 1, __ATOMIC_RELAXED);
+	if (event != NULL)
+		clRetainEvent(profileEvent);
+	if (clSetEventCallback(profileEvent, CL_COMPLETE, ProfileEventCallback, profiled) != CL_SUCCESS) {
+		clReleaseEvent(profileEvent);
+		ReleaseProfile(profile);
+		free(profiled);
+	}
+	if (event != NULL)
+		*event = profileEvent;
+}
+
+static void CL_CALLBACK ProfileEventCallback(cl_event event, cl_int status, void* userData) {
+	ProfiledEvent_t* profiled = (ProfiledEvent_t*)userData;
+	cl_ulong queued = 0, start = 0, end = 0;
+
+	//A queue without CL_QUEUE_PROFILING_ENABLE gives no timestamps, the command is then not recorded
+	if ((status == CL_COMPLETE)
+		&& (clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_QUEUED, sizeof(cl_ulong), &queued, NULL) == CL_SUCCESS)
+		&& (clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &start, NULL) == CL_SUCCESS)
+		&& (clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &end, NULL) == CL_SUCCESS)
+		&& (end >= start) && (start >= queued))
+		RecordProfile(profiled->kind, profiled->size, queued, start, end, profiled->profile);
+	clReleaseEvent(event);
+	ReleaseProfile(profiled->profile);
+	free(profiled);
+}
+
+static void RecordProfile(enum ProfileKind_t kind, size_t size, cl_ulong queued, cl_ulong start, cl_ulong end, TransferProfile_t* profile) {
+	//The latency of a transfer includes the time it waited in the queue
+	uint64_t latency = end - queued;
+	int latencyBucket = GetLatencyBucket(latency);
+
+	pthread_mutex_lock(&profile->lock);
+	profile->latencyHistogram[((int)kind * PROFILE_SIZE_BUCKETS + GetSizeBucket(size)) * PROFILE_LATENCY_BUCKETS + latencyBucket]++;
+	profile->busyTime[kind] += end - start;
+	ProfileRecord_t* record = &profile->records[profile->nextRecord];
+	record->kind = kind;
+	record->size = size;
+	record->queued = queued;
+	record->start = start;
+	record->end = end;
+	profile->nextRecord = (profile->nextRecord + 1) % PROFILE_RECORDS;
+	profile->numberOfRecords++;
+	pthread_mutex_unlock(&profile->lock);
+}
+
+static int GetSizeBucket(size_t size) {
+	int bucket = 0;
+	while ((bucket < PROFILE_SIZE_BUCKETS - 1) && (((size_t)2 << bucket) <= size))
+		bucket++;
+	return bucket;
+}
+
+static int GetLatencyBucket(uint64_t latency) {
+	int octave = 0;
+	if (latency < PROFILE_SUB_BUCKETS)
+		return (int)latency;
+	while ((latency >> octave) >= 2 * PROFILE_SUB_BUCKETS)
+		octave++;
+	//The bits below the leading bit pick one of the PROFILE_SUB_BUCKETS buckets of the octave
+	int bucket = (octave + 1) * PROFILE_SUB_BUCKETS + (int)((latency >> octave) - PROFILE_SUB_BUCKETS);
+	return (bucket < PROFILE_LATENCY_BUCKETS) ? bucket : PROFILE_LATENCY_BUCKETS - 1;
+}
+
+static uint64_t GetBucketLatency(int bucket) {
+	if (bucket < PROFILE_SUB_BUCKETS)
+		return (uint64_t)bucket;
+	int octave = bucket / PROFILE_SUB_BUCKETS - 1;
+	uint64_t low = (uint64_t)(PROFILE_SUB_BUCKETS + bucket % PROFILE_SUB_BUCKETS) << octave;
+	//The middle of the bucket
+	return low + (((uint64_t)1 << octave) >> 1);
+}
+
+void GetCacheStats(struct Cache_t* cachePtr, CacheStats_t* stats) {
+	int numberOfSets = 0, maxLinesPerSet = 0, set = 0;
+
+	memset(stats, 0, sizeof(CacheStats_t));
+	CountStatsSets(cachePtr, &numberOfSets, &maxLinesPerSet);
+	stats->numberOfSets = numberOfSets;
+	stats->maxLinesPerSet = maxLinesPerSet;
+	stats->setOccupancy = (int*)calloc(numberOfSets, sizeof(int));
+	stats->setMisses = (uint64_t*)calloc(numberOfSets, sizeof(uint64_t));
+	stats->occupancyHistogram = (uint64_t*)calloc(maxLinesPerSet + 1, sizeof(uint64_t));
+	AddCacheStats(cachePtr, stats, &set);
+	stats->misses = stats->coldMisses + stats->conflictMisses + stats->capacityMisses;
+}
+
+void FreeCacheStats(CacheStats_t* stats) {
+	free(stats->setOccupancy);
+	free(stats->setMisses);
+	free(stats->occupancyHistogram);
+	stats->setOccupancy = NULL;
+	stats->setMisses = NULL;
+	stats->occupancyHistogram = NULL;
+}
+
+void ResetCacheStats(struct Cache_t* cachePtr) {
+	//Every counter is reset on its own, a thread safe cache may keep counting in the meantime
+	__atomic_store_n(&cachePtr->memCopies, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&cachePtr->ReadTransfers, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&cachePtr->WriteTransfers, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&cachePtr->Bypasses, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&cachePtr->PeerTransfers, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&cachePtr->Prefetches, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&cachePtr->UsefulPrefetches, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&cachePtr->UnchangedHits, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&cachePtr->ChangedUploads, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&cachePtr->DedupCopies, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&cachePtr->CompressedTransfers, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&cachePtr->SavedBytes, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&cachePtr->Hits, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&cachePtr->ColdMisses, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&cachePtr->CapacityMisses, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&cachePtr->Evictions, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&cachePtr->DirtyWriteBacks, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&cachePtr->BytesToDevice, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&cachePtr->BytesToHost, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&cachePtr->DuelMisses[0], 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&cachePtr->DuelMisses[1], 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&cachePtr->PolicySwitches, 0, __ATOMIC_RELAXED);
+	for (int set = 0; set < cachePtr->numberOfSets; set++) {
+		LockSet(set, cachePtr);
+		__atomic_store_n(&cachePtr->conflictMisses[set], 0, __ATOMIC_RELAXED);
+		__atomic_store_n(&cachePtr->setMisses[set], 0, __ATOMIC_RELAXED);
+		UnlockSet(set, cachePtr);
+	}
+	for (int i = 0; i < cachePtr->numberOfSizeClasses; i++)
+		ResetCacheStats(cachePtr->sizeClass[i]);
+	for (int i = 0; i < cachePtr->numberOfDevices; i++)
+		ResetCacheStats(cachePtr->device[i]);
+}
+
+static void CountStatsSets(struct Cache_t* cachePtr, int* numberOfSets, int* maxLinesPerSet) {
+	*numberOfSets += cachePtr->numberOfSets;
+	if ((cachePtr->numberOfSets > 0) && (cachePtr->numberOfLinesPerSet > *maxLinesPerSet))
+		*maxLinesPerSet = cachePtr->numberOfLinesPerSet;
+	for (int i = 0; i < cachePtr->numberOfSizeClasses; i++)
+		CountStatsSets(cachePtr->sizeClass[i], numberOfSets, maxLinesPerSet);
+	for (int i = 0; i < cachePtr->numberOfDevices; i++)
+		CountStatsSets(cachePtr->device[i], numberOfSets, maxLinesPerSet);
+}
+
+static void AddCacheStats(struct Cache_t* cachePtr, CacheStats_t* stats, int* set) {
+	//The counters of a front end cache are sums of its size classes or devices, only the line caches are added
+	if (cachePtr->numberOfSets > 0) {
+		stats->hits += __atomic_load_n(&cachePtr->Hits, __ATOMIC_RELAXED);
+		stats->coldMisses += __atomic_load_n(&cachePtr->ColdMisses, __ATOMIC_RELAXED);
+		stats->capacityMisses += __atomic_load_n(&cachePtr->CapacityMisses, __ATOMIC_RELAXED);
+		stats->evictions += __atomic_load_n(&cachePtr->Evictions, __ATOMIC_RELAXED);
+		stats->dirtyWriteBacks += __atomic_load_n(&cachePtr->DirtyWriteBacks, __ATOMIC_RELAXED);
+		stats->bypasses += (uint64_t)__atomic_load_n(&cachePtr->Bypasses, __ATOMIC_RELAXED);
+		stats->bytesToDevice += __atomic_load_n(&cachePtr->BytesToDevice, __ATOMIC_RELAXED);
+		stats->bytesToHost += __atomic_load_n(&cachePtr->BytesToHost, __ATOMIC_RELAXED);
+		stats->duelMisses[0] += __atomic_load_n(&cachePtr->DuelMisses[0], __ATOMIC_RELAXED);
+		stats->duelMisses[1] += __atomic_load_n(&cachePtr->DuelMisses[1], __ATOMIC_RELAXED);
+		stats->policySwitches += __atomic_load_n(&cachePtr->PolicySwitches, __ATOMIC_RELAXED);
+		//The first line cache decides the follower policy
+		if (*set == 0)
+			stats->followerPolicy = (cachePtr->setPolicy != NULL) ? cachePtr->duelPolicy[__atomic_load_n(&cachePtr->duelWinner, __ATOMIC_RELAXED)] : cachePtr->policy;
+	}
+	//The sets are read under their lock, the numbers of different sets may be from slightly different moments
+	for (int i = 0; i < cachePtr->numberOfSets; i++, (*set)++) {
+		int occupancy = 0;
+		LockSet(i, cachePtr);
+		for (int line = i * cachePtr->numberOfLinesPerSet; line < (i + 1) * cachePtr->numberOfLinesPerSet; line++) {
+			if (cachePtr->valid[line] == true)
+				occupancy++;
+		}
+		stats->conflictMisses += __atomic_load_n(&cachePtr->conflictMisses[i], __ATOMIC_RELAXED);
+		stats->setMisses[*set] = __atomic_load_n(&cachePtr->setMisses[i], __ATOMIC_RELAXED);
+		UnlockSet(i, cachePtr);
+		stats->setOccupancy[*set] = occupancy;
+		stats->occupancyHistogram[occupancy]++;
 	}
-	return 1;
+	for (int i = 0; i < cachePtr->numberOfSizeClasses; i++)
+		AddCacheStats(cachePtr->sizeClass[i], stats, set);
+	for (int i = 0; i < cachePtr->numberOfDevices; i++)
+		AddCacheStats(cachePtr->device[i], stats, set);
+}
+
+int clFlushCache(cl_command_queue command_queue, struct Cache_t* cachePtr) {
+	cl_int err = CL_SUCCESS;
+
+	TraceRequest(flush_TK, 0, 0, 0, NULL, cachePtr);
+
+	if (cachePtr->device != NULL) {
+		//Every device writes back on its own queue
+		int result = 0;
+		for (int i = 0; i < cachePtr->numberOfDevices; i++)
+			result |= clFlushCache(cachePtr->device[i]->commandQueue, cachePtr->device[i]);
+		SumSubCacheCounters(cachePtr);
+		return result;
+	}
+	if (cachePtr->sizeClass != NULL) {
+		int result = 0;
+		for (int i = 0; i < cachePtr->numberOfSizeClasses; i++)
+			result |= clFlushCache(command_queue, cachePtr->sizeClass[i]);
+		SumSubCacheCounters(cachePtr);
+		return result;
+	}
+
+	//Enqueue all write backs without blocking and wait once at the end
+	for (int set = 0; (set < cachePtr->numberOfSets) && (err == CL_SUCCESS); set++) {
+		LockSet(set, cachePtr);
+		for (int line = set * cachePtr->numberOfLinesPerSet; line < (set + 1) * cachePtr->numberOfLinesPerSet; line++) {
+			if ((cachePtr->valid[line] != true) || (cachePtr->dirty[line] != true))
+				continue;
+			cl_event profileEvent = NULL;
+			err = clEnqueueReadBuffer(command_queue, cachePtr->deviceData[line], CL_FALSE, 0, cachePtr->size[line], cachePtr->hostData[line], 0, NULL, (cachePtr->profile != NULL) ? &profileEvent : NULL);
+			HandOverProfileEvent(profileEvent, to_host_PK, cachePtr->size[line], NULL, cachePtr->profile);
+			if (err != CL_SUCCESS)
+				break;
+			cachePtr->dirty[line] = false;
+			cachePtr->deviceAuthoritative[line] = false;
+			ADD_COUNTER(cachePtr->memCopies, 1);
+			ADD_COUNTER(cachePtr->ReadTransfers, 1);
+			ADD_COUNTER(cachePtr->DirtyWriteBacks, 1);
+			if (cachePtr->memoryBackend == copy_MB)
+				ADD_COUNTER(cachePtr->BytesToHost, (uint64_t)cachePtr->size[line]);
+		}
+		UnlockSet(set, cachePtr);
+	}
+	LockBypass(cachePtr);
+	for (int i = 0; (i < cachePtr->numberOfBypassBuffers) && (err == CL_SUCCESS); i++) {
+		if (cachePtr->bypass[i].dirty != true)
+			continue;
+		cl_event profileEvent = NULL;
+		err = clEnqueueReadBuffer(command_queue, cachePtr->bypass[i].deviceData, CL_FALSE, 0, cachePtr->bypass[i].size, cachePtr->bypass[i].hostData, 0, NULL, (cachePtr->profile != NULL) ? &profileEvent : NULL);
+		HandOverProfileEvent(profileEvent, to_host_PK, cachePtr->bypass[i].size, NULL, cachePtr->profile);
+		if (err != CL_SUCCESS)
+			break;
+		cachePtr->bypass[i].dirty = false;
+		ADD_COUNTER(cachePtr->memCopies, 1);
+		ADD_COUNTER(cachePtr->ReadTransfers, 1);
+		ADD_COUNTER(cachePtr->DirtyWriteBacks, 1);
+		if (cachePtr->memoryBackend == copy_MB)
+			ADD_COUNTER(cachePtr->BytesToHost, (uint64_t)cachePtr->bypass[i].size);
+	}
+	UnlockBypass(cachePtr);
+	if (clFinish(command_queue) != CL_SUCCESS || err != CL_SUCCESS)
+		return 1;
+	//All work on the bypass buffers is done, they are not needed anymore
+	LockBypass(cachePtr);
+	while (cachePtr->numberOfBypassBuffers > 0)
+		ReleaseBypass(command_queue, cachePtr->numberOfBypassBuffers - 1, false, cachePtr);
+	UnlockBypass(cachePtr);
+	return 0;
 }
 
 void FreeCache(struct Cache_t* cachePtr) {
-	int numberOfLinesPerSet = cachePtr->numberOfLinesPerSet;
-	int numberOfSets = cachePtr->numberOfSets;
-	
-	for (int i = 0; i < numberOfSets; i++) {
-		for (int j = 0; j < numberOfLinesPerSet; j++) {
-			//Free the data and meta data from the cachelines
-			free(cachePtr->cacheLine[i][j].metaData);
-			clReleaseMemObject(cachePtr->cacheLine[i][j].deviceData);
-		}	
-		//Free the cachelines from the sets
-		free(cachePtr->cacheLine[i]);
+	int numberOfCacheLines = cachePtr->numberOfLinesPerSet * cachePtr->numberOfSets;
+
+	//Pins that wait for an event keep a pointer into the cache, let their callbacks finish first
+	ReleaseCompletedPins(true, cachePtr);
+	//Unmap and release the staging ring while the queue is still retained
+	if (cachePtr->numberOfSets > 0)
+		SetStagingBuffers(cachePtr, 0, 0);
+	for (int i = 0; i < cachePtr->numberOfTransferQueues; i++)
+		clReleaseCommandQueue(cachePtr->transferQueue[i]);
+	free(cachePtr->transferQueue);
+	if (cachePtr->packedData != NULL)
+		clReleaseMemObject(cachePtr->packedData);
+	if (cachePtr->unpackKernel != NULL)
+		clReleaseKernel(cachePtr->unpackKernel);
+	if (cachePtr->markKernel != NULL)
+		clReleaseKernel(cachePtr->markKernel);
+	if (cachePtr->compressionEvent != NULL)
+		clReleaseEvent(cachePtr->compressionEvent);
+	if (cachePtr->compressedData != NULL)
+		clReleaseMemObject(cachePtr->compressedData);
+	if (cachePtr->markData != NULL)
+		clReleaseMemObject(cachePtr->markData);
+	//Events that did not complete yet hold their own reference to the profile
+	ReleaseProfile(cachePtr->profile);
+	SetTraceFile(cachePtr, NULL);
+	//Destroy the locks, no other thread may use the cache anymore
+	SetThreadSafe(cachePtr, 0);
+	//Release the device buffers of the cachelines
+	for (int i = 0; i < numberOfCacheLines; i++) {
+		if (cachePtr->deviceData[i] != NULL)
+			clReleaseMemObject(cachePtr->deviceData[i]);
 	}
+	//Free the fields of the cachelines
+	free(cachePtr->tag);
+	free(cachePtr->hostData);
+	free(cachePtr->valid);
+	free(cachePtr->dirty);
+	free(cachePtr->deviceAuthoritative);
+	free(cachePtr->size);
+	free(cachePtr->accessedOrder);
+	free(cachePtr->deviceData);
+	free(cachePtr->metaData);
+	FreeHashedIndex(cachePtr->hashedIndex);
+	free(cachePtr->lineState);
+	free(cachePtr->ghostTag);
+	free(cachePtr->ghostState);
+	free(cachePtr->ghostOrder);
+	free(cachePtr->arcTarget);
+	free(cachePtr->admissionFilter);
+	free(cachePtr->prefetched);
+	free(cachePtr->setPolicy);
+	free(cachePtr->contentHash);
+	free(cachePtr->pinCount);
+	free(cachePtr->prefetchHistory);
+	//Release the temporary buffers of bypassed requests
+	for (int i = 0; i < cachePtr->numberOfBypassBuffers; i++)
+		clReleaseMemObject(cachePtr->bypass[i].deviceData);
+	free(cachePtr->bypass);
+	//Free the size classes behind the cache
+	for (int i = 0; i < cachePtr->numberOfSizeClasses; i++)
+		FreeCache(cachePtr->sizeClass[i]);
+	free(cachePtr->sizeClass);
+	for (int i = 0; i < cachePtr->numberOfDevices; i++)
+		FreeCache(cachePtr->device[i]);
+	free(cachePtr->device);
 	//Free the sets from the cache
 	free(cachePtr->replacementLine);
-	free(cachePtr->cacheLine);
+	free(cachePtr->decayCounter);
+	free(cachePtr->randomState);
+	free(cachePtr->conflictMisses);
+	free(cachePtr->setMisses);
+	//Release the context and queue retained by CreateCache(), a multi-device cache has no queue of its own
+	if (cachePtr->commandQueue != NULL)
+		clReleaseCommandQueue(cachePtr->commandQueue);
+	clReleaseContext(cachePtr->context);
 	//Free the cache
 	free(cachePtr);
 }
@@ -1,4 +1,8 @@
 #include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <time.h>
 #ifndef cache
 #define cache
 #ifdef __APPLE__
@@ -12,64 +16,528 @@
 //-----------Defining constants--------------
 //-------------------------------------------
 
+/*
+* A flag for clCreateCacheBuffer() and clEnqueueCacheBuffer() for data that will not be reused.
+* A request with this flag gets a temporary buffer that does not take a line, unless the data is already cached.
+* The bit is far above the flags defined by OpenCL and is never passed to the OpenCL runtime.
+*/
+#define CL_MEM_CACHE_BYPASS ((cl_mem_flags)1 << 40)
+
 /*
 * There are multiple different cache configurations supported by this application.
 * The different configurations are listed in an enumerate to be used as an argument
 * in the create_cache function.
+* Any other power of 2 number of ways is created with CreateAssociativeCache(), such a cache has the n_way configuration.
 */
-typedef enum CacheConfiguration_t { direct_mapped, two_way, four_way, fully_associative } config;
+typedef enum CacheConfiguration_t { direct_mapped, two_way, four_way, fully_associative, n_way } config;
 
 /*
 * There are multiple different replacement policies supported by this application.
 * The different replacement policies are listed in an enumerate to be used as an argument
 * in the CreateCache() function.
+* The last four policies resist one-pass scans that would flush the hot lines out of an LRU cache:
+* clock_RP approximates LRU with one reference bit per line and a clock hand per set.
+* slru_RP puts new lines in a probation segment, a hit promotes them to a protected segment of 3/4 of the ways.
+* two_queue_RP (2Q) keeps new lines in a FIFO of 1/4 of the ways and remembers the tags it evicts,
+* a miss on a remembered tag goes directly to the LRU main segment.
+* arc_RP (ARC) remembers the tags evicted from its recency and frequency segments and adapts
+* the size of both segments to the misses on those tags.
+*/
+typedef enum ReplacementPolicy_t {random_RP, fifo_RP, lru_RP, mru_RP, lfu_RP, mfu_RP, clock_RP, slru_RP, two_queue_RP, arc_RP} policy;
+
+/*
+* There are two write policies supported by this application.
+* With no_write_back_WP the data only returns to the host when the application calls clEnqueueReadCacheBuffer().
+* With write_back_WP output buffers are marked dirty and are written back to the host 
+* when they are evicted or when clFlushCache() is called.
+* The write policy is set with the SetWritePolicy() function.
+*/
+typedef enum WritePolicy_t {no_write_back_WP, write_back_WP} writePolicy;
+
+/*
+* There are multiple index functions to map a host address to a set.
+* modulo_IF takes the index bits directly above the addressBitShift, this is the default.
+* xor_fold_IF folds all higher address bits onto the index bits with an XOR.
+* fibonacci_IF multiplies the address with the golden ratio and takes the top bits.
+* The hashed index functions spread the regular strides of malloc over all sets.
+* The index function is set with the SetIndexFunction() function.
+*/
+typedef enum IndexFunction_t {modulo_IF, xor_fold_IF, fibonacci_IF} indexFunction;
+
+/*
+* A hash function for the 64 bit application keys of a keyed cache (see SetKeyHash()).
+* The index function of the cache takes the set from the hash instead of from the bits of a host address.
+*/
+typedef uint64_t (*KeyHash_t)(uint64_t key);
+
+/*
+* There are two admission policies to decide if a miss may take a line.
+* With admit_all_AP every miss takes a line, this is the default.
+* With seen_twice_AP a miss in a full cache only takes a line when the same host address missed before,
+* the first miss is bypassed like a request with CL_MEM_CACHE_BYPASS. The last missed address is 
+* remembered per slot of the admissionFilter, which has one slot per line.
+* The admission policy is set with the SetAdmissionPolicy() function.
+*/
+typedef enum AdmissionPolicy_t {admit_all_AP, seen_twice_AP} admissionPolicy;
+
+/*
+* There are two built-in prefetchers that watch the requests of clCreateCacheBuffer() and clEnqueueCacheBuffer().
+* With no_prefetch_PF nothing is prefetched, this is the default.
+* stride_PF recognizes a fixed distance between the host addresses of consecutive requests and prefetches 
+* the next host addresses at that distance. It reads host memory that was never requested, so it only prefetches 
+* inside the host range given to SetPrefetcher().
+* sequence_PF remembers the recent requests, a request for a host address that was requested before prefetches 
+* the inputs that followed it the last time, like the next stage of a chain of kernels.
+* The prefetcher is set with the SetPrefetcher() function.
 */
-typedef enum ReplacementPolicy_t {random_RP, fifo_RP, lru_RP, mru_RP, lfu_RP, mfu_RP} policy;
+typedef enum Prefetcher_t {no_prefetch_PF, stride_PF, sequence_PF} prefetcher;
+
+/*
+* There are three checks of the content behind the host address of a request with CL_MEM_COPY_HOST_PTR.
+* With address_CC a request hits on its host address alone, changed host data is not uploaded again. This is the default.
+* With unchanged_CC every line that was uploaded from the host keeps a 64 bit fingerprint (xxHash64) of its data.
+* A hit hashes the host data and only returns the line without a transfer when the fingerprint and size are unchanged, 
+* otherwise the line is uploaded again. Lines produced on the device are never replaced by the check.
+* With dedup_CC a miss is also filled by a copy on the device from an other line with the same fingerprint and size,
+* so byte identical buffers at different host addresses are only uploaded once.
+* The content check is set with the SetContentCheck() function.
+*/
+typedef enum ContentCheck_t {address_CC, unchanged_CC, dedup_CC} contentCheck;
+
+/*
+* There are three memory backends for the buffers of the lines, the backend is chosen by CreateZeroCopyCache().
+* With copy_MB every line has its own device buffer that is filled by a copy, this is the backend of CreateCache().
+* With host_ptr_MB a line wraps the host memory of its data with CL_MEM_USE_HOST_PTR. Fills and write backs 
+* only synchronize that memory, which is free on a device that shares the memory of the host.
+* With svm_MB the device has fine grained system SVM, the lines wrap the host memory as well and fills and write backs
+* are replaced by clEnqueueSVMMigrateMem() hints to move the memory to the device or back to the host.
+* auto_MB picks svm_MB, host_ptr_MB or copy_MB from what the device of the command queue reports.
+*/
+typedef enum MemoryBackend_t {copy_MB, host_ptr_MB, svm_MB, auto_MB} memoryBackend;
+
+/*
+* The kinds of commands that are timed when profiling is on (see SetProfiling()): 
+* the transfers to the device, the transfers to the host and the kernels passed to ProfileKernel().
+*/
+typedef enum ProfileKind_t {to_device_PK, to_host_PK, kernel_PK} profileKind;
 
 /*
 * A struct for extra meta data for a node is defined.
 * This struct contains any application specific meta data.
-* The int nodeId is an example and is a placeholder for now.
+* The int nodeId is a stable key of the data given by SetNodeId(), -1 when the line has none. Host addresses 
+* change from one run to the next, a snapshot of the cache (see SaveCacheSnapshot()) names the data by its nodeId.
 */
 typedef struct MetaData_t {
 	int nodeId;
-	int accessedOrder;
 } MetaData_t;
 
 /*
-* A structure that represent a single cache line is defined.
-* Within this structure a boolean is used to indicate if the data in that line is valid.
-* A void pointer is used to store the pointer to the data in host memory as a tag. 
-* This tag is used to indicate which data from the host memory is represented in the cache.
-* A cl_mem  is created to point to the memory on the accelerator card.
-* A pointer to the MetaData_t struct is included. In this struct extra data for a node can be stored.
+* A struct for a temporary buffer of a bypassed request is defined.
+* The tag is the host address of the data, or its key in a keyed cache, and size the number of bytes of the buffer.
+* hostData is the host memory the buffer was filled from and is written back to.
+* The dirty boolean indicates that the buffer holds output data that still has to be written back (write_back_WP only).
 */
-typedef struct CacheLine_t {
-	bool valid;
+typedef struct BypassBuffer_t {
 	void* tag;
-	struct MetaData_t* metaData;
+	void* hostData;
+	cl_mem deviceData;
+	size_t size;
+	bool dirty;
+} BypassBuffer_t;
+
+/*
+* A struct for a pin that is released when an event completes is defined.
+* The completed boolean and the execution status of the event are set by the event callback, 
+* the pin itself is released by the next call on the cache. The pending pins of a cache form a list through next.
+*/
+typedef struct PinnedBuffer_t {
+	void* hostAddress;
 	cl_mem deviceData;
-} CacheLine_t;
+	cl_event event;
+	cl_int status;
+	bool completed;
+	struct PinnedBuffer_t* next;
+} PinnedBuffer_t;
+
+/*
+* A struct for the line a request pinned is defined, owner is the cache of lines that holds it or NULL when 
+* the request pinned no line. clCreateCacheBuffers() unpins its buffers by these lines without looking them up again.
+*/
+typedef struct PinnedLine_t {
+	struct Cache_t* owner;
+	int line;
+} PinnedLine_t;
+
+/*
+* A struct for a request remembered by the sequence_PF prefetcher is defined.
+* The isInput boolean is set for requests with CL_MEM_COPY_HOST_PTR, only those are prefetched.
+*/
+typedef struct PrefetchEntry_t {
+	void* hostAddress;
+	size_t size;
+	bool isInput;
+} PrefetchEntry_t;
+
+/*
+* A struct for the statistics returned by GetCacheStats() is defined, all counters have 64 bits.
+* A request that finds its data in a line is a hit, a request that fills a line is a miss. A miss on an empty line 
+* is a cold miss, a miss that evicts a valid line while an other set still has an empty line is a conflict miss 
+* and every other miss is a capacity miss, also the refill of data that needs more bytes than its line held.
+* Bypassed requests and prefetches are neither hits nor misses, evictions also count the lines evicted by a prefetch.
+* The bytes moved over the bus are counted after compression, zero copy caches move no bytes.
+* setOccupancy holds the valid lines and setMisses the misses of every set, the sets of the size classes or 
+* devices follow each other. occupancyHistogram[i] is the number of sets with i valid lines.
+* The arrays are allocated by GetCacheStats() and released with FreeCacheStats().
+* With a policy duel (see SetPolicyDuel()) duelMisses counts the misses of the leader sets of both policies, 
+* policySwitches how often the follower sets changed their policy and followerPolicy is the current winner. 
+* Without a duel followerPolicy is the policy of the cache (of the first size class or device).
+*/
+typedef struct CacheStats_t {
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t coldMisses;
+	uint64_t conflictMisses;
+	uint64_t capacityMisses;
+	uint64_t evictions;
+	uint64_t dirtyWriteBacks;
+	uint64_t bypasses;
+	uint64_t bytesToDevice;
+	uint64_t bytesToHost;
+	uint64_t duelMisses[2];
+	uint64_t policySwitches;
+	enum ReplacementPolicy_t followerPolicy;
+	int numberOfSets;
+	int maxLinesPerSet;
+	int* setOccupancy;
+	uint64_t* setMisses;
+	uint64_t* occupancyHistogram;
+} CacheStats_t;
+
+/*
+* The kinds of requests in a trace (see SetTraceFile()): clCreateCacheBuffer(), clEnqueueCacheBuffer() and every 
+* buffer of clCreateCacheBuffers() are create_TK, then the reads, the range reads and writes and clFlushCache().
+*/
+typedef enum TraceKind_t {create_TK, read_TK, read_range_TK, write_range_TK, flush_TK} traceKind;
+
+/*
+* A trace file starts with a TraceHeader_t and then holds one TraceRecord_t per request, in the byte order of the host.
+* The time is in nanoseconds from the start of the trace, flags holds the cl_mem_flags of a create_TK request.
+*/
+#define CACHE_TRACE_MAGIC 0x54434C43
+#define CACHE_TRACE_VERSION 1
+
+typedef struct TraceHeader_t {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t recordSize;
+	uint32_t reserved;
+} TraceHeader_t;
+
+typedef struct TraceRecord_t {
+	uint64_t time;
+	uint64_t hostAddress;
+	uint64_t size;
+	uint64_t offset;
+	uint64_t flags;
+	uint32_t kind;
+	uint32_t reserved;
+} TraceRecord_t;
+
+/*
+* A snapshot file (see SaveCacheSnapshot()) starts with a SnapshotHeader_t and then holds one SnapshotEntry_t per line
+* with a nodeId, in the byte order of the host. The hottest lines come first: rank is the place of the line in the 
+* recency order of its set, or the frequency order for lfu_RP and mfu_RP, 0 for the most recently or most often used 
+* line. size is the number of bytes of the line.
+*/
+#define CACHE_SNAPSHOT_MAGIC 0x53434C43
+#define CACHE_SNAPSHOT_VERSION 1
+
+typedef struct SnapshotHeader_t {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t entrySize;
+	uint32_t numberOfEntries;
+} SnapshotHeader_t;
+
+typedef struct SnapshotEntry_t {
+	int32_t nodeId;
+	uint32_t rank;
+	uint64_t size;
+} SnapshotEntry_t;
+
+/*
+* A struct for a trace that is recorded is defined, the records are collected and written to the file 
+* TRACE_BUFFER_RECORDS at a time. The lock protects the records, start is the time the trace started.
+*/
+typedef struct TraceFile_t {
+	FILE* file;
+	pthread_mutex_t lock;
+	TraceRecord_t* records;
+	int numberOfRecords;
+	struct timespec start;
+} TraceFile_t;
+
+/*
+* A struct for a profiled command is defined, the times are the OpenCL profiling times in nanoseconds.
+*/
+typedef struct ProfileRecord_t {
+	enum ProfileKind_t kind;
+	size_t size;
+	cl_ulong queued;
+	cl_ulong start;
+	cl_ulong end;
+} ProfileRecord_t;
+
+/*
+* A struct for the profile of a cache and all its size classes or devices is defined.
+* The latencyHistogram counts the latencies (from queued to end) per kind and power of 2 size, busyTime sums 
+* per kind the time the commands ran. The records are a ring of the last profiled commands, nextRecord is 
+* the record that is overwritten next and numberOfRecords counts all recorded commands.
+* Every cache and every pending event callback holds one of the references, the lock protects the counters.
+*/
+typedef struct TransferProfile_t {
+	pthread_mutex_t lock;
+	int references;
+	uint64_t* latencyHistogram;
+	uint64_t busyTime[3];
+	ProfileRecord_t* records;
+	int nextRecord;
+	uint64_t numberOfRecords;
+} TransferProfile_t;
+
+/*
+* A struct for the user data of a profiled event callback is defined.
+*/
+typedef struct ProfiledEvent_t {
+	TransferProfile_t* profile;
+	enum ProfileKind_t kind;
+	size_t size;
+} ProfiledEvent_t;
+
+/*
+* A structure for the lookup and replacement state of a fully associative cache is defined.
+* The slot array is an open addressing hash table from host address to line, -1 is an empty slot.
+* For lru_RP, mru_RP and fifo_RP the lines are in one list from head (most recent) to tail.
+* For lfu_RP and mfu_RP the lines are in frequency buckets, sorted from firstBucket (lowest frequency) 
+* to lastBucket. The next and prev arrays link the lines within their list or bucket.
+* Empty lines are kept on the freeLines stack. This way every lookup and every replacement is O(1).
+*/
+typedef struct FullyAssociativeIndex_t {
+	int slotMask;
+	int* slot;
+	int* next;
+	int* prev;
+	int* bucket;
+	int head;
+	int tail;
+	int* freeLines;
+	int numberOfFreeLines;
+	int* bucketFrequency;
+	int* bucketHead;
+	int* bucketTail;
+	int* bucketNext;
+	int* bucketPrev;
+	int firstBucket;
+	int lastBucket;
+	int freeBucket;
+	uint64_t memoryAllocated;
+} FullyAssociativeIndex_t;
 
 /*
 * A structure that represents the cache is defined.
 * This structure contains all the parameters of the instantiated cache
-* It also contains a double pointer pointing to the different cachelines in the different sets of the cache.
+* The cachelines are stored as one array per field, indexed by set * numberOfLinesPerSet + way.
+* The ways of a set are next to each other, so a lookup only reads a few host cache lines per field.
+* Within the valid array a boolean is used to indicate if the data in that line is valid.
+* A void pointer is used to store the pointer to the data in host memory as a tag. 
+* This tag is used to indicate which data from the host memory is represented in the cache.
+* The hostData of a line is the host memory it is filled from and written back to, the same pointer as the tag 
+* unless the cache is keyed (see SetKeyHash()). Then the tag holds the 64 bit key of the application plus 1
+* and keyHash, when set, hashes the key for the index function.
+* A cl_mem is allocated once by CreateCache() and points to the memory of the line on the accelerator card.
+* On a miss the line is refilled in place, the buffer itself is only released by FreeCache().
+* The deviceAuthoritative boolean indicates that the data was produced on the accelerator card,
+* the data in host memory may be older until it is read back.
+* The dirty boolean indicates that this data still has to be written back to host memory (write_back_WP only).
+* The size is the number of bytes the line holds, this can be less than the dataSize of the cache.
+* The accessedOrder holds the replacement policy state of the line and in the metaData extra data for a node can be stored.
+* For lfu_RP and mfu_RP it is an access count, the counts of a set are halved every decayPeriod accesses 
+* to that set (decayCounter), so lines that were popular long ago can be evicted again.
+* For the other policies it is a recency stamp taken from replacementLine, the stamps of a set are halved 
+* before the counter can overflow.
+* The lineState holds the reference bit (clock_RP) or the segment (slru_RP, two_queue_RP, arc_RP) of the line.
+* For two_queue_RP and arc_RP every set remembers up to numberOfLinesPerSet evicted tags in the ghost arrays,
+* the ghostState is the segment the tag was evicted from, 0 for an empty entry.
+* The arcTarget is the adapted size of the recency segment of each set (arc_RP only).
+* The bypass array holds the temporary buffers of bypassed requests, Bypasses counts these requests.
+* Every set has its own randomState for random_RP.
+* A thread safe cache (see SetThreadSafe()) has numberOfLocks setLocks, set s is protected by lock s % numberOfLocks.
+* The setSequence of a lock is odd while a thread changes its sets, so hits can be read without the lock.
+* The bypassLock protects the bypass array. The counters are updated with atomic operations.
+* The context and command queue given to CreateCache() are retained and used to allocate and refill the lines.
+* A cache made by CreateSizeClassCache() holds no lines itself, the sizeClass array points to one cache per size class.
+* The counters of such a cache are the sum of the counters of its size classes.
+* A cache made by CreateMultiDeviceCache() has no lines and no command queue, the device array points to one cache 
+* per device. PeerTransfers counts the lines that were filled by a copy from an other device instead of from the host.
+* Prefetches counts the lines filled by a prefetch and UsefulPrefetches the prefetched lines that were requested 
+* before they were evicted, prefetched marks the lines that were not requested yet since their prefetch.
+* The pinCount of a line counts the unfinished requests that need it, a pinned line is never chosen as victim.
+* numberOfPinnedLines counts the lines with a pinCount above 0. The pendingPins of clPinCacheBuffersUntil()
+* are protected by the pinLock.
+* A cache with staging buffers moves the data of its transfers through numberOfStagingBuffers page locked buffers 
+* of stagingSize bytes. stagingHost holds their mapped host pointers and stagingEvent the last transfer of each buffer, 
+* nextStagingBuffer is the buffer that is used next. The ring is protected by the stagingLock.
+* The packed uploads of clCreateCacheBuffers() go through the packedData buffer of packedDataSize bytes, which is 
+* kept for the next batch and protected by the packLock until the lines are filled from it.
+* Transfers of at least two transferChunkSize chunks are split over the numberOfTransferQueues transferQueue.
+* The contentHash of a line is the fingerprint of its host data, 0 when it has none (see SetContentCheck()).
+* UnchangedHits counts the checked hits without a transfer, ChangedUploads the hits that were uploaded again 
+* and DedupCopies the misses that were copied from a line with the same content.
+* With compression (see SetCompression()) the transfers skip the zero blocks of the data with the unpackKernel 
+* and markKernel. CompressedTransfers counts those transfers and SavedBytes the bytes they did not move.
+* The packed uploads go through the compressedData buffer of compressedDataSize bytes and the marks of a read 
+* through the markData buffer of markDataSize bytes, both are kept for the next transfer. compressionEvent is 
+* the last unpack out of the compressedData. zeroBlockShare is the percentage of zero blocks the last compressible 
+* transfer found, a read only marks its blocks when enough were zero or every COMPRESSION_PROBE_PERIOD skipped reads, 
+* counted by compressionSkips. The kernel arguments and the buffers are protected by the compressionLock.
+* The prefetcher state of the front end cache is protected by the prefetchLock. The prefetchHistory is a ring 
+* of numberOfPrefetchEntries requests, prefetchHistoryNext is the entry that is overwritten next.
+* The conflictMisses array counts per set the misses that evicted a valid line while 
+* the cache still had empty lines in other sets, setMisses counts all misses per set.
+* Hits, ColdMisses, CapacityMisses, Evictions, DirtyWriteBacks, BytesToDevice and BytesToHost are the 
+* 64 bit counters of GetCacheStats().
+* The memoryBackend decides how the deviceData of the lines is allocated (see MemoryBackend_t), a zero copy 
+* backend creates the buffer of a line when it gets new data, the deviceData of an empty line may be NULL.
+* The profile is shared by the cache and all its size classes or devices, it is NULL when profiling is off.
+* The trace records the requests on the cache while a trace file is set, it is NULL otherwise.
+* A fully associative cache has a hashedIndex, GetWay() and SetWay() then use it instead of scanning all ways.
+* During a policy duel every set has a setPolicy, the policy its replacement state was last kept for. 
+* The leader sets every duelPeriod sets use duelPolicy[0] and duelPolicy[1], the follower sets use the duelWinner. 
+* The duelCounter saturates between 0 and DUEL_COUNTER_MAX, DuelMisses counts the misses of both leader groups 
+* and PolicySwitches the changes of the duelWinner.
 */
 typedef struct Cache_t {
+	cl_context context;
+	cl_command_queue commandQueue;
 	int memCopies;
 	int ReadTransfers;
 	int WriteTransfers;
 	int tagSize;
 	int dataSize;
 	int indexBitMask;
+	int indexSize;
 	int addressBitShift;
 	int numberOfLinesPerSet;
 	int numberOfSets;
 	enum CacheConfiguration_t config;
-	CacheLine_t** cacheLine;
+	void** tag;
+	void** hostData;
+	bool* valid;
+	bool* dirty;
+	bool* deviceAuthoritative;
+	size_t* size;
+	int* accessedOrder;
+	cl_mem* deviceData;
+	MetaData_t* metaData;
 	int* replacementLine;
 	enum ReplacementPolicy_t policy;
+	enum WritePolicy_t writePolicy;
+	int numberOfSizeClasses;
+	struct Cache_t** sizeClass;
+	enum IndexFunction_t indexFunction;
+	bool keyed;
+	KeyHash_t keyHash;
+	int numberOfValidLines;
+	uint64_t* conflictMisses;
+	uint64_t* setMisses;
+	uint64_t Hits;
+	uint64_t ColdMisses;
+	uint64_t CapacityMisses;
+	uint64_t Evictions;
+	uint64_t DirtyWriteBacks;
+	uint64_t BytesToDevice;
+	uint64_t BytesToHost;
+	struct FullyAssociativeIndex_t* hashedIndex;
+	unsigned char* lineState;
+	void** ghostTag;
+	unsigned char* ghostState;
+	int* ghostOrder;
+	int* arcTarget;
+	int decayPeriod;
+	int* decayCounter;
+	enum AdmissionPolicy_t admissionPolicy;
+	void** admissionFilter;
+	int Bypasses;
+	BypassBuffer_t* bypass;
+	int numberOfBypassBuffers;
+	int bypassCapacity;
+	uint32_t* randomState;
+	bool threadSafe;
+	int numberOfLocks;
+	pthread_mutex_t* setLocks;
+	unsigned int* setSequence;
+	pthread_mutex_t bypassLock;
+	int numberOfDevices;
+	struct Cache_t** device;
+	int PeerTransfers;
+	int* pinCount;
+	int numberOfPinnedLines;
+	PinnedBuffer_t* pendingPins;
+	pthread_mutex_t pinLock;
+	int numberOfStagingBuffers;
+	size_t stagingSize;
+	cl_mem* stagingBuffer;
+	void** stagingHost;
+	cl_event* stagingEvent;
+	int nextStagingBuffer;
+	pthread_mutex_t stagingLock;
+	cl_mem packedData;
+	size_t packedDataSize;
+	pthread_mutex_t packLock;
+	int numberOfTransferQueues;
+	cl_command_queue* transferQueue;
+	size_t transferChunkSize;
+	enum ContentCheck_t contentCheck;
+	uint64_t* contentHash;
+	int UnchangedHits;
+	int ChangedUploads;
+	int DedupCopies;
+	enum MemoryBackend_t memoryBackend;
+	TransferProfile_t* profile;
+	TraceFile_t* trace;
+	unsigned char* setPolicy;
+	enum ReplacementPolicy_t duelPolicy[2];
+	int duelPeriod;
+	int duelCounter;
+	int duelWinner;
+	uint64_t DuelMisses[2];
+	uint64_t PolicySwitches;
+	cl_kernel unpackKernel;
+	cl_kernel markKernel;
+	int CompressedTransfers;
+	uint64_t SavedBytes;
+	cl_mem compressedData;
+	size_t compressedDataSize;
+	cl_event compressionEvent;
+	cl_mem markData;
+	size_t markDataSize;
+	int zeroBlockShare;
+	int compressionSkips;
+	pthread_mutex_t compressionLock;
+	bool* prefetched;
+	int Prefetches;
+	int UsefulPrefetches;
+	enum Prefetcher_t prefetcher;
+	int prefetchDepth;
+	char* prefetchLow;
+	char* prefetchHigh;
+	char* lastAddress;
+	intptr_t lastStride;
+	int strideConfidence;
+	PrefetchEntry_t* prefetchHistory;
+	int numberOfPrefetchEntries;
+	int prefetchHistoryNext;
+	pthread_mutex_t prefetchLock;
 } Cache_t;
 
 /*
@@ -92,25 +560,121 @@ typedef struct AcceleratorParameters_t {
 * Next the data_size is required. This represents the amount of data stored at any node.
 * The CreateCache() function will determine the total Cache size based on the dataSize 
 * and the numberOfCacheLines. If this is larger than the defined MAX_SIZE an error will be asserted.
-* The cache will create a cl_mem array the size of dataSize for each cache line.
-* This means the data in a CacheLine_t represents the data of a single node.
+* The cache will create a cl_mem array the size of dataSize for each cache line in the given context.
+* These buffers are allocated once and reused, a miss only refills the line through the commandQueue.
+* This means the data in a cacheline represents the data of a single node.
 * The tagSize is represents the number of bytes required for the tag.
 * Last the config is required. This can be any configuration defined in the 
 * cache_configuration enumeration.
-* The function returns the pointer to the cache.
+* The function returns the pointer to the cache, or NULL when the device buffers could not be allocated.
+* In that case the OpenCL error is returned in errorcode_ret.
 */
 struct Cache_t* CreateCache(
+	cl_context context, 
+	cl_command_queue commandQueue, 
+	int numberOfCacheLines, 
+	int dataSize, 
+	int tagSize, 
+	enum CacheConfiguration_t config, 
+	enum ReplacementPolicy_t policy, 
+	cl_int *errorcode_ret);
+
+/*
+* A function to instantiate a software cache with any associativity.
+* The numberOfWays has to be a power of 2 and the numberOfCacheLines / numberOfWays sets 
+* have to be a power of 2 as well. A numberOfWays of numberOfCacheLines gives a fully associative cache.
+* The other arguments are the same as for CreateCache(). 
+* When the numbers are not valid NULL is returned and errorcode_ret is set to CL_INVALID_VALUE.
+*/
+struct Cache_t* CreateAssociativeCache(
+	cl_context context, 
+	cl_command_queue commandQueue, 
+	int numberOfCacheLines, 
+	int numberOfWays, 
+	int dataSize, 
+	int tagSize, 
+	enum ReplacementPolicy_t policy, 
+	cl_int *errorcode_ret);
+
+/*
+* A function to instantiate a cache that does not copy the data on devices that share the memory of the host.
+* The arguments are the same as for CreateCache(), the backend selects how the lines hold their data (see MemoryBackend_t).
+* With auto_MB the device of the commandQueue is asked for fine grained system SVM and for memory shared with the host, 
+* a device without either gets the copy_MB backend. An svm_MB request on a device without system SVM gets host_ptr_MB.
+* A line of a zero copy cache is the host memory of its data, so kernels see changes of the host data right away 
+* and output buffers are written into the host memory directly. The returned buffer of a line is released 
+* when the line gets other data, it is only valid as long as the data is cached.
+* Staging buffers, transfer queues and compression are not used by a zero copy cache.
+*/
+struct Cache_t* CreateZeroCopyCache(
+	cl_context context, 
+	cl_command_queue commandQueue, 
+	int numberOfCacheLines, 
+	int dataSize, 
+	int tagSize, 
+	enum CacheConfiguration_t config, 
+	enum ReplacementPolicy_t policy, 
+	enum MemoryBackend_t backend, 
+	cl_int *errorcode_ret);
+
+/*
+* A function to instantiate a cache for entries of different sizes.
+* The cache consists of numberOfSizeClasses caches, size class i has numberOfCacheLines[i] 
+* lines of dataSizes[i] bytes. The dataSizes have to be sorted from small to large.
+* Every entry is stored in the smallest size class that fits the size given to clCreateCacheBuffer(),
+* so small entries only take the device memory of a small line and evict other small entries.
+* The tagSize, config and policy are the same for every size class.
+* The function returns the pointer to the cache, or NULL when one of the size classes could not be created.
+*/
+struct Cache_t* CreateSizeClassCache(
+	cl_context context, 
+	cl_command_queue commandQueue, 
+	int numberOfSizeClasses, 
+	const int* numberOfCacheLines, 
+	const int* dataSizes, 
+	int tagSize, 
+	enum CacheConfiguration_t config, 
+	enum ReplacementPolicy_t policy, 
+	cl_int *errorcode_ret);
+
+/*
+* A function to instantiate one logical cache over several devices of the same context.
+* Every device gets a cache of numberOfCacheLines lines on commandQueues[i], so the lines of all devices add up.
+* A request on the queue of a device is served by that device. A request on an other queue goes to the device
+* that already holds the data, new data is spread over the devices by its host address.
+* A device that misses data held by an other device copies it from there instead of from the host, and data produced 
+* by a device (a request without CL_MEM_COPY_HOST_PTR) or written with clEnqueueWriteCacheBufferRange() is dropped 
+* from the other devices. Reads and clFlushCache() use the queue of the device that holds the data, so the 
+* command_queue given to them only selects the preferred device.
+* The function returns the pointer to the cache, or NULL when the cache of one of the devices could not be created.
+*/
+struct Cache_t* CreateMultiDeviceCache(
+	cl_context context, 
+	int numberOfDevices, 
+	const cl_command_queue* commandQueues, 
 	int numberOfCacheLines, 
 	int dataSize, 
 	int tagSize, 
 	enum CacheConfiguration_t config, 
-	enum ReplacementPolicy_t policy);
+	enum ReplacementPolicy_t policy, 
+	cl_int *errorcode_ret);
 
 /*
 * This function transfers data from the host memory to the cache memory.
 * The function checks if the data is already in cache and will only transfer when not already there.
 * The function returns a cl_mem pointing to the cacheline where the data is stored.
-* When CL_MEM_COPY_HOST_PTR is not provided as flag the data will always be written to the cache.
+* When CL_MEM_COPY_HOST_PTR is not provided as flag the buffer is an output buffer, the data on the accelerator 
+* card becomes authoritative for the hostAddress, so a later call with CL_MEM_COPY_HOST_PTR for the same hostAddress 
+* returns the line without any transfer. The host data of an output buffer is still written into the line, so a kernel 
+* that writes only part of it keeps the other host bytes. Only a CL_MEM_WRITE_ONLY output buffer is not written, 
+* and a line that already holds the data produced on the device for the hostAddress is returned as it is.
+* Data is written with a blocking clEnqueueWriteBuffer() on the command queue of the cache into the existing buffer of the line.
+* The flags are only used to decide on the transfer, every line is allocated as CL_MEM_READ_WRITE.
+* Exactly size bytes are transferred, the size can not be larger than the dataSize of the cache.
+* A hit on a line that holds less than size bytes fills the line again.
+* When the transfer fails NULL is returned and the error is stored in errorcode_ret.
+* With write_back_WP output buffers are also marked dirty. 
+* A dirty line that gets evicted is first read back to its host address.
 */
 cl_mem clCreateCacheBuffer(
 	cl_context context, 
@@ -120,14 +684,89 @@ cl_mem clCreateCacheBuffer(
 	cl_int *errorcode_ret, 
 	struct Cache_t* cachePtr);
 
+/*
+* This function is the non-blocking variant of clCreateCacheBuffer().
+* The transfer is enqueued on the given command_queue after the events in event_wait_list and
+* the cl_mem of the line is returned immediately. The returned event completes when the line holds the data, 
+* a kernel using the cl_mem should wait for it. On a hit the event is a marker on the command_queue.
+* The hostAddress must not be modified or freed before the event has completed.
+* When event is NULL no event is returned, like for any other clEnqueue function.
+*/
+cl_mem clEnqueueCacheBuffer(
+	cl_command_queue command_queue, 
+	cl_mem_flags flags, 
+	size_t size, 
+	void* hostAddress, 
+	cl_uint num_events_in_wait_list,
+	const cl_event *event_wait_list, 
+	cl_event *event,
+	cl_int *errorcode_ret, 
+	struct Cache_t* cachePtr);
+
+/*
+* This function resolves all buffers of a kernel launch at once, like count calls of clCreateCacheBuffer().
+* Buffer i is requested with flags[i], sizes[i] and hostAddresses[i] and its cl_mem is stored in deviceData[i].
+* The lines of the batch are pinned until all buffers are resolved, so one buffer can not evict an other, 
+* a buffer that finds its set full with pinned lines gets a temporary buffer like CL_MEM_CACHE_BYPASS.
+* The fills are enqueued without blocking on command_queue and the function waits for all of them at once.
+* When two or more input buffers miss, their data is packed without padding into one upload of no more bytes than 
+* their own uploads and their lines are filled from it by copies on the device. The packed data goes through a 
+* buffer of the cache that is kept for the next batch, a batch that finds it in use by an other thread fills every 
+* miss on its own like a single miss. A cache with size classes, devices, a zero copy backend, a content check or an 
+* admission policy fills every miss on its own. The buffers are seen by the prefetcher like single requests.
+* When a request fails its error is stored in errorcode_ret, the following buffers are not requested, the bypass 
+* buffers of the batch are released and every deviceData is NULL. The function returns 0 on success and 1 on failure.
+*/
+int clCreateCacheBuffers(
+	cl_context context, 
+	cl_command_queue command_queue, 
+	int count, 
+	const cl_mem_flags* flags, 
+	const size_t* sizes, 
+	void** hostAddresses, 
+	cl_mem* deviceData, 
+	cl_int *errorcode_ret, 
+	struct Cache_t* cachePtr);
+
+/*
+* Functions to keep the line of a buffer in the cache while a kernel that uses it has not finished.
+* A pinned line is never evicted, a miss in a set without unpinned ways gets a temporary buffer 
+* like CL_MEM_CACHE_BYPASS. The pins are counted, every clPinCacheBuffer() needs one clUnpinCacheBuffer().
+* The line is identified by the hostAddress and the deviceData returned for it, so the copies of a 
+* CreateMultiDeviceCache() cache are pinned separately.
+* clPinCacheBuffersUntil() pins count buffers until event completes, for example the event of the kernel 
+* that uses them. The pins are released by the first call on the cache after the completion. When the event 
+* terminated with an error the lines stay pinned, clUnpinCacheBuffer() releases them.
+* The functions return 0 on success and 1 when a buffer is not the line of its host address, 
+* a temporary buffer of a bypassed request needs no pin.
+*/
+int clPinCacheBuffer(
+	void* hostAddress, 
+	cl_mem deviceData, 
+	struct Cache_t* cachePtr);
+
+int clUnpinCacheBuffer(
+	void* hostAddress, 
+	cl_mem deviceData, 
+	struct Cache_t* cachePtr);
+
+int clPinCacheBuffersUntil(
+	cl_event event, 
+	int count, 
+	void** hostAddresses, 
+	const cl_mem* deviceData, 
+	struct Cache_t* cachePtr);
+
 /*
 * This function transfers data back from the cache memory to the host memory.
 * The host_address pointing to location in the host memory where the data will be stored
 * and the cache_address pointing to the location in cache memory are provided.
 * The data is not cleared in cache. This will only happen if location in the cache is 
 * overwritten by the put() function.
+* Exactly size bytes are read starting at offset, this range has to lie within the bytes held by the line.
 * The function returns an integer to indicate if the transfer was successful.
 * When the function returns '0' the data is successfully transfered to the cache.
+* After a read of the whole line it is no longer dirty and the host data is up to date again.
 */
 int clEnqueueReadCacheBuffer(
 	cl_command_queue command_queue, 
@@ -141,40 +780,404 @@ int clEnqueueReadCacheBuffer(
 	struct Cache_t* cachePtr);
 
 /*
-* This functions frees the allocated memory space.
-* Since only one cache can be instantiated no arguments are required.
+* This function transfers part of a cached line back to the host memory.
+* The hostAddress is the address the data was cached with, size bytes starting at offset in the line 
+* are read to the same offset from hostAddress. The range has to lie within the bytes held by the line.
+* The line stays valid, only a read of the whole line makes it clean again.
+* When the function returns '0' the data is successfully transfered to the host.
 */
-void FreeCache(
+int clEnqueueReadCacheBufferRange(
+	cl_command_queue command_queue, 
+	cl_bool blocking_read, 
+	size_t offset, 
+	size_t size, 
+	void* hostAddress, 
+	cl_uint num_events_in_wait_list,
+	const cl_event *event_wait_list, 
+	cl_event *event,
 	struct Cache_t* cachePtr);
 
-//-------------------------------------------
-//-------Defining internal functions---------
-//-------------------------------------------
+/*
+* This function updates part of a cached line from the host memory.
+* The hostAddress is the address the data was cached with, size bytes starting at the same offset 
+* from hostAddress are written to offset in the line. The range has to lie within the bytes held by the line.
+* Only the touched bytes are transferred and the line stays valid.
+* When the data is not in cache nothing is transferred and '1' is returned.
+* When the function returns '0' the data is successfully transfered to the cache.
+*/
+int clEnqueueWriteCacheBufferRange(
+	cl_command_queue command_queue, 
+	cl_bool blocking_write, 
+	size_t offset, 
+	size_t size, 
+	void* hostAddress, 
+	cl_uint num_events_in_wait_list,
+	const cl_event *event_wait_list, 
+	cl_event *event,
+	struct Cache_t* cachePtr);
+
+/*
+* The functions of a keyed cache (see SetKeyHash()). They work like the functions without Keyed, the data is 
+* looked up by its 64 bit application key, such as the id of a graph node, instead of by its host address.
+* A buffer that is reallocated or a pointer that is reused after free() can not alias an other key, and the same 
+* key hits in whatever host memory its data is passed this time. hostAddress is the host memory of the request, 
+* a hit writes the line back there from then on. A zero copy line that gets other host memory is filled again.
+* The reads and range transfers work on the host memory of the last request of the key.
+* The keys go up to UINTPTR_MAX - 1, a key on a cache that is not keyed fails with CL_INVALID_OPERATION.
+* The keyed requests are not seen by the prefetcher. A CreateMultiDeviceCache() cache has no command queue of its 
+* own, so clCreateCacheBufferKeyed() fails on it with CL_INVALID_COMMAND_QUEUE, clEnqueueCacheBufferKeyed() 
+* takes the queue of the device.
+*/
+cl_mem clCreateCacheBufferKeyed(
+	cl_context context, 
+	cl_mem_flags flags, 
+	uint64_t key, 
+	void* hostAddress, 
+	size_t size, 
+	cl_int *errorcode_ret, 
+	struct Cache_t* cachePtr);
+
+cl_mem clEnqueueCacheBufferKeyed(
+	cl_command_queue command_queue, 
+	cl_mem_flags flags, 
+	uint64_t key, 
+	void* hostAddress, 
+	size_t size, 
+	cl_uint num_events_in_wait_list,
+	const cl_event *event_wait_list, 
+	cl_event *event,
+	cl_int *errorcode_ret, 
+	struct Cache_t* cachePtr);
+
+int clEnqueueReadCacheBufferKeyed(
+	cl_command_queue command_queue, 
+	cl_bool blocking_read, 
+	size_t offset, 
+	size_t size, 
+	uint64_t key, 
+	cl_uint num_events_in_wait_list,
+	const cl_event *event_wait_list, 
+	cl_event *event,
+	struct Cache_t* cachePtr);
+
+int clEnqueueReadCacheBufferRangeKeyed(
+	cl_command_queue command_queue, 
+	cl_bool blocking_read, 
+	size_t offset, 
+	size_t size, 
+	uint64_t key, 
+	cl_uint num_events_in_wait_list,
+	const cl_event *event_wait_list, 
+	cl_event *event,
+	struct Cache_t* cachePtr);
+
+int clEnqueueWriteCacheBufferRangeKeyed(
+	cl_command_queue command_queue, 
+	cl_bool blocking_write, 
+	size_t offset, 
+	size_t size, 
+	uint64_t key, 
+	cl_uint num_events_in_wait_list,
+	const cl_event *event_wait_list, 
+	cl_event *event,
+	struct Cache_t* cachePtr);
+
+/*
+* This function sets the index function of the cache. By default a cache uses modulo_IF.
+* The index function should be set directly after CreateCache(), before any data is cached.
+*/
+void SetIndexFunction(
+	struct Cache_t* cachePtr, 
+	enum IndexFunction_t indexFunction);
+
+/*
+* This function makes the cache and all its size classes or devices a keyed cache, its lines are tagged on the 
+* 64 bit keys of the Keyed functions instead of on host addresses. The index function takes the set from 
+* keyHash(key), or from the key itself when keyHash is NULL. Dense keys like node ids spread over the sets 
+* with modulo_IF already, keyHash is for keys with a pattern the index functions do not break up.
+* A keyed cache only takes keyed requests, clFlushCache() writes every line back to its hostData.
+* SaveCacheSnapshot() and WarmCache() need a cache that is tagged on host addresses.
+* The cache is made keyed directly after it is created, before any data is cached.
+*/
+void SetKeyHash(
+	struct Cache_t* cachePtr, 
+	KeyHash_t keyHash);
+
+/*
+* This function sets after how many accesses to a set the counts of lfu_RP and mfu_RP are halved.
+* By default this is 16 times the number of ways, a decayPeriod of 0 disables the decay.
+*/
+void SetDecayPeriod(
+	struct Cache_t* cachePtr, 
+	int decayPeriod);
+
+/*
+* This function sets the write policy of the cache. By default a cache uses no_write_back_WP.
+* The write policy should be set directly after CreateCache(), before any data is cached.
+*/
+void SetWritePolicy(
+	struct Cache_t* cachePtr, 
+	enum WritePolicy_t writePolicy);
 
 /*
-* A function to apply the indexbitmask created in the CreateCache() function to the hostAddress.
+* This function makes the cache safe to use from multiple host threads at the same time.
+* The sets are protected by numberOfLocks striped locks, rounded down to a power of 2 and to at most one lock per set.
+* Hits that need no transfer and only change a stamp or a reference bit (random_RP, fifo_RP, clock_RP, and lru_RP 
+* and mru_RP for set associative caches) are read optimistically without taking a lock, they retry with the 
+* lock when a writer changed the set at the same time. 
+* A cache with size classes also serializes the requests for the same host address.
+* A numberOfLocks of 0 makes the cache single threaded again, which is the default.
+* This function itself, the Set functions and FreeCache() may not be called while other threads use the cache.
+* A returned buffer can be refilled by an other thread as soon as its line is evicted.
 */
-static int GetIndex(
-	int indexBitMask, 
-	int addressBitShift, 
-	void* hostAddress);
+void SetThreadSafe(
+	struct Cache_t* cachePtr, 
+	int numberOfLocks);
 
 /*
-* A function to find the way where the data is cached. 
-* It loops through all ways in a set until it finds a line with valid data and the correct tag. 
+* This function sets the admission policy of the cache. By default a cache uses admit_all_AP.
 */
-static int GetWay(
+void SetAdmissionPolicy(
+	struct Cache_t* cachePtr, 
+	enum AdmissionPolicy_t admissionPolicy);
+
+/*
+* A function to set the check of the host data of a request (see ContentCheck_t), the default is address_CC.
+* The check hashes the host data of every request with CL_MEM_COPY_HOST_PTR under the lock of its set.
+* A line without a fingerprint, like a line filled before the check was set or a line changed by 
+* clEnqueueWriteCacheBufferRange(), is uploaded again on its next checked hit. A line copied from an other device 
+* keeps the fingerprint of that device, a copy of data produced by a device is never replaced by a check.
+* A checked hit needs the same size as the line, dedup_CC only copies lines of the same size.
+* The cache and all its size classes and devices get the same check.
+*/
+void SetContentCheck(
+	struct Cache_t* cachePtr, 
+	enum ContentCheck_t contentCheck);
+
+/*
+* A function to transfer sparse data in a compressed form, the default is without compression.
+* The data is split into blocks of 64 32 bit words. A fill or write of at least 64 KiB first samples every 8th 
+* block of the host data, when enough blocks are zero only the non zero blocks and a block index are uploaded 
+* and a kernel unpacks them into the buffer. A blocking write back first lets a kernel mark the non zero blocks 
+* and only reads those, the zero blocks are cleared on the host. The marks are only made while the last compressible
+* transfer found enough zero blocks, and now and then to notice that the data became sparse again.
+* Dense data is transferred as before.
+* The kernels are built for all devices of the context, 1 is returned when the build failed and 0 on success.
+* The cache and all its size classes and devices get the same setting.
+*/
+int SetCompression(
+	struct Cache_t* cachePtr, 
+	bool compression);
+
+/*
+* A function to give the cache extra queues for the transfers of large lines, for example one per copy engine.
+* Fills, write backs, range transfers and reads of at least 2 * transferChunkSize bytes are split into chunks 
+* of transferChunkSize bytes that are spread round robin over the transferQueues.
+* The chunks start after the commands that are already on the queue of the request, and a barrier on that queue
+* makes later commands, like the kernel that uses the line, wait for all chunks. Hits and the kernels stay on 
+* the queue of the request. Split reads go directly to the host memory, split writes use the staging buffers.
+* The queues are retained by the cache, a numberOfTransferQueues of 0 removes them, which is the default.
+* The size classes of the cache get the same queues, the devices of a CreateMultiDeviceCache() cache 
+* need their own queues and are set separately through the device array.
+*/
+void SetTransferQueues(
+	struct Cache_t* cachePtr, 
+	int numberOfTransferQueues, 
+	const cl_command_queue* transferQueues, 
+	size_t transferChunkSize);
+
+/*
+* A function to give the cache a ring of numberOfStagingBuffers page locked host buffers of stagingSize bytes.
+* Fills, range writes and blocking reads of at least 4096 bytes are then copied through the ring in chunks 
+* of stagingSize bytes, the copy of one chunk to or from the ring overlaps the transfer of the previous one.
+* At least 2 and at most 16 buffers are used, a numberOfStagingBuffers of 0 removes the ring, which is the default.
+* A staged fill copies the host data when it is enqueued, so the host data has to be ready at that time 
+* and may change as soon as the call returns. Non-blocking reads go directly to the host memory.
+* Every size class or device of the cache gets its own ring.
+* The function returns 0 on success and 1 when the pinned memory could not be allocated, 
+* that cache then transfers directly from and to the host memory.
+*/
+int SetStagingBuffers(
+	struct Cache_t* cachePtr, 
+	int numberOfStagingBuffers, 
+	size_t stagingSize);
+
+/*
+* A function to select the built-in prefetcher of the cache, see Prefetcher_t.
+* Every request of clCreateCacheBuffer() or clEnqueueCacheBuffer() prefetches up to prefetchDepth lines
+* with non-blocking fills on the queue of that request.
+* stride_PF only prefetches host addresses from lowAddress up to highAddress, the range must be valid host memory.
+* A prefetch evicts lines like any other miss, so the cache has to hold the buffers of the running kernel 
+* and prefetchDepth more lines, otherwise a prefetch can evict a line that was just returned.
+*/
+void SetPrefetcher(
+	struct Cache_t* cachePtr, 
+	enum Prefetcher_t prefetcher, 
+	int prefetchDepth, 
+	void* lowAddress, 
+	void* highAddress);
+
+/*
+* A function to fill the lines of count host addresses ahead of their use.
+* The fills are non-blocking writes on command_queue, the host data may not change until they completed.
+* Line i gets sizes[i] bytes, or dataSize bytes of the cache when sizes is NULL.
+* Data that is already cached is not transferred and a prefetch never takes a bypass buffer,
+* a prefetch that is refused by the admission policy is dropped.
+* The function returns 0 when all fills were enqueued and 1 when one of them failed.
+*/
+int clCachePrefetch(
+	cl_command_queue command_queue, 
+	void** hostAddresses, 
+	const size_t* sizes, 
+	int count, 
+	struct Cache_t* cachePtr);
+
+/*
+* A function to give the cached data of hostAddress a stable key, the nodeId of its line (see MetaData_t).
+* The key lives as long as the data is in the line, it is -1 again when the line gets other data.
+* The function returns 0 when the data is cached and 1 when no line holds it.
+*/
+int SetNodeId(
+	struct Cache_t* cachePtr, 
 	void* hostAddress, 
-	int setIndex, 
+	int nodeId);
+
+/*
+* A function to save the lines with a nodeId of the cache and all its size classes or devices in a snapshot file 
+* (see SnapshotHeader_t), so a later run can warm its cache with WarmCache(). The file is written through a 
+* memory mapping to fileName with a .tmp suffix and then renamed, a worker reading the old snapshot is not disturbed.
+* Lines with data produced on the device or with dirty data are left out, they do not match the host data.
+* When the function returns '0' the snapshot is written.
+*/
+int SaveCacheSnapshot(
+	struct Cache_t* cachePtr, 
+	const char* fileName);
+
+/*
+* A function to fill a new cache with the hot lines of a snapshot from SaveCacheSnapshot().
+* nodeAddresses[nodeId] is the host address of the data with that nodeId in this run, entries with a nodeId of 
+* numberOfNodes or more or a NULL address are skipped. A set only takes as many lines as it has empty ways, 
+* starting with the hottest lines, and data that is already cached is not transferred again.
+* The lines of a batch of up to PACKED_BATCH_SIZE bytes are packed into one buffer that is uploaded at once, 
+* the lines are then filled from it by copies on the device, enqueued on command_queue without blocking. 
+* The lines get their nodeId back, the fills count as prefetches. No other thread may use the cache meanwhile.
+* When the function returns '0' all fills were enqueued, '1' means the snapshot could not be read or a fill failed.
+*/
+int WarmCache(
+	cl_command_queue command_queue, 
+	const char* fileName, 
+	void** nodeAddresses, 
+	int numberOfNodes, 
+	struct Cache_t* cachePtr);
+
+/*
+* A function to let two replacement policies duel for the sets of the cache, for the cache and all its size classes 
+* or devices. A few leader sets always use firstPolicy and as many always use secondPolicy, a saturating counter 
+* counts up on a miss in a firstPolicy leader and down on a miss in a secondPolicy leader. All other sets follow 
+* the policy that misses less, so the cache follows the phases of the application. A follower set takes over the 
+* age of its lines when it changes policy. Two equal policies end the duel, all sets then use that policy.
+* Only random_RP, fifo_RP, lru_RP, mru_RP, lfu_RP and mfu_RP can duel, the cache needs at least 16 sets and 2 ways
+* and may not be used by other threads while the duel is set. Follower hits always take the set lock.
+* When the function returns '0' the duel is set, '1' means a cache can not duel and keeps its policy.
+*/
+int SetPolicyDuel(
+	struct Cache_t* cachePtr, 
+	enum ReplacementPolicy_t firstPolicy, 
+	enum ReplacementPolicy_t secondPolicy);
+
+/*
+* A function to get the statistics of the cache (see CacheStats_t) in stats.
+* The statistics of a cache with size classes or devices are the sums of all of them.
+* The counters are read while other threads may still use the cache, FreeCacheStats() releases the arrays in stats.
+*/
+void GetCacheStats(
+	struct Cache_t* cachePtr, 
+	CacheStats_t* stats);
+
+void FreeCacheStats(
+	CacheStats_t* stats);
+
+/*
+* A function to set all counters of the cache and its size classes or devices back to 0, 
+* the int counters like memCopies as well as the statistics of GetCacheStats(). The data in the lines is kept.
+*/
+void ResetCacheStats(
+	struct Cache_t* cachePtr);
+
+/*
+* A function to record every request on the cache to a trace file, for the cache simulator of the Testbench.
+* The requests are written with their host address, size, flags and time (see TraceRecord_t), a fileName of 
+* NULL ends the trace and a new trace file ends the running trace first. FreeCache() also ends the trace.
+* The trace file is set while no other thread uses the cache.
+* When the function returns '0' the trace file is open, or the running trace is completely written when ending it.
+*/
+int SetTraceFile(
+	struct Cache_t* cachePtr, 
+	const char* fileName);
+
+/*
+* A function to turn the profiling of the transfers on or off, for the cache and all its size classes or devices.
+* Every transfer between host and lines is timed with its OpenCL event, the command queues of the caches 
+* must be created with CL_QUEUE_PROFILING_ENABLE. A split or staged transfer is timed by its last command.
+* Turning profiling off or on again drops the recorded profile.
+* When the function returns '0' the profiling is set, '1' means a command queue has no profiling.
+*/
+int SetProfiling(
+	struct Cache_t* cachePtr, 
+	bool profiling);
+
+/*
+* A function to time a kernel of the application in the profile of the cache, for GetMissTimeFraction().
+* The event must come from a queue with CL_QUEUE_PROFILING_ENABLE, the cache takes its own reference.
+*/
+void ProfileKernel(
+	struct Cache_t* cachePtr, 
+	cl_event event);
+
+/*
+* A function to get a percentile (0.0 to 1.0) of the latencies of a kind of profiled commands in nanoseconds.
+* With a size only the transfers of the same power of 2 size are taken, a size of 0 takes all of them.
+* The latency is the middle of its histogram bucket, it is 0 when nothing is profiled.
+*/
+uint64_t GetProfileLatency(
+	struct Cache_t* cachePtr, 
+	enum ProfileKind_t kind, 
+	size_t size, 
+	double percentile);
+
+/*
+* A function to get the fraction of the profiled time spent on transfers, against the transfers and the 
+* kernels passed to ProfileKernel() together.
+*/
+double GetMissTimeFraction(
 	struct Cache_t* cachePtr);
 
 /*
-* A function to determine in which way the data must be stored.
-* It first checks if an empty way is available within the provided set.
-* If all ways are full it overwrites a way based on the replacement policy.
+* A function to write the last profiled commands as a Chrome trace (JSON, for chrome://tracing or Perfetto).
+* Every kind of command has its own track, the times are in microseconds from the first queued command.
+* When the function returns '0' the file is written.
 */
-static int SetWay(
-	int setIndex, 
+int WriteChromeTrace(
+	struct Cache_t* cachePtr, 
+	const char* fileName);
+
+/*
+* This function writes all dirty cache lines back to their host address.
+* The reads are enqueued on the given command_queue, the function returns when all reads are done.
+* The data stays valid in cache. 
+* The temporary buffers of bypassed requests are written back when dirty and then released.
+* When the function returns '0' all dirty data is successfully transfered to the host.
+*/
+int clFlushCache(
+	cl_command_queue command_queue, 
+	struct Cache_t* cachePtr);
+
+/*
+* This functions frees the allocated memory space.
+* Dirty lines are not written back, call clFlushCache() first to keep that data.
+* The device buffers of all cache lines are released together with the retained context and command queue.
+*/
+void FreeCache(
 	struct Cache_t* cachePtr);
 
 #endif